@@ -0,0 +1,155 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "disk.h"
+#include "scheduler.h"
+
+// AHCI SATA host bus adapter. Each port has a 32-slot command list; with
+// NCQ every slot can be outstanding at once and the drive completes them
+// in whatever order suits it. Requests are submitted asynchronously and
+// completed from the HBA interrupt.
+
+#define AHCI_MAX_PORTS      32
+#define AHCI_MAX_DRIVES     4
+#define AHCI_MAX_SLOTS      32
+#define AHCI_PRDS_PER_SLOT  8
+#define AHCI_PRD_MAX_BYTES  (4 * 1024 * 1024)
+#define AHCI_MAX_SECTORS    2048        // Per command; larger requests are split
+#define AHCI_TIMEOUT_TICKS  TIMER_MS_TO_TICKS(5000)
+
+// HBA global registers
+#define AHCI_CAP_NCS_SHIFT  8
+#define AHCI_CAP_NCS_MASK   0x1F
+#define AHCI_CAP_SNCQ       (1u << 30)
+#define AHCI_GHC_HR         (1u << 0)
+#define AHCI_GHC_IE         (1u << 1)
+#define AHCI_GHC_AE         (1u << 31)
+
+// Port command and status
+#define AHCI_PXCMD_ST       (1u << 0)
+#define AHCI_PXCMD_FRE      (1u << 4)
+#define AHCI_PXCMD_FR       (1u << 14)
+#define AHCI_PXCMD_CR       (1u << 15)
+
+// Port interrupt status / enable
+#define AHCI_PXIS_DHRS      (1u << 0)   // D2H register FIS
+#define AHCI_PXIS_PSS       (1u << 1)   // PIO setup FIS
+#define AHCI_PXIS_DSS       (1u << 2)   // DMA setup FIS
+#define AHCI_PXIS_SDBS      (1u << 3)   // Set device bits FIS (NCQ completion)
+#define AHCI_PXIS_IFS       (1u << 27)
+#define AHCI_PXIS_HBDS      (1u << 28)
+#define AHCI_PXIS_HBFS      (1u << 29)
+#define AHCI_PXIS_TFES      (1u << 30)
+#define AHCI_PXIS_ERRORS    (AHCI_PXIS_IFS | AHCI_PXIS_HBDS | AHCI_PXIS_HBFS | AHCI_PXIS_TFES)
+
+#define AHCI_SSTS_DET_PRESENT 3
+#define AHCI_SIG_ATA        0x00000101
+
+#define AHCI_FIS_TYPE_H2D   0x27
+
+// ATA commands used over AHCI
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+
+typedef volatile struct {
+    uint32_t clb;
+    uint32_t clbu;
+    uint32_t fb;
+    uint32_t fbu;
+    uint32_t is;
+    uint32_t ie;
+    uint32_t cmd;
+    uint32_t reserved0;
+    uint32_t tfd;
+    uint32_t sig;
+    uint32_t ssts;
+    uint32_t sctl;
+    uint32_t serr;
+    uint32_t sact;
+    uint32_t ci;
+    uint32_t sntf;
+    uint32_t fbs;
+    uint32_t reserved1[11];
+    uint32_t vendor[4];
+} ahci_port_regs_t;
+
+typedef volatile struct {
+    uint32_t cap;
+    uint32_t ghc;
+    uint32_t is;
+    uint32_t pi;
+    uint32_t vs;
+    uint32_t ccc_ctl;
+    uint32_t ccc_pts;
+    uint32_t em_loc;
+    uint32_t em_ctl;
+    uint32_t cap2;
+    uint32_t bohc;
+    uint32_t reserved[29];
+    uint32_t vendor[24];
+    ahci_port_regs_t ports[AHCI_MAX_PORTS];
+} ahci_hba_regs_t;
+
+// Command list entry
+typedef struct {
+    uint16_t flags;             // CFL in bits 0-4, W = bit 6
+    uint16_t prdtl;
+    volatile uint32_t prdbc;
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} __attribute__((packed)) ahci_cmd_header_t;
+
+#define AHCI_CMD_WRITE      (1 << 6)
+
+typedef struct {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;               // Byte count - 1, bit 31 = interrupt
+} __attribute__((packed)) ahci_prd_t;
+
+typedef struct {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    ahci_prd_t prdt[AHCI_PRDS_PER_SLOT];
+} __attribute__((packed)) ahci_cmd_table_t;
+
+// Called from the HBA interrupt (or the polling loop) with interrupts off
+typedef void (*ahci_callback_t)(void* context, bool ok);
+
+typedef struct {
+    ahci_callback_t callback;
+    void* context;
+} ahci_slot_t;
+
+typedef struct {
+    ahci_port_regs_t* regs;
+    uint32_t port;
+    ahci_cmd_header_t* cmd_list;
+    ahci_cmd_table_t* tables[AHCI_MAX_SLOTS];
+    ahci_slot_t slots[AHCI_MAX_SLOTS];
+    volatile uint32_t busy;     // Slots handed to the HBA
+    uint32_t depth;             // Usable slots
+    bool ncq;
+    wait_queue_t wait;          // Woken whenever a slot completes
+
+    // Statistics
+    uint32_t commands;
+    uint32_t errors;
+    uint32_t max_in_flight;
+} ahci_port_t;
+
+int ahci_init(void);
+bool ahci_identify(uint32_t drive, disk_info_t* disk);
+int ahci_submit(uint32_t drive, uint64_t lba, uint32_t count, void* buffer, bool write,
+                ahci_callback_t callback, void* context);
+void ahci_poll(uint32_t drive);
+uint32_t ahci_queue_depth(uint32_t drive);
+bool ahci_read_sectors(uint32_t drive, uint64_t lba, uint32_t count, void* buffer);
+bool ahci_write_sectors(uint32_t drive, uint64_t lba, uint32_t count, const void* buffer);
+
+#endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define ARP_H
 
 #include "net.h"
+#include "scheduler.h"
 
 // ARP Header structure
 typedef struct __attribute__((packed)) {
@@ -20,24 +21,50 @@ typedef struct __attribute__((packed)) {
 #define ARP_OP_REQUEST 1
 #define ARP_OP_REPLY   2
 
+// Neighbour states
+typedef enum {
+    ARP_STATE_FREE,
+    ARP_STATE_INCOMPLETE,   // Request sent, packets queued until the reply
+    ARP_STATE_REACHABLE,    // Confirmed within ARP_REACHABLE_TIME
+    ARP_STATE_STALE         // Still usable, refreshed on next use
+} arp_state_t;
+
+#define ARP_MAX_PENDING 4       // Frames held per INCOMPLETE entry; IP holds
+                                // datagrams needing fragments whole
+
 // ARP Table entry
-typedef struct {
+typedef struct arp_entry {
     ip_addr_t ip;
     mac_addr_t mac;
-    uint32_t timestamp;
-    int valid;
+    arp_state_t state;
+    uint32_t timestamp;         // Tick of the last confirmation
+    uint32_t probe_deadline;    // Tick of the next request retry
+    uint32_t retries;
+    net_buffer_t* pending[ARP_MAX_PENDING];
+    uint32_t pending_count;
+    struct arp_entry* hash_next;
 } arp_entry_t;
 
-#define ARP_TABLE_SIZE 32
+#define ARP_TABLE_SIZE 64
+#define ARP_HASH_SIZE  32
 #define ARP_TIMEOUT 300  // 5 minutes in seconds
 
+// Timing, in timer ticks
+#define ARP_TIMER_INTERVAL   TIMER_MS_TO_TICKS(100)
+#define ARP_RETRY_INTERVAL   TIMER_MS_TO_TICKS(1000)
+#define ARP_MAX_RETRIES      3
+#define ARP_REACHABLE_TIME   TIMER_MS_TO_TICKS(30000)
+#define ARP_EXPIRE_TIME      (ARP_TIMEOUT * TIMER_FREQUENCY)
+
 // ARP Functions
 void arp_init(void);
 void arp_handle_packet(net_buffer_t* buffer, size_t offset);
 int arp_resolve(ip_addr_t ip, mac_addr_t* mac);
+int arp_output(net_buffer_t* buffer, ip_addr_t next_hop);
 void arp_send_request(ip_addr_t target_ip);
 void arp_send_reply(ip_addr_t target_ip, mac_addr_t target_mac);
 void arp_add_entry(ip_addr_t ip, mac_addr_t mac);
 arp_entry_t* arp_lookup(ip_addr_t ip);
+void arp_timer_tick(void);
 
 #endif
\ No newline at end of file
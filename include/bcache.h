@@ -0,0 +1,62 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "disk.h"
+#include "scheduler.h"
+
+// Sector buffer cache. Buffers are keyed by (disk, LBA) in a hash table
+// and kept on two LRU lists: filesystem metadata (FAT sectors, directory
+// clusters) is only evicted once no plain data buffer is left to reuse.
+// Writes are write-back; dirty buffers reach the disk through the block
+// layer on bcache_sync() or once they have aged BCACHE_WRITEBACK_TICKS,
+// from deferred work. Process context only.
+
+#define BCACHE_BUFFERS          1024    // 512 KB of sector buffers
+#define BCACHE_HASH_SIZE        256
+#define BCACHE_READ_BATCH       256     // Sectors fetched per miss run (one 128 KB command)
+#define BCACHE_DIRTY_LIMIT      (BCACHE_BUFFERS / 2)
+#define BCACHE_WRITEBACK_TICKS  TIMER_MS_TO_TICKS(5000)
+#define BCACHE_FLUSH_CHECK_TICKS TIMER_MS_TO_TICKS(1000)
+
+// Buffer flags
+#define BCACHE_VALID    0x01
+#define BCACHE_DIRTY    0x02
+#define BCACHE_META     0x04    // Also a request flag: keep hot
+
+typedef struct bcache_buf {
+    uint32_t disk_id;
+    uint64_t lba;
+    uint8_t* data;
+    uint16_t flags;
+    uint16_t refs;
+    uint32_t dirty_since;       // Tick the buffer first became dirty
+    volatile bool write_failed; // Set by the write completion, which may run in an IRQ
+    struct bcache_buf* hash_next;
+    struct bcache_buf* lru_prev;
+    struct bcache_buf* lru_next;
+} bcache_buf_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;        // Sectors written back
+    uint32_t write_errors;
+    uint32_t dirty;
+} bcache_stats_t;
+
+void bcache_init(void);
+bcache_buf_t* bcache_get(uint32_t disk_id, uint64_t lba, uint32_t flags);
+void bcache_mark_dirty(bcache_buf_t* buf);
+void bcache_release(bcache_buf_t* buf);
+bool bcache_read(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer, uint32_t flags);
+bool bcache_write(uint32_t disk_id, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags);
+bool bcache_sync(uint32_t disk_id);
+bool bcache_sync_all(void);
+void bcache_invalidate(uint32_t disk_id);
+bcache_stats_t* bcache_get_stats(void);
+void bcache_dump(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef BLK_H
+#define BLK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "disk.h"
+#include "scheduler.h"
+
+// Block request layer. Requests are queued per disk, merged with
+// neighbours that continue them on disk, and dispatched in LBA order
+// (C-LOOK) unless one has waited past its deadline. Submitters continue
+// immediately and learn the outcome through a completion callback.
+//
+// Queues are plugged: nothing reaches the device until the queue is
+// unplugged, flushed, grows past BLK_MAX_PENDING, or has sat idle for
+// BLK_UNPLUG_TICKS (checked from deferred work).
+
+#define BLK_MAX_MERGE_SECTORS   256     // 128 KB per dispatched command
+#define BLK_MAX_PENDING         64      // Queued commands before a forced unplug
+#define BLK_UNPLUG_TICKS        TIMER_MS_TO_TICKS(20)
+#define BLK_READ_DEADLINE_TICKS TIMER_MS_TO_TICKS(100)
+#define BLK_WRITE_DEADLINE_TICKS TIMER_MS_TO_TICKS(1000)
+
+// Runs with interrupts disabled, possibly from the disk interrupt
+typedef void (*blk_callback_t)(void* context, bool ok);
+
+typedef struct blk_request {
+    uint32_t disk_id;
+    uint64_t lba;
+    uint32_t count;
+    void* buffer;               // Must stay valid until the callback runs
+    bool write;
+    blk_callback_t callback;
+    void* context;
+    uint32_t seq;               // Submission order
+
+    // Set on the first request of a merged run
+    struct blk_request* next;   // Next run in the LBA-sorted queue
+    struct blk_request* merged; // Following requests in this run
+    struct blk_request* tail;
+    uint32_t total;             // Sectors in the whole run
+    uint32_t deadline;          // Earliest deadline in the run (ticks)
+    uint8_t* bounce;            // Word-aligned staging buffer, if any
+    void* bounce_block;         // kmalloc'd block holding it
+} blk_request_t;
+
+typedef struct {
+    uint32_t submitted;
+    uint32_t merged;            // Requests folded into another run
+    uint32_t dispatched;        // Commands sent to the device
+    uint32_t sectors;
+    uint32_t expired;           // Dispatched out of order for a deadline
+    uint32_t errors;
+} blk_stats_t;
+
+typedef struct {
+    uint32_t disk_id;
+    blk_request_t* pending;     // Runs sorted by LBA
+    uint32_t pending_runs;
+    blk_request_t* active;      // Runs on the device, for ordering checks
+    uint64_t position;          // Where the elevator head is
+    uint32_t oldest;            // Submission tick of the oldest pending run
+    volatile uint32_t in_flight;
+    volatile uint32_t flush_errors;
+    wait_queue_t wait;          // Woken on every completion
+    blk_stats_t stats;
+} blk_queue_t;
+
+void blk_init(void);
+int blk_submit(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer, bool write,
+               blk_callback_t callback, void* context);
+void blk_unplug(uint32_t disk_id);
+bool blk_flush(uint32_t disk_id);
+bool blk_read(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer);
+bool blk_write(uint32_t disk_id, uint64_t lba, uint32_t count, const void* buffer);
+void blk_dump(void);
+
+#endif
\ No newline at end of file
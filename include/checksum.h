@@ -0,0 +1,44 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Internet checksum (RFC 1071) shared by IP, ICMP, UDP and TCP.
+//
+// Partial sums are 32-bit one's complement accumulators over the bytes as
+// they sit in memory, so no per-word byte swapping is needed: the folded
+// result can be stored into a header field as is. Pieces fed to
+// csum_partial must start at an even offset of the checksummed region;
+// only the last piece may have an odd length.
+
+void checksum_init(void);
+
+uint32_t csum_partial(const void* data, size_t length, uint32_t sum);
+uint32_t csum_partial_copy(void* dest, const void* src, size_t length, uint32_t sum);
+
+// TCP/UDP pseudo header; addresses in host byte order
+uint32_t csum_pseudo_header(uint32_t src_ip, uint32_t dst_ip, uint8_t protocol,
+                            uint16_t length, uint32_t sum);
+
+// Fold a partial sum and complement it, ready to store
+static inline uint16_t csum_fold(uint32_t sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+// RFC 1624 incremental update, HC' = ~(~HC + ~m + m'), for a checksum
+// field covering a 16-bit value that changed from old to new. All values
+// are in memory (network) order.
+static inline void csum_replace2(uint16_t* check, uint16_t old_value, uint16_t new_value) {
+    uint32_t sum = (uint16_t)~*check;
+    sum += (uint16_t)~old_value;
+    sum += new_value;
+    *check = csum_fold(sum);
+}
+
+// Throughput report for the shell
+void checksum_benchmark(void);
+
+#endif
\ No newline at end of file
@@ -3,6 +3,11 @@
 
 #include "net.h"
 #include "ip.h"
+#include "scheduler.h"
+
+// DHCP client (RFC 2131). A timer-driven state machine acquires, renews
+// and rebinds the lease on eth0. The last lease is saved to disk, so the
+// next boot starts in INIT-REBOOT and needs one REQUEST/ACK round trip.
 
 // DHCP Header structure
 typedef struct __attribute__((packed)) {
@@ -38,6 +43,8 @@ typedef struct __attribute__((packed)) {
 #define DHCP_OPTION_MESSAGE_TYPE          53
 #define DHCP_OPTION_SERVER_IDENTIFIER     54
 #define DHCP_OPTION_PARAMETER_REQUEST     55
+#define DHCP_OPTION_RENEWAL_TIME          58
+#define DHCP_OPTION_REBINDING_TIME        59
 #define DHCP_OPTION_CLIENT_IDENTIFIER     61
 #define DHCP_OPTION_END                   255
 
@@ -57,38 +64,97 @@ typedef struct __attribute__((packed)) {
 // DHCP Magic Cookie
 #define DHCP_MAGIC_COOKIE 0x63825363
 
-// DHCP Client State
+#define DHCP_OPTIONS_SIZE   312
+
+// Timing (RFC 2131 4.1, 4.4.5). Lease times are clamped so every deadline
+// stays within half the tick counter's range.
+#define DHCP_TIMER_INTERVAL     TIMER_MS_TO_TICKS(250)
+#define DHCP_INITIAL_TIMEOUT    4       // Seconds, doubles per retransmission
+#define DHCP_MAX_TIMEOUT        64
+#define DHCP_REBOOT_TIMEOUT     2       // INIT-REBOOT gives up quickly
+#define DHCP_MAX_RETRIES        4       // Per exchange before starting over
+#define DHCP_REBOOT_RETRIES     2
+#define DHCP_MIN_RENEW_RETRY    60      // Seconds between RENEWING/REBINDING sends
+#define DHCP_MAX_LEASE          (180 * 24 * 3600)
+
+// The last lease is kept in a file on the boot disk's volume, which the
+// kernel mounts at startup, so the next boot can confirm it in one round
+// trip. Without that volume the lease is simply not kept.
+#define DHCP_LEASE_PATH         "/mnt/disk0/dhcp.lse"
+#define DHCP_LEASE_MAGIC        0x31504844  // "DHP1"
+
+// DHCP Client State (RFC 2131 figure 5)
 typedef enum {
     DHCP_STATE_INIT,
     DHCP_STATE_SELECTING,
     DHCP_STATE_REQUESTING,
+    DHCP_STATE_INIT_REBOOT,
+    DHCP_STATE_REBOOTING,
     DHCP_STATE_BOUND,
     DHCP_STATE_RENEWING,
     DHCP_STATE_REBINDING
 } dhcp_state_t;
 
+// Parameters carried by one lease
 typedef struct {
-    dhcp_state_t state;
-    uint32_t transaction_id;
-    ip_addr_t offered_ip;
-    ip_addr_t server_ip;
+    ip_addr_t address;
+    ip_addr_t server_ip;        // Server identifier
     ip_addr_t subnet_mask;
     ip_addr_t router;
     ip_addr_t dns_server;
+    uint32_t lease_time;        // Seconds
+    uint32_t renewal_time;      // T1, seconds from the start of the lease
+    uint32_t rebind_time;       // T2
+} dhcp_lease_t;
+
+// Contents of the lease file
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t mac[6];
+    uint8_t address[4];
+    uint8_t server_ip[4];
+    uint8_t subnet_mask[4];
+    uint8_t router[4];
+    uint8_t dns_server[4];
     uint32_t lease_time;
-    uint32_t renewal_time;
-    uint32_t rebind_time;
+    uint32_t checksum;          // FNV-1a over the bytes before it
+} dhcp_lease_record_t;
+
+typedef struct {
+    dhcp_state_t state;
+    uint32_t transaction_id;
+    dhcp_lease_t lease;         // Current lease, or the offer being requested
+    int have_lease;             // lease holds a lease worth asking for again
+    
+    // Ticks
+    uint32_t exchange_start;    // First message of the current exchange
+    uint32_t lease_start;       // Time the REQUEST that got the ACK went out
+    uint32_t request_sent;
+    uint32_t retry_deadline;
+    uint32_t renew_at;          // T1
+    uint32_t rebind_at;         // T2
+    uint32_t expires_at;
+    uint32_t retries;
+    uint32_t timeout;           // Seconds until the next retransmission
+    
     int active;
+    dhcp_lease_t stored;        // What the record on disk holds
+    int stored_valid;
+    int lease_dirty;            // The record on disk is stale
+    uint32_t bound_ms;          // Duration of the last acquisition
+    dhcp_state_t bound_from;    // INIT, INIT_REBOOT, RENEWING or REBINDING
 } dhcp_client_t;
 
 // DHCP Functions
 void dhcp_init(void);
-void dhcp_start_discovery(void);
-void dhcp_handle_packet(net_buffer_t* buffer, size_t offset);
-void dhcp_send_discover(void);
-void dhcp_send_request(ip_addr_t server_ip, ip_addr_t requested_ip);
-int dhcp_parse_options(uint8_t* options, size_t length);
-void dhcp_configure_interface(void);
+void dhcp_start(void);
+void dhcp_renew(void);
+void dhcp_release(void);
+void dhcp_handle_packet(uint8_t* data, size_t length);
+void dhcp_timer_tick(void);
+void dhcp_sync(void);
+void dhcp_dump(void);
+int dhcp_parse_options(uint8_t* options, size_t length, dhcp_lease_t* lease);
 
 // Helper functions
 uint32_t dhcp_generate_xid(void);
@@ -6,7 +6,8 @@
 #include <stdbool.h>
 
 #define DISK_SECTOR_SIZE 512
-#define MAX_DISKS 4
+#define MAX_DISKS 8
+#define DISK_AHCI_BASE 4       // Disks 4-7 are drives on the AHCI controller
 
 typedef enum {
     DISK_TYPE_UNKNOWN = 0,
@@ -24,6 +25,8 @@ typedef struct {
     char model[41];
     char serial[21];
     bool is_lba48;
+    bool dma;              // Drive and controller both do bus-master DMA
+    uint8_t port;          // AHCI port number for SATA disks
 } disk_info_t;
 
 // ATA registers
@@ -40,6 +43,10 @@ typedef struct {
 #define ATA_REG_DRIVE      0x06
 #define ATA_REG_STATUS     0x07
 #define ATA_REG_COMMAND    0x07
+#define ATA_REG_CONTROL    0x206   // Device control (alternate status on read)
+
+// Device control bits
+#define ATA_CTRL_SRST      0x04    // Software reset of both drives on the channel
 
 // ATA commands
 #define ATA_CMD_READ_SECTORS     0x20
@@ -47,6 +54,10 @@ typedef struct {
 #define ATA_CMD_IDENTIFY         0xEC
 #define ATA_CMD_READ_SECTORS_EXT 0x24
 #define ATA_CMD_WRITE_SECTORS_EXT 0x34
+#define ATA_CMD_READ_DMA         0xC8
+#define ATA_CMD_WRITE_DMA        0xCA
+#define ATA_CMD_READ_DMA_EXT     0x25
+#define ATA_CMD_WRITE_DMA_EXT    0x35
 
 // ATA status bits
 #define ATA_STATUS_ERR  0x01
@@ -56,6 +67,37 @@ typedef struct {
 #define ATA_STATUS_RDY  0x40
 #define ATA_STATUS_BSY  0x80
 
+// Bus-master IDE registers, offsets from PCI BAR4 (secondary channel at +8)
+#define ATA_BM_REG_COMMAND 0x00
+#define ATA_BM_REG_STATUS  0x02
+#define ATA_BM_REG_PRDT    0x04
+#define ATA_BM_CHANNEL_SIZE 8
+
+#define ATA_BM_CMD_START   0x01
+#define ATA_BM_CMD_READ    0x08    // Device to memory
+
+#define ATA_BM_STATUS_ACTIVE 0x01
+#define ATA_BM_STATUS_ERR    0x02
+#define ATA_BM_STATUS_IRQ    0x04
+
+// Physical region descriptor: one contiguous buffer that may not cross
+// a 64 KB boundary; a byte count of 0 means 64 KB
+typedef struct {
+    uint32_t address;
+    uint16_t bytes;
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+#define ATA_PRD_EOT 0x8000
+
+#define ATA_IRQ_PRIMARY   46       // IRQ 14
+#define ATA_IRQ_SECONDARY 47       // IRQ 15
+
+// diskbench parameters
+#define DISK_BENCH_CHUNK_SECTORS 128
+#define DISK_BENCH_RANDOM_READS  256
+#define DISK_BENCH_RANDOM_SECTORS 8
+
 // Function prototypes
 bool disk_init(void);
 bool disk_detect(uint32_t disk_id);
@@ -63,7 +105,9 @@ disk_info_t* disk_get_info(uint32_t disk_id);
 bool disk_read_sectors(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer);
 bool disk_write_sectors(uint32_t disk_id, uint64_t lba, uint32_t count, const void* buffer);
 void disk_list_devices(void);
+void disk_benchmark(uint32_t disk_id, uint32_t kb);
 
 // Internal functions (implemented in disk.c)
+void disk_parse_identify(disk_info_t* disk, const uint16_t* identify);
 
 #endif // DISK_H
\ No newline at end of file
@@ -0,0 +1,90 @@
+#ifndef DNS_H
+#define DNS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "scheduler.h"
+
+// Stub resolver: A queries over UDP to one recursive server, answers
+// cached per name for their TTL. Failed lookups are cached too (RFC 2308)
+// and concurrent lookups of the same name share one query.
+
+#define DNS_MAX_NAME        128
+#define DNS_MAX_PACKET      512
+#define DNS_CACHE_SIZE      64
+#define DNS_HASH_SIZE       32
+
+// Timing
+#define DNS_TIMER_INTERVAL  TIMER_MS_TO_TICKS(100)
+#define DNS_RETRY_INTERVAL  TIMER_MS_TO_TICKS(1000)   // Doubles per retry
+#define DNS_MAX_RETRIES     3
+#define DNS_NEGATIVE_TTL    60      // Seconds, when no SOA comes with the answer
+#define DNS_MAX_TTL         86400   // Seconds
+
+// Header flags
+#define DNS_FLAG_QR         0x8000
+#define DNS_FLAG_TC         0x0200
+#define DNS_FLAG_RD         0x0100
+#define DNS_RCODE_MASK      0x000F
+#define DNS_RCODE_NXDOMAIN  3
+
+// Record types and class
+#define DNS_TYPE_A          1
+#define DNS_TYPE_CNAME      5
+#define DNS_TYPE_SOA        6
+#define DNS_CLASS_IN        1
+
+// Message header
+typedef struct __attribute__((packed)) {
+    uint16_t id;
+    uint16_t flags;
+    uint16_t qdcount;
+    uint16_t ancount;
+    uint16_t nscount;
+    uint16_t arcount;
+} dns_header_t;
+
+typedef enum {
+    DNS_ENTRY_FREE,
+    DNS_ENTRY_PENDING,      // Query outstanding, callers sleep on wait
+    DNS_ENTRY_POSITIVE,     // addr valid until expires
+    DNS_ENTRY_NEGATIVE      // Lookup failed with error until expires
+} dns_state_t;
+
+typedef struct dns_entry {
+    char name[DNS_MAX_NAME];    // Lower case, no trailing dot
+    uint32_t hash;
+    dns_state_t state;
+    uint32_t addr;              // Host byte order
+    int error;                  // Negative errno for NEGATIVE entries
+    uint32_t expires;           // Tick
+    uint32_t last_used;         // Tick, for LRU replacement
+    uint16_t query_id;
+    uint32_t retries;
+    uint32_t retry_deadline;
+    uint32_t waiters;
+    wait_queue_t wait;
+    struct dns_entry* hash_next;
+} dns_entry_t;
+
+typedef struct {
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t negative_hits;
+    uint32_t misses;
+    uint32_t coalesced;         // Lookups that joined an outstanding query
+    uint32_t queries;           // Datagrams sent, retries included
+    uint32_t timeouts;
+} dns_stats_t;
+
+// DNS Functions
+void dns_init(void);
+void dns_set_server(uint32_t server);
+uint32_t dns_get_server(void);
+int dns_resolve(const char* name, uint32_t* addr);
+void dns_flush(void);
+void dns_timer_tick(void);
+dns_stats_t* dns_get_stats(void);
+void dns_dump(void);
+
+#endif
\ No newline at end of file
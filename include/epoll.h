@@ -0,0 +1,58 @@
+#ifndef EPOLL_H
+#define EPOLL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "scheduler.h"
+
+// Readiness events
+#define EPOLLIN     0x001   // Data (or EOF, or a pending connection) to read
+#define EPOLLOUT    0x004   // Room in the send buffer
+#define EPOLLERR    0x008
+#define EPOLLHUP    0x010   // Connection fully closed
+#define EPOLLET     0x80000000  // Edge-triggered: report changes only
+
+// epoll_ctl operations
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+#define EPOLL_MAX_INSTANCES 16
+
+typedef struct {
+    uint32_t events;
+    uint32_t data;      // Opaque caller cookie, returned with each event
+} epoll_event_t;
+
+struct epoll_instance;
+
+// One watched socket inside an epoll instance
+typedef struct epoll_item {
+    struct epoll_instance* ep;
+    int socket;
+    uint32_t events;
+    uint32_t data;
+    int on_ready_list;
+    struct epoll_item* next_ready;      // Instance ready list
+    struct epoll_item* next_watcher;    // Socket's poll_head list
+    struct epoll_item* next_item;       // All items of the instance
+} epoll_item_t;
+
+// Embedded in every pollable object; lists the epoll items watching it
+typedef struct {
+    epoll_item_t* watchers;
+} poll_head_t;
+
+// Called by socket code whenever readiness may have changed. Safe from
+// interrupt context; costs nothing when nobody is watching.
+void poll_notify(poll_head_t* head);
+void poll_head_init(poll_head_t* head);
+void poll_head_detach(poll_head_t* head);
+
+// In-kernel API. Sockets are socket layer descriptors (see socket.h).
+int epoll_create(void);
+int epoll_ctl(int epfd, int op, int socket, epoll_event_t* event);
+int epoll_wait(int epfd, epoll_event_t* events, int max_events, int timeout_ms);
+int epoll_close(int epfd);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef ERRNO_H
+#define ERRNO_H
+
+// Kernel error codes, returned negated (e.g. -EAGAIN)
+#define ENOENT       2
+#define EBADF        9
+#define EAGAIN       11
+#define ENOMEM       12
+#define EINVAL       22
+#define EMFILE       24
+#define EDESTADDRREQ 89
+#define EPROTONOSUPPORT 93
+#define EOPNOTSUPP   95
+#define EAFNOSUPPORT 97
+#define EADDRINUSE   98
+#define ENETUNREACH  101
+#define ECONNRESET   104
+#define ENOTCONN     107
+#define ETIMEDOUT    110
+
+#define EWOULDBLOCK  EAGAIN
+
+#endif
\ No newline at end of file
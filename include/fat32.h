@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "vfs.h"
 
 // FAT32 structures
 typedef struct __attribute__((packed)) {
@@ -78,6 +79,26 @@ typedef struct __attribute__((packed)) {
 #define FAT32_EOC_MARK        0x0FFFFFF8
 #define FAT32_BAD_CLUSTER     0x0FFFFFF7
 
+typedef struct __attribute__((packed)) {
+    uint8_t  order;         // Sequence number, 0x40 on the last entry
+    uint16_t name1[5];
+    uint8_t  attr;          // Always FAT32_ATTR_LONG_NAME
+    uint8_t  type;
+    uint8_t  checksum;      // Of the short name that follows
+    uint16_t name2[6];
+    uint16_t first_cluster; // Always 0
+    uint16_t name3[2];
+} fat32_lfn_entry_t;
+
+#define FAT32_LFN_LAST        0x40
+#define FAT32_LFN_CHARS       13
+#define FAT32_MAX_NAME        255
+#define FAT32_DELETED         0xE5
+
+// Case flags in nt_reserved for 8.3 names stored in lower case
+#define FAT32_NT_LOWER_BASE   0x08
+#define FAT32_NT_LOWER_EXT    0x10
+
 typedef struct {
     uint32_t disk_id;
     uint32_t start_sector;
@@ -86,18 +107,84 @@ typedef struct {
     uint32_t fat_start_sector;
     uint32_t data_start_sector;
     uint32_t root_dir_cluster;
+    uint32_t cluster_size;      // Bytes
+    uint32_t cluster_count;     // Data clusters, numbered from 2
+    uint32_t free_count;        // From FSInfo, 0xFFFFFFFF if unknown
+    uint32_t next_free;         // Allocation hint from FSInfo
+    bool fs_info_dirty;
     bool mounted;
 } fat32_fs_t;
 
+// A run of clusters that are contiguous on disk
+typedef struct {
+    uint32_t file_cluster;      // Index of the first cluster within the file
+    uint32_t cluster;
+    uint32_t count;
+} fat32_extent_t;
+
+typedef struct {
+    fat32_fs_t* fs;
+    uint32_t first_cluster;
+    uint32_t size;
+    uint32_t position;
+    uint32_t entry_sector;      // Location of the directory entry
+    uint32_t entry_offset;
+    bool dirty;                 // Size or first cluster changed
+    
+    // Cluster chain, cached as extents while the file is walked
+    fat32_extent_t* extents;
+    uint32_t extent_count;
+    uint32_t extent_capacity;
+    uint32_t extent_hint;       // Last extent used
+    uint32_t chain_clusters;    // Clusters cached so far
+    bool chain_complete;
+} fat32_file_t;
+
+typedef struct {
+    fat32_fs_t* fs;
+    uint32_t first_cluster;
+    uint32_t cluster;           // Cluster number cluster_index of the chain
+    uint32_t cluster_index;
+    uint32_t index;             // Next entry to read
+} fat32_dir_t;
+
+typedef struct {
+    char name[FAT32_MAX_NAME + 1];
+    char short_name[11];        // Raw 8.3 name
+    uint8_t attr;
+    uint32_t size;
+    uint32_t first_cluster;
+    uint32_t dir_cluster;       // Directory holding the entry
+    uint32_t entry_index;       // Short entry
+    uint32_t lfn_index;         // First long name entry, or entry_index
+} fat32_dirent_t;
+
 // Function prototypes
 bool fat32_format_disk(uint32_t disk_id, uint32_t start_sector, uint32_t total_sectors, const char* volume_label);
 bool fat32_mount(uint32_t disk_id, uint32_t start_sector, fat32_fs_t* fs);
 bool fat32_unmount(fat32_fs_t* fs);
+bool fat32_sync(fat32_fs_t* fs);
+
+// Paths are relative to the volume root and separated by '/'
+bool fat32_stat(fat32_fs_t* fs, const char* path, fat32_dirent_t* entry);
+bool fat32_opendir(fat32_fs_t* fs, const char* path, fat32_dir_t* dir);
+bool fat32_readdir(fat32_dir_t* dir, fat32_dirent_t* entry);
+bool fat32_open(fat32_fs_t* fs, const char* path, fat32_file_t* file);
+bool fat32_create(fat32_fs_t* fs, const char* path, fat32_file_t* file);
+int32_t fat32_read(fat32_file_t* file, void* buffer, uint32_t size);
+int32_t fat32_write(fat32_file_t* file, const void* buffer, uint32_t size);
+bool fat32_seek(fat32_file_t* file, uint32_t position);
+bool fat32_close(fat32_file_t* file);
+bool fat32_unlink(fat32_fs_t* fs, const char* path);
+bool fat32_mkdir(fat32_fs_t* fs, const char* path);
+
+// Root directory node of a volume, for vfs_mount()
+vfs_node_t* fat32_vfs_mount(uint32_t disk_id);
 
 // Internal functions
 bool fat32_write_boot_sector(uint32_t disk_id, uint32_t sector, fat32_boot_sector_t* boot_sector);
 bool fat32_write_fs_info(uint32_t disk_id, uint32_t sector, fat32_fs_info_t* fs_info);
-bool fat32_clear_fat_table(uint32_t disk_id, uint32_t fat_start, uint32_t fat_sectors);
+bool fat32_clear_fat_table(uint32_t disk_id, uint32_t fat_start, uint32_t fat_sectors, uint8_t num_fats);
 bool fat32_create_root_directory(uint32_t disk_id, uint32_t data_start, const char* volume_label);
 
 uint32_t fat32_calculate_clusters(uint32_t total_sectors, uint32_t reserved_sectors, uint8_t num_fats, uint8_t sectors_per_cluster);
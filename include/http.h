@@ -3,6 +3,39 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "scheduler.h"
+#include "vfs.h"
+
+// HTTP/1.1 client. Connections are kept alive and pooled per host:port,
+// bodies are framed by Content-Length, chunked encoding or connection
+// close, and delivered to a callback as they arrive.
+
+#define HTTP_POOL_SIZE       8
+#define HTTP_MAX_HOST        128
+#define HTTP_MAX_HEADERS     8192                        // Header block limit
+#define HTTP_BUFFER_SIZE     4096                        // Receive buffer per request
+#define HTTP_IDLE_TIMEOUT    TIMER_MS_TO_TICKS(30000)    // Pooled connection lifetime
+#define HTTP_LENGTH_UNKNOWN  0xFFFFFFFF
+
+// Called for each piece of the body; return < 0 to abort the transfer
+typedef int (*http_body_callback_t)(void* context, const uint8_t* data, size_t length);
+
+// Body sink that writes each piece into a file at the running offset.
+// Pass it to http_request as on_body with an http_file_sink_t context.
+typedef struct {
+    vfs_node_t* file;
+    size_t offset;
+} http_file_sink_t;
+
+int http_file_sink(void* context, const uint8_t* data, size_t length);
+
+// Response head, filled in before the first body callback
+typedef struct {
+    int status_code;
+    uint32_t content_length;    // HTTP_LENGTH_UNKNOWN if not given
+    int chunked;
+    int keep_alive;
+} http_head_t;
 
 // HTTP response structure
 typedef struct {
@@ -12,9 +45,21 @@ typedef struct {
     size_t body_length;
 } http_response_t;
 
+typedef struct {
+    uint32_t requests;
+    uint32_t connections_opened;
+    uint32_t connections_reused;
+} http_stats_t;
+
 // HTTP functions
+int http_request(const char* method, const char* host, uint16_t port, const char* path,
+                 http_head_t* head, http_body_callback_t on_body, void* context);
 int http_get(const char* host, uint16_t port, const char* path, http_response_t* response);
+int http_download(const char* host, uint16_t port, const char* path, const char* file_path,
+                  http_head_t* head);
 void http_free_response(http_response_t* response);
+void http_pool_flush(void);
+http_stats_t* http_get_stats(void);
 
 // URL parsing
 int http_parse_url(const char* url, char* host, uint16_t* port, char* path);
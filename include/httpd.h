@@ -0,0 +1,79 @@
+#ifndef HTTPD_H
+#define HTTPD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "scheduler.h"
+#include "vfs.h"
+
+// Static file server. Event driven from deferred work: each tick drains
+// the ready list of one epoll instance over non-blocking sockets, so any
+// number of connections share no thread. GET and HEAD serve VFS files,
+// mounted volumes included; bodies are read from the file straight into
+// the socket send ring, and connections stay open per HTTP/1.1
+// (pipelined requests included).
+
+#define HTTPD_DEFAULT_PORT      80
+#define HTTPD_MAX_CONNECTIONS   64
+#define HTTPD_REQUEST_SIZE      1024    // Request head limit, 431 beyond it
+#define HTTPD_HEADER_SIZE       256     // Response head
+#define HTTPD_MAX_EVENTS        16      // Per epoll_wait
+#define HTTPD_READS_PER_EVENT   4       // Bound on work per connection per tick
+#define HTTPD_MAX_REQUESTS      100     // Per keep-alive connection
+#define HTTPD_WORK_INTERVAL     1
+#define HTTPD_IDLE_TIMEOUT      TIMER_MS_TO_TICKS(15000)
+#define HTTPD_SWEEP_INTERVAL    TIMER_MS_TO_TICKS(1000)
+
+typedef enum {
+    HTTPD_CONN_READING,     // Collecting a request head
+    HTTPD_CONN_SENDING      // Queueing the response as send space opens
+} httpd_conn_state_t;
+
+// Per-connection state, allocated from a slab cache
+typedef struct httpd_conn {
+    int fd;
+    httpd_conn_state_t state;
+    uint32_t interest;          // Events registered with epoll
+    uint32_t last_active;       // Tick
+    uint32_t requests;
+    int keep_alive;
+    
+    // Request head; pipelined bytes after it wait for the next round
+    char request[HTTPD_REQUEST_SIZE + 1];
+    size_t request_length;
+    
+    // Response: head from header[], body from the file or a canned page
+    char header[HTTPD_HEADER_SIZE];
+    size_t header_length;
+    size_t header_sent;
+    const uint8_t* body;        // Canned page; NULL when sending the file
+    size_t body_length;
+    size_t body_sent;
+    vfs_node_t* file;           // Pinned while the body is in flight
+    
+    struct httpd_conn* next;
+    struct httpd_conn* prev;
+} httpd_conn_t;
+
+typedef struct {
+    uint32_t accepted;
+    uint32_t rejected;          // Over HTTPD_MAX_CONNECTIONS
+    uint32_t active;
+    uint32_t requests;
+    uint32_t reused;            // Requests on an already used connection
+    uint32_t status_2xx;
+    uint32_t status_4xx;
+    uint32_t status_5xx;
+    uint32_t bytes_sent;        // Body bytes
+    uint32_t idle_closed;
+} httpd_stats_t;
+
+// HTTPD Functions
+void httpd_init(void);
+int httpd_start(uint16_t port);
+void httpd_stop(void);
+int httpd_is_running(void);
+httpd_stats_t* httpd_get_stats(void);
+void httpd_dump(void);
+
+#endif
\ No newline at end of file
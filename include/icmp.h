@@ -19,7 +19,7 @@ typedef struct __attribute__((packed)) {
 
 // ICMP Functions
 void icmp_init(void);
-void icmp_handle_packet(net_buffer_t* buffer, size_t offset, ip_header_t* ip_hdr);
+void icmp_handle_packet(ip_header_t* ip_hdr, uint8_t* data, size_t length);
 void icmp_send_echo_reply(ip_addr_t dest, uint16_t id, uint16_t sequence, uint8_t* data, size_t length);
 int icmp_send_ping(ip_addr_t dest, uint16_t id, uint16_t sequence, uint8_t* data, size_t length);
 
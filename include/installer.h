@@ -36,6 +36,8 @@ typedef struct {
     install_status_t status;
     uint32_t progress_percent;
     char status_message[128];
+    uint32_t format_ms;         // Time taken by the format step
+    uint32_t format_ms_per_gb;
 } install_config_t;
 
 // Function prototypes
@@ -86,4 +86,17 @@ void register_interrupt_handler(uint8_t n, isr_t handler);
 
 void irq_init(void);
 
+// Disable interrupts and return the previous EFLAGS for irq_restore()
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define IP_H
 
 #include "net.h"
+#include "scheduler.h"
 
 // IP Header structure
 typedef struct __attribute__((packed)) {
@@ -22,10 +23,39 @@ typedef struct __attribute__((packed)) {
 #define IP_PROTOCOL_TCP  6
 #define IP_PROTOCOL_UDP  17
 
+// Flags and fragment offset (in 8-byte units)
+#define IP_FLAG_DF          0x4000
+#define IP_FLAG_MF          0x2000
+#define IP_FRAGMENT_MASK    0x1FFF
+
+#define IP_MTU              1500
+#define IP_MAX_PACKET       65535
+
+// Reassembly limits
+#define IP_REASM_MAX_MEMORY 262144  // Bytes held across all datagrams
+#define IP_REASM_TIMEOUT    TIMER_MS_TO_TICKS(30000)
+#define IP_REASM_TIMER_INTERVAL TIMER_MS_TO_TICKS(500)
+
+// Datagrams that need fragmenting wait whole for their next hop's MAC
+#define IP_MAX_DEFERRED     4
+
+// Piece of a reassembled datagram's payload. Pieces are kept sorted and
+// never overlap; offsets are bytes from the start of the IP payload.
+typedef struct ip_fragment {
+    uint16_t offset;
+    uint16_t length;
+    struct ip_fragment* next;
+    uint8_t data[];
+} ip_fragment_t;
+
 // IP Functions
 void ip_init(void);
 void ip_handle_packet(net_buffer_t* buffer, size_t offset);
+void ip_receive(ip_header_t* ip_hdr, uint8_t* payload, size_t length);
 int ip_send_packet(ip_addr_t dest, uint8_t protocol, uint8_t* data, size_t length);
+uint32_t ip_source_address(uint32_t dest);
 uint16_t ip_checksum(void* data, size_t length);
+void ip_reasm_timer_tick(void);
+void ip_neighbour_update(ip_addr_t next_hop, int reachable);
 
 #endif
\ No newline at end of file
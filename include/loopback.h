@@ -0,0 +1,20 @@
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include "net.h"
+#include "ip.h"
+
+// Loopback device "lo" (127.0.0.1/8). Packets for local addresses are
+// passed from ip_send_packet to ip_receive without building a frame or
+// copying the payload.
+
+#define LOOPBACK_BENCH_PORT        5001
+#define LOOPBACK_BENCH_CHUNK       4096
+#define LOOPBACK_BENCH_TIMEOUT_MS  10000
+
+void loopback_init(void);
+net_interface_t* loopback_get_interface(void);
+int loopback_output(ip_header_t* ip_hdr, uint8_t* data, size_t length);
+void loopback_benchmark(uint32_t total_bytes);
+
+#endif
\ No newline at end of file
@@ -30,14 +30,34 @@ typedef struct {
     uint8_t addr[4];
 } ip_addr_t;
 
-// Network interface
+// Per-interface traffic counters
 typedef struct {
+    uint32_t rx_packets;
+    uint32_t rx_bytes;
+    uint32_t rx_dropped;
+    uint32_t tx_packets;
+    uint32_t tx_bytes;
+    uint32_t tx_dropped;
+} net_if_stats_t;
+
+#define NET_MAX_INTERFACES 8
+#define NET_IF_LOOPBACK    0x1
+
+// Network interface
+typedef struct net_interface {
     mac_addr_t mac;
     ip_addr_t ip;
     ip_addr_t netmask;
     ip_addr_t gateway;
     int active;
     char name[16];
+    uint32_t flags;
+    uint32_t mtu;                 // Largest IP packet, header included
+    net_if_stats_t stats;
+    
+    // Hand a finished Ethernet frame to the hardware. The caller keeps
+    // ownership of the buffer.
+    void (*transmit)(struct net_interface* iface, net_buffer_t* buffer);
 } net_interface_t;
 
 // Ethernet header
@@ -59,8 +79,14 @@ void net_send_packet(net_buffer_t* buffer);
 void net_receive_packet(uint8_t* data, size_t length);
 
 // Interface management
+int net_register_interface(net_interface_t* iface);
+net_interface_t* net_find_interface(const char* name);
+net_interface_t* net_get_interface_at(int index);
+net_interface_t* net_interface_for_address(ip_addr_t* ip);
+void net_interface_configure(net_interface_t* iface, ip_addr_t ip, ip_addr_t netmask, ip_addr_t gateway);
+void net_interface_unconfigure(net_interface_t* iface);
 void net_set_interface(mac_addr_t mac, ip_addr_t ip, ip_addr_t netmask, ip_addr_t gateway);
-net_interface_t* net_get_interface(void);
+net_interface_t* net_get_interface(void);   // Primary Ethernet interface
 uint32_t get_local_ip(void);
 
 // Utility functions
@@ -23,10 +23,21 @@
 #define PCI_BASE_ADDRESS_3 0x1C
 #define PCI_BASE_ADDRESS_4 0x20
 #define PCI_BASE_ADDRESS_5 0x24
+#define PCI_INTERRUPT_LINE 0x3C
+
+// PCI Command register bits
+#define PCI_COMMAND_IO         0x0001
+#define PCI_COMMAND_MEMORY     0x0002
+#define PCI_COMMAND_BUS_MASTER 0x0004
 
 // PCI Device Classes
+#define PCI_CLASS_MASS_STORAGE 0x01
 #define PCI_CLASS_DISPLAY  0x03
 
+// Mass storage subclasses
+#define PCI_SUBCLASS_IDE   0x01
+#define PCI_SUBCLASS_SATA  0x06
+
 // PCI Device structure
 typedef struct {
     uint16_t vendor_id;
@@ -37,6 +48,7 @@ typedef struct {
     uint32_t base_addresses[6];
     uint8_t class_code;
     uint8_t subclass;
+    uint8_t prog_if;
 } pci_device_t;
 
 // PCI Functions
@@ -47,5 +59,7 @@ uint8_t pci_read_config_byte(uint8_t bus, uint8_t device, uint8_t function, uint
 void pci_write_config_dword(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value);
 int pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t* dev);
 int pci_scan_bus(void);
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t* dev);
+void pci_enable_bus_master(pci_device_t* dev);
 
 #endif
\ No newline at end of file
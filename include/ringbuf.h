@@ -0,0 +1,33 @@
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Byte ring buffer. head and tail run freely and are masked on access, so
+// the size must be a power of two; used = tail - head even after wrap.
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t head;   // Next byte to read
+    size_t tail;   // Next byte to write
+} ring_buffer_t;
+
+int ring_init(ring_buffer_t* ring, size_t size);
+void ring_free(ring_buffer_t* ring);
+int ring_resize(ring_buffer_t* ring, size_t new_size);
+
+size_t ring_write(ring_buffer_t* ring, const void* data, size_t len);
+size_t ring_read(ring_buffer_t* ring, void* buffer, size_t len);
+size_t ring_peek(ring_buffer_t* ring, size_t offset, void* buffer, size_t len);
+size_t ring_discard(ring_buffer_t* ring, size_t len);
+
+static inline size_t ring_used(ring_buffer_t* ring) {
+    return ring->tail - ring->head;
+}
+
+static inline size_t ring_space(ring_buffer_t* ring) {
+    return ring->size - (ring->tail - ring->head);
+}
+
+#endif
\ No newline at end of file
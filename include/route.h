@@ -0,0 +1,42 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include "net.h"
+
+// Routing table: a path-compressed binary trie over destination
+// prefixes (longest-prefix match) fronted by a small per-destination
+// cache. Addresses are host byte order, as in tcp.c/udp.c.
+
+#define ROUTE_MAX_ROUTES  128
+#define ROUTE_CACHE_SIZE  64     // Direct-mapped, power of two
+
+typedef struct route_entry {
+    uint32_t prefix;            // Network part only, host bits zero
+    uint8_t prefix_length;      // 0..32
+    uint32_t gateway;           // 0 for directly connected networks
+    net_interface_t* iface;
+    int in_use;
+} route_entry_t;
+
+typedef struct {
+    uint32_t lookups;
+    uint32_t cache_hits;
+    uint32_t cache_misses;
+    uint32_t no_route;
+} route_stats_t;
+
+// Function prototypes
+void route_init(void);
+int route_add(uint32_t prefix, uint8_t prefix_length, uint32_t gateway, net_interface_t* iface);
+int route_delete(uint32_t prefix, uint8_t prefix_length);
+void route_flush_interface(net_interface_t* iface);
+void route_interface_up(net_interface_t* iface);
+
+// Resolve the outgoing interface and next hop for dest. Returns 0 on
+// success, -1 if no route matches.
+int route_lookup(uint32_t dest, net_interface_t** iface, uint32_t* next_hop);
+
+route_stats_t* route_get_stats(void);
+void route_dump(void);
+
+#endif
\ No newline at end of file
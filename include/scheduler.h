@@ -6,6 +6,24 @@
 #include "interrupts.h"
 
 #define TIMER_FREQUENCY 100
+#define TIMER_MS_PER_TICK (1000 / TIMER_FREQUENCY)
+#define TIMER_MS_TO_TICKS(ms) (((ms) + TIMER_MS_PER_TICK - 1) / TIMER_MS_PER_TICK)
+#define MAX_TIMER_CALLBACKS 16
+#define MAX_WORK_ITEMS 8
+
+// Wait queue: sleepers are released when the generation changes
+typedef struct {
+    volatile uint32_t generation;
+} wait_queue_t;
+
+// Periodic callbacks run from the timer interrupt with interrupts disabled
+typedef void (*timer_callback_t)(void);
+
+// Deferred work comes due on the timer like a callback, but runs once the
+// handler proper is done: with interrupts enabled, one item at a time,
+// and never while process context holds work_disable(). This is where
+// disk and filesystem work that must not run in an interrupt goes.
+typedef void (*work_callback_t)(void);
 
 void scheduler_init(void);
 void timer_handler(registers_t regs);
@@ -19,4 +37,21 @@ process_t* get_current_running_process(void);
 void enable_scheduler(void);
 void disable_scheduler(void);
 
+// Wait queues. Callers check their condition with interrupts disabled
+// (irq_save) and then sleep, so a wakeup cannot slip in between.
+void wait_queue_init(wait_queue_t* wq);
+void wait_queue_sleep(wait_queue_t* wq);
+int wait_queue_sleep_timeout(wait_queue_t* wq, uint32_t ticks);
+void wake_up(wait_queue_t* wq);
+
+// Kernel timer
+uint32_t timer_get_ticks(void);
+int timer_register_callback(timer_callback_t callback, uint32_t interval_ticks);
+
+// Deferred work. work_disable() nests; process context brackets code that
+// shares state with a work item (the block and filesystem layers) with it.
+int work_register(work_callback_t callback, uint32_t interval_ticks);
+void work_disable(void);
+void work_enable(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Object caches for fixed-size kernel objects. A slab is one physical page:
+// a header followed by equal-sized objects threaded on a free list, so
+// allocation and release are O(1) and never fragment the kmalloc heap.
+// Safe from interrupt context.
+
+#define SLAB_NAME_LEN 16
+
+struct slab_cache;
+
+typedef struct slab {
+    struct slab_cache* cache;
+    struct slab* next;
+    struct slab* prev;
+    void* free_list;            // First free object; each stores the next
+    uint32_t in_use;
+} slab_t;
+
+typedef struct slab_cache {
+    char name[SLAB_NAME_LEN];
+    size_t object_size;         // Rounded up to pointer alignment
+    uint32_t objects_per_slab;
+    slab_t* partial;            // Slabs with free objects, allocation order
+    slab_t* full;
+    slab_t* empty;              // One spare slab kept to absorb churn
+    
+    // Statistics
+    uint32_t slabs;
+    uint32_t objects_in_use;
+    uint32_t peak_in_use;
+    uint32_t allocations;
+    uint32_t failures;
+} slab_cache_t;
+
+int slab_cache_init(slab_cache_t* cache, const char* name, size_t object_size);
+void* slab_alloc(slab_cache_t* cache);
+void slab_free(slab_cache_t* cache, void* object);
+void slab_cache_dump(slab_cache_t* cache);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "epoll.h"
+
+// BSD-style socket layer over TCP and UDP. Descriptors index one table
+// shared by the kernel and user programs.
+
+#define AF_INET      2
+
+#define SOCK_STREAM  1
+#define SOCK_DGRAM   2
+
+#define IPPROTO_TCP  6
+#define IPPROTO_UDP  17
+
+#define SOL_SOCKET   1
+#define SO_NONBLOCK  1      // value != 0: calls return -EAGAIN instead of sleeping
+
+#define SOCKET_MAX   256
+
+// Produces outgoing data in place for socket_send_fill(): writes up to
+// length bytes into dest and returns the count, or < 0 on error
+typedef int (*socket_fill_t)(void* context, void* dest, size_t length);
+
+// Address and port are in host byte order
+typedef struct {
+    uint16_t family;
+    uint16_t port;
+    uint32_t addr;
+} sockaddr_in_t;
+
+int socket_create(int domain, int type, int protocol);
+int socket_bind(int fd, const sockaddr_in_t* addr);
+int socket_listen(int fd, int backlog);
+int socket_accept(int fd, sockaddr_in_t* addr);
+int socket_connect(int fd, const sockaddr_in_t* addr);
+int socket_sendto(int fd, const void* data, size_t length, const sockaddr_in_t* addr);
+int socket_recvfrom(int fd, void* buffer, size_t length, sockaddr_in_t* addr);
+int socket_send(int fd, const void* data, size_t length);
+int socket_send_fill(int fd, socket_fill_t fill, void* context, size_t length);
+int socket_recv(int fd, void* buffer, size_t length);
+int socket_setsockopt(int fd, int level, int option, int value);
+int socket_close(int fd);
+
+// Readiness for epoll
+uint32_t socket_poll(int fd);
+poll_head_t* socket_poll_head(int fd);
+
+#endif
\ No newline at end of file
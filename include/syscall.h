@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "interrupts.h"
+#include "epoll.h"
+#include "socket.h"
 
 #define SYSCALL_PRINT    0
 #define SYSCALL_READ     1
@@ -12,6 +14,19 @@
 #define SYSCALL_EXIT     4
 #define SYSCALL_GETPID   5
 #define SYSCALL_YIELD    6
+#define SYSCALL_EPOLL_CREATE 7
+#define SYSCALL_EPOLL_CTL    8
+#define SYSCALL_EPOLL_WAIT   9
+#define SYSCALL_EPOLL_CLOSE  10
+#define SYSCALL_SOCKET       11
+#define SYSCALL_BIND         12
+#define SYSCALL_LISTEN       13
+#define SYSCALL_ACCEPT       14
+#define SYSCALL_CONNECT      15
+#define SYSCALL_SENDTO       16
+#define SYSCALL_RECVFROM     17
+#define SYSCALL_CLOSE        18
+#define SYSCALL_RESOLVE      19
 
 typedef struct {
     uint32_t eax;
@@ -119,4 +134,204 @@ static inline void sys_yield(void) {
     );
 }
 
+static inline int sys_epoll_create(void) {
+    int result;
+    asm volatile (
+        "mov $7, %%eax\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        :
+        : "eax"
+    );
+    return result;
+}
+
+static inline int sys_epoll_ctl(int epfd, int op, int socket, epoll_event_t* event) {
+    int result;
+    asm volatile (
+        "mov $8, %%eax\n"
+        "mov %1, %%ebx\n"
+        "mov %2, %%ecx\n"
+        "mov %3, %%edx\n"
+        "mov %4, %%esi\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "g" (epfd), "g" (op), "g" (socket), "g" (event)
+        : "eax", "ebx", "ecx", "edx", "esi", "memory"
+    );
+    return result;
+}
+
+static inline int sys_epoll_wait(int epfd, epoll_event_t* events, int max_events, int timeout_ms) {
+    int result;
+    asm volatile (
+        "mov $9, %%eax\n"
+        "mov %1, %%ebx\n"
+        "mov %2, %%ecx\n"
+        "mov %3, %%edx\n"
+        "mov %4, %%esi\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "g" (epfd), "g" (events), "g" (max_events), "g" (timeout_ms)
+        : "eax", "ebx", "ecx", "edx", "esi", "memory"
+    );
+    return result;
+}
+
+static inline int sys_epoll_close(int epfd) {
+    int result;
+    asm volatile (
+        "mov $10, %%eax\n"
+        "mov %1, %%ebx\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "r" (epfd)
+        : "eax", "ebx", "memory"
+    );
+    return result;
+}
+
+static inline int sys_socket(int domain, int type, int protocol) {
+    int result;
+    asm volatile (
+        "mov $11, %%eax\n"
+        "mov %1, %%ebx\n"
+        "mov %2, %%ecx\n"
+        "mov %3, %%edx\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "g" (domain), "g" (type), "g" (protocol)
+        : "eax", "ebx", "ecx", "edx", "memory"
+    );
+    return result;
+}
+
+static inline int sys_bind(int fd, const sockaddr_in_t* addr) {
+    int result;
+    asm volatile (
+        "mov $12, %%eax\n"
+        "mov %1, %%ebx\n"
+        "mov %2, %%ecx\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "g" (fd), "g" (addr)
+        : "eax", "ebx", "ecx", "memory"
+    );
+    return result;
+}
+
+static inline int sys_listen(int fd, int backlog) {
+    int result;
+    asm volatile (
+        "mov $13, %%eax\n"
+        "mov %1, %%ebx\n"
+        "mov %2, %%ecx\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "g" (fd), "g" (backlog)
+        : "eax", "ebx", "ecx", "memory"
+    );
+    return result;
+}
+
+static inline int sys_accept(int fd, sockaddr_in_t* addr) {
+    int result;
+    asm volatile (
+        "mov $14, %%eax\n"
+        "mov %1, %%ebx\n"
+        "mov %2, %%ecx\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "g" (fd), "g" (addr)
+        : "eax", "ebx", "ecx", "memory"
+    );
+    return result;
+}
+
+static inline int sys_connect(int fd, const sockaddr_in_t* addr) {
+    int result;
+    asm volatile (
+        "mov $15, %%eax\n"
+        "mov %1, %%ebx\n"
+        "mov %2, %%ecx\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "g" (fd), "g" (addr)
+        : "eax", "ebx", "ecx", "memory"
+    );
+    return result;
+}
+
+static inline int sys_sendto(int fd, const void* data, size_t length, const sockaddr_in_t* addr) {
+    int result;
+    asm volatile (
+        "mov $16, %%eax\n"
+        "mov %1, %%ebx\n"
+        "mov %2, %%ecx\n"
+        "mov %3, %%edx\n"
+        "mov %4, %%esi\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "g" (fd), "g" (data), "g" (length), "g" (addr)
+        : "eax", "ebx", "ecx", "edx", "esi", "memory"
+    );
+    return result;
+}
+
+static inline int sys_recvfrom(int fd, void* buffer, size_t length, sockaddr_in_t* addr) {
+    int result;
+    asm volatile (
+        "mov $17, %%eax\n"
+        "mov %1, %%ebx\n"
+        "mov %2, %%ecx\n"
+        "mov %3, %%edx\n"
+        "mov %4, %%esi\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "g" (fd), "g" (buffer), "g" (length), "g" (addr)
+        : "eax", "ebx", "ecx", "edx", "esi", "memory"
+    );
+    return result;
+}
+
+static inline int sys_close(int fd) {
+    int result;
+    asm volatile (
+        "mov $18, %%eax\n"
+        "mov %1, %%ebx\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "r" (fd)
+        : "eax", "ebx", "memory"
+    );
+    return result;
+}
+
+static inline int sys_resolve(const char* name, uint32_t* addr) {
+    int result;
+    asm volatile (
+        "mov $19, %%eax\n"
+        "mov %1, %%ebx\n"
+        "mov %2, %%ecx\n"
+        "int $0x80\n"
+        "mov %%eax, %0"
+        : "=r" (result)
+        : "g" (name), "g" (addr)
+        : "eax", "ebx", "ecx", "memory"
+    );
+    return result;
+}
+
 #endif
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "ip.h"
+#include "ringbuf.h"
+#include "scheduler.h"
+#include "epoll.h"
 
 // TCP header flags
 #define TCP_FLAG_FIN  0x01
@@ -13,6 +16,49 @@
 #define TCP_FLAG_ACK  0x10
 #define TCP_FLAG_URG  0x20
 
+// Sequence number comparison (modulo 2^32)
+#define TCP_SEQ_LT(a, b)  ((int32_t)((a) - (b)) < 0)
+#define TCP_SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define TCP_SEQ_GT(a, b)  ((int32_t)((a) - (b)) > 0)
+#define TCP_SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+
+// Retransmission timing, in timer ticks (see TIMER_FREQUENCY)
+#define TCP_RTO_INITIAL     100   // 1 s (RFC 6298)
+#define TCP_RTO_MIN         20    // 200 ms
+#define TCP_RTO_MAX         6000  // 60 s
+#define TCP_MAX_RETRIES     8     // Give up on the connection after this many
+#define TCP_MSL             3000  // 30 s, TIME_WAIT lasts 2 * MSL
+#define TCP_CONNECT_TIMEOUT 1500  // 15 s, covers several SYN retransmits
+#define TCP_TIMER_INTERVAL  1     // Ticks between tcp_timer_tick calls
+#define TCP_DELACK_TIMEOUT  TIMER_MS_TO_TICKS(40)
+#define TCP_DELACK_SEGMENTS 2     // ACK at least every second full segment
+#define TCP_LINGER_TIMEOUT  200   // 2 s, blocking tcp_close waits for the FIN exchange
+
+#define TCP_MAX_SOCKETS     256
+#define TCP_DEFAULT_BACKLOG 16
+
+// Socket options for tcp_setsockopt
+#define TCP_NODELAY         1     // Disable Nagle coalescing of small writes
+#define TCP_CORK            2     // Hold partial segments until uncorked
+
+// TCP options
+#define TCP_OPT_END            0
+#define TCP_OPT_NOP            1
+#define TCP_OPT_MSS            2
+#define TCP_OPT_WSCALE         3
+#define TCP_OPT_SACK_PERMITTED 4
+#define TCP_OPT_SACK           5
+#define TCP_MAX_OPTIONS_LEN    40
+#define TCP_MAX_SACK_BLOCKS    4
+
+// Segment size and windows
+#define TCP_DEFAULT_MSS      536     // Assumed when the peer sends no MSS option
+#define TCP_LOCAL_MSS        1460    // Ethernet MTU minus IP and TCP headers
+#define TCP_MAX_WSCALE       14
+#define TCP_LOCAL_WSCALE     3       // Lets us advertise TCP_MAX_BUFFER_SIZE
+#define TCP_INITIAL_BUFFER_SIZE 16384   // Ring sizes are powers of two
+#define TCP_MAX_BUFFER_SIZE  262144
+
 // TCP states
 typedef enum {
     TCP_CLOSED,
@@ -41,14 +87,17 @@ typedef struct {
     uint16_t urgent_ptr;
 } __attribute__((packed)) tcp_header_t;
 
-// TCP pseudo header for checksum
-typedef struct {
-    uint32_t src_ip;
-    uint32_t dst_ip;
-    uint8_t  zero;
-    uint8_t  protocol;
-    uint16_t tcp_length;
-} __attribute__((packed)) tcp_pseudo_header_t;
+// Unacknowledged segment kept for retransmission
+typedef struct tcp_segment {
+    uint32_t seq;
+    uint8_t flags;
+    uint8_t* data;
+    size_t data_len;
+    uint32_t sent_tick;
+    int retransmitted;  // Karn: never take RTT samples from these
+    int sacked;         // Covered by a SACK block from the peer
+    struct tcp_segment* next;
+} tcp_segment_t;
 
 // TCP connection structure
 typedef struct tcp_connection {
@@ -65,27 +114,81 @@ typedef struct tcp_connection {
     uint32_t recv_seq;
     uint32_t recv_ack;
     
-    // Window management
-    uint16_t send_window;
-    uint16_t recv_window;
+    // Window management (in bytes, already scaled)
+    uint32_t send_window;
+    uint32_t recv_window;
+    
+    // Negotiated options
+    uint16_t send_mss;           // Largest segment we may send
+    uint8_t send_wscale;         // Shift applied to the peer's window
+    uint8_t recv_wscale;         // Shift applied to our advertised window
+    int sack_permitted;
+    
+    // NewReno congestion control (RFC 6582)
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t dup_acks;
+    uint32_t recover;            // send_seq when fast recovery began
+    int in_recovery;
     
-    // Buffers
-    uint8_t* send_buffer;
-    uint8_t* recv_buffer;
-    size_t send_buffer_size;
-    size_t recv_buffer_size;
-    size_t send_buffer_used;
-    size_t recv_buffer_used;
+    // Socket buffers. send_ring only holds data not yet handed to IP;
+    // sent data lives in the retransmission queue until acknowledged.
+    ring_buffer_t send_ring;
+    ring_buffer_t recv_ring;
+    wait_queue_t send_wait;      // Writers waiting for send_ring space
+    wait_queue_t recv_wait;      // Readers waiting for data or EOF
+    
+    // Receive buffer auto-tuning
+    uint32_t recv_rtt_start;
+    size_t recv_rtt_bytes;
+    int persist_pending;         // Zero window probe scheduled
+    
+    // Delayed ACK (RFC 1122) and Nagle (RFC 896)
+    uint32_t ack_pending;        // In-order segments received but not ACKed
+    uint32_t delack_deadline;    // Tick at which a pending ACK must go out
+    int nodelay;                 // TCP_NODELAY: send small segments at once
+    int cork;                    // TCP_CORK: only full segments go out
+    int close_pending;           // Send FIN once send_ring drains
+    
+    // Readiness notification; points into the owning socket, if any
+    poll_head_t* poll;
+    
+    // Passive open: children wait on their listener's accept queue
+    struct tcp_connection* listener;
+    struct tcp_connection* accept_next;
+    struct tcp_connection* accept_head;
+    struct tcp_connection* accept_tail;
+    int accept_count;
+    int accept_backlog;
+    
+    // Retransmission queue and RTT estimation (Jacobson/Karels)
+    uint32_t send_una;           // Oldest unacknowledged sequence number
+    tcp_segment_t* retransmit_head;
+    tcp_segment_t* retransmit_tail;
+    uint32_t srtt;               // Smoothed RTT in ticks, scaled by 8
+    uint32_t rttvar;             // RTT variance in ticks, scaled by 4
+    uint32_t rto;                // Current retransmission timeout in ticks
+    uint32_t rto_deadline;       // Tick at which the oldest segment is resent
+    uint32_t retries;            // Consecutive timeouts without progress
+    uint32_t time_wait_deadline; // Tick at which TIME_WAIT expires
+    int orphaned;                // Socket closed, reap once the timers finish
     
     // Connection tracking
     struct tcp_connection* next;
 } tcp_connection_t;
 
+// Writes up to len bytes of outgoing data into dest; returns the count,
+// or < 0 on error
+typedef int (*tcp_fill_t)(void* context, void* dest, size_t len);
+
 // TCP socket structure
 typedef struct {
     tcp_connection_t* connection;
     int socket_id;
     int is_listening;
+    int nonblocking;    // tcp_send/tcp_recv return -EAGAIN instead of sleeping
+    int nodelay;        // Copied to the connection once it exists
+    poll_head_t poll;   // epoll items watching this socket
 } tcp_socket_t;
 
 // TCP functions
@@ -100,8 +203,15 @@ int tcp_listen(int socket, int backlog);
 int tcp_accept(int socket, uint32_t* remote_ip, uint16_t* remote_port);
 int tcp_connect(int socket, uint32_t remote_ip, uint16_t remote_port);
 int tcp_send(int socket, const void* data, size_t len);
+int tcp_send_fill(int socket, tcp_fill_t fill, void* context, size_t len);
 int tcp_recv(int socket, void* buffer, size_t len);
 int tcp_close(int socket);
+int tcp_set_nonblocking(int socket, int nonblocking);
+int tcp_setsockopt(int socket, int option, int value);
+
+// Readiness for epoll
+uint32_t tcp_poll(int socket);
+poll_head_t* tcp_poll_head(int socket);
 
 // Connection management
 tcp_connection_t* tcp_create_connection(void);
@@ -117,6 +227,9 @@ void tcp_send_ack(tcp_connection_t* conn);
 void tcp_send_fin(tcp_connection_t* conn);
 void tcp_send_rst(tcp_connection_t* conn);
 
+// Output path
+void tcp_output(tcp_connection_t* conn);
+
 // Timer functions
 void tcp_timer_tick(void);
 void tcp_retransmit_check(void);
@@ -3,6 +3,8 @@
 
 #include "net.h"
 #include "ip.h"
+#include "scheduler.h"
+#include "epoll.h"
 
 // UDP Header structure
 typedef struct __attribute__((packed)) {
@@ -12,12 +14,63 @@ typedef struct __attribute__((packed)) {
     uint16_t checksum;    // Checksum
 } udp_header_t;
 
+#define UDP_HASH_SIZE        64      // Buckets in the port -> socket table
+#define UDP_RECV_QUEUE_MAX   65536   // Bytes queued per socket before drops
+#define UDP_EPHEMERAL_FIRST  49152
+
+// Received datagram waiting in a socket's queue
+typedef struct udp_datagram {
+    uint32_t src_ip;
+    uint16_t src_port;
+    size_t length;
+    struct udp_datagram* next;
+    uint8_t data[];
+} udp_datagram_t;
+
+struct udp_socket;
+
+// In-kernel services (DHCP, DNS, ...) consume datagrams directly from the
+// receive path instead of queueing them. Runs in interrupt context.
+typedef void (*udp_rx_handler_t)(struct udp_socket* sock, uint32_t src_ip, uint16_t src_port,
+                                 uint8_t* data, size_t length);
+
+typedef struct udp_socket {
+    uint32_t local_ip;          // 0 accepts datagrams for any local address
+    uint16_t local_port;
+    int bound;
+    int nonblocking;
+    
+    udp_datagram_t* queue_head;
+    udp_datagram_t* queue_tail;
+    size_t queued_bytes;
+    uint32_t drops;             // Datagrams dropped on a full queue
+    wait_queue_t recv_wait;
+    poll_head_t poll;
+    
+    udp_rx_handler_t handler;
+    void* handler_context;
+    
+    struct udp_socket* hash_next;
+} udp_socket_t;
+
 // UDP Functions
 void udp_init(void);
-void udp_handle_packet(net_buffer_t* buffer, size_t offset, ip_header_t* ip_hdr);
+void udp_handle_packet(ip_header_t* ip_hdr, uint8_t* data, size_t length);
+void udp_handle_fragments(ip_header_t* ip_hdr, ip_fragment_t* fragments, size_t length);
 int udp_send_packet(ip_addr_t dest_ip, uint16_t src_port, uint16_t dest_port, uint8_t* data, size_t length);
 uint16_t udp_checksum(ip_header_t* ip_hdr, udp_header_t* udp_hdr, uint8_t* data, size_t length);
 
+// UDP sockets. Addresses and ports are in host byte order.
+udp_socket_t* udp_socket_create(void);
+int udp_socket_bind(udp_socket_t* sock, uint32_t local_ip, uint16_t port);
+void udp_socket_set_handler(udp_socket_t* sock, udp_rx_handler_t handler, void* context);
+int udp_socket_sendto(udp_socket_t* sock, const void* data, size_t length,
+                      uint32_t dest_ip, uint16_t dest_port);
+int udp_socket_recvfrom(udp_socket_t* sock, void* buffer, size_t length,
+                        uint32_t* src_ip, uint16_t* src_port);
+uint32_t udp_socket_poll(udp_socket_t* sock);
+void udp_socket_close(udp_socket_t* sock);
+
 // Common UDP ports
 #define UDP_PORT_DHCP_SERVER 67
 #define UDP_PORT_DHCP_CLIENT 68
@@ -5,26 +5,84 @@
 #include <stddef.h>
 
 #define VFS_MAX_NAME_LEN 64
-#define VFS_MAX_FILES 256
+#define VFS_DIR_MIN_BUCKETS 8
 #define VFS_MAX_FILE_SIZE 4096
 #define VFS_MAX_PATH_LEN 512
+#define VFS_MAX_MOUNTS 8
+#define VFS_DCACHE_SIZE 256      // Dentry cache slots, power of two
 
 typedef enum {
     VFS_FILE,
     VFS_DIRECTORY
 } vfs_type_t;
 
+struct vfs_node;
+
+typedef struct {
+    char name[VFS_MAX_NAME_LEN];
+    vfs_type_t type;
+    size_t size;
+} vfs_dirent_t;
+
+// Per-filesystem operations. In-memory nodes use the built-in ramfs table,
+// whose children list is complete; nodes of a mounted volume use the
+// volume's table, and lookup() fills the children list on demand. The
+// VFS calls them with deferred work held off, so work items can use the
+// same files.
+typedef struct vfs_ops {
+    const char* fs_name;
+    struct vfs_node* (*lookup)(struct vfs_node* dir, const char* name);
+    int (*read)(struct vfs_node* node, size_t offset, void* buffer, size_t size);
+    int (*write)(struct vfs_node* node, size_t offset, const void* buffer, size_t size);
+    int (*readdir)(struct vfs_node* dir, size_t index, vfs_dirent_t* entry);
+    struct vfs_node* (*create)(struct vfs_node* dir, const char* name);  // New empty file
+    void (*release)(struct vfs_node* node);     // Free fs_private
+} vfs_ops_t;
+
+// Children of a directory: a hash table for lookups, chained through
+// vfs_node.hash_next, and an array in creation order for listing. Both
+// grow by doubling; files have none of this. The generation changes
+// whenever a child is added or removed.
+typedef struct vfs_dir {
+    struct vfs_node** buckets;
+    size_t bucket_count;        // Power of two
+    struct vfs_node** entries;
+    size_t count;
+    size_t capacity;
+    uint32_t generation;
+} vfs_dir_t;
+
 typedef struct vfs_node {
     char name[VFS_MAX_NAME_LEN];
     vfs_type_t type;
     size_t size;
-    uint8_t* data;
+    uint8_t* data;          // ramfs contents; NULL on other filesystems
+    const vfs_ops_t* ops;
+    void* fs_private;
     struct vfs_node* parent;
-    struct vfs_node* children[VFS_MAX_FILES];
-    size_t child_count;
+    vfs_dir_t* dir;         // Directories only
+    struct vfs_node* hash_next; // Next in the parent's bucket
     uint32_t creation_time;
+    uint32_t refs;          // Holders outside the tree (vfs_node_get)
+    int unlinked;           // Deleted while referenced; freed on last put
 } vfs_node_t;
 
+// Dentry cache slot: the result of looking up a name in a directory,
+// exactly as it was spelled. A NULL node records that the name does not
+// exist. The slot is stale once the directory's generation moves on.
+typedef struct {
+    vfs_node_t* parent;
+    uint32_t generation;
+    vfs_node_t* node;
+    char name[VFS_MAX_NAME_LEN];
+} vfs_dentry_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t negative_hits;     // Hits that proved a name absent
+    uint32_t misses;
+} vfs_dcache_stats_t;
+
 typedef struct {
     vfs_node_t* current_dir;
     vfs_node_t* root_dir;
@@ -45,7 +103,31 @@ vfs_node_t* vfs_create_file(const char* name, const uint8_t* data, size_t size);
 int vfs_delete_file(const char* name);
 vfs_node_t* vfs_open_file(const char* name);
 
-// Path operations
+// Pin a node so its data stays valid after vfs_delete_file
+void vfs_node_get(vfs_node_t* node);
+void vfs_node_put(vfs_node_t* node);
+
+// Data access through the node's filesystem. Return bytes or -1.
+int vfs_read(vfs_node_t* node, size_t offset, void* buffer, size_t size);
+int vfs_write(vfs_node_t* node, size_t offset, const void* buffer, size_t size);
+int vfs_readdir(vfs_node_t* dir, size_t index, vfs_dirent_t* entry);
+
+// Filesystems
+vfs_node_t* vfs_alloc_node(const char* name, vfs_type_t type, const vfs_ops_t* ops);
+void vfs_free_node(vfs_node_t* node);
+int vfs_mount(const char* name, vfs_node_t* root);
+int vfs_umount(const char* name);
+int vfs_forget(vfs_node_t* node);
+vfs_node_t* vfs_get_mount(size_t index);
+
+// Path operations. vfs_lookup walks absolute or relative paths through
+// the dentry cache; filesystems call vfs_dcache_invalidate_dir when names
+// in a directory change on disk behind the VFS.
+vfs_node_t* vfs_lookup(const char* path);
+vfs_node_t* vfs_create(const char* path);
+void vfs_dcache_invalidate_dir(vfs_node_t* dir);
+vfs_dcache_stats_t* vfs_dcache_get_stats(void);
+void vfs_dcache_dump(void);
 void vfs_get_current_path(char* buffer, size_t buffer_size);
 vfs_node_t* vfs_get_current_dir(void);
 vfs_node_t* vfs_get_root_dir(void);
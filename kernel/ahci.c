@@ -0,0 +1,518 @@
+#include "../include/ahci.h"
+#include "../include/pci.h"
+#include "../include/memory.h"
+#include "../include/interrupts.h"
+#include "../include/errno.h"
+
+extern void terminal_writestring(const char* data);
+
+#define AHCI_SPIN_LIMIT 50000000
+#define AHCI_BOUNCE_SECTORS (PAGE_SIZE / DISK_SECTOR_SIZE)
+
+static ahci_hba_regs_t* hba = NULL;
+static ahci_port_t drives[AHCI_MAX_DRIVES];
+static uint32_t drive_count = 0;
+static uint32_t hba_slots = 1;
+static bool hba_ncq = false;
+
+// Odd-addressed buffers are staged here; PRDs must be word aligned
+static uint8_t ahci_bounce[PAGE_SIZE] __attribute__((aligned(16)));
+static uint16_t ahci_identify_buffer[256] __attribute__((aligned(16)));
+
+typedef struct {
+    volatile uint32_t pending;
+    volatile bool failed;
+} ahci_sync_t;
+
+static void ahci_memset(void* ptr, int value, size_t size) {
+    uint8_t* p = (uint8_t*)ptr;
+    for (size_t i = 0; i < size; i++) {
+        p[i] = (uint8_t)value;
+    }
+}
+
+static void ahci_memcpy(void* dest, const void* src, size_t size) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    for (size_t i = 0; i < size; i++) {
+        d[i] = s[i];
+    }
+}
+
+static void ahci_stop_port(ahci_port_regs_t* regs) {
+    regs->cmd &= ~AHCI_PXCMD_ST;
+    regs->cmd &= ~AHCI_PXCMD_FRE;
+    for (uint32_t spin = 0; spin < AHCI_SPIN_LIMIT; spin++) {
+        if (!(regs->cmd & (AHCI_PXCMD_CR | AHCI_PXCMD_FR))) {
+            break;
+        }
+    }
+}
+
+static void ahci_start_port(ahci_port_regs_t* regs) {
+    for (uint32_t spin = 0; spin < AHCI_SPIN_LIMIT; spin++) {
+        if (!(regs->cmd & AHCI_PXCMD_CR)) {
+            break;
+        }
+    }
+    regs->cmd |= AHCI_PXCMD_FRE;
+    regs->cmd |= AHCI_PXCMD_ST;
+}
+
+static void ahci_complete_slot(ahci_port_t* p, uint32_t slot, bool ok) {
+    ahci_slot_t* s = &p->slots[slot];
+    ahci_callback_t callback = s->callback;
+    void* context = s->context;
+    
+    s->callback = NULL;
+    p->busy &= ~(1u << slot);
+    if (!ok) {
+        p->errors++;
+    }
+    if (callback) {
+        callback(context, ok);
+    }
+}
+
+// Fail everything in flight and restart the port. Stopping the engine
+// clears PxCI and PxSACT, so the slots can be handed out again.
+static void ahci_recover(ahci_port_t* p) {
+    ahci_stop_port(p->regs);
+    p->regs->serr = 0xFFFFFFFF;
+    p->regs->is = 0xFFFFFFFF;
+    
+    uint32_t outstanding = p->busy;
+    for (uint32_t slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+        if (outstanding & (1u << slot)) {
+            ahci_complete_slot(p, slot, false);
+        }
+    }
+    
+    ahci_start_port(p->regs);
+    hba->is = 1u << p->port;
+    wake_up(&p->wait);
+}
+
+// Reap finished slots. Called with interrupts disabled, from the HBA
+// interrupt or from a caller that is polling.
+static void ahci_service(ahci_port_t* p) {
+    uint32_t status = p->regs->is;
+    p->regs->is = status;
+    hba->is = 1u << p->port;
+    
+    if (status & AHCI_PXIS_ERRORS) {
+        ahci_recover(p);
+        return;
+    }
+    
+    // A slot is done once the HBA has cleared it from both CI and SACT
+    uint32_t done = p->busy & ~(p->regs->ci | p->regs->sact);
+    if (!done) {
+        return;
+    }
+    
+    for (uint32_t slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+        if (done & (1u << slot)) {
+            ahci_complete_slot(p, slot, true);
+        }
+    }
+    wake_up(&p->wait);
+}
+
+static void ahci_irq(registers_t regs) {
+    (void)regs;
+    
+    // Loop until quiet: the PIC is edge triggered and would miss a port
+    // that raised its status while another was being serviced
+    for (int pass = 0; pass < 4 && hba->is; pass++) {
+        uint32_t pending = hba->is;
+        for (uint32_t i = 0; i < drive_count; i++) {
+            if (pending & (1u << drives[i].port)) {
+                ahci_service(&drives[i]);
+            }
+        }
+    }
+}
+
+// Fill in the command table and ring the doorbell. Returns the slot, or
+// -EAGAIN when every usable slot is in flight.
+static int ahci_issue(ahci_port_t* p, uint8_t command, uint64_t lba, uint32_t count,
+                      void* buffer, uint32_t bytes, bool write,
+                      ahci_callback_t callback, void* context) {
+    if ((uint32_t)buffer & 1) {
+        return -EINVAL;
+    }
+    
+    uint32_t flags = irq_save();
+    
+    uint32_t mask = p->depth >= 32 ? 0xFFFFFFFF : ((1u << p->depth) - 1);
+    uint32_t free = ~p->busy & mask;
+    if (!free) {
+        irq_restore(flags);
+        return -EAGAIN;
+    }
+    uint32_t slot = __builtin_ctz(free);
+    
+    ahci_cmd_table_t* table = p->tables[slot];
+    ahci_memset(table->cfis, 0, sizeof(table->cfis));
+    
+    // Memory is identity mapped, so the buffer address is its bus address
+    uint32_t address = (uint32_t)buffer;
+    uint32_t prds = 0;
+    while (bytes > 0) {
+        if (prds == AHCI_PRDS_PER_SLOT) {
+            irq_restore(flags);
+            return -EINVAL;
+        }
+        uint32_t chunk = bytes > AHCI_PRD_MAX_BYTES ? AHCI_PRD_MAX_BYTES : bytes;
+        table->prdt[prds].dba = address;
+        table->prdt[prds].dbau = 0;
+        table->prdt[prds].reserved = 0;
+        table->prdt[prds].dbc = chunk - 1;
+        address += chunk;
+        bytes -= chunk;
+        prds++;
+    }
+    
+    bool queued = command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED;
+    uint8_t* fis = table->cfis;
+    fis[0] = AHCI_FIS_TYPE_H2D;
+    fis[1] = 0x80;                          // Command, not control
+    fis[2] = command;
+    fis[4] = lba & 0xFF;
+    fis[5] = (lba >> 8) & 0xFF;
+    fis[6] = (lba >> 16) & 0xFF;
+    fis[7] = command == ATA_CMD_IDENTIFY ? 0 : 0x40;  // LBA mode
+    fis[8] = (lba >> 24) & 0xFF;
+    fis[9] = (lba >> 32) & 0xFF;
+    fis[10] = (lba >> 40) & 0xFF;
+    if (queued) {
+        // FPDMA carries the count in FEATURES and the tag in COUNT
+        fis[3] = count & 0xFF;
+        fis[11] = (count >> 8) & 0xFF;
+        fis[12] = slot << 3;
+    } else {
+        fis[12] = count & 0xFF;
+        fis[13] = (count >> 8) & 0xFF;
+    }
+    
+    ahci_cmd_header_t* header = &p->cmd_list[slot];
+    header->flags = 5 | (write ? AHCI_CMD_WRITE : 0);  // 20-byte FIS
+    header->prdtl = prds;
+    header->prdbc = 0;
+    
+    p->slots[slot].callback = callback;
+    p->slots[slot].context = context;
+    p->busy |= 1u << slot;
+    p->commands++;
+    
+    uint32_t in_flight = 0;
+    for (uint32_t bits = p->busy; bits; bits &= bits - 1) {
+        in_flight++;
+    }
+    if (in_flight > p->max_in_flight) {
+        p->max_in_flight = in_flight;
+    }
+    
+    __asm__ volatile ("" : : : "memory");
+    if (queued) {
+        p->regs->sact = 1u << slot;
+    }
+    p->regs->ci = 1u << slot;
+    
+    irq_restore(flags);
+    return (int)slot;
+}
+
+// Wait for at least one slot to finish. flags is the caller's saved
+// EFLAGS: with interrupts on we halt until the HBA interrupt, otherwise
+// the port is polled. On timeout the port is reset.
+static bool ahci_wait(ahci_port_t* p, uint32_t flags) {
+    uint32_t before = p->busy;
+    
+    if (flags & 0x200) {
+        uint32_t deadline = timer_get_ticks() + AHCI_TIMEOUT_TICKS;
+        while ((int32_t)(timer_get_ticks() - deadline) < 0) {
+            wait_queue_sleep_timeout(&p->wait, 1);
+            // Reap here too, in case the interrupt line is not routed
+            ahci_service(p);
+            if (p->busy != before) {
+                return true;
+            }
+        }
+    } else {
+        for (uint32_t spin = 0; spin < AHCI_SPIN_LIMIT; spin++) {
+            ahci_service(p);
+            if (p->busy != before) {
+                return true;
+            }
+        }
+    }
+    
+    ahci_recover(p);
+    return false;
+}
+
+static void ahci_sync_done(void* context, bool ok) {
+    ahci_sync_t* sync = (ahci_sync_t*)context;
+    if (!ok) {
+        sync->failed = true;
+    }
+    sync->pending--;
+}
+
+// Issue the whole request at once, split across as many slots as the
+// queue allows, then wait for all of it
+static bool ahci_transfer(ahci_port_t* p, uint64_t lba, uint32_t count, void* buffer, bool write) {
+    ahci_sync_t sync = { 0, false };
+    uint8_t* buf = (uint8_t*)buffer;
+    uint8_t read_cmd = p->ncq ? ATA_CMD_READ_FPDMA_QUEUED : ATA_CMD_READ_DMA_EXT;
+    uint8_t write_cmd = p->ncq ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_WRITE_DMA_EXT;
+    
+    uint32_t flags = irq_save();
+    
+    while (count > 0 && !sync.failed) {
+        uint32_t n = count > AHCI_MAX_SECTORS ? AHCI_MAX_SECTORS : count;
+        int slot = ahci_issue(p, write ? write_cmd : read_cmd, lba, n, buf,
+                              n * DISK_SECTOR_SIZE, write, ahci_sync_done, &sync);
+        if (slot == -EAGAIN) {
+            if (!ahci_wait(p, flags)) {
+                break;
+            }
+            continue;
+        }
+        if (slot < 0) {
+            sync.failed = true;
+            break;
+        }
+        
+        sync.pending++;
+        lba += n;
+        buf += n * DISK_SECTOR_SIZE;
+        count -= n;
+    }
+    
+    // A timeout resets the port, which completes every slot as failed
+    while (sync.pending > 0) {
+        ahci_wait(p, flags);
+    }
+    
+    irq_restore(flags);
+    return !sync.failed && count == 0;
+}
+
+static bool ahci_port_setup(ahci_port_t* p, uint32_t port) {
+    ahci_port_regs_t* regs = &hba->ports[port];
+    
+    // Page 0: 1 KB command list then the 256-byte received FIS area;
+    // pages 1-2: sixteen 256-byte command tables each
+    uint8_t* base = (uint8_t*)pmm_alloc_page();
+    uint8_t* tables0 = (uint8_t*)pmm_alloc_page();
+    uint8_t* tables1 = (uint8_t*)pmm_alloc_page();
+    if (!base || !tables0 || !tables1) {
+        if (base) pmm_free_page(base);
+        if (tables0) pmm_free_page(tables0);
+        if (tables1) pmm_free_page(tables1);
+        return false;
+    }
+    ahci_memset(base, 0, PAGE_SIZE);
+    ahci_memset(tables0, 0, PAGE_SIZE);
+    ahci_memset(tables1, 0, PAGE_SIZE);
+    
+    ahci_stop_port(regs);
+    
+    p->regs = regs;
+    p->port = port;
+    p->cmd_list = (ahci_cmd_header_t*)base;
+    p->busy = 0;
+    p->depth = hba_slots;
+    p->ncq = false;
+    p->commands = 0;
+    p->errors = 0;
+    p->max_in_flight = 0;
+    wait_queue_init(&p->wait);
+    
+    uint32_t per_page = PAGE_SIZE / sizeof(ahci_cmd_table_t);
+    for (uint32_t slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+        uint8_t* page = slot < per_page ? tables0 : tables1;
+        p->tables[slot] = (ahci_cmd_table_t*)(page + (slot % per_page) * sizeof(ahci_cmd_table_t));
+        p->cmd_list[slot].ctba = (uint32_t)p->tables[slot];
+        p->cmd_list[slot].ctbau = 0;
+        p->slots[slot].callback = NULL;
+    }
+    
+    regs->clb = (uint32_t)base;
+    regs->clbu = 0;
+    regs->fb = (uint32_t)(base + 1024);
+    regs->fbu = 0;
+    regs->serr = 0xFFFFFFFF;
+    regs->is = 0xFFFFFFFF;
+    regs->ie = AHCI_PXIS_DHRS | AHCI_PXIS_PSS | AHCI_PXIS_DSS | AHCI_PXIS_SDBS | AHCI_PXIS_ERRORS;
+    
+    ahci_start_port(regs);
+    return true;
+}
+
+int ahci_init(void) {
+    pci_device_t dev;
+    if (!pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_SATA, &dev) || dev.prog_if != 0x01) {
+        return 0;
+    }
+    
+    uint32_t abar = dev.base_addresses[5] & 0xFFFFFFF0;
+    if (!abar || (dev.base_addresses[5] & 1)) {
+        return 0;
+    }
+    
+    pci_enable_bus_master(&dev);
+    hba = (ahci_hba_regs_t*)abar;
+    hba->ghc |= AHCI_GHC_AE;
+    
+    hba_slots = ((hba->cap >> AHCI_CAP_NCS_SHIFT) & AHCI_CAP_NCS_MASK) + 1;
+    hba_ncq = (hba->cap & AHCI_CAP_SNCQ) != 0;
+    
+    uint8_t irq = pci_read_config_byte(dev.bus, dev.device, dev.function, PCI_INTERRUPT_LINE);
+    if (irq < 16) {
+        register_interrupt_handler(32 + irq, ahci_irq);
+    }
+    
+    uint32_t implemented = hba->pi;
+    for (uint32_t port = 0; port < AHCI_MAX_PORTS && drive_count < AHCI_MAX_DRIVES; port++) {
+        if (!(implemented & (1u << port))) {
+            continue;
+        }
+        
+        // Device present with link up, and a plain ATA disk (not ATAPI)
+        ahci_port_regs_t* regs = &hba->ports[port];
+        if ((regs->ssts & 0x0F) != AHCI_SSTS_DET_PRESENT || regs->sig != AHCI_SIG_ATA) {
+            continue;
+        }
+        
+        if (ahci_port_setup(&drives[drive_count], port)) {
+            drive_count++;
+        }
+    }
+    
+    hba->ghc |= AHCI_GHC_IE;
+    
+    if (drive_count > 0) {
+        terminal_writestring(hba_ncq ? "AHCI: SATA controller with NCQ\n" : "AHCI: SATA controller\n");
+    }
+    return (int)drive_count;
+}
+
+bool ahci_identify(uint32_t drive, disk_info_t* disk) {
+    if (drive >= drive_count) {
+        return false;
+    }
+    
+    ahci_port_t* p = &drives[drive];
+    ahci_sync_t sync = { 1, false };
+    
+    uint32_t flags = irq_save();
+    if (ahci_issue(p, ATA_CMD_IDENTIFY, 0, 0, ahci_identify_buffer, sizeof(ahci_identify_buffer),
+                   false, ahci_sync_done, &sync) < 0) {
+        irq_restore(flags);
+        return false;
+    }
+    while (sync.pending > 0) {
+        ahci_wait(p, flags);
+    }
+    irq_restore(flags);
+    
+    if (sync.failed) {
+        return false;
+    }
+    
+    disk_parse_identify(disk, ahci_identify_buffer);
+    disk->type = DISK_TYPE_ATA_SATA;
+    disk->dma = true;
+    disk->port = p->port;
+    
+    // Word 76 bit 8: NCQ supported; word 75: queue depth - 1
+    if (hba_ncq && (ahci_identify_buffer[76] & (1 << 8))) {
+        uint32_t depth = (ahci_identify_buffer[75] & 0x1F) + 1;
+        p->ncq = true;
+        p->depth = depth < hba_slots ? depth : hba_slots;
+    }
+    return true;
+}
+
+// Queue a transfer of up to AHCI_MAX_SECTORS sectors. Returns the slot,
+// -EAGAIN if the queue is full, or -EINVAL for a bad request; callback
+// runs on completion from interrupt context.
+int ahci_submit(uint32_t drive, uint64_t lba, uint32_t count, void* buffer, bool write,
+                ahci_callback_t callback, void* context) {
+    if (drive >= drive_count || count == 0 || count > AHCI_MAX_SECTORS) {
+        return -EINVAL;
+    }
+    
+    ahci_port_t* p = &drives[drive];
+    uint8_t command;
+    if (p->ncq) {
+        command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+    } else {
+        command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    }
+    return ahci_issue(p, command, lba, count, buffer, count * DISK_SECTOR_SIZE, write, callback, context);
+}
+
+// Reap completions without waiting for the interrupt
+void ahci_poll(uint32_t drive) {
+    if (drive >= drive_count) {
+        return;
+    }
+    uint32_t flags = irq_save();
+    ahci_service(&drives[drive]);
+    irq_restore(flags);
+}
+
+uint32_t ahci_queue_depth(uint32_t drive) {
+    return drive < drive_count ? drives[drive].depth : 0;
+}
+
+bool ahci_read_sectors(uint32_t drive, uint64_t lba, uint32_t count, void* buffer) {
+    if (drive >= drive_count) {
+        return false;
+    }
+    
+    if (!((uint32_t)buffer & 1)) {
+        return ahci_transfer(&drives[drive], lba, count, buffer, false);
+    }
+    
+    uint8_t* buf = (uint8_t*)buffer;
+    while (count > 0) {
+        uint32_t n = count > AHCI_BOUNCE_SECTORS ? AHCI_BOUNCE_SECTORS : count;
+        if (!ahci_transfer(&drives[drive], lba, n, ahci_bounce, false)) {
+            return false;
+        }
+        ahci_memcpy(buf, ahci_bounce, n * DISK_SECTOR_SIZE);
+        lba += n;
+        buf += n * DISK_SECTOR_SIZE;
+        count -= n;
+    }
+    return true;
+}
+
+bool ahci_write_sectors(uint32_t drive, uint64_t lba, uint32_t count, const void* buffer) {
+    if (drive >= drive_count) {
+        return false;
+    }
+    
+    if (!((uint32_t)buffer & 1)) {
+        return ahci_transfer(&drives[drive], lba, count, (void*)buffer, true);
+    }
+    
+    const uint8_t* buf = (const uint8_t*)buffer;
+    while (count > 0) {
+        uint32_t n = count > AHCI_BOUNCE_SECTORS ? AHCI_BOUNCE_SECTORS : count;
+        ahci_memcpy(ahci_bounce, buf, n * DISK_SECTOR_SIZE);
+        if (!ahci_transfer(&drives[drive], lba, n, ahci_bounce, true)) {
+            return false;
+        }
+        lba += n;
+        buf += n * DISK_SECTOR_SIZE;
+        count -= n;
+    }
+    return true;
+}
\ No newline at end of file
@@ -1,19 +1,91 @@
 #include "../include/arp.h"
+#include "../include/ip.h"
+#include "../include/interrupts.h"
 
 extern void terminal_writestring(const char* data);
 
 static arp_entry_t arp_table[ARP_TABLE_SIZE];
+static arp_entry_t* arp_hash[ARP_HASH_SIZE];
+
+static inline uint32_t arp_hash_ip(ip_addr_t* ip) {
+    return (ip->addr[3] ^ ip->addr[2] ^ (ip->addr[1] << 1)) & (ARP_HASH_SIZE - 1);
+}
 
 void arp_init(void) {
     // Initialize ARP table
     for (int i = 0; i < ARP_TABLE_SIZE; i++) {
-        arp_table[i].valid = 0;
+        arp_table[i].state = ARP_STATE_FREE;
         arp_table[i].timestamp = 0;
+        arp_table[i].pending_count = 0;
+        arp_table[i].hash_next = NULL;
     }
+    for (int i = 0; i < ARP_HASH_SIZE; i++) {
+        arp_hash[i] = NULL;
+    }
+    
+    timer_register_callback(arp_timer_tick, ARP_TIMER_INTERVAL);
     
     terminal_writestring("ARP protocol initialized\n");
 }
 
+// Drop an entry and any packets still waiting on it. Interrupts must be
+// disabled.
+static void arp_free_entry(arp_entry_t* entry) {
+    for (uint32_t i = 0; i < entry->pending_count; i++) {
+        net_free_buffer(entry->pending[i]);
+    }
+    entry->pending_count = 0;
+    
+    arp_entry_t** link = &arp_hash[arp_hash_ip(&entry->ip)];
+    while (*link) {
+        if (*link == entry) {
+            *link = entry->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    entry->hash_next = NULL;
+    entry->state = ARP_STATE_FREE;
+}
+
+// Take a free slot, evicting the least recently confirmed resolved entry
+// if the table is full. Interrupts must be disabled.
+static arp_entry_t* arp_alloc_entry(ip_addr_t ip) {
+    arp_entry_t* victim = NULL;
+    
+    for (int i = 0; i < ARP_TABLE_SIZE; i++) {
+        if (arp_table[i].state == ARP_STATE_FREE) {
+            victim = &arp_table[i];
+            break;
+        }
+        if (arp_table[i].state != ARP_STATE_INCOMPLETE &&
+            (!victim || (int32_t)(arp_table[i].timestamp - victim->timestamp) < 0)) {
+            victim = &arp_table[i];
+        }
+    }
+    
+    if (!victim) return NULL;   // Everything is mid-resolution
+    if (victim->state != ARP_STATE_FREE) {
+        arp_free_entry(victim);
+    }
+    
+    ip_copy(&victim->ip, &ip);
+    victim->retries = 0;
+    victim->pending_count = 0;
+    uint32_t bucket = arp_hash_ip(&ip);
+    victim->hash_next = arp_hash[bucket];
+    arp_hash[bucket] = victim;
+    return victim;
+}
+
+// Fill in the destination MAC of a queued Ethernet frame and send it
+static void arp_transmit(net_buffer_t* buffer, mac_addr_t* mac) {
+    eth_header_t* eth = (eth_header_t*)buffer->data;
+    mac_copy(&eth->dest, mac);
+    net_send_packet(buffer);
+    net_free_buffer(buffer);
+}
+
 void arp_handle_packet(net_buffer_t* buffer, size_t offset) {
     if (buffer->length < offset + sizeof(arp_header_t)) {
         return; // Packet too small
@@ -34,13 +106,16 @@ void arp_handle_packet(net_buffer_t* buffer, size_t offset) {
         return;
     }
     
-    // Check if the packet is for us
-    if (!ip_compare(&arp_hdr->target_ip, &iface->ip)) {
-        return; // Not for us
+    // RFC 826: refresh a sender we already know about, but only learn new
+    // neighbours from packets addressed to us
+    int for_us = ip_compare(&arp_hdr->target_ip, &iface->ip);
+    if (for_us || arp_lookup(arp_hdr->sender_ip)) {
+        arp_add_entry(arp_hdr->sender_ip, arp_hdr->sender_mac);
     }
     
-    // Add sender to ARP table
-    arp_add_entry(arp_hdr->sender_ip, arp_hdr->sender_mac);
+    if (!for_us) {
+        return; // Not for us
+    }
     
     uint16_t operation = ntohs(arp_hdr->operation);
     
@@ -52,17 +127,81 @@ void arp_handle_packet(net_buffer_t* buffer, size_t offset) {
 }
 
 int arp_resolve(ip_addr_t ip, mac_addr_t* mac) {
+    uint32_t irq_flags = irq_save();
+    
     // Check ARP table first
     arp_entry_t* entry = arp_lookup(ip);
-    if (entry && entry->valid) {
+    if (entry && entry->state != ARP_STATE_INCOMPLETE) {
         mac_copy(mac, &entry->mac);
+        irq_restore(irq_flags);
         return 1;
     }
     
-    // Send ARP request
-    arp_send_request(ip);
+    // Start resolving; the caller may retry once the reply is in
+    if (!entry && (entry = arp_alloc_entry(ip)) != NULL) {
+        entry->state = ARP_STATE_INCOMPLETE;
+        entry->probe_deadline = timer_get_ticks() + ARP_RETRY_INTERVAL;
+        arp_send_request(ip);
+    }
     
-    // For now, return failure (in real implementation, would wait for reply)
+    irq_restore(irq_flags);
+    return 0;
+}
+
+// Send a fully built Ethernet frame to next_hop, whose MAC is filled in
+// here. Takes ownership of buffer. If the neighbour is still unresolved
+// the frame is held until the ARP reply arrives instead of being dropped.
+int arp_output(net_buffer_t* buffer, ip_addr_t next_hop) {
+    // Limited broadcast needs no resolution
+    if (next_hop.addr[0] == 255 && next_hop.addr[1] == 255 &&
+        next_hop.addr[2] == 255 && next_hop.addr[3] == 255) {
+        mac_addr_t broadcast = {{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}};
+        arp_transmit(buffer, &broadcast);
+        return 0;
+    }
+    
+    uint32_t irq_flags = irq_save();
+    uint32_t now = timer_get_ticks();
+    
+    arp_entry_t* entry = arp_lookup(next_hop);
+    if (entry && entry->state != ARP_STATE_INCOMPLETE) {
+        mac_addr_t mac = entry->mac;
+        
+        // Stale entries are still used, but re-verified in the background
+        if (entry->state == ARP_STATE_STALE &&
+            (int32_t)(now - entry->probe_deadline) >= 0) {
+            entry->probe_deadline = now + ARP_RETRY_INTERVAL;
+            arp_send_request(next_hop);
+        }
+        
+        irq_restore(irq_flags);
+        arp_transmit(buffer, &mac);
+        return 0;
+    }
+    
+    if (!entry) {
+        entry = arp_alloc_entry(next_hop);
+        if (!entry) {
+            irq_restore(irq_flags);
+            net_free_buffer(buffer);
+            return -1;
+        }
+        entry->state = ARP_STATE_INCOMPLETE;
+        entry->probe_deadline = now + ARP_RETRY_INTERVAL;
+        arp_send_request(next_hop);
+    }
+    
+    // Queue full: the oldest packet gives way to the newest
+    if (entry->pending_count == ARP_MAX_PENDING) {
+        net_free_buffer(entry->pending[0]);
+        for (uint32_t i = 1; i < ARP_MAX_PENDING; i++) {
+            entry->pending[i - 1] = entry->pending[i];
+        }
+        entry->pending_count--;
+    }
+    entry->pending[entry->pending_count++] = buffer;
+    
+    irq_restore(irq_flags);
     return 0;
 }
 
@@ -142,41 +281,83 @@ void arp_send_reply(ip_addr_t target_ip, mac_addr_t target_mac) {
 }
 
 void arp_add_entry(ip_addr_t ip, mac_addr_t mac) {
-    // Find existing entry or empty slot
-    int slot = -1;
-    for (int i = 0; i < ARP_TABLE_SIZE; i++) {
-        if (arp_table[i].valid && ip_compare(&arp_table[i].ip, &ip)) {
-            slot = i;
-            break;
-        } else if (!arp_table[i].valid && slot == -1) {
-            slot = i;
-        }
-    }
+    uint32_t irq_flags = irq_save();
     
-    if (slot == -1) {
-        // Table full, find oldest entry
-        uint32_t oldest_time = arp_table[0].timestamp;
-        slot = 0;
-        for (int i = 1; i < ARP_TABLE_SIZE; i++) {
-            if (arp_table[i].timestamp < oldest_time) {
-                oldest_time = arp_table[i].timestamp;
-                slot = i;
-            }
+    // Find existing entry or take a new slot
+    arp_entry_t* entry = arp_lookup(ip);
+    if (!entry) {
+        entry = arp_alloc_entry(ip);
+        if (!entry) {
+            irq_restore(irq_flags);
+            return;
         }
     }
     
     // Add/update entry
-    ip_copy(&arp_table[slot].ip, &ip);
-    mac_copy(&arp_table[slot].mac, &mac);
-    arp_table[slot].timestamp = 0; // TODO: Get current time
-    arp_table[slot].valid = 1;
+    mac_copy(&entry->mac, &mac);
+    entry->state = ARP_STATE_REACHABLE;
+    entry->timestamp = timer_get_ticks();
+    entry->retries = 0;
+    
+    // Release packets that were waiting for this neighbour
+    for (uint32_t i = 0; i < entry->pending_count; i++) {
+        arp_transmit(entry->pending[i], &entry->mac);
+    }
+    entry->pending_count = 0;
+    
+    irq_restore(irq_flags);
+    
+    // Large datagrams held whole by IP can be fragmented now
+    ip_neighbour_update(ip, 1);
 }
 
 arp_entry_t* arp_lookup(ip_addr_t ip) {
-    for (int i = 0; i < ARP_TABLE_SIZE; i++) {
-        if (arp_table[i].valid && ip_compare(&arp_table[i].ip, &ip)) {
-            return &arp_table[i];
+    for (arp_entry_t* entry = arp_hash[arp_hash_ip(&ip)]; entry; entry = entry->hash_next) {
+        if (ip_compare(&entry->ip, &ip)) {
+            return entry;
         }
     }
     return NULL;
+}
+
+// Retry unanswered requests, age confirmed entries to STALE and forget
+// neighbours not heard from in ARP_TIMEOUT
+void arp_timer_tick(void) {
+    uint32_t now = timer_get_ticks();
+    
+    for (int i = 0; i < ARP_TABLE_SIZE; i++) {
+        arp_entry_t* entry = &arp_table[i];
+        
+        switch (entry->state) {
+            case ARP_STATE_INCOMPLETE:
+                if ((int32_t)(now - entry->probe_deadline) < 0) break;
+                if (entry->retries >= ARP_MAX_RETRIES) {
+                    // Unreachable: drop the queued packets
+                    ip_addr_t ip = entry->ip;
+                    arp_free_entry(entry);
+                    ip_neighbour_update(ip, 0);
+                    break;
+                }
+                entry->retries++;
+                entry->probe_deadline = now + ARP_RETRY_INTERVAL;
+                arp_send_request(entry->ip);
+                break;
+            
+            case ARP_STATE_REACHABLE:
+                if (now - entry->timestamp >= ARP_REACHABLE_TIME) {
+                    entry->state = ARP_STATE_STALE;
+                    entry->probe_deadline = now;
+                }
+                break;
+            
+            case ARP_STATE_STALE:
+                if (now - entry->timestamp >= ARP_EXPIRE_TIME) {
+                    arp_free_entry(entry);
+                }
+                break;
+            
+            default:
+                break;
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,510 @@
+#include "../include/bcache.h"
+#include "../include/blk.h"
+#include "../include/memory.h"
+
+extern void terminal_writestring(const char* data);
+
+static bcache_buf_t buffers[BCACHE_BUFFERS];
+static bcache_buf_t* hash_table[BCACHE_HASH_SIZE];
+
+// LRU lists, most recently used at the head
+static bcache_buf_t* lru_head[2];
+static bcache_buf_t* lru_tail[2];
+
+static bcache_stats_t stats;
+static bool bcache_ready = false;
+
+static void bcache_memcpy(void* dest, const void* src, size_t size) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    for (size_t i = 0; i < size; i++) {
+        d[i] = s[i];
+    }
+}
+
+static void bcache_itoa(uint32_t value, char* str) {
+    char temp[12];
+    int pos = 0;
+    
+    do {
+        temp[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    
+    int i = 0;
+    while (pos > 0) {
+        str[i++] = temp[--pos];
+    }
+    str[i] = '\0';
+}
+
+static uint32_t bcache_hash(uint32_t disk_id, uint64_t lba) {
+    uint32_t key = (uint32_t)lba ^ (uint32_t)(lba >> 32) ^ (disk_id << 28);
+    return (key * 2654435761u) >> 24;
+}
+
+static int bcache_list(bcache_buf_t* buf) {
+    return (buf->flags & BCACHE_META) ? 1 : 0;
+}
+
+static void bcache_lru_unlink(bcache_buf_t* buf) {
+    int list = bcache_list(buf);
+    if (buf->lru_prev) buf->lru_prev->lru_next = buf->lru_next;
+    else lru_head[list] = buf->lru_next;
+    if (buf->lru_next) buf->lru_next->lru_prev = buf->lru_prev;
+    else lru_tail[list] = buf->lru_prev;
+    buf->lru_prev = NULL;
+    buf->lru_next = NULL;
+}
+
+static void bcache_lru_push(bcache_buf_t* buf) {
+    int list = bcache_list(buf);
+    buf->lru_prev = NULL;
+    buf->lru_next = lru_head[list];
+    if (lru_head[list]) lru_head[list]->lru_prev = buf;
+    else lru_tail[list] = buf;
+    lru_head[list] = buf;
+}
+
+static void bcache_hash_remove(bcache_buf_t* buf) {
+    bcache_buf_t** link = &hash_table[bcache_hash(buf->disk_id, buf->lba)];
+    while (*link && *link != buf) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = buf->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+
+static bcache_buf_t* bcache_lookup(uint32_t disk_id, uint64_t lba) {
+    for (bcache_buf_t* buf = hash_table[bcache_hash(disk_id, lba)]; buf; buf = buf->hash_next) {
+        if (buf->disk_id == disk_id && buf->lba == lba && (buf->flags & BCACHE_VALID)) {
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+// Move to the front of its list, switching lists if it became metadata
+static void bcache_touch(bcache_buf_t* buf, uint32_t flags) {
+    bcache_lru_unlink(buf);
+    if (flags & BCACHE_META) {
+        buf->flags |= BCACHE_META;
+    }
+    bcache_lru_push(buf);
+}
+
+static void bcache_set_dirty(bcache_buf_t* buf) {
+    if (!(buf->flags & BCACHE_DIRTY)) {
+        buf->flags |= BCACHE_DIRTY;
+        buf->dirty_since = timer_get_ticks();
+        stats.dirty++;
+    }
+}
+
+static void bcache_clear_dirty(bcache_buf_t* buf) {
+    if (buf->flags & BCACHE_DIRTY) {
+        buf->flags &= ~BCACHE_DIRTY;
+        stats.dirty--;
+    }
+}
+
+static bcache_buf_t* bcache_find_victim(bool allow_dirty) {
+    for (int list = 0; list < 2; list++) {
+        for (bcache_buf_t* buf = lru_tail[list]; buf; buf = buf->lru_prev) {
+            if (buf->refs == 0 && (allow_dirty || !(buf->flags & BCACHE_DIRTY))) {
+                return buf;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Take a buffer for (disk, lba): the least recently used clean one, data
+// before metadata. A dirty victim is written out first. Returns NULL if
+// every buffer is pinned.
+static bcache_buf_t* bcache_alloc(uint32_t disk_id, uint64_t lba, uint32_t flags) {
+    bcache_buf_t* buf = bcache_find_victim(false);
+    if (!buf) {
+        buf = bcache_find_victim(true);
+        if (!buf) {
+            return NULL;
+        }
+        if (!blk_write(buf->disk_id, buf->lba, 1, buf->data)) {
+            stats.write_errors++;
+            return NULL;
+        }
+        stats.writebacks++;
+        bcache_clear_dirty(buf);
+    }
+    
+    if (buf->flags & BCACHE_VALID) {
+        bcache_hash_remove(buf);
+        stats.evictions++;
+    }
+    
+    bcache_lru_unlink(buf);
+    buf->disk_id = disk_id;
+    buf->lba = lba;
+    buf->flags = flags & BCACHE_META;
+    buf->refs = 0;
+    bcache_lru_push(buf);
+    
+    uint32_t bucket = bcache_hash(disk_id, lba);
+    buf->hash_next = hash_table[bucket];
+    hash_table[bucket] = buf;
+    return buf;
+}
+
+// May run from the disk interrupt: only note the outcome, bcache_sync
+// settles it after the flush
+static void bcache_write_done(void* context, bool ok) {
+    bcache_buf_t* buf = (bcache_buf_t*)context;
+    if (!ok) {
+        buf->write_failed = true;
+    }
+}
+
+static void bcache_writeback(void);
+
+void bcache_init(void) {
+    for (int i = 0; i < BCACHE_HASH_SIZE; i++) {
+        hash_table[i] = NULL;
+    }
+    lru_head[0] = lru_head[1] = NULL;
+    lru_tail[0] = lru_tail[1] = NULL;
+    
+    uint32_t per_page = PAGE_SIZE / DISK_SECTOR_SIZE;
+    uint8_t* page = NULL;
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        if (i % per_page == 0) {
+            page = (uint8_t*)pmm_alloc_page();
+            if (!page) {
+                break;
+            }
+        }
+        
+        bcache_buf_t* buf = &buffers[i];
+        buf->data = page + (i % per_page) * DISK_SECTOR_SIZE;
+        buf->flags = 0;
+        buf->refs = 0;
+        buf->write_failed = false;
+        buf->hash_next = NULL;
+        bcache_lru_push(buf);
+    }
+    
+    bcache_ready = true;
+    work_register(bcache_writeback, BCACHE_FLUSH_CHECK_TICKS);
+}
+
+// Each public entry point holds off deferred work, where the periodic
+// write-back runs, around a _locked version that expects it held off
+static bcache_buf_t* bcache_get_locked(uint32_t disk_id, uint64_t lba, uint32_t flags) {
+    if (!bcache_ready) {
+        return NULL;
+    }
+    
+    bcache_buf_t* buf = bcache_lookup(disk_id, lba);
+    if (buf) {
+        stats.hits++;
+    } else {
+        stats.misses++;
+        buf = bcache_alloc(disk_id, lba, flags);
+        if (!buf) {
+            return NULL;
+        }
+        if (!blk_read(disk_id, lba, 1, buf->data)) {
+            bcache_hash_remove(buf);
+            buf->flags = 0;
+            return NULL;
+        }
+        buf->flags |= BCACHE_VALID;
+    }
+    
+    bcache_touch(buf, flags);
+    buf->refs++;
+    return buf;
+}
+
+// Return a pinned, valid buffer for the sector, reading it on a miss
+bcache_buf_t* bcache_get(uint32_t disk_id, uint64_t lba, uint32_t flags) {
+    work_disable();
+    bcache_buf_t* buf = bcache_get_locked(disk_id, lba, flags);
+    work_enable();
+    return buf;
+}
+
+void bcache_mark_dirty(bcache_buf_t* buf) {
+    work_disable();
+    bcache_set_dirty(buf);
+    work_enable();
+}
+
+void bcache_release(bcache_buf_t* buf) {
+    work_disable();
+    if (buf && buf->refs > 0) {
+        buf->refs--;
+    }
+    if (stats.dirty > BCACHE_DIRTY_LIMIT) {
+        bcache_sync_all();
+    }
+    work_enable();
+}
+
+static bool bcache_read_locked(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer, uint32_t flags) {
+    uint8_t* out = (uint8_t*)buffer;
+    
+    if (!bcache_ready) {
+        return blk_read(disk_id, lba, count, buffer);
+    }
+    
+    uint32_t i = 0;
+    while (i < count) {
+        bcache_buf_t* buf = bcache_lookup(disk_id, lba + i);
+        if (buf) {
+            stats.hits++;
+            bcache_touch(buf, flags);
+            bcache_memcpy(out + i * DISK_SECTOR_SIZE, buf->data, DISK_SECTOR_SIZE);
+            i++;
+            continue;
+        }
+        
+        uint32_t run = 1;
+        while (i + run < count && run < BCACHE_READ_BATCH && !bcache_lookup(disk_id, lba + i + run)) {
+            run++;
+        }
+        if (!blk_read(disk_id, lba + i, run, out + i * DISK_SECTOR_SIZE)) {
+            return false;
+        }
+        stats.misses += run;
+        
+        for (uint32_t j = 0; j < run; j++) {
+            buf = bcache_alloc(disk_id, lba + i + j, flags);
+            if (!buf) {
+                break;
+            }
+            bcache_memcpy(buf->data, out + (i + j) * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE);
+            buf->flags |= BCACHE_VALID;
+        }
+        i += run;
+    }
+    return true;
+}
+
+// Copy sectors out of the cache. Consecutive misses are fetched with one
+// request straight into the caller's buffer and then cached.
+bool bcache_read(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer, uint32_t flags) {
+    work_disable();
+    bool ok = bcache_read_locked(disk_id, lba, count, buffer, flags);
+    work_enable();
+    return ok;
+}
+
+static bool bcache_write_locked(uint32_t disk_id, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
+    const uint8_t* in = (const uint8_t*)buffer;
+    
+    if (!bcache_ready) {
+        return blk_write(disk_id, lba, count, buffer);
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        bcache_buf_t* buf = bcache_lookup(disk_id, lba + i);
+        if (!buf) {
+            buf = bcache_alloc(disk_id, lba + i, flags);
+            if (!buf) {
+                if (!blk_write(disk_id, lba + i, 1, in + i * DISK_SECTOR_SIZE)) {
+                    return false;
+                }
+                continue;
+            }
+            buf->flags |= BCACHE_VALID;
+        }
+        
+        bcache_touch(buf, flags);
+        bcache_memcpy(buf->data, in + i * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE);
+        bcache_set_dirty(buf);
+    }
+    
+    if (stats.dirty > BCACHE_DIRTY_LIMIT) {
+        return bcache_sync_all();
+    }
+    return true;
+}
+
+// Write-back: the data lands in the cache and is marked dirty. Sectors
+// that cannot get a buffer are written through.
+bool bcache_write(uint32_t disk_id, uint64_t lba, uint32_t count, const void* buffer, uint32_t flags) {
+    work_disable();
+    bool ok = bcache_write_locked(disk_id, lba, count, buffer, flags);
+    work_enable();
+    return ok;
+}
+
+static bool bcache_sync_locked(uint32_t disk_id) {
+    static bcache_buf_t* dirty[BCACHE_BUFFERS];
+    uint32_t n = 0;
+    
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        bcache_buf_t* buf = &buffers[i];
+        if ((buf->flags & BCACHE_DIRTY) && buf->disk_id == disk_id) {
+            // Insertion sort by LBA
+            uint32_t j = n++;
+            while (j > 0 && dirty[j - 1]->lba > buf->lba) {
+                dirty[j] = dirty[j - 1];
+                j--;
+            }
+            dirty[j] = buf;
+        }
+    }
+    
+    if (n == 0) {
+        return true;
+    }
+    
+    for (uint32_t i = 0; i < n; i++) {
+        bcache_buf_t* buf = dirty[i];
+        bcache_clear_dirty(buf);
+        buf->refs++;            // Pinned while the write is queued
+        if (blk_submit(disk_id, buf->lba, 1, buf->data, true, bcache_write_done, buf) < 0) {
+            stats.write_errors++;
+            bcache_set_dirty(buf);
+            buf->refs--;
+            dirty[i] = NULL;
+        }
+    }
+    
+    bool ok = blk_flush(disk_id);
+    
+    for (uint32_t i = 0; i < n; i++) {
+        bcache_buf_t* buf = dirty[i];
+        if (!buf) {
+            continue;
+        }
+        if (buf->write_failed) {
+            // Keep the data; the next sync retries it
+            buf->write_failed = false;
+            stats.write_errors++;
+            bcache_set_dirty(buf);
+        } else {
+            stats.writebacks++;
+        }
+        buf->refs--;
+    }
+    return ok;
+}
+
+// Queue every dirty buffer of the disk in LBA order, so the block layer
+// merges neighbours into large writes, then wait for them
+bool bcache_sync(uint32_t disk_id) {
+    work_disable();
+    bool ok = bcache_sync_locked(disk_id);
+    work_enable();
+    return ok;
+}
+
+bool bcache_sync_all(void) {
+    bool ok = true;
+    for (uint32_t disk_id = 0; disk_id < MAX_DISKS; disk_id++) {
+        if (disk_get_info(disk_id) && !bcache_sync(disk_id)) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Write back and forget every buffer of a disk, e.g. after it has been
+// rewritten underneath the cache
+void bcache_invalidate(uint32_t disk_id) {
+    work_disable();
+    bcache_sync_locked(disk_id);
+    
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        bcache_buf_t* buf = &buffers[i];
+        if ((buf->flags & BCACHE_VALID) && buf->disk_id == disk_id && buf->refs == 0) {
+            bcache_hash_remove(buf);
+            bcache_clear_dirty(buf);
+            bcache_lru_unlink(buf);
+            buf->flags = 0;
+            bcache_lru_push(buf);
+        }
+    }
+    work_enable();
+}
+
+// Periodic write-back, deferred work every BCACHE_FLUSH_CHECK_TICKS: sync
+// every disk whose oldest dirty buffer has aged past the threshold
+static void bcache_writeback(void) {
+    if (stats.dirty == 0) {
+        return;
+    }
+    
+    uint32_t now = timer_get_ticks();
+    bool due[MAX_DISKS] = { false };
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        bcache_buf_t* buf = &buffers[i];
+        if ((buf->flags & BCACHE_DIRTY) && now - buf->dirty_since >= BCACHE_WRITEBACK_TICKS) {
+            due[buf->disk_id] = true;
+        }
+    }
+    
+    for (uint32_t disk_id = 0; disk_id < MAX_DISKS; disk_id++) {
+        if (due[disk_id]) {
+            bcache_sync_locked(disk_id);
+        }
+    }
+}
+
+bcache_stats_t* bcache_get_stats(void) {
+    return &stats;
+}
+
+void bcache_dump(void) {
+    char num[12];
+    uint32_t lookups = stats.hits + stats.misses;
+    uint32_t cached = 0;
+    uint32_t meta = 0;
+    
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        if (buffers[i].flags & BCACHE_VALID) {
+            cached++;
+            if (buffers[i].flags & BCACHE_META) meta++;
+        }
+    }
+    
+    terminal_writestring("Buffer cache: ");
+    bcache_itoa(cached, num);
+    terminal_writestring(num);
+    terminal_writestring("/");
+    bcache_itoa(BCACHE_BUFFERS, num);
+    terminal_writestring(num);
+    terminal_writestring(" sectors cached (");
+    bcache_itoa(meta, num);
+    terminal_writestring(num);
+    terminal_writestring(" metadata), ");
+    bcache_itoa(stats.dirty, num);
+    terminal_writestring(num);
+    terminal_writestring(" dirty\n  hits ");
+    bcache_itoa(stats.hits, num);
+    terminal_writestring(num);
+    terminal_writestring(", misses ");
+    bcache_itoa(stats.misses, num);
+    terminal_writestring(num);
+    terminal_writestring(", hit rate ");
+    uint32_t rate = 0;
+    if (lookups > 0) {
+        rate = lookups > 0x1000000 ? stats.hits / (lookups / 100) : stats.hits * 100 / lookups;
+    }
+    bcache_itoa(rate, num);
+    terminal_writestring(num);
+    terminal_writestring("%\n  evictions ");
+    bcache_itoa(stats.evictions, num);
+    terminal_writestring(num);
+    terminal_writestring(", written back ");
+    bcache_itoa(stats.writebacks, num);
+    terminal_writestring(num);
+    terminal_writestring(", write errors ");
+    bcache_itoa(stats.write_errors, num);
+    terminal_writestring(num);
+    terminal_writestring("\n");
+}
\ No newline at end of file
@@ -0,0 +1,523 @@
+#include "../include/blk.h"
+#include "../include/ahci.h"
+#include "../include/slab.h"
+#include "../include/memory.h"
+#include "../include/errno.h"
+
+extern void terminal_writestring(const char* data);
+
+static blk_queue_t queues[MAX_DISKS];
+static slab_cache_t blk_request_cache;
+static uint32_t blk_seq = 0;
+
+typedef struct {
+    volatile bool done;
+    volatile bool ok;
+} blk_sync_t;
+
+static void blk_memcpy(void* dest, const void* src, size_t size) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    for (size_t i = 0; i < size; i++) {
+        d[i] = s[i];
+    }
+}
+
+static void blk_itoa(uint32_t value, char* str) {
+    char temp[12];
+    int pos = 0;
+    
+    do {
+        temp[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    
+    int i = 0;
+    while (pos > 0) {
+        str[i++] = temp[--pos];
+    }
+    str[i] = '\0';
+}
+
+static bool blk_overlaps(uint64_t a, uint32_t a_count, uint64_t b, uint32_t b_count) {
+    return a < b + b_count && b < a + a_count;
+}
+
+static void blk_active_add(blk_queue_t* q, blk_request_t* run) {
+    run->next = q->active;
+    q->active = run;
+}
+
+static void blk_active_remove(blk_queue_t* q, blk_request_t* run) {
+    blk_request_t** link = &q->active;
+    while (*link && *link != run) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = run->next;
+    }
+}
+
+// A request must wait for earlier ones on the same sectors when either
+// side writes; reads may pass each other freely
+static bool blk_conflicts(blk_queue_t* q, uint64_t lba, uint32_t count, bool write) {
+    for (blk_request_t* run = q->pending; run; run = run->next) {
+        if ((write || run->write) && blk_overlaps(lba, count, run->lba, run->total)) {
+            return true;
+        }
+    }
+    for (blk_request_t* run = q->active; run; run = run->next) {
+        if ((write || run->write) && blk_overlaps(lba, count, run->lba, run->total)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void blk_insert_run(blk_queue_t* q, blk_request_t* run) {
+    blk_request_t** link = &q->pending;
+    while (*link && (*link)->lba <= run->lba) {
+        link = &(*link)->next;
+    }
+    run->next = *link;
+    *link = run;
+    
+    if (q->pending_runs++ == 0) {
+        q->oldest = timer_get_ticks();
+    }
+}
+
+// Fold the request into a pending run it extends, front or back
+static bool blk_try_merge(blk_queue_t* q, blk_request_t* req) {
+    blk_request_t** link = &q->pending;
+    for (blk_request_t* run = q->pending; run; link = &run->next, run = run->next) {
+        if (run->write != req->write || run->total + req->count > BLK_MAX_MERGE_SECTORS) {
+            continue;
+        }
+        
+        if (run->lba + run->total == req->lba) {
+            run->tail->merged = req;
+            run->tail = req;
+            run->total += req->count;
+            if ((int32_t)(req->deadline - run->deadline) < 0) {
+                run->deadline = req->deadline;
+            }
+            return true;
+        }
+        
+        if (req->lba + req->count == run->lba) {
+            req->merged = run;
+            req->tail = run->tail;
+            req->total = req->count + run->total;
+            if ((int32_t)(run->deadline - req->deadline) < 0) {
+                req->deadline = run->deadline;
+            }
+            req->next = run->next;
+            *link = req;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Complete every request of a run; called with interrupts disabled
+static void blk_run_done(void* context, bool ok) {
+    blk_request_t* run = (blk_request_t*)context;
+    blk_queue_t* q = &queues[run->disk_id];
+    uint8_t* bounce = run->bounce;
+    void* bounce_block = run->bounce_block;
+    uint32_t offset = 0;
+    
+    blk_active_remove(q, run);
+    if (!ok) {
+        q->stats.errors++;
+        q->flush_errors++;
+    }
+    
+    blk_request_t* req = run;
+    while (req) {
+        blk_request_t* next = req->merged;
+        uint32_t bytes = req->count * DISK_SECTOR_SIZE;
+        if (ok && bounce && !req->write) {
+            blk_memcpy(req->buffer, bounce + offset, bytes);
+        }
+        offset += bytes;
+        
+        if (req->callback) {
+            req->callback(req->context, ok);
+        }
+        slab_free(&blk_request_cache, req);
+        req = next;
+    }
+    
+    if (bounce_block) {
+        kfree(bounce_block);
+    }
+    
+    q->in_flight--;
+    wake_up(&q->wait);
+}
+
+// Pick the next run: the most overdue one if any deadline has passed,
+// otherwise the first at or beyond the head, wrapping to the lowest LBA
+static blk_request_t* blk_pick(blk_queue_t* q) {
+    uint32_t now = timer_get_ticks();
+    blk_request_t** chosen = NULL;
+    
+    for (blk_request_t** link = &q->pending; *link; link = &(*link)->next) {
+        if ((int32_t)(now - (*link)->deadline) >= 0 &&
+            (!chosen || (int32_t)((*link)->deadline - (*chosen)->deadline) < 0)) {
+            chosen = link;
+        }
+    }
+    if (chosen) {
+        q->stats.expired++;
+    } else {
+        for (blk_request_t** link = &q->pending; *link; link = &(*link)->next) {
+            if ((*link)->lba >= q->position) {
+                chosen = link;
+                break;
+            }
+        }
+        if (!chosen) {
+            chosen = &q->pending;
+        }
+    }
+    
+    blk_request_t* run = *chosen;
+    *chosen = run->next;
+    q->pending_runs--;
+    return run;
+}
+
+// Staging buffer for a run. The heap only guarantees byte alignment and
+// AHCI PRDs must be word aligned, so the block has a byte to spare.
+static bool blk_alloc_bounce(blk_request_t* run) {
+    run->bounce_block = kmalloc(run->total * DISK_SECTOR_SIZE + 1);
+    if (!run->bounce_block) {
+        run->bounce = NULL;
+        return false;
+    }
+    run->bounce = (uint8_t*)run->bounce_block + ((uint32_t)run->bounce_block & 1);
+    return true;
+}
+
+static void blk_free_bounce(blk_request_t* run) {
+    if (run->bounce_block) {
+        kfree(run->bounce_block);
+    }
+    run->bounce_block = NULL;
+    run->bounce = NULL;
+}
+
+// Send one run to the device. Returns false when the queue is empty or
+// the device has no free command slot.
+static bool blk_dispatch_one(blk_queue_t* q) {
+    uint32_t flags = irq_save();
+    if (!q->pending) {
+        irq_restore(flags);
+        return false;
+    }
+    blk_request_t* run = blk_pick(q);
+    irq_restore(flags);
+    
+    disk_info_t* disk = disk_get_info(q->disk_id);
+    bool ahci = disk && disk->type == DISK_TYPE_ATA_SATA;
+    
+    // A merged run is staged through one buffer so it becomes one command,
+    // and so is an odd-addressed buffer bound for AHCI, which would
+    // otherwise be rejected
+    run->bounce = NULL;
+    run->bounce_block = NULL;
+    if (run->merged || (ahci && ((uint32_t)run->buffer & 1))) {
+        if (!blk_alloc_bounce(run)) {
+            // Out of memory: send the first request alone. An unmerged
+            // run goes as it is and fails in ahci_submit.
+            if (run->merged) {
+                blk_request_t* rest = run->merged;
+                rest->tail = run->tail;
+                rest->total = run->total - run->count;
+                rest->deadline = run->deadline;
+                run->merged = NULL;
+                run->tail = run;
+                run->total = run->count;
+                
+                flags = irq_save();
+                blk_insert_run(q, rest);
+                irq_restore(flags);
+            }
+        } else if (run->write) {
+            uint32_t offset = 0;
+            for (blk_request_t* req = run; req; req = req->merged) {
+                blk_memcpy(run->bounce + offset, req->buffer, req->count * DISK_SECTOR_SIZE);
+                offset += req->count * DISK_SECTOR_SIZE;
+            }
+        }
+    }
+    void* buffer = run->bounce ? (void*)run->bounce : run->buffer;
+    
+    flags = irq_save();
+    q->position = run->lba + run->total;
+    q->in_flight++;
+    blk_active_add(q, run);
+    q->stats.dispatched++;
+    q->stats.sectors += run->total;
+    irq_restore(flags);
+    
+    if (ahci) {
+        // Queued on the controller; completes from the HBA interrupt
+        int result = ahci_submit(q->disk_id - DISK_AHCI_BASE, run->lba, run->total, buffer, run->write,
+                                 blk_run_done, run);
+        if (result == -EAGAIN) {
+            flags = irq_save();
+            blk_active_remove(q, run);
+            q->in_flight--;
+            q->stats.dispatched--;
+            q->stats.sectors -= run->total;
+            blk_free_bounce(run);
+            blk_insert_run(q, run);
+            irq_restore(flags);
+            return false;
+        }
+        if (result < 0) {
+            flags = irq_save();
+            blk_run_done(run, false);
+            irq_restore(flags);
+        }
+        return true;
+    }
+    
+    bool ok = run->write ? disk_write_sectors(q->disk_id, run->lba, run->total, buffer)
+                         : disk_read_sectors(q->disk_id, run->lba, run->total, buffer);
+    flags = irq_save();
+    blk_run_done(run, ok);
+    irq_restore(flags);
+    return true;
+}
+
+static void blk_dispatch(blk_queue_t* q) {
+    while (blk_dispatch_one(q)) {
+    }
+}
+
+// Sleep until something completes. With interrupts off (or no interrupt
+// routed) the controller is polled instead.
+static void blk_wait(blk_queue_t* q) {
+    uint32_t flags = irq_save();
+    if (q->in_flight > 0 && (flags & 0x200)) {
+        wait_queue_sleep_timeout(&q->wait, 1);
+    }
+    irq_restore(flags);
+    
+    disk_info_t* disk = disk_get_info(q->disk_id);
+    if (disk && disk->type == DISK_TYPE_ATA_SATA) {
+        ahci_poll(q->disk_id - DISK_AHCI_BASE);
+    }
+}
+
+// Dispatch everything and wait for the device to go idle
+static void blk_drain(blk_queue_t* q) {
+    for (;;) {
+        blk_dispatch(q);
+        if (!q->pending && q->in_flight == 0) {
+            break;
+        }
+        blk_wait(q);
+    }
+}
+
+static void blk_unplug_stale(void);
+
+void blk_init(void) {
+    slab_cache_init(&blk_request_cache, "blk_request", sizeof(blk_request_t));
+    
+    for (uint32_t i = 0; i < MAX_DISKS; i++) {
+        blk_queue_t* q = &queues[i];
+        uint8_t* zero = (uint8_t*)q;
+        for (size_t j = 0; j < sizeof(*q); j++) {
+            zero[j] = 0;
+        }
+        q->disk_id = i;
+        wait_queue_init(&q->wait);
+    }
+    
+    work_register(blk_unplug_stale, 1);
+}
+
+// Public entry points hold off deferred work, which unplugs stale queues
+// and runs the cache write-back, for as long as they touch a queue
+static int blk_submit_locked(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer, bool write,
+                             blk_callback_t callback, void* context) {
+    disk_info_t* disk = disk_get_info(disk_id);
+    if (!disk || count == 0 || !buffer || lba + count > disk->sectors) {
+        return -EINVAL;
+    }
+    
+    blk_request_t* req = (blk_request_t*)slab_alloc(&blk_request_cache);
+    if (!req) {
+        return -ENOMEM;
+    }
+    
+    blk_queue_t* q = &queues[disk_id];
+    req->disk_id = disk_id;
+    req->lba = lba;
+    req->count = count;
+    req->buffer = buffer;
+    req->write = write;
+    req->callback = callback;
+    req->context = context;
+    req->next = NULL;
+    req->merged = NULL;
+    req->tail = req;
+    req->total = count;
+    req->deadline = timer_get_ticks() + (write ? BLK_WRITE_DEADLINE_TICKS : BLK_READ_DEADLINE_TICKS);
+    req->bounce = NULL;
+    req->bounce_block = NULL;
+    
+    uint32_t flags = irq_save();
+    bool conflict = blk_conflicts(q, lba, count, write);
+    irq_restore(flags);
+    if (conflict) {
+        blk_drain(q);
+    }
+    
+    flags = irq_save();
+    req->seq = blk_seq++;
+    q->stats.submitted++;
+    if (blk_try_merge(q, req)) {
+        q->stats.merged++;
+    } else {
+        blk_insert_run(q, req);
+    }
+    bool full = q->pending_runs > BLK_MAX_PENDING;
+    irq_restore(flags);
+    
+    if (full) {
+        blk_dispatch(q);
+    }
+    return 0;
+}
+
+// Queue a transfer. Returns 0 once queued, or -EINVAL/-ENOMEM; the
+// callback reports the outcome. Call from process context or deferred
+// work, never an interrupt: a request that overlaps queued writes first
+// drains the queue to keep ordering.
+int blk_submit(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer, bool write,
+               blk_callback_t callback, void* context) {
+    work_disable();
+    int result = blk_submit_locked(disk_id, lba, count, buffer, write, callback, context);
+    work_enable();
+    return result;
+}
+
+void blk_unplug(uint32_t disk_id) {
+    if (disk_id < MAX_DISKS) {
+        work_disable();
+        blk_dispatch(&queues[disk_id]);
+        work_enable();
+    }
+}
+
+// Write out everything queued and wait for it. Returns false if any
+// request has failed since the previous flush.
+bool blk_flush(uint32_t disk_id) {
+    if (disk_id >= MAX_DISKS) {
+        return false;
+    }
+    
+    blk_queue_t* q = &queues[disk_id];
+    work_disable();
+    blk_drain(q);
+    work_enable();
+    
+    uint32_t flags = irq_save();
+    bool ok = q->flush_errors == 0;
+    q->flush_errors = 0;
+    irq_restore(flags);
+    return ok;
+}
+
+// Unplug queues that have waited long enough for merges; deferred work
+// every tick
+static void blk_unplug_stale(void) {
+    uint32_t now = timer_get_ticks();
+    for (uint32_t i = 0; i < MAX_DISKS; i++) {
+        blk_queue_t* q = &queues[i];
+        if (q->pending && now - q->oldest >= BLK_UNPLUG_TICKS) {
+            blk_dispatch(q);
+        }
+    }
+}
+
+static void blk_sync_done(void* context, bool ok) {
+    blk_sync_t* sync = (blk_sync_t*)context;
+    sync->ok = ok;
+    sync->done = true;
+}
+
+static bool blk_transfer(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer, bool write) {
+    blk_sync_t sync = { false, false };
+    work_disable();
+    bool queued = blk_submit_locked(disk_id, lba, count, buffer, write, blk_sync_done, &sync) >= 0;
+    
+    blk_queue_t* q = &queues[disk_id];
+    while (queued && !sync.done) {
+        blk_dispatch(q);
+        if (!sync.done) {
+            blk_wait(q);
+        }
+    }
+    work_enable();
+    return queued && sync.ok;
+}
+
+// Synchronous helpers; they go through the queue so they are ordered
+// against asynchronous requests on the same sectors
+bool blk_read(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer) {
+    return blk_transfer(disk_id, lba, count, buffer, false);
+}
+
+bool blk_write(uint32_t disk_id, uint64_t lba, uint32_t count, const void* buffer) {
+    return blk_transfer(disk_id, lba, count, (void*)buffer, true);
+}
+
+void blk_dump(void) {
+    char num[12];
+    
+    for (uint32_t i = 0; i < MAX_DISKS; i++) {
+        blk_queue_t* q = &queues[i];
+        if (!disk_get_info(i)) {
+            continue;
+        }
+        
+        blk_stats_t* s = &q->stats;
+        terminal_writestring("disk");
+        blk_itoa(i, num);
+        terminal_writestring(num);
+        terminal_writestring(": submitted ");
+        blk_itoa(s->submitted, num);
+        terminal_writestring(num);
+        terminal_writestring(", merged ");
+        blk_itoa(s->merged, num);
+        terminal_writestring(num);
+        terminal_writestring(", commands ");
+        blk_itoa(s->dispatched, num);
+        terminal_writestring(num);
+        terminal_writestring(", sectors ");
+        blk_itoa(s->sectors, num);
+        terminal_writestring(num);
+        terminal_writestring("\n  deadline dispatches ");
+        blk_itoa(s->expired, num);
+        terminal_writestring(num);
+        terminal_writestring(", errors ");
+        blk_itoa(s->errors, num);
+        terminal_writestring(num);
+        terminal_writestring(", queued ");
+        blk_itoa(q->pending_runs, num);
+        terminal_writestring(num);
+        terminal_writestring(", in flight ");
+        blk_itoa(q->in_flight, num);
+        terminal_writestring(num);
+        terminal_writestring("\n");
+    }
+}
\ No newline at end of file
@@ -2,8 +2,19 @@
 #include "../include/bsh.h"
 #include "../include/video.h"
 #include "../include/disk.h"
+#include "../include/blk.h"
+#include "../include/bcache.h"
 #include "../include/fat32.h"
+#include "../include/vfs.h"
 #include "../include/installer.h"
+#include "../include/checksum.h"
+#include "../include/route.h"
+#include "../include/loopback.h"
+#include "../include/dns.h"
+#include "../include/errno.h"
+#include "../include/http.h"
+#include "../include/httpd.h"
+#include "../include/dhcp.h"
 // GUI removed - will be rewritten
 
 extern void terminal_writestring(const char* data);
@@ -30,6 +41,23 @@ int cmd_gui2(const char* args);
 int cmd_disks(const char* args);
 int cmd_format(const char* args);
 int cmd_install(const char* args);
+int cmd_csumbench(const char* args);
+int cmd_route(const char* args);
+int cmd_ifconfig(const char* args);
+int cmd_lobench(const char* args);
+int cmd_nslookup(const char* args);
+int cmd_dns(const char* args);
+int cmd_wget(const char* args);
+int cmd_httpd(const char* args);
+int cmd_dhcp(const char* args);
+int cmd_diskbench(const char* args);
+int cmd_iostat(const char* args);
+int cmd_bcache(const char* args);
+int cmd_dcache(const char* args);
+int cmd_mount(const char* args);
+int cmd_umount(const char* args);
+int cmd_ls(const char* args);
+int cmd_cat(const char* args);
 
 static simple_command_t commands[] = {
     {"help", "Show available commands", cmd_help},
@@ -38,8 +66,25 @@ static simple_command_t commands[] = {
     {"fontdemo", "Demonstrate modern SF Pro font system", cmd_modern_font_demo},
     {"gui2", "Launch new GUI system", cmd_gui2},
     {"disks", "Show disk information", cmd_disks},
+    {"diskbench", "Compare PIO and DMA disk reads (diskbench [disk] [KB])", cmd_diskbench},
+    {"iostat", "Show block request queue counters", cmd_iostat},
+    {"bcache", "Buffer cache counters (bcache, bcache sync)", cmd_bcache},
+    {"dcache", "Dentry cache counters", cmd_dcache},
+    {"mount", "Mount a FAT32 disk under /mnt (mount, mount DISK [NAME])", cmd_mount},
+    {"umount", "Unmount a volume (umount NAME)", cmd_umount},
+    {"ls", "List a directory (ls [PATH])", cmd_ls},
+    {"cat", "Print a file (cat PATH)", cmd_cat},
     {"format", "Format disk with FAT32 (format 0)", cmd_format},
     {"install", "Install ByteOS to disk (install 0)", cmd_install},
+    {"csumbench", "Benchmark Internet checksum routines", cmd_csumbench},
+    {"route", "Show the IP routing table", cmd_route},
+    {"ifconfig", "Show network interfaces and counters", cmd_ifconfig},
+    {"lobench", "Benchmark TCP over loopback (lobench [KB])", cmd_lobench},
+    {"nslookup", "Resolve a host name (nslookup name)", cmd_nslookup},
+    {"dns", "DNS cache (dns, dns flush, dns server IP)", cmd_dns},
+    {"wget", "Fetch a URL over HTTP/1.1 (wget [-p] [-o FILE] URL)", cmd_wget},
+    {"httpd", "Static file server (httpd, httpd start [port], httpd stop)", cmd_httpd},
+    {"dhcp", "DHCP lease (dhcp, dhcp renew, dhcp release)", cmd_dhcp},
     {"exit", "Exit shell", cmd_exit},
     {NULL, NULL, NULL}
 };
@@ -274,13 +319,412 @@ int cmd_gui2(const char* args) {
     return gui2_main_loop();
 }
 
+int cmd_csumbench(const char* args) {
+    (void)args;
+    checksum_benchmark();
+    return 0;
+}
+
+int cmd_route(const char* args) {
+    (void)args;
+    route_dump();
+    return 0;
+}
+
+static void bsh_write_uint(uint32_t value) {
+    char buffer[12];
+    int pos = 0;
+    do {
+        buffer[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (pos > 0) {
+        terminal_putchar(buffer[--pos]);
+    }
+}
+
+int cmd_ifconfig(const char* args) {
+    (void)args;
+    
+    for (int i = 0; i < NET_MAX_INTERFACES; i++) {
+        net_interface_t* iface = net_get_interface_at(i);
+        if (!iface) break;
+        
+        terminal_writestring(iface->name);
+        terminal_writestring(iface->active ? ": UP" : ": DOWN");
+        if (iface->flags & NET_IF_LOOPBACK) {
+            terminal_writestring(" LOOPBACK");
+        }
+        terminal_writestring("  mtu ");
+        bsh_write_uint(iface->mtu);
+        terminal_writestring("\n  inet ");
+        terminal_writestring(ip_to_string(&iface->ip));
+        terminal_writestring("  netmask ");
+        terminal_writestring(ip_to_string(&iface->netmask));
+        if (!(iface->flags & NET_IF_LOOPBACK)) {
+            terminal_writestring("  ether ");
+            terminal_writestring(mac_to_string(&iface->mac));
+        }
+        terminal_writestring("\n  RX packets ");
+        bsh_write_uint(iface->stats.rx_packets);
+        terminal_writestring("  bytes ");
+        bsh_write_uint(iface->stats.rx_bytes);
+        terminal_writestring("  dropped ");
+        bsh_write_uint(iface->stats.rx_dropped);
+        terminal_writestring("\n  TX packets ");
+        bsh_write_uint(iface->stats.tx_packets);
+        terminal_writestring("  bytes ");
+        bsh_write_uint(iface->stats.tx_bytes);
+        terminal_writestring("  dropped ");
+        bsh_write_uint(iface->stats.tx_dropped);
+        terminal_writestring("\n");
+    }
+    return 0;
+}
+
+int cmd_lobench(const char* args) {
+    // Transfer size in KB, 4 MB by default
+    uint32_t kb = 0;
+    while (args && *args >= '0' && *args <= '9') {
+        kb = kb * 10 + (*args++ - '0');
+    }
+    if (kb == 0) kb = 4096;
+    
+    loopback_benchmark(kb * 1024);
+    return 0;
+}
+
+int cmd_nslookup(const char* args) {
+    if (!args || !*args) {
+        terminal_writestring("Usage: nslookup name\n");
+        return 1;
+    }
+    
+    uint32_t addr;
+    int result = dns_resolve(args, &addr);
+    if (result < 0) {
+        terminal_writestring(args);
+        terminal_writestring(result == -ENOENT ? ": no such name\n" :
+                             result == -ETIMEDOUT ? ": server timed out\n" :
+                             result == -ENETUNREACH ? ": no DNS server configured\n" :
+                             ": lookup failed\n");
+        return 1;
+    }
+    
+    ip_addr_t ip;
+    ip.addr[0] = (addr >> 24) & 0xFF;
+    ip.addr[1] = (addr >> 16) & 0xFF;
+    ip.addr[2] = (addr >> 8) & 0xFF;
+    ip.addr[3] = addr & 0xFF;
+    terminal_writestring(args);
+    terminal_writestring(" has address ");
+    terminal_writestring(ip_to_string(&ip));
+    terminal_writestring("\n");
+    return 0;
+}
+
+int cmd_dns(const char* args) {
+    if (args && args[0] == 'f') {
+        dns_flush();
+        terminal_writestring("DNS cache flushed\n");
+        return 0;
+    }
+    
+    if (args && args[0] == 's') {
+        // "server A.B.C.D"
+        const char* ip = args;
+        while (*ip && *ip != ' ') ip++;
+        while (*ip == ' ') ip++;
+        
+        uint32_t server;
+        if (!*ip || dns_resolve(ip, &server) < 0) {
+            terminal_writestring("Usage: dns server A.B.C.D\n");
+            return 1;
+        }
+        dns_set_server(server);
+    }
+    
+    dns_dump();
+    return 0;
+}
+
+// Body sink for wget: optionally echo, always count
+static int wget_body(void* context, const uint8_t* data, size_t length) {
+    int* print = (int*)context;
+    if (*print) {
+        for (size_t i = 0; i < length; i++) {
+            terminal_putchar((char)data[i]);
+        }
+    }
+    return 0;
+}
+
+int cmd_wget(const char* args) {
+    int print = 0;
+    char output[VFS_MAX_PATH_LEN];
+    output[0] = '\0';
+    while (args && args[0] == '-') {
+        if (args[1] == 'p') {
+            print = 1;
+            args += 2;
+        } else if (args[1] == 'o') {
+            // "-o FILE"
+            args += 2;
+            while (*args == ' ') args++;
+            size_t i = 0;
+            while (*args && *args != ' ') {
+                if (i == sizeof(output) - 1) {
+                    terminal_writestring("wget: file name too long\n");
+                    return 1;
+                }
+                output[i++] = *args++;
+            }
+            output[i] = '\0';
+        } else {
+            break;
+        }
+        while (*args == ' ') args++;
+    }
+    if (!args || !*args) {
+        terminal_writestring("Usage: wget [-p] [-o FILE] URL\n");
+        return 1;
+    }
+    
+    char host[256];
+    char path[256];
+    uint16_t port;
+    if (strlen(args) >= sizeof(path) || http_parse_url(args, host, &port, path) < 0) {
+        terminal_writestring("wget: bad URL\n");
+        return 1;
+    }
+    
+    http_head_t head;
+    int length;
+    if (output[0]) {
+        // The file is the sink; -p has nothing left to echo
+        print = 0;
+        length = http_download(host, port, path, output, &head);
+    } else {
+        length = http_request("GET", host, port, path, &head, wget_body, &print);
+    }
+    if (length < 0) {
+        terminal_writestring(output[0] ? "wget: download failed (the file must be new or empty)\n" :
+                                         "wget: request failed\n");
+        return 1;
+    }
+    
+    http_stats_t* stats = http_get_stats();
+    terminal_writestring(print ? "\nHTTP " : "HTTP ");
+    bsh_write_uint(head.status_code);
+    terminal_writestring(", ");
+    bsh_write_uint(length);
+    terminal_writestring(head.chunked ? " bytes (chunked)" : " bytes");
+    terminal_writestring("\nConnections opened: ");
+    bsh_write_uint(stats->connections_opened);
+    terminal_writestring("  reused: ");
+    bsh_write_uint(stats->connections_reused);
+    terminal_writestring("\n");
+    return 0;
+}
+
+int cmd_httpd(const char* args) {
+    if (args && args[0] == 's' && args[1] == 't' && args[2] == 'a') {
+        // "start [port]"
+        const char* p = args;
+        while (*p && *p != ' ') p++;
+        while (*p == ' ') p++;
+        uint32_t port = 0;
+        while (*p >= '0' && *p <= '9') {
+            port = port * 10 + (*p++ - '0');
+        }
+        if (port == 0 || port > 65535) port = HTTPD_DEFAULT_PORT;
+        
+        int result = httpd_start((uint16_t)port);
+        if (result < 0) {
+            terminal_writestring(result == -EADDRINUSE ? "httpd: already running\n" :
+                                                         "httpd: cannot listen on that port\n");
+            return 1;
+        }
+    } else if (args && args[0] == 's' && args[1] == 't' && args[2] == 'o') {
+        httpd_stop();
+    }
+    
+    httpd_dump();
+    return 0;
+}
+
+int cmd_dhcp(const char* args) {
+    if (args && args[0] == 'r' && args[1] == 'e' && args[2] == 'n') {
+        dhcp_renew();
+    } else if (args && args[0] == 'r' && args[1] == 'e' && args[2] == 'l') {
+        dhcp_release();
+        dhcp_sync();
+    }
+    
+    dhcp_dump();
+    return 0;
+}
+
+int cmd_diskbench(const char* args) {
+    // "[disk] [KB]": disk 0 and 8 MB by default
+    uint32_t disk_id = 0;
+    uint32_t kb = 0;
+    if (args && *args >= '0' && *args < '0' + MAX_DISKS && (args[1] == ' ' || args[1] == '\0')) {
+        disk_id = *args - '0';
+        args++;
+        while (*args == ' ') args++;
+    }
+    while (args && *args >= '0' && *args <= '9') {
+        kb = kb * 10 + (*args++ - '0');
+    }
+    if (kb == 0) kb = 8192;
+    
+    disk_benchmark(disk_id, kb);
+    return 0;
+}
+
+int cmd_iostat(const char* args) {
+    (void)args;
+    blk_dump();
+    return 0;
+}
+
+int cmd_bcache(const char* args) {
+    if (args && args[0] == 's') {
+        if (bcache_sync_all()) {
+            terminal_writestring("Buffer cache synced\n");
+        } else {
+            terminal_writestring("Buffer cache sync failed\n");
+            return 1;
+        }
+    }
+    
+    bcache_dump();
+    return 0;
+}
+
+int cmd_dcache(const char* args) {
+    (void)args;
+    vfs_dcache_dump();
+    return 0;
+}
+
+int cmd_mount(const char* args) {
+    if (!args || !*args) {
+        vfs_node_t* root = vfs_get_mount(0);
+        if (!root) {
+            terminal_writestring("No volumes mounted\n");
+            return 0;
+        }
+        for (size_t i = 0; (root = vfs_get_mount(i)) != NULL; i++) {
+            terminal_writestring("/mnt/");
+            terminal_writestring(root->name);
+            terminal_writestring(" type ");
+            terminal_writestring(root->ops->fs_name);
+            terminal_writestring("\n");
+        }
+        return 0;
+    }
+    
+    if (*args < '0' || *args >= '0' + MAX_DISKS) {
+        terminal_writestring("Usage: mount DISK [NAME]\n");
+        return 1;
+    }
+    uint32_t disk_id = *args - '0';
+    
+    // Default name: diskN
+    char name[VFS_MAX_NAME_LEN] = "disk0";
+    name[4] = '0' + disk_id;
+    const char* arg = args + 1;
+    while (*arg == ' ') arg++;
+    if (*arg) {
+        size_t i = 0;
+        while (arg[i] && arg[i] != ' ' && i < VFS_MAX_NAME_LEN - 1) {
+            name[i] = arg[i];
+            i++;
+        }
+        name[i] = '\0';
+    }
+    
+    vfs_node_t* root = fat32_vfs_mount(disk_id);
+    if (!root) {
+        terminal_writestring("No FAT32 volume on that disk\n");
+        return 1;
+    }
+    if (vfs_mount(name, root) < 0) {
+        terminal_writestring("Cannot mount at /mnt/");
+        terminal_writestring(name);
+        terminal_writestring("\n");
+        return 1;
+    }
+    
+    terminal_writestring("Mounted at /mnt/");
+    terminal_writestring(name);
+    terminal_writestring("\n");
+    return 0;
+}
+
+int cmd_umount(const char* args) {
+    if (!args || !*args) {
+        terminal_writestring("Usage: umount NAME\n");
+        return 1;
+    }
+    
+    int result = vfs_umount(args);
+    if (result == -2) {
+        terminal_writestring("Volume is in use\n");
+        return 1;
+    }
+    if (result < 0) {
+        terminal_writestring("Not mounted\n");
+        return 1;
+    }
+    return 0;
+}
+
+int cmd_ls(const char* args) {
+    vfs_node_t* dir = (args && *args) ? vfs_lookup(args) : vfs_get_current_dir();
+    if (!dir) {
+        terminal_writestring("No such directory\n");
+        return 1;
+    }
+    vfs_list_directory(dir);
+    return 0;
+}
+
+int cmd_cat(const char* args) {
+    vfs_node_t* file = (args && *args) ? vfs_lookup(args) : NULL;
+    if (!file || file->type != VFS_FILE) {
+        terminal_writestring("No such file\n");
+        return 1;
+    }
+    
+    char chunk[512];
+    size_t offset = 0;
+    while (offset < file->size) {
+        int n = vfs_read(file, offset, chunk, sizeof(chunk));
+        if (n <= 0) {
+            terminal_writestring("\nRead error\n");
+            return 1;
+        }
+        for (int i = 0; i < n; i++) {
+            terminal_putchar(chunk[i]);
+        }
+        offset += n;
+    }
+    if (offset > 0 && chunk[(offset - 1) % sizeof(chunk)] != '\n') {
+        terminal_putchar('\n');
+    }
+    return 0;
+}
+
 int cmd_disks(const char* args) {
     (void)args;
     
     terminal_writestring("Disk Information:\n");
     terminal_writestring("=================\n");
     
-    for (int i = 0; i < 4; i++) {
+    for (int i = 0; i < MAX_DISKS; i++) {
         disk_info_t* disk = disk_get_info(i);
         if (disk && disk->present) {
             terminal_writestring("Disk ");
@@ -327,7 +771,7 @@ int cmd_disks(const char* args) {
             size_str[pos] = '\0';
             
             terminal_writestring(size_str);
-            terminal_writestring(" MB)\n");
+            terminal_writestring(disk->dma ? " MB, DMA)\n" : " MB, PIO)\n");
             
             // Show model if available
             terminal_writestring("  Model: ");
@@ -353,7 +797,7 @@ int cmd_format(const char* args) {
     
     // Simple argument parsing - just get disk number
     int disk_id = 0;
-    if (args && *args >= '0' && *args <= '3') {
+    if (args && *args >= '0' && *args < '0' + MAX_DISKS) {
         disk_id = *args - '0';
     }
     
@@ -404,8 +848,11 @@ int cmd_format(const char* args) {
     uint32_t start_sector = 0;
     uint32_t total_sectors = (uint32_t)disk->sectors;
     
+    uint32_t start_ticks = timer_get_ticks();
     if (fat32_format_disk(disk_id, start_sector, total_sectors, "ByteOS")) {
-        terminal_writestring("Format completed successfully!\n");
+        terminal_writestring("Format completed successfully in ");
+        bsh_write_uint((timer_get_ticks() - start_ticks) * TIMER_MS_PER_TICK);
+        terminal_writestring(" ms!\n");
         terminal_writestring("Filesystem: FAT32\n");
         terminal_writestring("Volume label: ByteOS\n");
         return 0;
@@ -423,7 +870,7 @@ int cmd_install(const char* args) {
     
     // Parse disk argument
     int disk_id = 0;
-    if (args && *args >= '0' && *args <= '3') {
+    if (args && *args >= '0' && *args < '0' + MAX_DISKS) {
         disk_id = *args - '0';
     }
     
@@ -488,6 +935,11 @@ int cmd_install(const char* args) {
         terminal_writestring("Installation completed successfully!\n");
         terminal_writestring("System Status:\n");
         terminal_writestring("  Filesystem: FAT32\n");
+        terminal_writestring("  Format: ");
+        bsh_write_uint(config.format_ms);
+        terminal_writestring(" ms, ");
+        bsh_write_uint(config.format_ms_per_gb);
+        terminal_writestring(" ms per GB\n");
         terminal_writestring("  Bootloader: Installed\n");
         terminal_writestring("  Kernel: Installed\n");
         terminal_writestring("  System Files: Installed\n");
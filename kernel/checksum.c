@@ -0,0 +1,270 @@
+#include "../include/checksum.h"
+#include "../include/scheduler.h"
+#include "../include/net.h"
+#include "../include/interrupts.h"
+
+extern void terminal_writestring(const char* data);
+
+#define CSUM_BENCH_SIZE  1500   // One Ethernet MTU
+#define CSUM_BENCH_TICKS 50     // Run each variant for half a second
+
+static int csum_have_sse2 = 0;
+
+// FXSAVE image of whoever was using the XMM registers when the SSE2 path
+// ran. Only touched with interrupts off, so one area is enough.
+static uint8_t csum_fxsave_area[512] __attribute__((aligned(16)));
+
+static void csum_itoa(uint32_t value, char* str) {
+    char temp[16];
+    int pos = 0;
+    
+    do {
+        temp[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    
+    int i = 0;
+    while (pos > 0) {
+        str[i++] = temp[--pos];
+    }
+    str[i] = '\0';
+}
+
+// Fold a 64-bit accumulator down to 32 bits without losing carries
+static inline uint32_t csum_fold64(uint64_t sum) {
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    return (uint32_t)sum;
+}
+
+// Sum the trailing 0-3 bytes in memory order
+static inline uint64_t csum_tail(const uint8_t* p, size_t length, uint64_t sum) {
+    if (length & 2) {
+        sum += *(const uint16_t*)p;
+        p += 2;
+    }
+    if (length & 1) {
+        sum += *p;
+    }
+    return sum;
+}
+
+// Portable path: 32-bit loads into a 64-bit accumulator, so carries are
+// only folded once at the end. 2^32 = 2^16 = 1 (mod 0xFFFF), so this equals
+// the 16-bit word sum.
+static uint32_t csum_partial_generic(const uint8_t* p, size_t length, uint32_t initial) {
+    uint64_t sum = initial;
+    
+    while (length >= 16) {
+        const uint32_t* w = (const uint32_t*)p;
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        p += 16;
+        length -= 16;
+    }
+    while (length >= 4) {
+        sum += *(const uint32_t*)p;
+        p += 4;
+        length -= 4;
+    }
+    
+    return csum_fold64(csum_tail(p, length, sum));
+}
+
+// SSE2 path: split every 32-bit lane into its two 16-bit words and add
+// them to separate 32-bit lanes, which cannot overflow within a batch
+typedef uint32_t csum_v4_t __attribute__((vector_size(16)));
+typedef uint32_t csum_uv4_t __attribute__((vector_size(16), aligned(1)));
+
+#define CSUM_SSE2_BATCH 4096    // 16-byte blocks per batch, 0xFFFF * 2 * 4096 < 2^32
+
+__attribute__((target("sse2"), noinline))
+static uint32_t csum_partial_sse2(const uint8_t* p, size_t length, uint32_t initial) {
+    uint64_t sum = initial;
+    const csum_v4_t mask = {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF};
+    
+    while (length >= 16) {
+        csum_v4_t acc = {0, 0, 0, 0};
+        size_t blocks = length / 16;
+        if (blocks > CSUM_SSE2_BATCH) blocks = CSUM_SSE2_BATCH;
+        length -= blocks * 16;
+        
+        while (blocks--) {
+            csum_v4_t v = *(const csum_uv4_t*)p;
+            acc += (v & mask) + (v >> 16);
+            p += 16;
+        }
+        sum += (uint64_t)acc[0] + acc[1] + acc[2] + acc[3];
+    }
+    while (length >= 4) {
+        sum += *(const uint32_t*)p;
+        p += 4;
+        length -= 4;
+    }
+    
+    return csum_fold64(csum_tail(p, length, sum));
+}
+
+// The checksum runs both in threads and in interrupt handlers (TCP
+// retransmits over loopback), and the task switch does not save XMM
+// state. Run the SSE2 path with interrupts off and preserve the registers
+// of whatever it interrupted.
+static uint32_t csum_partial_xmm(const uint8_t* p, size_t length, uint32_t initial) {
+    uint32_t irq_flags = irq_save();
+    asm volatile("fxsave %0" : "=m"(csum_fxsave_area));
+    uint32_t sum = csum_partial_sse2(p, length, initial);
+    asm volatile("fxrstor %0" :: "m"(csum_fxsave_area));
+    irq_restore(irq_flags);
+    return sum;
+}
+
+// Enable SSE (CR0.EM off, CR0.MP and CR4.OSFXSR/OSXMMEXCPT on) if the CPU
+// has SSE2. XMM registers are only used through csum_partial_xmm.
+void checksum_init(void) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    
+    if (!(edx & (1 << 26))) {
+        return;
+    }
+    
+    uint32_t cr0, cr4;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~(1 << 2);
+    cr0 |= (1 << 1);
+    asm volatile("mov %0, %%cr0" :: "r"(cr0));
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= (1 << 9) | (1 << 10);
+    asm volatile("mov %0, %%cr4" :: "r"(cr4));
+    
+    csum_have_sse2 = 1;
+}
+
+uint32_t csum_partial(const void* data, size_t length, uint32_t sum) {
+    // Below this the FXSAVE/FXRSTOR pair costs more than SSE2 saves
+    if (csum_have_sse2 && length >= 256) {
+        return csum_partial_xmm((const uint8_t*)data, length, sum);
+    }
+    return csum_partial_generic((const uint8_t*)data, length, sum);
+}
+
+// Copy and checksum in one pass over the data, for building packets
+uint32_t csum_partial_copy(void* dest, const void* src, size_t length, uint32_t initial) {
+    const uint8_t* s = (const uint8_t*)src;
+    uint8_t* d = (uint8_t*)dest;
+    uint64_t sum = initial;
+    
+    while (length >= 8) {
+        uint32_t w0 = ((const uint32_t*)s)[0];
+        uint32_t w1 = ((const uint32_t*)s)[1];
+        ((uint32_t*)d)[0] = w0;
+        ((uint32_t*)d)[1] = w1;
+        sum += (uint64_t)w0 + w1;
+        s += 8;
+        d += 8;
+        length -= 8;
+    }
+    while (length >= 4) {
+        uint32_t w = *(const uint32_t*)s;
+        *(uint32_t*)d = w;
+        sum += w;
+        s += 4;
+        d += 4;
+        length -= 4;
+    }
+    for (size_t i = 0; i < length; i++) {
+        d[i] = s[i];
+    }
+    
+    return csum_fold64(csum_tail(s, length, sum));
+}
+
+uint32_t csum_pseudo_header(uint32_t src_ip, uint32_t dst_ip, uint8_t protocol,
+                            uint16_t length, uint32_t sum) {
+    uint64_t total = sum;
+    total += htons(src_ip >> 16) + htons(src_ip & 0xFFFF);
+    total += htons(dst_ip >> 16) + htons(dst_ip & 0xFFFF);
+    total += htons(protocol);
+    total += htons(length);
+    return csum_fold64(total);
+}
+
+// Straightforward 16-bit loop, the baseline the benchmark compares against
+static uint16_t csum_reference(const uint8_t* p, size_t length) {
+    uint32_t sum = 0;
+    while (length > 1) {
+        sum += *(const uint16_t*)p;
+        p += 2;
+        length -= 2;
+    }
+    if (length) sum += *p;
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return ~sum;
+}
+
+static void csum_report(const char* name, uint32_t iterations, uint32_t ticks) {
+    // MB/s = bytes / 2^20 / (ticks / TIMER_FREQUENCY)
+    uint32_t kb = (uint32_t)(((uint64_t)iterations * CSUM_BENCH_SIZE) >> 10);
+    uint32_t mb_per_s = (kb * TIMER_FREQUENCY / ticks) >> 10;
+    char num[16];
+    
+    terminal_writestring("  ");
+    terminal_writestring(name);
+    terminal_writestring(": ");
+    csum_itoa(mb_per_s / 1024, num);
+    terminal_writestring(num);
+    terminal_writestring(".");
+    uint32_t hundredths = (mb_per_s % 1024) * 100 / 1024;
+    if (hundredths < 10) terminal_writestring("0");
+    csum_itoa(hundredths, num);
+    terminal_writestring(num);
+    terminal_writestring(" GB/s (");
+    csum_itoa(mb_per_s, num);
+    terminal_writestring(num);
+    terminal_writestring(" MB/s)\n");
+}
+
+// Run fn over MTU-sized buffers for CSUM_BENCH_TICKS timer ticks
+#define CSUM_BENCH(name, expr) do {                                     \
+        uint32_t start = timer_get_ticks();                             \
+        while (timer_get_ticks() == start);                             \
+        start = timer_get_ticks();                                      \
+        uint32_t iterations = 0;                                        \
+        while (timer_get_ticks() - start < CSUM_BENCH_TICKS) {          \
+            for (int rep = 0; rep < 64; rep++) {                        \
+                sink += (expr);                                         \
+            }                                                           \
+            iterations += 64;                                           \
+        }                                                               \
+        csum_report(name, iterations, timer_get_ticks() - start);       \
+    } while (0)
+
+void checksum_benchmark(void) {
+    static uint8_t src[CSUM_BENCH_SIZE + 4];
+    static uint8_t dst[CSUM_BENCH_SIZE + 4];
+    volatile uint32_t sink = 0;
+    
+    for (int i = 0; i < CSUM_BENCH_SIZE; i++) {
+        src[i] = (uint8_t)(i * 7 + 3);
+    }
+    
+    // All variants must agree before their speed means anything
+    uint16_t expected = csum_reference(src, CSUM_BENCH_SIZE);
+    if (csum_fold(csum_partial_generic(src, CSUM_BENCH_SIZE, 0)) != expected ||
+        csum_fold(csum_partial_copy(dst, src, CSUM_BENCH_SIZE, 0)) != expected ||
+        (csum_have_sse2 && csum_fold(csum_partial_xmm(src, CSUM_BENCH_SIZE, 0)) != expected)) {
+        terminal_writestring("Checksum self-test FAILED\n");
+        return;
+    }
+    
+    terminal_writestring("Checksum throughput, 1500 byte buffers:\n");
+    CSUM_BENCH("16-bit reference ", csum_reference(src, CSUM_BENCH_SIZE));
+    CSUM_BENCH("32-bit           ", csum_partial_generic(src, CSUM_BENCH_SIZE, 0));
+    if (csum_have_sse2) {
+        CSUM_BENCH("SSE2             ", csum_partial_xmm(src, CSUM_BENCH_SIZE, 0));
+    } else {
+        terminal_writestring("  SSE2             : not available\n");
+    }
+    CSUM_BENCH("copy + checksum  ", csum_partial_copy(dst, src, CSUM_BENCH_SIZE, 0));
+}
\ No newline at end of file
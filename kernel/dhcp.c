@@ -1,22 +1,95 @@
 #include "../include/dhcp.h"
 #include "../include/udp.h"
 #include "../include/memory.h"
+#include "../include/dns.h"
+#include "../include/vfs.h"
+#include "../include/interrupts.h"
 
 extern void terminal_writestring(const char* data);
 
 static dhcp_client_t dhcp_client;
 static uint32_t dhcp_xid_counter = 1;
+static udp_socket_t* dhcp_socket = NULL;
 
-void dhcp_init(void) {
-    dhcp_client.state = DHCP_STATE_INIT;
-    dhcp_client.active = 0;
-    dhcp_client.transaction_id = 0;
-    
-    terminal_writestring("DHCP client initialized\n");
+static const ip_addr_t dhcp_broadcast = {{255, 255, 255, 255}};
+
+static void dhcp_itoa(uint32_t value, char* buffer) {
+    char temp[12];
+    int pos = 0;
+    do {
+        temp[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    int i = 0;
+    while (pos > 0) {
+        buffer[i++] = temp[--pos];
+    }
+    buffer[i] = '\0';
+}
+
+static void dhcp_write_uint(uint32_t value) {
+    char buffer[12];
+    dhcp_itoa(value, buffer);
+    terminal_writestring(buffer);
+}
+
+static uint32_t dhcp_ip_to_u32(const ip_addr_t* ip) {
+    return ((uint32_t)ip->addr[0] << 24) | ((uint32_t)ip->addr[1] << 16) |
+           ((uint32_t)ip->addr[2] << 8) | (uint32_t)ip->addr[3];
+}
+
+static void dhcp_copy_bytes(uint8_t* dest, const uint8_t* src, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        dest[i] = src[i];
+    }
+}
+
+static int dhcp_same_bytes(const uint8_t* a, const uint8_t* b, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+static const char* dhcp_state_name(dhcp_state_t state) {
+    switch (state) {
+        case DHCP_STATE_INIT:        return "INIT";
+        case DHCP_STATE_SELECTING:   return "SELECTING";
+        case DHCP_STATE_REQUESTING:  return "REQUESTING";
+        case DHCP_STATE_INIT_REBOOT: return "INIT-REBOOT";
+        case DHCP_STATE_REBOOTING:   return "REBOOTING";
+        case DHCP_STATE_BOUND:       return "BOUND";
+        case DHCP_STATE_RENEWING:    return "RENEWING";
+        case DHCP_STATE_REBINDING:   return "REBINDING";
+    }
+    return "?";
+}
+
+// Has the tick counter reached deadline?
+static int dhcp_expired(uint32_t now, uint32_t deadline) {
+    return (int32_t)(now - deadline) >= 0;
+}
+
+static uint32_t dhcp_seconds_to_ticks(uint32_t seconds) {
+    return seconds * TIMER_FREQUENCY;
+}
+
+// Receive handler for the client port; only server replies matter
+static void dhcp_receive(udp_socket_t* sock, uint32_t src_ip, uint16_t src_port,
+                         uint8_t* data, size_t length) {
+    (void)sock;
+    (void)src_ip;
+    if (src_port == UDP_PORT_DHCP_SERVER) {
+        dhcp_handle_packet(data, length);
+    }
 }
 
 uint32_t dhcp_generate_xid(void) {
-    return dhcp_xid_counter++;
+    // Unique per exchange and unlikely to collide with other clients
+    net_interface_t* iface = net_get_interface();
+    uint32_t mac_bits = ((uint32_t)iface->mac.addr[2] << 24) | ((uint32_t)iface->mac.addr[3] << 16) |
+                        ((uint32_t)iface->mac.addr[4] << 8) | (uint32_t)iface->mac.addr[5];
+    return (mac_bits ^ (timer_get_ticks() << 12)) + dhcp_xid_counter++;
 }
 
 void dhcp_add_option(uint8_t* buffer, size_t* offset, uint8_t type, uint8_t length, void* data) {
@@ -34,65 +107,70 @@ void dhcp_add_option(uint8_t* buffer, size_t* offset, uint8_t type, uint8_t leng
     }
 }
 
-void dhcp_start_discovery(void) {
-    if (dhcp_client.active) {
-        return; // Already running
-    }
-    
-    terminal_writestring("Starting DHCP discovery...\n");
-    dhcp_client.state = DHCP_STATE_INIT;
-    dhcp_client.active = 1;
-    dhcp_send_discover();
-}
-
-void dhcp_send_discover(void) {
+// Build and send one client message. Which fields and options go in, and
+// where it is sent, follows the state (RFC 2131 table 5).
+static void dhcp_send_message(uint8_t msg_type) {
     net_interface_t* iface = net_get_interface();
-    if (!iface) {
-        return;
-    }
+    dhcp_client_t* client = &dhcp_client;
     
-    // Allocate buffer for DHCP packet
-    size_t dhcp_size = sizeof(dhcp_header_t) + 312; // 312 bytes for options
+    size_t dhcp_size = sizeof(dhcp_header_t) + DHCP_OPTIONS_SIZE;
     uint8_t* dhcp_packet = (uint8_t*)kmalloc(dhcp_size);
     if (!dhcp_packet) {
         return;
     }
-    
-    // Clear packet
     for (size_t i = 0; i < dhcp_size; i++) {
         dhcp_packet[i] = 0;
     }
     
+    uint32_t now = timer_get_ticks();
+    int renewing = client->state == DHCP_STATE_RENEWING;
+    int rebinding = client->state == DHCP_STATE_REBINDING;
+    int releasing = msg_type == DHCP_MSG_RELEASE;
+    
     // Build DHCP header
     dhcp_header_t* dhcp_hdr = (dhcp_header_t*)dhcp_packet;
     dhcp_hdr->op = DHCP_BOOTREQUEST;
     dhcp_hdr->htype = 1; // Ethernet
     dhcp_hdr->hlen = 6;  // MAC address length
     dhcp_hdr->hops = 0;
-    dhcp_hdr->xid = htonl(dhcp_generate_xid());
-    dhcp_client.transaction_id = ntohl(dhcp_hdr->xid);
-    dhcp_hdr->secs = 0;
-    dhcp_hdr->flags = htons(DHCP_FLAG_BROADCAST);
-    dhcp_hdr->ciaddr = 0;
-    dhcp_hdr->yiaddr = 0;
-    dhcp_hdr->siaddr = 0;
-    dhcp_hdr->giaddr = 0;
-    
-    // Copy MAC address
+    dhcp_hdr->xid = htonl(client->transaction_id);
+    dhcp_hdr->secs = htons((uint16_t)((now - client->exchange_start) / TIMER_FREQUENCY));
+    
+    // A client that owns its address says so in ciaddr and can take
+    // unicast replies; everyone else asks for broadcast ones
+    if (renewing || rebinding || releasing) {
+        dhcp_copy_bytes((uint8_t*)&dhcp_hdr->ciaddr, client->lease.address.addr, 4);
+        dhcp_hdr->flags = 0;
+    } else {
+        dhcp_hdr->flags = htons(DHCP_FLAG_BROADCAST);
+    }
+    
     for (int i = 0; i < 6; i++) {
         dhcp_hdr->chaddr[i] = iface->mac.addr[i];
     }
-    
     dhcp_hdr->cookie = htonl(DHCP_MAGIC_COOKIE);
     
     // Add options
     uint8_t* options = dhcp_packet + sizeof(dhcp_header_t);
     size_t options_offset = 0;
     
-    // Message Type (DISCOVER)
-    uint8_t msg_type = DHCP_MSG_DISCOVER;
     dhcp_add_option(options, &options_offset, DHCP_OPTION_MESSAGE_TYPE, 1, &msg_type);
     
+    // Requested IP: the offer (REQUESTING), the remembered lease
+    // (REBOOTING), or a hint in DISCOVER
+    if ((msg_type == DHCP_MSG_DISCOVER && client->have_lease) ||
+        client->state == DHCP_STATE_REQUESTING || client->state == DHCP_STATE_REBOOTING) {
+        dhcp_add_option(options, &options_offset, DHCP_OPTION_REQUESTED_IP, 4,
+                        client->lease.address.addr);
+    }
+    
+    // Server identifier only when answering a particular server's offer,
+    // or telling it the lease is given back
+    if (client->state == DHCP_STATE_REQUESTING || releasing) {
+        dhcp_add_option(options, &options_offset, DHCP_OPTION_SERVER_IDENTIFIER, 4,
+                        client->lease.server_ip.addr);
+    }
+    
     // Client Identifier (MAC address)
     uint8_t client_id[7];
     client_id[0] = 1; // Hardware type (Ethernet)
@@ -101,105 +179,98 @@ void dhcp_send_discover(void) {
     }
     dhcp_add_option(options, &options_offset, DHCP_OPTION_CLIENT_IDENTIFIER, 7, client_id);
     
-    // Parameter Request List
-    uint8_t param_list[] = {
-        DHCP_OPTION_SUBNET_MASK,
-        DHCP_OPTION_ROUTER,
-        DHCP_OPTION_DNS_SERVER,
-        DHCP_OPTION_LEASE_TIME
-    };
-    dhcp_add_option(options, &options_offset, DHCP_OPTION_PARAMETER_REQUEST, 4, param_list);
+    if (!releasing) {
+        uint8_t param_list[] = {
+            DHCP_OPTION_SUBNET_MASK,
+            DHCP_OPTION_ROUTER,
+            DHCP_OPTION_DNS_SERVER,
+            DHCP_OPTION_LEASE_TIME,
+            DHCP_OPTION_RENEWAL_TIME,
+            DHCP_OPTION_REBINDING_TIME
+        };
+        dhcp_add_option(options, &options_offset, DHCP_OPTION_PARAMETER_REQUEST,
+                        sizeof(param_list), param_list);
+    }
     
-    // End option
     dhcp_add_option(options, &options_offset, DHCP_OPTION_END, 0, NULL);
     
-    // Send DHCP DISCOVER
-    ip_addr_t broadcast_ip = {{255, 255, 255, 255}};
-    udp_send_packet(broadcast_ip, UDP_PORT_DHCP_CLIENT, UDP_PORT_DHCP_SERVER, 
-                   dhcp_packet, sizeof(dhcp_header_t) + options_offset);
+    // RENEWING and RELEASE go to the server that granted the lease
+    ip_addr_t dest = (renewing || releasing) ? client->lease.server_ip : dhcp_broadcast;
+    udp_send_packet(dest, UDP_PORT_DHCP_CLIENT, UDP_PORT_DHCP_SERVER,
+                    dhcp_packet, sizeof(dhcp_header_t) + options_offset);
     
-    dhcp_client.state = DHCP_STATE_SELECTING;
+    if (msg_type == DHCP_MSG_REQUEST) {
+        client->request_sent = now;
+    }
     
     kfree(dhcp_packet);
-    terminal_writestring("DHCP DISCOVER sent\n");
 }
 
-void dhcp_send_request(ip_addr_t server_ip, ip_addr_t requested_ip) {
-    net_interface_t* iface = net_get_interface();
-    if (!iface) {
-        return;
-    }
-    
-    // Allocate buffer for DHCP packet
-    size_t dhcp_size = sizeof(dhcp_header_t) + 312;
-    uint8_t* dhcp_packet = (uint8_t*)kmalloc(dhcp_size);
-    if (!dhcp_packet) {
-        return;
+// Retransmit timer for SELECTING, REQUESTING and REBOOTING: exponential
+// backoff from the given timeout up to DHCP_MAX_TIMEOUT
+static void dhcp_arm_retry(uint32_t timeout) {
+    dhcp_client.timeout = timeout;
+    dhcp_client.retry_deadline = timer_get_ticks() + dhcp_seconds_to_ticks(timeout);
+}
+
+// In RENEWING and REBINDING, wait half the time left until deadline, but
+// at least DHCP_MIN_RENEW_RETRY (RFC 2131 4.4.5)
+static void dhcp_arm_renew_retry(uint32_t deadline) {
+    uint32_t now = timer_get_ticks();
+    uint32_t wait = (uint32_t)(deadline - now) / 2;
+    if (wait < dhcp_seconds_to_ticks(DHCP_MIN_RENEW_RETRY)) {
+        wait = dhcp_seconds_to_ticks(DHCP_MIN_RENEW_RETRY);
     }
-    
-    // Clear packet
-    for (size_t i = 0; i < dhcp_size; i++) {
-        dhcp_packet[i] = 0;
+    dhcp_client.retry_deadline = now + wait;
+}
+
+// Start a new exchange in the given state and send its first message
+static void dhcp_begin_exchange(dhcp_state_t state) {
+    dhcp_client_t* client = &dhcp_client;
+    client->state = state;
+    client->transaction_id = dhcp_generate_xid();
+    client->exchange_start = timer_get_ticks();
+    client->retries = 0;
+    
+    switch (state) {
+        case DHCP_STATE_SELECTING:
+            dhcp_send_message(DHCP_MSG_DISCOVER);
+            dhcp_arm_retry(DHCP_INITIAL_TIMEOUT);
+            break;
+        case DHCP_STATE_REBOOTING:
+            dhcp_send_message(DHCP_MSG_REQUEST);
+            dhcp_arm_retry(DHCP_REBOOT_TIMEOUT);
+            break;
+        case DHCP_STATE_RENEWING:
+            dhcp_send_message(DHCP_MSG_REQUEST);
+            dhcp_arm_renew_retry(client->rebind_at);
+            break;
+        case DHCP_STATE_REBINDING:
+            dhcp_send_message(DHCP_MSG_REQUEST);
+            dhcp_arm_renew_retry(client->expires_at);
+            break;
+        default:
+            break;
     }
-    
-    // Build DHCP header
-    dhcp_header_t* dhcp_hdr = (dhcp_header_t*)dhcp_packet;
-    dhcp_hdr->op = DHCP_BOOTREQUEST;
-    dhcp_hdr->htype = 1;
-    dhcp_hdr->hlen = 6;
-    dhcp_hdr->hops = 0;
-    dhcp_hdr->xid = htonl(dhcp_client.transaction_id);
-    dhcp_hdr->secs = 0;
-    dhcp_hdr->flags = htons(DHCP_FLAG_BROADCAST);
-    dhcp_hdr->ciaddr = 0;
-    dhcp_hdr->yiaddr = 0;
-    dhcp_hdr->siaddr = 0;
-    dhcp_hdr->giaddr = 0;
-    
-    // Copy MAC address
-    for (int i = 0; i < 6; i++) {
-        dhcp_hdr->chaddr[i] = iface->mac.addr[i];
+}
+
+// Give up the address and start over with DISCOVER
+static void dhcp_restart(int forget_lease) {
+    net_interface_t* iface = net_get_interface();
+    if (dhcp_client.state == DHCP_STATE_BOUND || dhcp_client.state == DHCP_STATE_RENEWING ||
+        dhcp_client.state == DHCP_STATE_REBINDING) {
+        net_interface_unconfigure(iface);
+        terminal_writestring("DHCP: lease lost, address released\n");
     }
     
-    dhcp_hdr->cookie = htonl(DHCP_MAGIC_COOKIE);
-    
-    // Add options
-    uint8_t* options = dhcp_packet + sizeof(dhcp_header_t);
-    size_t options_offset = 0;
-    
-    // Message Type (REQUEST)
-    uint8_t msg_type = DHCP_MSG_REQUEST;
-    dhcp_add_option(options, &options_offset, DHCP_OPTION_MESSAGE_TYPE, 1, &msg_type);
-    
-    // Requested IP Address
-    dhcp_add_option(options, &options_offset, DHCP_OPTION_REQUESTED_IP, 4, &requested_ip);
-    
-    // Server Identifier
-    dhcp_add_option(options, &options_offset, DHCP_OPTION_SERVER_IDENTIFIER, 4, &server_ip);
-    
-    // Client Identifier
-    uint8_t client_id[7];
-    client_id[0] = 1;
-    for (int i = 0; i < 6; i++) {
-        client_id[i + 1] = iface->mac.addr[i];
+    if (forget_lease) {
+        dhcp_client.have_lease = 0;
+        dhcp_client.lease_dirty = dhcp_client.stored_valid;
     }
-    dhcp_add_option(options, &options_offset, DHCP_OPTION_CLIENT_IDENTIFIER, 7, client_id);
-    
-    // End option
-    dhcp_add_option(options, &options_offset, DHCP_OPTION_END, 0, NULL);
-    
-    // Send DHCP REQUEST
-    ip_addr_t broadcast_ip = {{255, 255, 255, 255}};
-    udp_send_packet(broadcast_ip, UDP_PORT_DHCP_CLIENT, UDP_PORT_DHCP_SERVER,
-                   dhcp_packet, sizeof(dhcp_header_t) + options_offset);
-    
-    dhcp_client.state = DHCP_STATE_REQUESTING;
-    
-    kfree(dhcp_packet);
-    terminal_writestring("DHCP REQUEST sent\n");
+    dhcp_begin_exchange(DHCP_STATE_SELECTING);
 }
 
-int dhcp_parse_options(uint8_t* options, size_t length) {
+int dhcp_parse_options(uint8_t* options, size_t length, dhcp_lease_t* lease) {
     size_t offset = 0;
     uint8_t msg_type = 0;
     
@@ -224,48 +295,58 @@ int dhcp_parse_options(uint8_t* options, size_t length) {
             break;
         }
         
+        uint8_t* value = options + offset;
+        uint32_t number = option_length == 4 ?
+            ((uint32_t)value[0] << 24) | ((uint32_t)value[1] << 16) |
+            ((uint32_t)value[2] << 8) | (uint32_t)value[3] : 0;
+        
         switch (option_type) {
             case DHCP_OPTION_MESSAGE_TYPE:
                 if (option_length == 1) {
-                    msg_type = options[offset];
+                    msg_type = value[0];
                 }
                 break;
                 
             case DHCP_OPTION_SUBNET_MASK:
                 if (option_length == 4) {
-                    for (int i = 0; i < 4; i++) {
-                        dhcp_client.subnet_mask.addr[i] = options[offset + i];
-                    }
+                    dhcp_copy_bytes(lease->subnet_mask.addr, value, 4);
                 }
                 break;
                 
+            // Lists: the first entry is the preferred one
             case DHCP_OPTION_ROUTER:
                 if (option_length >= 4) {
-                    for (int i = 0; i < 4; i++) {
-                        dhcp_client.router.addr[i] = options[offset + i];
-                    }
+                    dhcp_copy_bytes(lease->router.addr, value, 4);
                 }
                 break;
                 
             case DHCP_OPTION_DNS_SERVER:
                 if (option_length >= 4) {
-                    for (int i = 0; i < 4; i++) {
-                        dhcp_client.dns_server.addr[i] = options[offset + i];
-                    }
+                    dhcp_copy_bytes(lease->dns_server.addr, value, 4);
                 }
                 break;
                 
             case DHCP_OPTION_LEASE_TIME:
                 if (option_length == 4) {
-                    dhcp_client.lease_time = ntohl(*(uint32_t*)(options + offset));
+                    lease->lease_time = number;
+                }
+                break;
+                
+            case DHCP_OPTION_RENEWAL_TIME:
+                if (option_length == 4) {
+                    lease->renewal_time = number;
+                }
+                break;
+                
+            case DHCP_OPTION_REBINDING_TIME:
+                if (option_length == 4) {
+                    lease->rebind_time = number;
                 }
                 break;
                 
             case DHCP_OPTION_SERVER_IDENTIFIER:
                 if (option_length == 4) {
-                    for (int i = 0; i < 4; i++) {
-                        dhcp_client.server_ip.addr[i] = options[offset + i];
-                    }
+                    dhcp_copy_bytes(lease->server_ip.addr, value, 4);
                 }
                 break;
         }
@@ -276,72 +357,392 @@ int dhcp_parse_options(uint8_t* options, size_t length) {
     return msg_type;
 }
 
-void dhcp_configure_interface(void) {
-    net_set_interface(net_get_interface()->mac, dhcp_client.offered_ip, 
-                     dhcp_client.subnet_mask, dhcp_client.router);
-    
-    terminal_writestring("DHCP configuration applied:\n");
-    terminal_writestring("  IP: ");
-    terminal_writestring(ip_to_string(&dhcp_client.offered_ip));
-    terminal_writestring("\n  Netmask: ");
-    terminal_writestring(ip_to_string(&dhcp_client.subnet_mask));
-    terminal_writestring("\n  Gateway: ");
-    terminal_writestring(ip_to_string(&dhcp_client.router));
-    terminal_writestring("\n");
+// Fill in missing or inconsistent times: T1 = 0.5, T2 = 0.875 of the lease
+static void dhcp_normalize_times(dhcp_lease_t* lease) {
+    if (lease->lease_time == 0 || lease->lease_time > DHCP_MAX_LEASE) {
+        lease->lease_time = DHCP_MAX_LEASE;
+    }
+    if (lease->rebind_time == 0 || lease->rebind_time >= lease->lease_time) {
+        lease->rebind_time = lease->lease_time - lease->lease_time / 8;
+    }
+    if (lease->renewal_time == 0 || lease->renewal_time >= lease->rebind_time) {
+        lease->renewal_time = lease->lease_time / 2;
+    }
 }
 
-void dhcp_handle_packet(net_buffer_t* buffer, size_t offset) {
-    if (buffer->length < offset + sizeof(dhcp_header_t)) {
-        return;
+static void dhcp_configure_interface(void) {
+    dhcp_lease_t* lease = &dhcp_client.lease;
+    net_set_interface(net_get_interface()->mac, lease->address, lease->subnet_mask, lease->router);
+    
+    uint32_t dns_ip = dhcp_ip_to_u32(&lease->dns_server);
+    if (dns_ip != 0) {
+        dns_set_server(dns_ip);
     }
+}
+
+static int dhcp_same_lease(const dhcp_lease_t* a, const dhcp_lease_t* b) {
+    return dhcp_same_bytes(a->address.addr, b->address.addr, 4) &&
+           dhcp_same_bytes(a->server_ip.addr, b->server_ip.addr, 4) &&
+           dhcp_same_bytes(a->subnet_mask.addr, b->subnet_mask.addr, 4) &&
+           dhcp_same_bytes(a->router.addr, b->router.addr, 4) &&
+           dhcp_same_bytes(a->dns_server.addr, b->dns_server.addr, 4) &&
+           a->lease_time == b->lease_time;
+}
+
+// ACK in any requesting state: take the lease, start its timers, and
+// reconfigure the interface only if the address or routes changed
+static void dhcp_bind(dhcp_lease_t* offer) {
+    dhcp_client_t* client = &dhcp_client;
+    net_interface_t* iface = net_get_interface();
+    
+    dhcp_normalize_times(offer);
     
-    dhcp_header_t* dhcp_hdr = (dhcp_header_t*)(buffer->data + offset);
+    int reconfigure = !iface->active ||
+        !dhcp_same_bytes(iface->ip.addr, offer->address.addr, 4) ||
+        !dhcp_same_bytes(iface->netmask.addr, offer->subnet_mask.addr, 4) ||
+        !dhcp_same_bytes(iface->gateway.addr, offer->router.addr, 4);
+    
+    // Renewals normally change nothing worth a disk write
+    if (!client->stored_valid || !dhcp_same_lease(&client->stored, offer)) {
+        client->lease_dirty = 1;
+    }
     
-    // Check if this is a reply and for us
-    if (dhcp_hdr->op != DHCP_BOOTREPLY || 
-        ntohl(dhcp_hdr->xid) != dhcp_client.transaction_id) {
+    dhcp_state_t from = client->state;
+    client->lease = *offer;
+    client->have_lease = 1;
+    client->state = DHCP_STATE_BOUND;
+    
+    // Lease times count from when the REQUEST went out
+    client->lease_start = client->request_sent;
+    client->renew_at = client->lease_start + dhcp_seconds_to_ticks(offer->renewal_time);
+    client->rebind_at = client->lease_start + dhcp_seconds_to_ticks(offer->rebind_time);
+    client->expires_at = client->lease_start + dhcp_seconds_to_ticks(offer->lease_time);
+    
+    client->bound_ms = (timer_get_ticks() - client->exchange_start) * TIMER_MS_PER_TICK;
+    client->bound_from = from == DHCP_STATE_REQUESTING ? DHCP_STATE_INIT :
+                         from == DHCP_STATE_REBOOTING ? DHCP_STATE_INIT_REBOOT : from;
+    
+    if (reconfigure) {
+        dhcp_configure_interface();
+        terminal_writestring("DHCP: bound to ");
+        terminal_writestring(ip_to_string(&offer->address));
+        terminal_writestring(" via ");
+        terminal_writestring(dhcp_state_name(client->bound_from));
+        terminal_writestring(" in ");
+        dhcp_write_uint(client->bound_ms);
+        terminal_writestring(" ms\n");
+    }
+}
+
+void dhcp_handle_packet(uint8_t* data, size_t length) {
+    if (length < sizeof(dhcp_header_t) || !dhcp_client.active) {
         return;
     }
     
-    // Check magic cookie
-    if (ntohl(dhcp_hdr->cookie) != DHCP_MAGIC_COOKIE) {
+    dhcp_header_t* dhcp_hdr = (dhcp_header_t*)data;
+    net_interface_t* iface = net_get_interface();
+    
+    // Check if this is a reply to our current exchange
+    if (dhcp_hdr->op != DHCP_BOOTREPLY ||
+        ntohl(dhcp_hdr->xid) != dhcp_client.transaction_id ||
+        ntohl(dhcp_hdr->cookie) != DHCP_MAGIC_COOKIE ||
+        !dhcp_same_bytes(dhcp_hdr->chaddr, iface->mac.addr, 6)) {
         return;
     }
     
-    // Parse options
-    uint8_t* options = buffer->data + offset + sizeof(dhcp_header_t);
-    size_t options_length = buffer->length - offset - sizeof(dhcp_header_t);
+    // Parse into a scratch lease; only an accepted reply replaces ours.
+    // Renewal ACKs may omit what did not change.
+    dhcp_lease_t offer;
+    uint8_t* zero = (uint8_t*)&offer;
+    for (size_t i = 0; i < sizeof(offer); i++) {
+        zero[i] = 0;
+    }
+    if (dhcp_client.state == DHCP_STATE_RENEWING || dhcp_client.state == DHCP_STATE_REBINDING) {
+        offer.server_ip = dhcp_client.lease.server_ip;
+        offer.subnet_mask = dhcp_client.lease.subnet_mask;
+        offer.router = dhcp_client.lease.router;
+        offer.dns_server = dhcp_client.lease.dns_server;
+    } else if (dhcp_client.state == DHCP_STATE_REQUESTING) {
+        offer.server_ip = dhcp_client.lease.server_ip;
+    }
     
-    uint8_t msg_type = dhcp_parse_options(options, options_length);
+    uint8_t msg_type = dhcp_parse_options(data + sizeof(dhcp_header_t),
+                                          length - sizeof(dhcp_header_t), &offer);
+    dhcp_copy_bytes(offer.address.addr, (uint8_t*)&dhcp_hdr->yiaddr, 4);
     
     switch (dhcp_client.state) {
         case DHCP_STATE_SELECTING:
-            if (msg_type == DHCP_MSG_OFFER) {
-                terminal_writestring("Received DHCP OFFER\n");
-                
-                // Store offered IP
-                for (int i = 0; i < 4; i++) {
-                    dhcp_client.offered_ip.addr[i] = (dhcp_hdr->yiaddr >> (i * 8)) & 0xFF;
-                }
-                
-                // Send REQUEST
-                dhcp_send_request(dhcp_client.server_ip, dhcp_client.offered_ip);
+            // Take the first usable offer; REQUEST keeps the same xid
+            if (msg_type == DHCP_MSG_OFFER && dhcp_ip_to_u32(&offer.address) != 0 &&
+                dhcp_ip_to_u32(&offer.server_ip) != 0) {
+                dhcp_client.lease = offer;
+                dhcp_client.state = DHCP_STATE_REQUESTING;
+                dhcp_client.retries = 0;
+                dhcp_send_message(DHCP_MSG_REQUEST);
+                dhcp_arm_retry(DHCP_INITIAL_TIMEOUT);
             }
             break;
             
         case DHCP_STATE_REQUESTING:
-            if (msg_type == DHCP_MSG_ACK) {
-                terminal_writestring("Received DHCP ACK\n");
-                dhcp_client.state = DHCP_STATE_BOUND;
-                dhcp_configure_interface();
+        case DHCP_STATE_REBOOTING:
+        case DHCP_STATE_RENEWING:
+        case DHCP_STATE_REBINDING:
+            if (msg_type == DHCP_MSG_ACK && dhcp_ip_to_u32(&offer.address) != 0) {
+                dhcp_bind(&offer);
             } else if (msg_type == DHCP_MSG_NAK) {
-                terminal_writestring("Received DHCP NAK, restarting...\n");
-                dhcp_client.state = DHCP_STATE_INIT;
-                dhcp_send_discover();
+                // The address is no longer ours to ask for
+                dhcp_restart(1);
             }
             break;
             
         default:
             break;
     }
+}
+
+void dhcp_timer_tick(void) {
+    dhcp_client_t* client = &dhcp_client;
+    if (!client->active) return;
+    
+    uint32_t now = timer_get_ticks();
+    
+    switch (client->state) {
+        case DHCP_STATE_SELECTING:
+        case DHCP_STATE_REQUESTING:
+        case DHCP_STATE_REBOOTING:
+            if (!dhcp_expired(now, client->retry_deadline)) break;
+            
+            client->retries++;
+            if (client->state == DHCP_STATE_REBOOTING && client->retries >= DHCP_REBOOT_RETRIES) {
+                // Nobody confirmed the old lease: keep it as a DISCOVER hint
+                dhcp_begin_exchange(DHCP_STATE_SELECTING);
+            } else if (client->state == DHCP_STATE_REQUESTING && client->retries >= DHCP_MAX_RETRIES) {
+                dhcp_begin_exchange(DHCP_STATE_SELECTING);
+            } else {
+                // DISCOVER keeps trying at the longest interval
+                uint32_t timeout = client->timeout * 2;
+                if (timeout > DHCP_MAX_TIMEOUT) timeout = DHCP_MAX_TIMEOUT;
+                dhcp_send_message(client->state == DHCP_STATE_SELECTING ?
+                                  DHCP_MSG_DISCOVER : DHCP_MSG_REQUEST);
+                dhcp_arm_retry(timeout);
+            }
+            break;
+            
+        case DHCP_STATE_BOUND:
+            if (dhcp_expired(now, client->renew_at)) {
+                dhcp_begin_exchange(DHCP_STATE_RENEWING);
+            }
+            break;
+            
+        case DHCP_STATE_RENEWING:
+            if (dhcp_expired(now, client->rebind_at)) {
+                dhcp_begin_exchange(DHCP_STATE_REBINDING);
+            } else if (dhcp_expired(now, client->retry_deadline)) {
+                dhcp_send_message(DHCP_MSG_REQUEST);
+                dhcp_arm_renew_retry(client->rebind_at);
+            }
+            break;
+            
+        case DHCP_STATE_REBINDING:
+            if (dhcp_expired(now, client->expires_at)) {
+                dhcp_restart(1);
+            } else if (dhcp_expired(now, client->retry_deadline)) {
+                dhcp_send_message(DHCP_MSG_REQUEST);
+                dhcp_arm_renew_retry(client->expires_at);
+            }
+            break;
+            
+        default:
+            break;
+    }
+}
+
+static uint32_t dhcp_record_checksum(const dhcp_lease_record_t* record) {
+    const uint8_t* bytes = (const uint8_t*)record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(*record) - sizeof(record->checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void dhcp_load_lease(void) {
+    dhcp_lease_record_t record;
+    vfs_node_t* file = vfs_lookup(DHCP_LEASE_PATH);
+    if (!file || file->type != VFS_FILE ||
+        vfs_read(file, 0, &record, sizeof(record)) != (int)sizeof(record)) {
+        return;
+    }
+    
+    if (record.magic != DHCP_LEASE_MAGIC || record.checksum != dhcp_record_checksum(&record) ||
+        !dhcp_same_bytes(record.mac, net_get_interface()->mac.addr, 6)) {
+        return;
+    }
+    
+    dhcp_lease_t* lease = &dhcp_client.lease;
+    dhcp_copy_bytes(lease->address.addr, record.address, 4);
+    dhcp_copy_bytes(lease->server_ip.addr, record.server_ip, 4);
+    dhcp_copy_bytes(lease->subnet_mask.addr, record.subnet_mask, 4);
+    dhcp_copy_bytes(lease->router.addr, record.router, 4);
+    dhcp_copy_bytes(lease->dns_server.addr, record.dns_server, 4);
+    lease->lease_time = record.lease_time;
+    lease->renewal_time = 0;
+    lease->rebind_time = 0;
+    dhcp_client.have_lease = 1;
+    dhcp_client.stored = *lease;
+    dhcp_client.stored_valid = 1;
+}
+
+// Write the lease record if it changed. Disk I/O must not run in interrupt
+// context, where the state machine lives, so this runs as deferred work.
+void dhcp_sync(void) {
+    if (!dhcp_client.lease_dirty) return;
+    
+    dhcp_lease_record_t record;
+    uint8_t* zero = (uint8_t*)&record;
+    for (size_t i = 0; i < sizeof(record); i++) {
+        zero[i] = 0;
+    }
+    
+    // Snapshot a consistent lease; a cleared record forgets it
+    uint32_t irq_flags = irq_save();
+    dhcp_client.lease_dirty = 0;
+    dhcp_client.stored = dhcp_client.lease;
+    dhcp_client.stored_valid = dhcp_client.have_lease;
+    if (dhcp_client.have_lease) {
+        dhcp_lease_t* lease = &dhcp_client.lease;
+        record.magic = DHCP_LEASE_MAGIC;
+        dhcp_copy_bytes(record.mac, net_get_interface()->mac.addr, 6);
+        dhcp_copy_bytes(record.address, lease->address.addr, 4);
+        dhcp_copy_bytes(record.server_ip, lease->server_ip.addr, 4);
+        dhcp_copy_bytes(record.subnet_mask, lease->subnet_mask.addr, 4);
+        dhcp_copy_bytes(record.router, lease->router.addr, 4);
+        dhcp_copy_bytes(record.dns_server, lease->dns_server.addr, 4);
+        record.lease_time = lease->lease_time;
+        record.checksum = dhcp_record_checksum(&record);
+    }
+    irq_restore(irq_flags);
+    
+    // Only a lease worth keeping creates the file
+    vfs_node_t* file = record.magic ? vfs_create(DHCP_LEASE_PATH) : vfs_lookup(DHCP_LEASE_PATH);
+    if (file && file->type == VFS_FILE) {
+        vfs_write(file, 0, &record, sizeof(record));
+    }
+}
+
+void dhcp_init(void) {
+    uint8_t* zero = (uint8_t*)&dhcp_client;
+    for (size_t i = 0; i < sizeof(dhcp_client); i++) {
+        zero[i] = 0;
+    }
+    dhcp_client.state = DHCP_STATE_INIT;
+    
+    dhcp_socket = udp_socket_create();
+    if (dhcp_socket) {
+        udp_socket_bind(dhcp_socket, 0, UDP_PORT_DHCP_CLIENT);
+        udp_socket_set_handler(dhcp_socket, dhcp_receive, NULL);
+    }
+    
+    dhcp_load_lease();
+    timer_register_callback(dhcp_timer_tick, DHCP_TIMER_INTERVAL);
+    work_register(dhcp_sync, DHCP_TIMER_INTERVAL);
+    
+    terminal_writestring(dhcp_client.have_lease ? "DHCP client initialized (saved lease found)\n" :
+                                                  "DHCP client initialized\n");
+}
+
+// Begin acquiring an address: INIT-REBOOT confirms a saved lease with one
+// REQUEST, INIT discovers from scratch
+void dhcp_start(void) {
+    uint32_t irq_flags = irq_save();
+    if (!dhcp_client.active) {
+        dhcp_client.active = 1;
+        if (dhcp_client.have_lease) {
+            dhcp_client.state = DHCP_STATE_INIT_REBOOT;
+            dhcp_begin_exchange(DHCP_STATE_REBOOTING);
+        } else {
+            dhcp_client.state = DHCP_STATE_INIT;
+            dhcp_begin_exchange(DHCP_STATE_SELECTING);
+        }
+    }
+    irq_restore(irq_flags);
+}
+
+// Renew now instead of at T1
+void dhcp_renew(void) {
+    uint32_t irq_flags = irq_save();
+    if (!dhcp_client.active) {
+        irq_restore(irq_flags);
+        dhcp_start();
+        return;
+    }
+    if (dhcp_client.state == DHCP_STATE_BOUND) {
+        dhcp_begin_exchange(DHCP_STATE_RENEWING);
+    }
+    irq_restore(irq_flags);
+}
+
+// Hand the address back to the server and stop
+void dhcp_release(void) {
+    uint32_t irq_flags = irq_save();
+    dhcp_state_t state = dhcp_client.state;
+    if (state == DHCP_STATE_BOUND || state == DHCP_STATE_RENEWING || state == DHCP_STATE_REBINDING) {
+        dhcp_send_message(DHCP_MSG_RELEASE);
+        net_interface_unconfigure(net_get_interface());
+    }
+    dhcp_client.have_lease = 0;
+    dhcp_client.lease_dirty = dhcp_client.stored_valid;
+    dhcp_client.active = 0;
+    dhcp_client.state = DHCP_STATE_INIT;
+    irq_restore(irq_flags);
+}
+
+static void dhcp_write_remaining(const char* label, uint32_t deadline, uint32_t now) {
+    terminal_writestring(label);
+    if (dhcp_expired(now, deadline)) {
+        terminal_writestring("passed");
+    } else {
+        dhcp_write_uint((deadline - now) / TIMER_FREQUENCY);
+        terminal_writestring(" s");
+    }
+}
+
+void dhcp_dump(void) {
+    dhcp_client_t* client = &dhcp_client;
+    uint32_t now = timer_get_ticks();
+    
+    terminal_writestring("DHCP state: ");
+    terminal_writestring(client->active ? dhcp_state_name(client->state) : "stopped");
+    terminal_writestring("\n");
+    
+    if (!client->have_lease) {
+        terminal_writestring("No lease\n");
+        return;
+    }
+    
+    terminal_writestring("Address ");
+    terminal_writestring(ip_to_string(&client->lease.address));
+    terminal_writestring("  netmask ");
+    terminal_writestring(ip_to_string(&client->lease.subnet_mask));
+    terminal_writestring("  router ");
+    terminal_writestring(ip_to_string(&client->lease.router));
+    terminal_writestring("\nServer ");
+    terminal_writestring(ip_to_string(&client->lease.server_ip));
+    terminal_writestring("  DNS ");
+    terminal_writestring(ip_to_string(&client->lease.dns_server));
+    terminal_writestring("  lease ");
+    dhcp_write_uint(client->lease.lease_time);
+    terminal_writestring(" s\n");
+    
+    if (client->active && (client->state == DHCP_STATE_BOUND || client->state == DHCP_STATE_RENEWING ||
+                           client->state == DHCP_STATE_REBINDING)) {
+        dhcp_write_remaining("Renew in ", client->renew_at, now);
+        dhcp_write_remaining(", rebind in ", client->rebind_at, now);
+        dhcp_write_remaining(", expires in ", client->expires_at, now);
+        terminal_writestring("\nLast acquired via ");
+        terminal_writestring(dhcp_state_name(client->bound_from));
+        terminal_writestring(" in ");
+        dhcp_write_uint(client->bound_ms);
+        terminal_writestring(" ms\n");
+    }
 }
\ No newline at end of file
@@ -1,7 +1,36 @@
 #include "../include/disk.h"
 #include "../include/interrupts.h"
+#include "../include/pci.h"
+#include "../include/memory.h"
+#include "../include/scheduler.h"
+#include "../include/ahci.h"
+
+extern void terminal_writestring(const char* data);
+
+#define ATA_PRD_MAX (PAGE_SIZE / sizeof(ata_prd_t))
+#define ATA_MAX_SECTORS_LBA28 256
+#define ATA_MAX_SECTORS_LBA48 65536
+// Every PRD covers at most 64 KB; keep one entry spare for misalignment
+#define ATA_DMA_MAX_SECTORS ((ATA_PRD_MAX - 1) * (0x10000 / DISK_SECTOR_SIZE))
+#define ATA_DMA_TIMEOUT_TICKS TIMER_MS_TO_TICKS(5000)
+#define ATA_DMA_POLL_LIMIT 50000000
+#define ATA_RESET_POLL_LIMIT 10000000
+
+// One IDE channel; DMA completion is signalled from its IRQ handler
+typedef struct {
+    uint16_t base;
+    uint16_t bmide;               // Bus-master register block, 0 if none
+    ata_prd_t* prdt;
+    volatile bool active;         // DMA command in flight
+    volatile bool done;
+    volatile uint8_t bm_status;
+    volatile uint8_t ata_status;
+    wait_queue_t wait;
+} ata_channel_t;
 
 static disk_info_t disks[MAX_DISKS];
+static ata_channel_t channels[2];
+static bool disk_dma_enabled = true;
 static bool disk_system_initialized = false;
 
 // I/O port operations
@@ -25,6 +54,26 @@ static inline uint16_t inw(uint16_t port) {
     return result;
 }
 
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile ("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static void disk_itoa(uint32_t value, char* str) {
+    char temp[12];
+    int pos = 0;
+    
+    do {
+        temp[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    
+    int i = 0;
+    while (pos > 0) {
+        str[i++] = temp[--pos];
+    }
+    str[i] = '\0';
+}
+
 static void ata_wait_bsy(uint16_t base) {
     while (inb(base + ATA_REG_STATUS) & ATA_STATUS_BSY) {
         // Wait for BSY to clear
@@ -72,27 +121,41 @@ static bool ata_identify(uint16_t base, uint8_t drive, uint16_t* buffer) {
     return true;
 }
 
-static bool ata_read_sectors(uint16_t base, uint8_t drive, uint32_t lba, uint8_t count, void* buffer) {
-    uint16_t* buf = (uint16_t*)buffer;
-    
-    // Select drive and set LBA mode
-    outb(base + ATA_REG_DRIVE, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
-    
-    // Wait for drive to be ready
-    ata_wait_bsy(base);
+// Select the drive and load LBA and sector count. LBA48 writes each
+// register twice, high-order byte first; a count of 0 means 65536
+// (LBA48) or 256 (LBA28) sectors.
+static void ata_setup_command(uint16_t base, uint8_t drive, uint64_t lba, uint32_t count, bool lba48) {
+    if (lba48) {
+        outb(base + ATA_REG_DRIVE, 0x40 | (drive << 4));
+        ata_wait_bsy(base);
+        
+        outb(base + ATA_REG_SECCOUNT, (count >> 8) & 0xFF);
+        outb(base + ATA_REG_LBA_LO, (lba >> 24) & 0xFF);
+        outb(base + ATA_REG_LBA_MID, (lba >> 32) & 0xFF);
+        outb(base + ATA_REG_LBA_HI, (lba >> 40) & 0xFF);
+    } else {
+        outb(base + ATA_REG_DRIVE, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
+        ata_wait_bsy(base);
+    }
     
-    // Set sector count and LBA
-    outb(base + ATA_REG_SECCOUNT, count);
+    outb(base + ATA_REG_SECCOUNT, count & 0xFF);
     outb(base + ATA_REG_LBA_LO, lba & 0xFF);
     outb(base + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
     outb(base + ATA_REG_LBA_HI, (lba >> 16) & 0xFF);
+}
+
+static bool ata_read_sectors(uint16_t base, uint8_t drive, uint64_t lba, uint32_t count, bool lba48, void* buffer) {
+    uint16_t* buf = (uint16_t*)buffer;
+    
+    ata_setup_command(base, drive, lba, count, lba48);
     
     // Send READ SECTORS command
-    outb(base + ATA_REG_COMMAND, ATA_CMD_READ_SECTORS);
+    outb(base + ATA_REG_COMMAND, lba48 ? ATA_CMD_READ_SECTORS_EXT : ATA_CMD_READ_SECTORS);
     
     // Read each sector
-    for (int sector = 0; sector < count; sector++) {
+    for (uint32_t sector = 0; sector < count; sector++) {
         // Wait for data to be ready
+        ata_wait_bsy(base);
         ata_wait_drq(base);
         
         // Check for errors
@@ -109,27 +172,18 @@ static bool ata_read_sectors(uint16_t base, uint8_t drive, uint32_t lba, uint8_t
     return true;
 }
 
-static bool ata_write_sectors(uint16_t base, uint8_t drive, uint32_t lba, uint8_t count, const void* buffer) {
+static bool ata_write_sectors(uint16_t base, uint8_t drive, uint64_t lba, uint32_t count, bool lba48, const void* buffer) {
     const uint16_t* buf = (const uint16_t*)buffer;
     
-    // Select drive and set LBA mode
-    outb(base + ATA_REG_DRIVE, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
-    
-    // Wait for drive to be ready
-    ata_wait_bsy(base);
-    
-    // Set sector count and LBA
-    outb(base + ATA_REG_SECCOUNT, count);
-    outb(base + ATA_REG_LBA_LO, lba & 0xFF);
-    outb(base + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
-    outb(base + ATA_REG_LBA_HI, (lba >> 16) & 0xFF);
+    ata_setup_command(base, drive, lba, count, lba48);
     
     // Send WRITE SECTORS command
-    outb(base + ATA_REG_COMMAND, ATA_CMD_WRITE_SECTORS);
+    outb(base + ATA_REG_COMMAND, lba48 ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_WRITE_SECTORS);
     
     // Write each sector
-    for (int sector = 0; sector < count; sector++) {
+    for (uint32_t sector = 0; sector < count; sector++) {
         // Wait for drive to be ready for data
+        ata_wait_bsy(base);
         ata_wait_drq(base);
         
         // Check for errors
@@ -143,14 +197,236 @@ static bool ata_write_sectors(uint16_t base, uint8_t drive, uint32_t lba, uint8_
         }
     }
     
+    // The last sector is only committed once BSY drops
+    ata_wait_bsy(base);
+    return !(inb(base + ATA_REG_STATUS) & (ATA_STATUS_ERR | ATA_STATUS_DF));
+}
+
+// Stop the engine and latch the result; runs from the IRQ handler or
+// from the polling loop, always with interrupts disabled
+static void ata_dma_complete(ata_channel_t* ch, uint8_t bm_status) {
+    outb(ch->bmide + ATA_BM_REG_COMMAND, 0);
+    ch->ata_status = inb(ch->base + ATA_REG_STATUS); // Also acks the drive
+    outb(ch->bmide + ATA_BM_REG_STATUS, bm_status | ATA_BM_STATUS_IRQ);
+    ch->bm_status = bm_status;
+    ch->active = false;
+    ch->done = true;
+    wake_up(&ch->wait);
+}
+
+static void ata_channel_irq(ata_channel_t* ch) {
+    if (!ch->bmide) {
+        return;
+    }
+    
+    uint8_t bm_status = inb(ch->bmide + ATA_BM_REG_STATUS);
+    if (!(bm_status & ATA_BM_STATUS_IRQ)) {
+        return;
+    }
+    
+    if (ch->active) {
+        ata_dma_complete(ch, bm_status);
+    } else {
+        // A PIO command finished; the PIO path polls, just clear the latch
+        outb(ch->bmide + ATA_BM_REG_STATUS, bm_status);
+    }
+}
+
+static void ata_primary_irq(registers_t regs) {
+    (void)regs;
+    ata_channel_irq(&channels[0]);
+}
+
+static void ata_secondary_irq(registers_t regs) {
+    (void)regs;
+    ata_channel_irq(&channels[1]);
+}
+
+// Describe the buffer with PRDs. Memory is identity mapped, so the
+// virtual address is also the bus address.
+static bool ata_build_prdt(ata_channel_t* ch, void* buffer, uint32_t bytes) {
+    uint32_t address = (uint32_t)buffer;
+    uint32_t entry = 0;
+    
+    while (bytes > 0) {
+        if (entry == ATA_PRD_MAX) {
+            return false;
+        }
+        
+        uint32_t chunk = 0x10000 - (address & 0xFFFF);
+        if (chunk > bytes) {
+            chunk = bytes;
+        }
+        
+        ch->prdt[entry].address = address;
+        ch->prdt[entry].bytes = (uint16_t)chunk;
+        ch->prdt[entry].flags = 0;
+        address += chunk;
+        bytes -= chunk;
+        entry++;
+    }
+    
+    ch->prdt[entry - 1].flags = ATA_PRD_EOT;
     return true;
 }
 
+// Software reset after a command timed out: the drive may still be busy
+// with it. Holds SRST for over 5 us (each status read takes ~1 us), then
+// waits for BSY to clear. A drive that never comes back is left busy,
+// which ata_transfer checks before falling back to PIO.
+static void ata_reset(ata_channel_t* ch) {
+    uint16_t control = ch->base + ATA_REG_CONTROL;
+    
+    outb(control, ATA_CTRL_SRST);
+    for (int i = 0; i < 10; i++) {
+        inb(control);
+    }
+    outb(control, 0);
+    
+    for (uint32_t spin = 0; spin < ATA_RESET_POLL_LIMIT; spin++) {
+        if (!(inb(control) & ATA_STATUS_BSY)) {
+            return;
+        }
+    }
+}
+
+static bool ata_dma_transfer(ata_channel_t* ch, uint8_t drive, uint64_t lba, uint32_t count, bool lba48,
+                             void* buffer, bool write) {
+    if (!ata_build_prdt(ch, buffer, (uint32_t)count * DISK_SECTOR_SIZE)) {
+        return false;
+    }
+    
+    uint32_t flags = irq_save();
+    uint8_t direction = write ? 0 : ATA_BM_CMD_READ;
+    
+    // Load the table, set the direction and clear stale status
+    outb(ch->bmide + ATA_BM_REG_COMMAND, 0);
+    outl(ch->bmide + ATA_BM_REG_PRDT, (uint32_t)ch->prdt);
+    outb(ch->bmide + ATA_BM_REG_COMMAND, direction);
+    outb(ch->bmide + ATA_BM_REG_STATUS,
+         inb(ch->bmide + ATA_BM_REG_STATUS) | ATA_BM_STATUS_ERR | ATA_BM_STATUS_IRQ);
+    ch->done = false;
+    ch->active = true;
+    
+    ata_setup_command(ch->base, drive, lba, count, lba48);
+    if (lba48) {
+        outb(ch->base + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+    } else {
+        outb(ch->base + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    }
+    outb(ch->bmide + ATA_BM_REG_COMMAND, direction | ATA_BM_CMD_START);
+    
+    if (flags & 0x200) {
+        // Halt until IRQ 14/15 reports completion
+        while (!ch->done) {
+            if (!wait_queue_sleep_timeout(&ch->wait, ATA_DMA_TIMEOUT_TICKS)) {
+                break;
+            }
+        }
+    } else {
+        // Interrupts are off (early boot or a timer callback): poll
+        for (uint32_t spin = 0; !ch->done && spin < ATA_DMA_POLL_LIMIT; spin++) {
+            uint8_t bm_status = inb(ch->bmide + ATA_BM_REG_STATUS);
+            if (bm_status & ATA_BM_STATUS_IRQ) {
+                ata_dma_complete(ch, bm_status);
+            }
+        }
+    }
+    
+    if (!ch->done) {
+        // Stop the engine, then abort the command still on the drive so
+        // the PIO retry starts from an idle channel
+        outb(ch->bmide + ATA_BM_REG_COMMAND, 0);
+        ch->active = false;
+        ata_reset(ch);
+        outb(ch->bmide + ATA_BM_REG_STATUS,
+             inb(ch->bmide + ATA_BM_REG_STATUS) | ATA_BM_STATUS_ERR | ATA_BM_STATUS_IRQ);
+        irq_restore(flags);
+        return false;
+    }
+    
+    bool ok = !(ch->bm_status & ATA_BM_STATUS_ERR) &&
+              !(ch->ata_status & (ATA_STATUS_ERR | ATA_STATUS_DF));
+    irq_restore(flags);
+    return ok;
+}
+
+// Find the PCI IDE controller and give each channel a PRD table. Only
+// compatibility mode is handled, where the channels sit at the legacy
+// ports and interrupt on IRQ 14/15.
+static void ata_dma_init(void) {
+    channels[0].base = ATA_PRIMARY_BASE;
+    channels[1].base = ATA_SECONDARY_BASE;
+    for (int i = 0; i < 2; i++) {
+        channels[i].bmide = 0;
+        channels[i].active = false;
+        wait_queue_init(&channels[i].wait);
+    }
+    
+    register_interrupt_handler(ATA_IRQ_PRIMARY, ata_primary_irq);
+    register_interrupt_handler(ATA_IRQ_SECONDARY, ata_secondary_irq);
+    
+    pci_device_t ide;
+    if (!pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_IDE, &ide)) {
+        return;
+    }
+    
+    // prog_if bit 7: bus master capable; bits 0/2: channel in native mode
+    uint32_t bar4 = ide.base_addresses[4];
+    if (!(ide.prog_if & 0x80) || (ide.prog_if & 0x05) || !(bar4 & 1) || !(bar4 & 0xFFFC)) {
+        return;
+    }
+    
+    pci_enable_bus_master(&ide);
+    
+    for (int i = 0; i < 2; i++) {
+        channels[i].prdt = (ata_prd_t*)pmm_alloc_page();
+        if (channels[i].prdt) {
+            channels[i].bmide = (uint16_t)((bar4 & 0xFFFC) + i * ATA_BM_CHANNEL_SIZE);
+        }
+    }
+}
+
+// Fill in capacity and identification strings from IDENTIFY DEVICE data
+void disk_parse_identify(disk_info_t* disk, const uint16_t* identify) {
+    disk->present = true;
+    disk->sector_size = DISK_SECTOR_SIZE;
+    
+    // Get drive capacity
+    if (identify[83] & (1 << 10)) { // LBA48 support
+        disk->is_lba48 = true;
+        disk->sectors = (uint64_t)identify[100] | ((uint64_t)identify[101] << 16) |
+                        ((uint64_t)identify[102] << 32) | ((uint64_t)identify[103] << 48);
+    } else {
+        disk->is_lba48 = false;
+        disk->sectors = (uint32_t)identify[60] | ((uint32_t)identify[61] << 16);
+    }
+    
+    // Extract model string (words 27-46)
+    for (int i = 0; i < 20; i++) {
+        disk->model[i * 2] = (identify[27 + i] >> 8) & 0xFF;
+        disk->model[i * 2 + 1] = identify[27 + i] & 0xFF;
+    }
+    disk->model[40] = '\0';
+    
+    // Extract serial number (words 10-19)
+    for (int i = 0; i < 10; i++) {
+        disk->serial[i * 2] = (identify[10 + i] >> 8) & 0xFF;
+        disk->serial[i * 2 + 1] = identify[10 + i] & 0xFF;
+    }
+    disk->serial[20] = '\0';
+}
+
 bool disk_detect(uint32_t disk_id) {
     if (disk_id >= MAX_DISKS) {
         return false;
     }
     
+    if (disk_id >= DISK_AHCI_BASE) {
+        disks[disk_id].present = ahci_identify(disk_id - DISK_AHCI_BASE, &disks[disk_id]);
+        return disks[disk_id].present;
+    }
+    
     uint16_t identify_buffer[256];
     uint16_t base;
     uint8_t drive;
@@ -173,32 +449,11 @@ bool disk_detect(uint32_t disk_id) {
     // Parse identification data
     disk_info_t* disk = &disks[disk_id];
     disk->disk_id = disk_id;
-    disk->present = true;
     disk->type = DISK_TYPE_ATA_PATA;
-    disk->sector_size = DISK_SECTOR_SIZE;
-    
-    // Get drive capacity
-    if (identify_buffer[83] & (1 << 10)) { // LBA48 support
-        disk->is_lba48 = true;
-        disk->sectors = *((uint64_t*)&identify_buffer[100]);
-    } else {
-        disk->is_lba48 = false;
-        disk->sectors = *((uint32_t*)&identify_buffer[60]);
-    }
-    
-    // Extract model string (words 27-46)
-    for (int i = 0; i < 20; i++) {
-        disk->model[i * 2] = (identify_buffer[27 + i] >> 8) & 0xFF;
-        disk->model[i * 2 + 1] = identify_buffer[27 + i] & 0xFF;
-    }
-    disk->model[40] = '\0';
+    disk_parse_identify(disk, identify_buffer);
     
-    // Extract serial number (words 10-19)
-    for (int i = 0; i < 10; i++) {
-        disk->serial[i * 2] = (identify_buffer[10 + i] >> 8) & 0xFF;
-        disk->serial[i * 2 + 1] = identify_buffer[10 + i] & 0xFF;
-    }
-    disk->serial[20] = '\0';
+    // Word 49 bit 8: DMA supported
+    disk->dma = channels[disk_id >> 1].bmide && (identify_buffer[49] & (1 << 8));
     
     return true;
 }
@@ -213,8 +468,12 @@ bool disk_init(void) {
         disks[i].disk_id = i;
         disks[i].present = false;
         disks[i].type = DISK_TYPE_UNKNOWN;
+        disks[i].dma = false;
     }
     
+    ata_dma_init();
+    ahci_init();
+    
     // Detect all possible drives
     int detected_count = 0;
     for (int i = 0; i < MAX_DISKS; i++) {
@@ -234,6 +493,50 @@ disk_info_t* disk_get_info(uint32_t disk_id) {
     return &disks[disk_id];
 }
 
+// Split a request into maximal commands: 65536 sectors with LBA48, 256
+// without, and no more than one PRD table can describe for DMA
+static bool ata_transfer(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer, bool write) {
+    disk_info_t* disk = &disks[disk_id];
+    ata_channel_t* ch = &channels[disk_id >> 1];
+    uint8_t drive = disk_id & 1;
+    uint8_t* buf = (uint8_t*)buffer;
+    
+    // Word-aligned buffers go through DMA; fall back to PIO if it fails
+    bool dma = disk_dma_enabled && disk->dma && !((uint32_t)buffer & 1);
+    
+    while (count > 0) {
+        uint32_t n = disk->is_lba48 ? ATA_MAX_SECTORS_LBA48 : ATA_MAX_SECTORS_LBA28;
+        if (dma && n > ATA_DMA_MAX_SECTORS) {
+            n = ATA_DMA_MAX_SECTORS;
+        }
+        if (n > count) {
+            n = count;
+        }
+        
+        bool ok = false;
+        if (dma) {
+            ok = ata_dma_transfer(ch, drive, lba, n, disk->is_lba48, buf, write);
+        }
+        if (!ok) {
+            // A reset that did not bring the drive back would hang PIO
+            if (inb(ch->base + ATA_REG_STATUS) & ATA_STATUS_BSY) {
+                return false;
+            }
+            ok = write ? ata_write_sectors(ch->base, drive, lba, n, disk->is_lba48, buf)
+                       : ata_read_sectors(ch->base, drive, lba, n, disk->is_lba48, buf);
+        }
+        if (!ok) {
+            return false;
+        }
+        
+        lba += n;
+        buf += n * DISK_SECTOR_SIZE;
+        count -= n;
+    }
+    
+    return true;
+}
+
 bool disk_read_sectors(uint32_t disk_id, uint64_t lba, uint32_t count, void* buffer) {
     if (disk_id >= MAX_DISKS || !disks[disk_id].present) {
         return false;
@@ -243,19 +546,16 @@ bool disk_read_sectors(uint32_t disk_id, uint64_t lba, uint32_t count, void* buf
         return false; // Out of bounds
     }
     
-    uint16_t base;
-    uint8_t drive;
-    
-    // Determine base address and drive number
-    if (disk_id < 2) {
-        base = ATA_PRIMARY_BASE;
-        drive = disk_id;
+    // The block layer's deferred work drives the same controller
+    work_disable();
+    bool ok;
+    if (disks[disk_id].type == DISK_TYPE_ATA_SATA) {
+        ok = ahci_read_sectors(disk_id - DISK_AHCI_BASE, lba, count, buffer);
     } else {
-        base = ATA_SECONDARY_BASE;
-        drive = disk_id - 2;
+        ok = ata_transfer(disk_id, lba, count, buffer, false);
     }
-    
-    return ata_read_sectors(base, drive, (uint32_t)lba, (uint8_t)count, buffer);
+    work_enable();
+    return ok;
 }
 
 bool disk_write_sectors(uint32_t disk_id, uint64_t lba, uint32_t count, const void* buffer) {
@@ -267,19 +567,16 @@ bool disk_write_sectors(uint32_t disk_id, uint64_t lba, uint32_t count, const vo
         return false; // Out of bounds
     }
     
-    uint16_t base;
-    uint8_t drive;
-    
-    // Determine base address and drive number
-    if (disk_id < 2) {
-        base = ATA_PRIMARY_BASE;
-        drive = disk_id;
+    // The block layer's deferred work drives the same controller
+    work_disable();
+    bool ok;
+    if (disks[disk_id].type == DISK_TYPE_ATA_SATA) {
+        ok = ahci_write_sectors(disk_id - DISK_AHCI_BASE, lba, count, buffer);
     } else {
-        base = ATA_SECONDARY_BASE;
-        drive = disk_id - 2;
+        ok = ata_transfer(disk_id, lba, count, (void*)buffer, true);
     }
-    
-    return ata_write_sectors(base, drive, (uint32_t)lba, (uint8_t)count, buffer);
+    work_enable();
+    return ok;
 }
 
 void disk_list_devices(void) {
@@ -289,4 +586,141 @@ void disk_list_devices(void) {
             // For now, just mark that the disk exists
         }
     }
+}
+
+// Print "<name> <test>: <amount> <unit> in <ms> ms, <rate> <rate_unit>"
+static void disk_bench_report(const char* name, const char* test, uint32_t amount, const char* unit,
+                              uint32_t elapsed, const char* rate_unit) {
+    char num[12];
+    if (elapsed == 0) elapsed = 1;
+    
+    terminal_writestring(name);
+    terminal_writestring(test);
+    disk_itoa(amount, num);
+    terminal_writestring(num);
+    terminal_writestring(unit);
+    terminal_writestring(" in ");
+    disk_itoa(elapsed * TIMER_MS_PER_TICK, num);
+    terminal_writestring(num);
+    terminal_writestring(" ms, ");
+    disk_itoa(amount * TIMER_FREQUENCY / elapsed, num);
+    terminal_writestring(num);
+    terminal_writestring(rate_unit);
+}
+
+static volatile uint32_t bench_completed;
+static volatile bool bench_failed;
+
+static void disk_bench_done(void* context, bool ok) {
+    (void)context;
+    if (!ok) bench_failed = true;
+    bench_completed++;
+}
+
+static uint32_t disk_bench_random_lba(uint32_t* seed, uint32_t slots) {
+    *seed = *seed * 1103515245 + 12345;
+    return ((*seed >> 8) % slots) * DISK_BENCH_RANDOM_SECTORS;
+}
+
+// Time sequential and random reads: PIO against DMA on IDE disks, and
+// queue depth 1 against a full NCQ queue on AHCI disks
+void disk_benchmark(uint32_t disk_id, uint32_t kb) {
+    disk_info_t* disk = disk_get_info(disk_id);
+    if (!disk) {
+        terminal_writestring("diskbench: no such disk\n");
+        return;
+    }
+    
+    uint32_t span = disk->sectors > 0x7FFFFFFF ? 0x7FFFFFFF : (uint32_t)disk->sectors;
+    uint32_t total = kb * 2;
+    if (total > span) total = span;
+    total -= total % DISK_BENCH_CHUNK_SECTORS;
+    if (total == 0 || span < 2 * DISK_BENCH_RANDOM_SECTORS) {
+        terminal_writestring("diskbench: disk too small\n");
+        return;
+    }
+    
+    uint8_t* buffer = (uint8_t*)kmalloc(DISK_BENCH_CHUNK_SECTORS * DISK_SECTOR_SIZE);
+    if (!buffer) {
+        terminal_writestring("diskbench: out of memory\n");
+        return;
+    }
+    
+    // Keep the block layer off the disk while the DMA mode is switched and
+    // the AHCI queue is driven directly
+    work_disable();
+    bool sata = disk->type == DISK_TYPE_ATA_SATA;
+    uint32_t slots = (span - DISK_BENCH_RANDOM_SECTORS) / DISK_BENCH_RANDOM_SECTORS;
+    bool saved = disk_dma_enabled;
+    bool ok = true;
+    
+    for (int mode = sata ? 1 : 0; ok && mode < 2; mode++) {
+        const char* name = sata ? "AHCI" : mode ? "DMA" : "PIO";
+        if (mode && !disk->dma) {
+            terminal_writestring("DMA: not available on this disk/controller\n");
+            break;
+        }
+        disk_dma_enabled = mode != 0;
+        
+        uint32_t start = timer_get_ticks();
+        for (uint32_t lba = 0; ok && lba < total; lba += DISK_BENCH_CHUNK_SECTORS) {
+            ok = disk_read_sectors(disk_id, lba, DISK_BENCH_CHUNK_SECTORS, buffer);
+        }
+        disk_bench_report(name, " sequential: ", total / 2, " KB", timer_get_ticks() - start, " KB/s\n");
+        
+        // Fixed seed so every mode reads the same sectors
+        uint32_t seed = 12345;
+        start = timer_get_ticks();
+        for (int i = 0; ok && i < DISK_BENCH_RANDOM_READS; i++) {
+            uint32_t lba = disk_bench_random_lba(&seed, slots);
+            ok = disk_read_sectors(disk_id, lba, DISK_BENCH_RANDOM_SECTORS, buffer);
+        }
+        disk_bench_report(name, " random 4K: ", DISK_BENCH_RANDOM_READS, " reads",
+                          timer_get_ticks() - start, " IOPS\n");
+    }
+    
+    if (ok && sata) {
+        // Keep the queue full; the buffers are shared since the data is discarded
+        uint32_t drive = disk_id - DISK_AHCI_BASE;
+        uint32_t depth = ahci_queue_depth(drive);
+        uint32_t max_depth = DISK_BENCH_CHUNK_SECTORS / DISK_BENCH_RANDOM_SECTORS;
+        if (depth > max_depth) depth = max_depth;
+        
+        uint32_t seed = 12345;
+        uint32_t issued = 0;
+        bench_completed = 0;
+        bench_failed = false;
+        
+        uint32_t start = timer_get_ticks();
+        while (bench_completed < DISK_BENCH_RANDOM_READS) {
+            if (!bench_failed && issued < DISK_BENCH_RANDOM_READS && issued - bench_completed < depth) {
+                uint32_t lba = disk_bench_random_lba(&seed, slots);
+                uint8_t* dest = buffer + (issued % depth) * DISK_BENCH_RANDOM_SECTORS * DISK_SECTOR_SIZE;
+                if (ahci_submit(drive, lba, DISK_BENCH_RANDOM_SECTORS, dest, false, disk_bench_done, NULL) >= 0) {
+                    issued++;
+                    continue;
+                }
+            }
+            if (bench_failed && bench_completed == issued) {
+                break;
+            }
+            ahci_poll(drive);
+            __asm__ volatile ("sti; hlt");
+        }
+        
+        char num[12];
+        disk_itoa(depth, num);
+        terminal_writestring("AHCI queue depth ");
+        terminal_writestring(num);
+        disk_bench_report("", ": ", bench_completed, " reads", timer_get_ticks() - start, " IOPS\n");
+        ok = !bench_failed;
+    }
+    
+    if (!ok) {
+        terminal_writestring("  (read error, results incomplete)\n");
+    }
+    
+    disk_dma_enabled = saved;
+    work_enable();
+    kfree(buffer);
 }
\ No newline at end of file
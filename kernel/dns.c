@@ -0,0 +1,612 @@
+#include "../include/dns.h"
+#include "../include/udp.h"
+#include "../include/net.h"
+#include "../include/errno.h"
+#include "../include/interrupts.h"
+
+extern void terminal_writestring(const char* data);
+
+static dns_entry_t dns_cache[DNS_CACHE_SIZE];
+static dns_entry_t* dns_hash[DNS_HASH_SIZE];
+static dns_stats_t dns_stats;
+static udp_socket_t* dns_socket = NULL;
+static uint32_t dns_server = 0;
+static uint32_t dns_id_state = 0;
+
+static char dns_tolower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static int dns_name_equal(const char* a, const char* b) {
+    while (*a && dns_tolower(*a) == dns_tolower(*b)) {
+        a++;
+        b++;
+    }
+    return dns_tolower(*a) == dns_tolower(*b);
+}
+
+// FNV-1a over the lower-cased name
+static uint32_t dns_hash_name(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void dns_itoa(uint32_t value, char* str) {
+    char temp[16];
+    int pos = 0;
+    
+    do {
+        temp[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    
+    int i = 0;
+    while (pos > 0) {
+        str[i++] = temp[--pos];
+    }
+    str[i] = '\0';
+}
+
+// Dotted quads need no query
+static int dns_parse_ipv4(const char* name, uint32_t* addr) {
+    uint32_t result = 0;
+    for (int octet = 0; octet < 4; octet++) {
+        if (*name < '0' || *name > '9') return 0;
+        uint32_t value = 0;
+        int digits = 0;
+        while (*name >= '0' && *name <= '9') {
+            value = value * 10 + (*name++ - '0');
+            if (++digits > 3 || value > 255) return 0;
+        }
+        result = (result << 8) | value;
+        if (octet < 3 && *name++ != '.') return 0;
+    }
+    if (*name) return 0;
+    *addr = result;
+    return 1;
+}
+
+// Labels must be 1..63 characters (RFC 1035)
+static int dns_valid_name(const char* name) {
+    size_t label_length = 0;
+    for (; *name; name++) {
+        if (*name == '.') {
+            if (label_length == 0) return 0;
+            label_length = 0;
+        } else if (++label_length > 63) {
+            return 0;
+        }
+    }
+    return label_length > 0;
+}
+
+// Query IDs should be hard to guess; mix a LCG with the tick counter
+static uint16_t dns_next_id(void) {
+    dns_id_state = dns_id_state * 1103515245u + 12345u + timer_get_ticks();
+    return (uint16_t)(dns_id_state >> 16);
+}
+
+static uint16_t dns_read16(const uint8_t* p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t dns_read32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Decode a possibly compressed name at *offset into dotted form and move
+// *offset past it. Returns 0 on a malformed or oversized name.
+static int dns_read_name(const uint8_t* msg, size_t length, size_t* offset, char* out, size_t out_size) {
+    size_t pos = *offset;
+    size_t out_length = 0;
+    int jumped = 0;
+    int hops = 0;
+    
+    while (1) {
+        if (pos >= length) return 0;
+        uint8_t label = msg[pos];
+        
+        if ((label & 0xC0) == 0xC0) {
+            if (pos + 1 >= length || ++hops > 16) return 0;
+            if (!jumped) *offset = pos + 2;
+            pos = ((size_t)(label & 0x3F) << 8) | msg[pos + 1];
+            jumped = 1;
+            continue;
+        }
+        if (label & 0xC0) return 0;
+        
+        pos++;
+        if (label == 0) break;
+        if (pos + label > length || out_length + label + 2 > out_size) return 0;
+        
+        if (out_length > 0) out[out_length++] = '.';
+        for (uint8_t i = 0; i < label; i++) {
+            out[out_length++] = (char)msg[pos + i];
+        }
+        pos += label;
+    }
+    
+    out[out_length] = '\0';
+    if (!jumped) *offset = pos;
+    return 1;
+}
+
+static int dns_skip_name(const uint8_t* msg, size_t length, size_t* offset) {
+    char scratch[DNS_MAX_NAME];
+    return dns_read_name(msg, length, offset, scratch, sizeof(scratch));
+}
+
+static dns_entry_t* dns_lookup(const char* name, uint32_t hash) {
+    for (dns_entry_t* entry = dns_hash[hash % DNS_HASH_SIZE]; entry; entry = entry->hash_next) {
+        if (entry->hash == hash && dns_name_equal(entry->name, name)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void dns_unhash(dns_entry_t* entry) {
+    dns_entry_t** link = &dns_hash[entry->hash % DNS_HASH_SIZE];
+    while (*link) {
+        if (*link == entry) {
+            *link = entry->hash_next;
+            return;
+        }
+        link = &(*link)->hash_next;
+    }
+}
+
+// Take a free slot, else the least recently used settled entry. Entries
+// with a query outstanding or callers still reading them are never taken.
+static dns_entry_t* dns_alloc_entry(const char* name, uint32_t hash) {
+    dns_entry_t* victim = NULL;
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dns_entry_t* entry = &dns_cache[i];
+        if (entry->state == DNS_ENTRY_FREE) {
+            victim = entry;
+            break;
+        }
+        if (entry->state == DNS_ENTRY_PENDING || entry->waiters > 0) {
+            continue;
+        }
+        if (!victim || (int32_t)(entry->last_used - victim->last_used) < 0) {
+            victim = entry;
+        }
+    }
+    if (!victim) return NULL;
+    
+    if (victim->state != DNS_ENTRY_FREE) {
+        dns_unhash(victim);
+    }
+    
+    size_t i = 0;
+    for (; name[i] && i < DNS_MAX_NAME - 1; i++) {
+        victim->name[i] = name[i];
+    }
+    victim->name[i] = '\0';
+    victim->hash = hash;
+    victim->waiters = 0;
+    victim->hash_next = dns_hash[hash % DNS_HASH_SIZE];
+    dns_hash[hash % DNS_HASH_SIZE] = victim;
+    return victim;
+}
+
+static void dns_send_query(dns_entry_t* entry) {
+    uint8_t packet[DNS_MAX_PACKET];
+    
+    dns_header_t* hdr = (dns_header_t*)packet;
+    hdr->id = htons(entry->query_id);
+    hdr->flags = htons(DNS_FLAG_RD);
+    hdr->qdcount = htons(1);
+    hdr->ancount = 0;
+    hdr->nscount = 0;
+    hdr->arcount = 0;
+    
+    // Question name as length-prefixed labels
+    size_t pos = sizeof(dns_header_t);
+    const char* label = entry->name;
+    while (*label) {
+        const char* end = label;
+        while (*end && *end != '.') end++;
+        size_t label_length = end - label;
+        
+        packet[pos++] = (uint8_t)label_length;
+        for (size_t i = 0; i < label_length; i++) {
+            packet[pos++] = (uint8_t)label[i];
+        }
+        label = *end ? end + 1 : end;
+    }
+    packet[pos++] = 0;
+    packet[pos++] = 0;
+    packet[pos++] = DNS_TYPE_A;
+    packet[pos++] = 0;
+    packet[pos++] = DNS_CLASS_IN;
+    
+    dns_stats.queries++;
+    udp_socket_sendto(dns_socket, packet, pos, dns_server, UDP_PORT_DNS);
+}
+
+// Settle a lookup and wake everyone waiting on it
+static void dns_complete(dns_entry_t* entry, dns_state_t state, uint32_t addr, int error, uint32_t ttl) {
+    if (ttl > DNS_MAX_TTL) ttl = DNS_MAX_TTL;
+    
+    entry->state = state;
+    entry->addr = addr;
+    entry->error = error;
+    entry->expires = timer_get_ticks() + ttl * TIMER_FREQUENCY;
+    wake_up(&entry->wait);
+}
+
+// Negative answers are cached for the smaller of the SOA record's TTL
+// and its MINIMUM field (RFC 2308)
+static uint32_t dns_negative_ttl(const uint8_t* msg, size_t length, size_t offset, uint16_t nscount) {
+    for (uint16_t i = 0; i < nscount; i++) {
+        if (!dns_skip_name(msg, length, &offset) || offset + 10 > length) break;
+        uint16_t type = dns_read16(msg + offset);
+        uint32_t ttl = dns_read32(msg + offset + 4);
+        uint16_t rdlength = dns_read16(msg + offset + 8);
+        offset += 10;
+        if (offset + rdlength > length) break;
+        
+        if (type == DNS_TYPE_SOA && rdlength >= 20) {
+            uint32_t minimum = dns_read32(msg + offset + rdlength - 4);
+            return ttl < minimum ? ttl : minimum;
+        }
+        offset += rdlength;
+    }
+    return DNS_NEGATIVE_TTL;
+}
+
+// Parse a response for a pending entry. Follows CNAME chains within the
+// answer section; the cached TTL is the smallest along the chain.
+static void dns_handle_response(dns_entry_t* entry, const uint8_t* msg, size_t length) {
+    dns_header_t* hdr = (dns_header_t*)msg;
+    uint16_t flags = ntohs(hdr->flags);
+    uint16_t qdcount = ntohs(hdr->qdcount);
+    uint16_t ancount = ntohs(hdr->ancount);
+    uint16_t nscount = ntohs(hdr->nscount);
+    
+    // The question must echo ours
+    size_t offset = sizeof(dns_header_t);
+    char name[DNS_MAX_NAME];
+    if (qdcount != 1 || !dns_read_name(msg, length, &offset, name, sizeof(name)) ||
+        !dns_name_equal(name, entry->name) || offset + 4 > length) {
+        return;
+    }
+    offset += 4;
+    size_t answers = offset;
+    
+    uint16_t rcode = flags & DNS_RCODE_MASK;
+    if (rcode != 0 && rcode != DNS_RCODE_NXDOMAIN) {
+        // Server trouble says nothing about the name: do not cache it
+        dns_complete(entry, DNS_ENTRY_NEGATIVE, 0, -EAGAIN, 0);
+        return;
+    }
+    
+    char current[DNS_MAX_NAME];
+    char target[DNS_MAX_NAME];
+    size_t i = 0;
+    for (; entry->name[i]; i++) current[i] = entry->name[i];
+    current[i] = '\0';
+    
+    uint32_t ttl = DNS_MAX_TTL;
+    int followed = 1;
+    
+    // Records may come in any order; rescan while the chain advances
+    for (int pass = 0; rcode == 0 && followed && pass < 8; pass++) {
+        followed = 0;
+        offset = answers;
+        
+        for (uint16_t n = 0; n < ancount; n++) {
+            if (!dns_read_name(msg, length, &offset, name, sizeof(name)) || offset + 10 > length) {
+                break;
+            }
+            uint16_t type = dns_read16(msg + offset);
+            uint16_t rclass = dns_read16(msg + offset + 2);
+            uint32_t record_ttl = dns_read32(msg + offset + 4);
+            uint16_t rdlength = dns_read16(msg + offset + 8);
+            offset += 10;
+            if (offset + rdlength > length) break;
+            
+            if (rclass == DNS_CLASS_IN && dns_name_equal(name, current)) {
+                if (record_ttl < ttl) ttl = record_ttl;
+                
+                if (type == DNS_TYPE_A && rdlength == 4) {
+                    dns_complete(entry, DNS_ENTRY_POSITIVE, dns_read32(msg + offset), 0, ttl);
+                    return;
+                }
+                
+                size_t rdata = offset;
+                if (type == DNS_TYPE_CNAME &&
+                    dns_read_name(msg, length, &rdata, target, sizeof(target))) {
+                    for (i = 0; target[i]; i++) current[i] = target[i];
+                    current[i] = '\0';
+                    followed = 1;
+                }
+            }
+            offset += rdlength;
+        }
+    }
+    
+    // NXDOMAIN, or the name exists without an address (NODATA). Skip the
+    // answer section to reach the SOA in the authority section.
+    offset = answers;
+    for (uint16_t n = 0; n < ancount; n++) {
+        if (!dns_skip_name(msg, length, &offset) || offset + 10 > length) break;
+        offset += 10 + dns_read16(msg + offset + 8);
+    }
+    uint32_t negative_ttl = dns_negative_ttl(msg, length, offset, nscount);
+    dns_complete(entry, DNS_ENTRY_NEGATIVE, 0, -ENOENT, negative_ttl);
+}
+
+// Receive handler for the resolver socket (interrupt context)
+static void dns_receive(udp_socket_t* sock, uint32_t src_ip, uint16_t src_port,
+                        uint8_t* data, size_t length) {
+    (void)sock;
+    if (src_port != UDP_PORT_DNS || src_ip != dns_server || length < sizeof(dns_header_t)) {
+        return;
+    }
+    
+    dns_header_t* hdr = (dns_header_t*)data;
+    if (!(ntohs(hdr->flags) & DNS_FLAG_QR)) {
+        return;
+    }
+    
+    uint16_t id = ntohs(hdr->id);
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dns_entry_t* entry = &dns_cache[i];
+        if (entry->state == DNS_ENTRY_PENDING && entry->query_id == id) {
+            dns_handle_response(entry, data, length);
+            return;
+        }
+    }
+}
+
+void dns_init(void) {
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dns_cache[i].state = DNS_ENTRY_FREE;
+        dns_cache[i].waiters = 0;
+        wait_queue_init(&dns_cache[i].wait);
+    }
+    for (int i = 0; i < DNS_HASH_SIZE; i++) {
+        dns_hash[i] = NULL;
+    }
+    dns_id_state = timer_get_ticks();
+    
+    dns_socket = udp_socket_create();
+    if (!dns_socket || udp_socket_bind(dns_socket, 0, 0) < 0) {
+        terminal_writestring("DNS: failed to open resolver socket\n");
+        return;
+    }
+    udp_socket_set_handler(dns_socket, dns_receive, NULL);
+    
+    timer_register_callback(dns_timer_tick, DNS_TIMER_INTERVAL);
+    terminal_writestring("DNS resolver initialized\n");
+}
+
+void dns_set_server(uint32_t server) {
+    uint32_t flags = irq_save();
+    if (server != dns_server) {
+        dns_server = server;
+        dns_flush();
+    }
+    irq_restore(flags);
+}
+
+uint32_t dns_get_server(void) {
+    return dns_server;
+}
+
+// Resolve name to an IPv4 address (host byte order). Returns 0, or
+// -ENOENT if the name has no address, -ETIMEDOUT if the server did not
+// answer, -ENETUNREACH if no server is configured.
+int dns_resolve(const char* name, uint32_t* addr) {
+    if (!name || !addr || !*name) {
+        return -EINVAL;
+    }
+    if (dns_parse_ipv4(name, addr)) {
+        return 0;
+    }
+    
+    // Cache key: lower case without a trailing dot
+    char key[DNS_MAX_NAME];
+    size_t length = 0;
+    while (name[length]) {
+        if (length >= DNS_MAX_NAME - 1) return -EINVAL;
+        key[length] = dns_tolower(name[length]);
+        length++;
+    }
+    if (key[length - 1] == '.') length--;
+    key[length] = '\0';
+    if (!dns_valid_name(key)) return -EINVAL;
+    
+    if (dns_name_equal(key, "localhost")) {
+        *addr = 0x7F000001;
+        return 0;
+    }
+    
+    uint32_t irq_flags = irq_save();
+    uint32_t now = timer_get_ticks();
+    dns_stats.lookups++;
+    
+    uint32_t hash = dns_hash_name(key);
+    dns_entry_t* entry = dns_lookup(key, hash);
+    
+    if (entry && entry->state != DNS_ENTRY_PENDING &&
+        (int32_t)(now - entry->expires) < 0) {
+        entry->last_used = now;
+        int result;
+        if (entry->state == DNS_ENTRY_POSITIVE) {
+            dns_stats.hits++;
+            *addr = entry->addr;
+            result = 0;
+        } else {
+            dns_stats.negative_hits++;
+            result = entry->error;
+        }
+        irq_restore(irq_flags);
+        return result;
+    }
+    
+    if (entry && entry->state == DNS_ENTRY_PENDING) {
+        dns_stats.coalesced++;
+    } else {
+        dns_stats.misses++;
+        if (!dns_server || !dns_socket) {
+            irq_restore(irq_flags);
+            return -ENETUNREACH;
+        }
+        
+        // An expired entry is refreshed in place
+        if (!entry) {
+            entry = dns_alloc_entry(key, hash);
+            if (!entry) {
+                irq_restore(irq_flags);
+                return -EAGAIN; // Every slot has a query outstanding
+            }
+        }
+        
+        entry->state = DNS_ENTRY_PENDING;
+        entry->query_id = dns_next_id();
+        entry->retries = 0;
+        entry->retry_deadline = now + DNS_RETRY_INTERVAL;
+        entry->last_used = now;
+        
+        // Over loopback the answer may arrive before this returns
+        dns_send_query(entry);
+    }
+    
+    entry->waiters++;
+    while (entry->state == DNS_ENTRY_PENDING) {
+        wait_queue_sleep(&entry->wait);
+    }
+    entry->waiters--;
+    
+    int result = entry->error;
+    if (entry->state == DNS_ENTRY_POSITIVE) {
+        *addr = entry->addr;
+        result = 0;
+    }
+    
+    irq_restore(irq_flags);
+    return result;
+}
+
+// Drop every settled entry; outstanding queries finish normally
+void dns_flush(void) {
+    uint32_t flags = irq_save();
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dns_entry_t* entry = &dns_cache[i];
+        if (entry->state != DNS_ENTRY_FREE && entry->state != DNS_ENTRY_PENDING &&
+            entry->waiters == 0) {
+            dns_unhash(entry);
+            entry->state = DNS_ENTRY_FREE;
+        }
+    }
+    irq_restore(flags);
+}
+
+// Retransmit outstanding queries with exponential backoff and give up
+// after DNS_MAX_RETRIES. Failures are not cached.
+void dns_timer_tick(void) {
+    uint32_t now = timer_get_ticks();
+    
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dns_entry_t* entry = &dns_cache[i];
+        if (entry->state != DNS_ENTRY_PENDING ||
+            (int32_t)(now - entry->retry_deadline) < 0) {
+            continue;
+        }
+        
+        if (entry->retries >= DNS_MAX_RETRIES) {
+            dns_stats.timeouts++;
+            dns_complete(entry, DNS_ENTRY_NEGATIVE, 0, -ETIMEDOUT, 0);
+            continue;
+        }
+        
+        entry->retries++;
+        entry->retry_deadline = now + (DNS_RETRY_INTERVAL << entry->retries);
+        dns_send_query(entry);
+    }
+}
+
+dns_stats_t* dns_get_stats(void) {
+    return &dns_stats;
+}
+
+void dns_dump(void) {
+    char num[16];
+    uint32_t now = timer_get_ticks();
+    
+    terminal_writestring("Server: ");
+    if (dns_server) {
+        ip_addr_t server;
+        server.addr[0] = (dns_server >> 24) & 0xFF;
+        server.addr[1] = (dns_server >> 16) & 0xFF;
+        server.addr[2] = (dns_server >> 8) & 0xFF;
+        server.addr[3] = dns_server & 0xFF;
+        terminal_writestring(ip_to_string(&server));
+    } else {
+        terminal_writestring("none");
+    }
+    terminal_writestring("\n");
+    
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dns_entry_t* entry = &dns_cache[i];
+        if (entry->state == DNS_ENTRY_FREE) continue;
+        
+        terminal_writestring("  ");
+        terminal_writestring(entry->name);
+        if (entry->state == DNS_ENTRY_PENDING) {
+            terminal_writestring("  (querying)\n");
+            continue;
+        }
+        if ((int32_t)(now - entry->expires) >= 0) {
+            terminal_writestring("  (expired)\n");
+            continue;
+        }
+        
+        if (entry->state == DNS_ENTRY_POSITIVE) {
+            ip_addr_t addr;
+            addr.addr[0] = (entry->addr >> 24) & 0xFF;
+            addr.addr[1] = (entry->addr >> 16) & 0xFF;
+            addr.addr[2] = (entry->addr >> 8) & 0xFF;
+            addr.addr[3] = entry->addr & 0xFF;
+            terminal_writestring("  ");
+            terminal_writestring(ip_to_string(&addr));
+        } else {
+            terminal_writestring("  (no address)");
+        }
+        terminal_writestring("  ttl ");
+        dns_itoa((entry->expires - now) / TIMER_FREQUENCY, num);
+        terminal_writestring(num);
+        terminal_writestring("s\n");
+    }
+    
+    terminal_writestring("Lookups: ");
+    dns_itoa(dns_stats.lookups, num);
+    terminal_writestring(num);
+    terminal_writestring("  hits: ");
+    dns_itoa(dns_stats.hits, num);
+    terminal_writestring(num);
+    terminal_writestring("  negative hits: ");
+    dns_itoa(dns_stats.negative_hits, num);
+    terminal_writestring(num);
+    terminal_writestring("  misses: ");
+    dns_itoa(dns_stats.misses, num);
+    terminal_writestring(num);
+    terminal_writestring("  coalesced: ");
+    dns_itoa(dns_stats.coalesced, num);
+    terminal_writestring(num);
+    terminal_writestring("\nQueries sent: ");
+    dns_itoa(dns_stats.queries, num);
+    terminal_writestring(num);
+    terminal_writestring("  timeouts: ");
+    dns_itoa(dns_stats.timeouts, num);
+    terminal_writestring(num);
+    terminal_writestring("\n");
+}
\ No newline at end of file
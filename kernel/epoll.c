@@ -0,0 +1,297 @@
+#include "../include/epoll.h"
+#include "../include/socket.h"
+#include "../include/memory.h"
+#include "../include/interrupts.h"
+#include "../include/errno.h"
+
+// An epoll instance keeps a ready list fed by poll_notify, so epoll_wait
+// only looks at sockets that changed instead of scanning every socket.
+typedef struct epoll_instance {
+    int in_use;
+    epoll_item_t* items;
+    epoll_item_t* ready_head;
+    epoll_item_t* ready_tail;
+    wait_queue_t wait;
+} epoll_instance_t;
+
+static epoll_instance_t epoll_instances[EPOLL_MAX_INSTANCES];
+
+static epoll_instance_t* epoll_get(int epfd) {
+    if (epfd < 0 || epfd >= EPOLL_MAX_INSTANCES || !epoll_instances[epfd].in_use) {
+        return NULL;
+    }
+    return &epoll_instances[epfd];
+}
+
+// Interrupts must be disabled
+static void epoll_mark_ready(epoll_item_t* item) {
+    if (item->on_ready_list) return;
+    
+    epoll_instance_t* ep = item->ep;
+    item->on_ready_list = 1;
+    item->next_ready = NULL;
+    if (ep->ready_tail) {
+        ep->ready_tail->next_ready = item;
+    } else {
+        ep->ready_head = item;
+    }
+    ep->ready_tail = item;
+    wake_up(&ep->wait);
+}
+
+// Interrupts must be disabled
+static void epoll_unlink_ready(epoll_item_t* item) {
+    if (!item->on_ready_list) return;
+    
+    epoll_instance_t* ep = item->ep;
+    epoll_item_t* prev = NULL;
+    for (epoll_item_t* it = ep->ready_head; it; prev = it, it = it->next_ready) {
+        if (it == item) {
+            if (prev) prev->next_ready = it->next_ready;
+            else ep->ready_head = it->next_ready;
+            if (ep->ready_tail == it) ep->ready_tail = prev;
+            break;
+        }
+    }
+    item->on_ready_list = 0;
+}
+
+// Interrupts must be disabled
+static void epoll_unlink_watcher(poll_head_t* head, epoll_item_t* item) {
+    epoll_item_t** link = &head->watchers;
+    while (*link) {
+        if (*link == item) {
+            *link = item->next_watcher;
+            return;
+        }
+        link = &(*link)->next_watcher;
+    }
+}
+
+// Interrupts must be disabled
+static void epoll_unlink_item(epoll_instance_t* ep, epoll_item_t* item) {
+    epoll_item_t** link = &ep->items;
+    while (*link) {
+        if (*link == item) {
+            *link = item->next_item;
+            return;
+        }
+        link = &(*link)->next_item;
+    }
+}
+
+void poll_head_init(poll_head_t* head) {
+    head->watchers = NULL;
+}
+
+void poll_notify(poll_head_t* head) {
+    if (!head || !head->watchers) return;
+    
+    uint32_t irq_flags = irq_save();
+    for (epoll_item_t* item = head->watchers; item; item = item->next_watcher) {
+        epoll_mark_ready(item);
+    }
+    irq_restore(irq_flags);
+}
+
+// The watched object is going away: drop every item that refers to it
+void poll_head_detach(poll_head_t* head) {
+    uint32_t irq_flags = irq_save();
+    
+    epoll_item_t* item = head->watchers;
+    while (item) {
+        epoll_item_t* next = item->next_watcher;
+        epoll_unlink_ready(item);
+        epoll_unlink_item(item->ep, item);
+        kfree(item);
+        item = next;
+    }
+    head->watchers = NULL;
+    
+    irq_restore(irq_flags);
+}
+
+int epoll_create(void) {
+    for (int i = 0; i < EPOLL_MAX_INSTANCES; i++) {
+        if (!epoll_instances[i].in_use) {
+            epoll_instance_t* ep = &epoll_instances[i];
+            ep->in_use = 1;
+            ep->items = NULL;
+            ep->ready_head = NULL;
+            ep->ready_tail = NULL;
+            wait_queue_init(&ep->wait);
+            return i;
+        }
+    }
+    return -ENOMEM;
+}
+
+static epoll_item_t* epoll_find_item(epoll_instance_t* ep, int socket) {
+    for (epoll_item_t* item = ep->items; item; item = item->next_item) {
+        if (item->socket == socket) return item;
+    }
+    return NULL;
+}
+
+int epoll_ctl(int epfd, int op, int socket, epoll_event_t* event) {
+    epoll_instance_t* ep = epoll_get(epfd);
+    if (!ep) return -EBADF;
+    
+    poll_head_t* head = socket_poll_head(socket);
+    if (!head) return -EBADF;
+    
+    if ((op == EPOLL_CTL_ADD || op == EPOLL_CTL_MOD) && !event) {
+        return -EINVAL;
+    }
+    
+    uint32_t irq_flags = irq_save();
+    epoll_item_t* item = epoll_find_item(ep, socket);
+    int result = 0;
+    
+    switch (op) {
+        case EPOLL_CTL_ADD:
+            if (item) {
+                result = -EINVAL;
+                break;
+            }
+            item = (epoll_item_t*)kmalloc(sizeof(epoll_item_t));
+            if (!item) {
+                result = -ENOMEM;
+                break;
+            }
+            item->ep = ep;
+            item->socket = socket;
+            item->events = event->events;
+            item->data = event->data;
+            item->on_ready_list = 0;
+            item->next_ready = NULL;
+            item->next_item = ep->items;
+            ep->items = item;
+            item->next_watcher = head->watchers;
+            head->watchers = item;
+            
+            // Report readiness that predates the registration
+            epoll_mark_ready(item);
+            break;
+            
+        case EPOLL_CTL_MOD:
+            if (!item) {
+                result = -EINVAL;
+                break;
+            }
+            item->events = event->events;
+            item->data = event->data;
+            epoll_mark_ready(item);
+            break;
+            
+        case EPOLL_CTL_DEL:
+            if (!item) {
+                result = -EINVAL;
+                break;
+            }
+            epoll_unlink_ready(item);
+            epoll_unlink_watcher(head, item);
+            epoll_unlink_item(ep, item);
+            kfree(item);
+            break;
+            
+        default:
+            result = -EINVAL;
+            break;
+    }
+    
+    irq_restore(irq_flags);
+    return result;
+}
+
+// Move ready items into events. Items whose socket is no longer ready are
+// dropped; level-triggered items that are still ready are requeued so the
+// next call reports them again. Interrupts must be disabled.
+static int epoll_collect(epoll_instance_t* ep, epoll_event_t* events, int max_events) {
+    int count = 0;
+    epoll_item_t* requeue_head = NULL;
+    epoll_item_t* requeue_tail = NULL;
+    
+    while (ep->ready_head && count < max_events) {
+        epoll_item_t* item = ep->ready_head;
+        ep->ready_head = item->next_ready;
+        if (!ep->ready_head) ep->ready_tail = NULL;
+        item->on_ready_list = 0;
+        item->next_ready = NULL;
+        
+        uint32_t ready = socket_poll(item->socket) & (item->events | EPOLLERR | EPOLLHUP);
+        if (!ready) continue;
+        
+        events[count].events = ready;
+        events[count].data = item->data;
+        count++;
+        
+        if (!(item->events & EPOLLET)) {
+            item->on_ready_list = 1;
+            if (requeue_tail) requeue_tail->next_ready = item;
+            else requeue_head = item;
+            requeue_tail = item;
+        }
+    }
+    
+    // Requeued items go behind the ones not yet looked at, so a busy
+    // socket cannot starve the others
+    if (requeue_head) {
+        if (ep->ready_tail) ep->ready_tail->next_ready = requeue_head;
+        else ep->ready_head = requeue_head;
+        ep->ready_tail = requeue_tail;
+    }
+    
+    return count;
+}
+
+// Wait for events. timeout_ms < 0 waits forever, 0 only polls. Returns the
+// number of events stored, 0 on timeout.
+int epoll_wait(int epfd, epoll_event_t* events, int max_events, int timeout_ms) {
+    epoll_instance_t* ep = epoll_get(epfd);
+    if (!ep) return -EBADF;
+    if (!events || max_events <= 0) return -EINVAL;
+    
+    uint32_t deadline = timer_get_ticks() + TIMER_MS_TO_TICKS(timeout_ms > 0 ? timeout_ms : 0);
+    uint32_t irq_flags = irq_save();
+    int count;
+    
+    for (;;) {
+        count = epoll_collect(ep, events, max_events);
+        if (count > 0 || timeout_ms == 0) break;
+        
+        if (timeout_ms < 0) {
+            wait_queue_sleep(&ep->wait);
+        } else {
+            int32_t remaining = (int32_t)(deadline - timer_get_ticks());
+            if (remaining <= 0) break;
+            wait_queue_sleep_timeout(&ep->wait, (uint32_t)remaining);
+        }
+    }
+    
+    irq_restore(irq_flags);
+    return count;
+}
+
+int epoll_close(int epfd) {
+    epoll_instance_t* ep = epoll_get(epfd);
+    if (!ep) return -EBADF;
+    
+    uint32_t irq_flags = irq_save();
+    
+    epoll_item_t* item = ep->items;
+    while (item) {
+        epoll_item_t* next = item->next_item;
+        poll_head_t* head = socket_poll_head(item->socket);
+        if (head) epoll_unlink_watcher(head, item);
+        kfree(item);
+        item = next;
+    }
+    ep->items = NULL;
+    ep->ready_head = NULL;
+    ep->ready_tail = NULL;
+    ep->in_use = 0;
+    
+    irq_restore(irq_flags);
+    return 0;
+}
\ No newline at end of file
@@ -1,5 +1,9 @@
 #include "../include/fat32.h"
 #include "../include/disk.h"
+#include "../include/blk.h"
+#include "../include/bcache.h"
+#include "../include/memory.h"
+#include "../include/vfs.h"
 
 // Simple string functions
 static size_t fat32_strlen(const char* str) {
@@ -50,7 +54,7 @@ bool fat32_write_boot_sector(uint32_t disk_id, uint32_t sector, fat32_boot_secto
     buffer[510] = 0x55;
     buffer[511] = 0xAA;
     
-    return disk_write_sectors(disk_id, sector, 1, buffer);
+    return blk_write(disk_id, sector, 1, buffer);
 }
 
 bool fat32_write_fs_info(uint32_t disk_id, uint32_t sector, fat32_fs_info_t* fs_info) {
@@ -60,19 +64,38 @@ bool fat32_write_fs_info(uint32_t disk_id, uint32_t sector, fat32_fs_info_t* fs_
     // Copy FS info structure to buffer
     fat32_memcpy(buffer, fs_info, sizeof(fat32_fs_info_t));
     
-    return disk_write_sectors(disk_id, sector, 1, buffer);
+    return blk_write(disk_id, sector, 1, buffer);
 }
 
-bool fat32_clear_fat_table(uint32_t disk_id, uint32_t fat_start, uint32_t fat_sectors) {
-    uint8_t buffer[512];
-    fat32_memset(buffer, 0, 512);
-    
-    // Clear all FAT sectors
-    for (uint32_t i = 0; i < fat_sectors; i++) {
-        if (!disk_write_sectors(disk_id, fat_start + i, 1, buffer)) {
+// Source for zero-fill writes; never written. Requests point at it until
+// they complete. One block-layer command's worth, so the chunks below are
+// dispatched as they are instead of being merged through a bounce buffer.
+#define FAT32_ZERO_FILL_SECTORS BLK_MAX_MERGE_SECTORS
+static uint8_t fat32_zero_fill[FAT32_ZERO_FILL_SECTORS * 512];
+
+// Queue zero writes over a range without waiting for them
+static bool fat32_queue_zero_fill(uint32_t disk_id, uint32_t start, uint32_t count) {
+    for (uint32_t done = 0; done < count; done += FAT32_ZERO_FILL_SECTORS) {
+        uint32_t n = count - done < FAT32_ZERO_FILL_SECTORS ? count - done : FAT32_ZERO_FILL_SECTORS;
+        if (blk_submit(disk_id, start + done, n, fat32_zero_fill, true, NULL, NULL) < 0) {
             return false;
         }
     }
+    return true;
+}
+
+bool fat32_clear_fat_table(uint32_t disk_id, uint32_t fat_start, uint32_t fat_sectors, uint8_t num_fats) {
+    // Zero all copies in 128 KB writes, interleaved so both FATs are in
+    // flight together instead of one after the other
+    for (uint32_t done = 0; done < fat_sectors; done += FAT32_ZERO_FILL_SECTORS) {
+        uint32_t n = fat_sectors - done < FAT32_ZERO_FILL_SECTORS ? fat_sectors - done : FAT32_ZERO_FILL_SECTORS;
+        for (uint8_t fat = 0; fat < num_fats; fat++) {
+            if (!fat32_queue_zero_fill(disk_id, fat_start + fat * fat_sectors + done, n)) {
+                blk_flush(disk_id);
+                return false;
+            }
+        }
+    }
     
     // Set special values in first FAT sector
     uint32_t fat_buffer[128];  // 512 bytes / 4 bytes per entry
@@ -82,7 +105,14 @@ bool fat32_clear_fat_table(uint32_t disk_id, uint32_t fat_start, uint32_t fat_se
     fat_buffer[1] = 0x0FFFFFFF;          // End of chain
     fat_buffer[2] = 0x0FFFFFFF;          // Root directory cluster (end of chain)
     
-    return disk_write_sectors(disk_id, fat_start, 1, fat_buffer);
+    // Ordered after the zero fill of the same sector by the block layer
+    for (uint8_t fat = 0; fat < num_fats; fat++) {
+        if (blk_submit(disk_id, fat_start + fat * fat_sectors, 1, fat_buffer, true, NULL, NULL) < 0) {
+            blk_flush(disk_id);
+            return false;
+        }
+    }
+    return blk_flush(disk_id);
 }
 
 bool fat32_create_root_directory(uint32_t disk_id, uint32_t data_start, const char* volume_label) {
@@ -105,7 +135,7 @@ bool fat32_create_root_directory(uint32_t disk_id, uint32_t data_start, const ch
         entry->file_size = 0;
     }
     
-    return disk_write_sectors(disk_id, data_start, 1, buffer);
+    return blk_write(disk_id, data_start, 1, buffer);
 }
 
 bool fat32_format_disk(uint32_t disk_id, uint32_t start_sector, uint32_t total_sectors, const char* volume_label) {
@@ -114,6 +144,9 @@ bool fat32_format_disk(uint32_t disk_id, uint32_t start_sector, uint32_t total_s
         return false;
     }
     
+    // The format writes around the buffer cache; drop what it holds
+    bcache_invalidate(disk_id);
+    
     // Calculate filesystem parameters
     uint8_t sectors_per_cluster = 8;  // 4KB clusters for most sizes
     uint16_t reserved_sectors = 32;   // Standard for FAT32
@@ -211,16 +244,17 @@ bool fat32_format_disk(uint32_t disk_id, uint32_t start_sector, uint32_t total_s
         return false;
     }
     
-    // Clear and initialize FAT tables
+    // Clear and initialize FAT tables, zeroing the root directory cluster
+    // in the same batch
     uint32_t fat_start = start_sector + reserved_sectors;
-    for (int fat = 0; fat < num_fats; fat++) {
-        if (!fat32_clear_fat_table(disk_id, fat_start + fat * fat_size_sectors, fat_size_sectors)) {
-            return false;
-        }
+    uint32_t data_start = fat_start + (num_fats * fat_size_sectors);
+    if (!fat32_queue_zero_fill(disk_id, data_start, sectors_per_cluster) ||
+        !fat32_clear_fat_table(disk_id, fat_start, fat_size_sectors, num_fats)) {
+        blk_flush(disk_id);
+        return false;
     }
     
     // Create root directory
-    uint32_t data_start = fat_start + (num_fats * fat_size_sectors);
     if (!fat32_create_root_directory(disk_id, data_start, volume_label)) {
         return false;
     }
@@ -233,7 +267,7 @@ bool fat32_mount(uint32_t disk_id, uint32_t start_sector, fat32_fs_t* fs) {
     
     // Read boot sector
     uint8_t buffer[512];
-    if (!disk_read_sectors(disk_id, start_sector, 1, buffer)) {
+    if (!bcache_read(disk_id, start_sector, 1, buffer, BCACHE_META)) {
         return false;
     }
     
@@ -254,6 +288,26 @@ bool fat32_mount(uint32_t disk_id, uint32_t start_sector, fat32_fs_t* fs) {
     fs->fat_start_sector = start_sector + fs->boot_sector.reserved_sectors;
     fs->data_start_sector = fs->fat_start_sector + (fs->boot_sector.num_fats * fs->boot_sector.fat_size_32);
     fs->root_dir_cluster = fs->boot_sector.root_cluster;
+    fs->cluster_size = fs->boot_sector.sectors_per_cluster * 512;
+    if (fs->cluster_size == 0 || fs->data_start_sector >= start_sector + fs->total_sectors) {
+        return false;
+    }
+    fs->cluster_count = (start_sector + fs->total_sectors - fs->data_start_sector) /
+                        fs->boot_sector.sectors_per_cluster;
+    
+    // Free space hints; an invalid FSInfo just means scanning from the start
+    fs->free_count = 0xFFFFFFFF;
+    fs->next_free = 2;
+    fs->fs_info_dirty = false;
+    if (bcache_read(disk_id, start_sector + fs->boot_sector.fs_info, 1, buffer, BCACHE_META)) {
+        fat32_fs_info_t* fs_info = (fat32_fs_info_t*)buffer;
+        if (fs_info->lead_signature == 0x41615252 && fs_info->struct_signature == 0x61417272) {
+            fs->free_count = fs_info->free_count;
+            if (fs_info->next_free >= 2 && fs_info->next_free < fs->cluster_count + 2) {
+                fs->next_free = fs_info->next_free;
+            }
+        }
+    }
     fs->mounted = true;
     
     return true;
@@ -264,7 +318,1211 @@ bool fat32_unmount(fat32_fs_t* fs) {
         return false;
     }
     
+    bool ok = fat32_sync(fs);
     fs->mounted = false;
     fat32_memset(fs, 0, sizeof(fat32_fs_t));
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// File engine. Everything goes through the buffer cache: FAT sectors and
+// directory clusters as metadata so they stay resident, file data as
+// ordinary buffers.
+// ---------------------------------------------------------------------------
+
+static char fat32_upper(char c) {
+    return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+static char fat32_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static bool fat32_name_equal(const char* a, const char* b) {
+    while (*a && *b) {
+        if (fat32_upper(*a) != fat32_upper(*b)) return false;
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static bool fat32_valid_cluster(fat32_fs_t* fs, uint32_t cluster) {
+    return cluster >= 2 && cluster < fs->cluster_count + 2;
+}
+
+static uint32_t fat32_cluster_lba(fat32_fs_t* fs, uint32_t cluster) {
+    return fs->data_start_sector + (cluster - 2) * fs->boot_sector.sectors_per_cluster;
+}
+
+static uint32_t fat32_entry_cluster(const fat32_dir_entry_t* entry) {
+    return ((uint32_t)entry->first_cluster_hi << 16) | entry->first_cluster_lo;
+}
+
+static bool fat32_get_fat(fat32_fs_t* fs, uint32_t cluster, uint32_t* value) {
+    uint32_t offset = cluster * 4;
+    bcache_buf_t* buf = bcache_get(fs->disk_id, fs->fat_start_sector + offset / 512, BCACHE_META);
+    if (!buf) return false;
+    
+    *value = *(uint32_t*)(buf->data + offset % 512) & 0x0FFFFFFF;
+    bcache_release(buf);
+    return true;
+}
+
+// Update the entry in every FAT copy
+static bool fat32_set_fat(fat32_fs_t* fs, uint32_t cluster, uint32_t value) {
+    uint32_t offset = cluster * 4;
+    for (uint32_t fat = 0; fat < fs->boot_sector.num_fats; fat++) {
+        uint32_t sector = fs->fat_start_sector + fat * fs->boot_sector.fat_size_32 + offset / 512;
+        bcache_buf_t* buf = bcache_get(fs->disk_id, sector, BCACHE_META);
+        if (!buf) return false;
+        
+        uint32_t* entry = (uint32_t*)(buf->data + offset % 512);
+        *entry = (*entry & 0xF0000000) | (value & 0x0FFFFFFF);
+        bcache_mark_dirty(buf);
+        bcache_release(buf);
+    }
+    return true;
+}
+
+// Allocate a free cluster and append it to the chain ending at `prev`
+// (0 starts a new chain). The search begins right after `prev` so files
+// grow contiguously, otherwise at the FSInfo next_free hint.
+static bool fat32_alloc_cluster(fat32_fs_t* fs, uint32_t prev, uint32_t* result) {
+    uint32_t end = fs->cluster_count + 2;
+    uint32_t cluster = fat32_valid_cluster(fs, prev + 1) ? prev + 1 : fs->next_free;
+    if (!fat32_valid_cluster(fs, cluster)) cluster = 2;
+    
+    uint32_t found = 0;
+    uint32_t scanned = 0;
+    while (!found && scanned < fs->cluster_count) {
+        // Scan the rest of this FAT sector without going back to the cache
+        bcache_buf_t* buf = bcache_get(fs->disk_id, fs->fat_start_sector + cluster / 128, BCACHE_META);
+        if (!buf) return false;
+        
+        uint32_t* entries = (uint32_t*)buf->data;
+        do {
+            if ((entries[cluster % 128] & 0x0FFFFFFF) == FAT32_FREE_CLUSTER) {
+                found = cluster;
+                break;
+            }
+            scanned++;
+            if (++cluster == end) cluster = 2;
+        } while (cluster % 128 != 0 && cluster != 2 && scanned < fs->cluster_count);
+        bcache_release(buf);
+    }
+    if (!found) return false;
+    
+    if (!fat32_set_fat(fs, found, 0x0FFFFFFF)) return false;
+    if (prev && !fat32_set_fat(fs, prev, found)) return false;
+    
+    if (fs->free_count != 0xFFFFFFFF && fs->free_count > 0) fs->free_count--;
+    fs->next_free = found + 1 < end ? found + 1 : 2;
+    fs->fs_info_dirty = true;
+    *result = found;
+    return true;
+}
+
+static bool fat32_free_chain(fat32_fs_t* fs, uint32_t cluster) {
+    while (fat32_valid_cluster(fs, cluster)) {
+        uint32_t next;
+        if (!fat32_get_fat(fs, cluster, &next) || !fat32_set_fat(fs, cluster, FAT32_FREE_CLUSTER)) {
+            return false;
+        }
+        if (fs->free_count != 0xFFFFFFFF) fs->free_count++;
+        cluster = next;
+    }
+    fs->fs_info_dirty = true;
+    return true;
+}
+
+static bool fat32_zero_cluster(fat32_fs_t* fs, uint32_t cluster) {
+    uint32_t lba = fat32_cluster_lba(fs, cluster);
+    for (uint32_t i = 0; i < fs->boot_sector.sectors_per_cluster; i++) {
+        if (!bcache_write(fs->disk_id, lba + i, 1, fat32_zero_fill, BCACHE_META)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool fat32_sync(fat32_fs_t* fs) {
+    if (!fs || !fs->mounted) return false;
+    
+    if (fs->fs_info_dirty) {
+        bcache_buf_t* buf = bcache_get(fs->disk_id, fs->start_sector + fs->boot_sector.fs_info, BCACHE_META);
+        if (buf) {
+            fat32_fs_info_t* fs_info = (fat32_fs_info_t*)buf->data;
+            if (fs_info->lead_signature == 0x41615252 && fs_info->struct_signature == 0x61417272) {
+                fs_info->free_count = fs->free_count;
+                fs_info->next_free = fs->next_free;
+                bcache_mark_dirty(buf);
+            }
+            bcache_release(buf);
+            fs->fs_info_dirty = false;
+        }
+    }
+    return bcache_sync(fs->disk_id);
+}
+
+// ---------------------------------------------------------------------------
+// Directories
+// ---------------------------------------------------------------------------
+
+static void fat32_dir_start(fat32_fs_t* fs, uint32_t cluster, fat32_dir_t* dir) {
+    dir->fs = fs;
+    dir->first_cluster = cluster ? cluster : fs->root_dir_cluster;
+    dir->cluster = dir->first_cluster;
+    dir->cluster_index = 0;
+    dir->index = 0;
+}
+
+// Find the sector and offset of entry `index`. Fails past the end of the
+// chain, leaving dir->cluster on the last cluster.
+static bool fat32_dir_locate(fat32_dir_t* dir, uint32_t index, uint32_t* sector, uint32_t* offset) {
+    fat32_fs_t* fs = dir->fs;
+    uint32_t per_cluster = fs->cluster_size / sizeof(fat32_dir_entry_t);
+    uint32_t target = index / per_cluster;
+    
+    if (target < dir->cluster_index) {
+        dir->cluster = dir->first_cluster;
+        dir->cluster_index = 0;
+    }
+    while (dir->cluster_index < target) {
+        uint32_t next;
+        if (!fat32_get_fat(fs, dir->cluster, &next) || !fat32_valid_cluster(fs, next)) {
+            return false;
+        }
+        dir->cluster = next;
+        dir->cluster_index++;
+    }
+    
+    uint32_t byte = (index % per_cluster) * sizeof(fat32_dir_entry_t);
+    *sector = fat32_cluster_lba(fs, dir->cluster) + byte / 512;
+    *offset = byte % 512;
+    return true;
+}
+
+static bool fat32_dir_write_entry(fat32_dir_t* dir, uint32_t index, const void* entry) {
+    uint32_t sector, offset;
+    if (!fat32_dir_locate(dir, index, &sector, &offset)) return false;
+    
+    bcache_buf_t* buf = bcache_get(dir->fs->disk_id, sector, BCACHE_META);
+    if (!buf) return false;
+    fat32_memcpy(buf->data + offset, entry, sizeof(fat32_dir_entry_t));
+    bcache_mark_dirty(buf);
+    bcache_release(buf);
     return true;
+}
+
+static uint8_t fat32_lfn_checksum(const char* short_name) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + (uint8_t)short_name[i]);
+    }
+    return sum;
+}
+
+// Byte offsets of the 13 UCS-2 characters in a long name entry
+static const uint8_t fat32_lfn_offsets[FAT32_LFN_CHARS] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+static uint16_t fat32_lfn_get(const void* lfn, int i) {
+    const uint8_t* p = (const uint8_t*)lfn + fat32_lfn_offsets[i];
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static void fat32_lfn_set(void* lfn, int i, uint16_t c) {
+    uint8_t* p = (uint8_t*)lfn + fat32_lfn_offsets[i];
+    p[0] = (uint8_t)c;
+    p[1] = (uint8_t)(c >> 8);
+}
+
+static void fat32_format_short_name(const char* raw, uint8_t case_flags, char* out) {
+    int len = 0;
+    for (int i = 0; i < 8 && raw[i] != ' '; i++) {
+        char c = raw[i];
+        if (i == 0 && (uint8_t)c == 0x05) c = (char)FAT32_DELETED;
+        out[len++] = (case_flags & FAT32_NT_LOWER_BASE) ? fat32_lower(c) : c;
+    }
+    if (raw[8] != ' ') {
+        out[len++] = '.';
+        for (int i = 8; i < 11 && raw[i] != ' '; i++) {
+            out[len++] = (case_flags & FAT32_NT_LOWER_EXT) ? fat32_lower(raw[i]) : raw[i];
+        }
+    }
+    out[len] = '\0';
+}
+
+// Return the next entry, assembling its long name if it has a valid one.
+// Deleted entries and the volume label are skipped.
+bool fat32_readdir(fat32_dir_t* dir, fat32_dirent_t* entry) {
+    int lfn_expected = 0;       // Sequence number of the next long name entry
+    bool lfn_done = false;      // A complete long name precedes this entry
+    uint8_t lfn_checksum = 0;
+    uint32_t lfn_start = 0;
+    
+    while (true) {
+        uint32_t sector, offset;
+        if (!fat32_dir_locate(dir, dir->index, &sector, &offset)) return false;
+        
+        bcache_buf_t* buf = bcache_get(dir->fs->disk_id, sector, BCACHE_META);
+        if (!buf) return false;
+        fat32_dir_entry_t* raw = (fat32_dir_entry_t*)(buf->data + offset);
+        uint8_t first = (uint8_t)raw->name[0];
+        
+        if (first == 0x00) {
+            // End of directory
+            bcache_release(buf);
+            return false;
+        }
+        
+        uint32_t index = dir->index++;
+        if (first == FAT32_DELETED) {
+            lfn_expected = 0;
+            lfn_done = false;
+        } else if ((raw->attr & FAT32_ATTR_LONG_NAME) == FAT32_ATTR_LONG_NAME) {
+            fat32_lfn_entry_t* lfn = (fat32_lfn_entry_t*)raw;
+            int order = lfn->order & 0x1F;
+            if (lfn->order & FAT32_LFN_LAST) {
+                lfn_expected = order;
+                lfn_checksum = lfn->checksum;
+                lfn_start = index;
+                int end = order * FAT32_LFN_CHARS;
+                entry->name[end < FAT32_MAX_NAME ? end : FAT32_MAX_NAME] = '\0';
+            }
+            
+            if (order == 0 || order != lfn_expected || lfn->checksum != lfn_checksum) {
+                lfn_expected = 0;
+                lfn_done = false;
+            } else {
+                int base = (order - 1) * FAT32_LFN_CHARS;
+                for (int i = 0; i < FAT32_LFN_CHARS && base + i < FAT32_MAX_NAME; i++) {
+                    uint16_t c = fat32_lfn_get(lfn, i);
+                    if (c == 0x0000) {
+                        entry->name[base + i] = '\0';
+                        break;
+                    }
+                    entry->name[base + i] = c < 0x80 ? (char)c : '?';
+                }
+                lfn_expected--;
+                lfn_done = lfn_expected == 0;
+            }
+        } else if (!(raw->attr & FAT32_ATTR_VOLUME_ID)) {
+            fat32_memcpy(entry->short_name, raw, 11);
+            if (lfn_done && fat32_lfn_checksum((const char*)raw) == lfn_checksum) {
+                entry->lfn_index = lfn_start;
+            } else {
+                fat32_format_short_name((const char*)raw, raw->nt_reserved, entry->name);
+                entry->lfn_index = index;
+            }
+            entry->attr = raw->attr;
+            entry->size = raw->file_size;
+            entry->first_cluster = fat32_entry_cluster(raw);
+            entry->dir_cluster = dir->first_cluster;
+            entry->entry_index = index;
+            bcache_release(buf);
+            return true;
+        } else {
+            lfn_expected = 0;
+            lfn_done = false;
+        }
+        bcache_release(buf);
+    }
+}
+
+static bool fat32_find(fat32_fs_t* fs, uint32_t dir_cluster, const char* name, fat32_dirent_t* entry) {
+    fat32_dir_t dir;
+    fat32_dir_start(fs, dir_cluster, &dir);
+    
+    while (fat32_readdir(&dir, entry)) {
+        char short_name[13];
+        fat32_format_short_name(entry->short_name, 0, short_name);
+        if (fat32_name_equal(entry->name, name) || fat32_name_equal(short_name, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Copy the next path component into `name`; returns the rest of the path
+static const char* fat32_path_next(const char* path, char* name) {
+    while (*path == '/') path++;
+    
+    int len = 0;
+    while (*path && *path != '/') {
+        if (len < FAT32_MAX_NAME) name[len++] = *path;
+        path++;
+    }
+    name[len] = '\0';
+    
+    while (*path == '/') path++;
+    return path;
+}
+
+static void fat32_root_entry(fat32_fs_t* fs, fat32_dirent_t* entry) {
+    fat32_memset(entry, 0, sizeof(*entry));
+    entry->attr = FAT32_ATTR_DIRECTORY;
+    entry->first_cluster = fs->root_dir_cluster;
+}
+
+bool fat32_stat(fat32_fs_t* fs, const char* path, fat32_dirent_t* entry) {
+    if (!fs || !fs->mounted || !path || !entry) return false;
+    
+    fat32_root_entry(fs, entry);
+    char name[FAT32_MAX_NAME + 1];
+    while (*path) {
+        path = fat32_path_next(path, name);
+        if (!name[0]) break;
+        if (!(entry->attr & FAT32_ATTR_DIRECTORY) || !fat32_find(fs, entry->first_cluster, name, entry)) {
+            return false;
+        }
+        // ".." of a top level directory points at cluster 0
+        if ((entry->attr & FAT32_ATTR_DIRECTORY) && entry->first_cluster == 0) {
+            entry->first_cluster = fs->root_dir_cluster;
+        }
+    }
+    return true;
+}
+
+// Resolve everything but the last component. `name` receives the last one.
+static bool fat32_lookup_parent(fat32_fs_t* fs, const char* path, fat32_dirent_t* parent, char* name) {
+    if (!fs || !fs->mounted || !path) return false;
+    
+    fat32_root_entry(fs, parent);
+    path = fat32_path_next(path, name);
+    while (*path) {
+        if (!fat32_find(fs, parent->first_cluster, name, parent) || !(parent->attr & FAT32_ATTR_DIRECTORY)) {
+            return false;
+        }
+        if (parent->first_cluster == 0) {
+            parent->first_cluster = fs->root_dir_cluster;
+        }
+        path = fat32_path_next(path, name);
+    }
+    
+    return name[0] && !fat32_name_equal(name, ".") && !fat32_name_equal(name, "..");
+}
+
+static bool fat32_short_char_ok(char c) {
+    if (c >= 'A' && c <= 'Z') return true;
+    if (c >= '0' && c <= '9') return true;
+    if ((uint8_t)c >= 0x80) return false;
+    const char* allowed = "!#$%&'()-@^_`{}~";
+    for (const char* p = allowed; *p; p++) {
+        if (*p == c) return true;
+    }
+    return false;
+}
+
+// Store `name` as a plain 8.3 entry if it is one, in a single case per part.
+// Sets the nt_reserved case flags.
+static bool fat32_make_short_name(const char* name, char* short_name, uint8_t* case_flags) {
+    fat32_memset(short_name, ' ', 11);
+    *case_flags = 0;
+    
+    int len = (int)fat32_strlen(name);
+    int dot = -1;
+    for (int i = 0; i < len; i++) {
+        if (name[i] == '.') {
+            if (dot >= 0) return false;
+            dot = i;
+        }
+    }
+    int base_len = dot >= 0 ? dot : len;
+    int ext_len = dot >= 0 ? len - dot - 1 : 0;
+    if (base_len == 0 || base_len > 8 || ext_len > 3 || (dot >= 0 && ext_len == 0)) return false;
+    
+    for (int part = 0; part < 2; part++) {
+        const char* src = part == 0 ? name : name + dot + 1;
+        int count = part == 0 ? base_len : ext_len;
+        bool upper = false, lower = false;
+        for (int i = 0; i < count; i++) {
+            char c = src[i];
+            if (c >= 'a' && c <= 'z') lower = true;
+            if (c >= 'A' && c <= 'Z') upper = true;
+            c = fat32_upper(c);
+            if (!fat32_short_char_ok(c)) return false;
+            short_name[(part == 0 ? 0 : 8) + i] = c;
+        }
+        if (upper && lower) return false;
+        if (lower) *case_flags |= part == 0 ? FAT32_NT_LOWER_BASE : FAT32_NT_LOWER_EXT;
+    }
+    
+    if ((uint8_t)short_name[0] == FAT32_DELETED) short_name[0] = 0x05;
+    return true;
+}
+
+static bool fat32_short_name_taken(fat32_fs_t* fs, uint32_t dir_cluster, const char* short_name) {
+    fat32_dir_t dir;
+    fat32_dirent_t entry;
+    fat32_dir_start(fs, dir_cluster, &dir);
+    
+    while (fat32_readdir(&dir, &entry)) {
+        bool same = true;
+        for (int i = 0; i < 11 && same; i++) {
+            same = entry.short_name[i] == short_name[i];
+        }
+        if (same) return true;
+    }
+    return false;
+}
+
+// Derive a unique BASIS~N short name for a long name
+static bool fat32_generate_short_name(fat32_fs_t* fs, uint32_t dir_cluster, const char* name, char* short_name) {
+    char basis[8];
+    int basis_len = 0;
+    fat32_memset(short_name, ' ', 11);
+    
+    int len = (int)fat32_strlen(name);
+    int dot = -1;
+    for (int i = len - 1; i > 0; i--) {
+        if (name[i] == '.') {
+            dot = i;
+            break;
+        }
+    }
+    
+    int base_end = dot >= 0 ? dot : len;
+    for (int i = 0; i < base_end && basis_len < 6; i++) {
+        char c = fat32_upper(name[i]);
+        if (c == ' ' || c == '.') continue;
+        basis[basis_len++] = fat32_short_char_ok(c) ? c : '_';
+    }
+    if (basis_len == 0) basis[basis_len++] = '_';
+    
+    if (dot >= 0) {
+        int ext_len = 0;
+        for (int i = dot + 1; i < len && ext_len < 3; i++) {
+            char c = fat32_upper(name[i]);
+            if (c == ' ') continue;
+            short_name[8 + ext_len++] = fat32_short_char_ok(c) ? c : '_';
+        }
+    }
+    
+    // BASIS~1 to ~4, then a hash of the long name keeps the search short
+    // when many names share a prefix
+    uint16_t hash = 0;
+    for (int i = 0; i < len; i++) {
+        hash = (uint16_t)(hash * 31 + (uint8_t)name[i]);
+    }
+    
+    for (uint32_t n = 1; n < 100000; n++) {
+        char stem[8];
+        int stem_len = basis_len;
+        fat32_memcpy(stem, basis, basis_len);
+        if (n > 4) {
+            const char* hex = "0123456789ABCDEF";
+            stem_len = basis_len < 2 ? basis_len : 2;
+            for (int i = 0; i < 4; i++) {
+                stem[stem_len++] = hex[(hash >> (12 - i * 4)) & 0xF];
+            }
+        }
+        
+        char tail[8];
+        int tail_len = 0;
+        uint32_t number = n > 4 ? n - 4 : n;
+        char digits[6];
+        int digit_count = 0;
+        do {
+            digits[digit_count++] = '0' + number % 10;
+            number /= 10;
+        } while (number > 0);
+        tail[tail_len++] = '~';
+        while (digit_count > 0) {
+            tail[tail_len++] = digits[--digit_count];
+        }
+        
+        int keep = stem_len < 8 - tail_len ? stem_len : 8 - tail_len;
+        fat32_memset(short_name, ' ', 8);
+        fat32_memcpy(short_name, stem, keep);
+        fat32_memcpy(short_name + keep, tail, tail_len);
+        
+        if (!fat32_short_name_taken(fs, dir_cluster, short_name)) return true;
+    }
+    return false;
+}
+
+static void fat32_vfs_dir_changed(fat32_fs_t* fs, uint32_t dir_cluster);
+
+// Add an entry, with long name entries in front of it when the name is
+// not plain 8.3. Grows the directory by a cluster when it is full.
+static bool fat32_dir_add(fat32_fs_t* fs, uint32_t dir_cluster, const char* name, uint8_t attr,
+                          uint32_t first_cluster, fat32_dirent_t* result) {
+    size_t name_len = fat32_strlen(name);
+    if (name_len == 0 || name_len > FAT32_MAX_NAME) return false;
+    
+    fat32_dir_entry_t entry;
+    fat32_memset(&entry, 0, sizeof(entry));
+    uint8_t case_flags;
+    uint32_t lfn_count = 0;
+    if (fat32_make_short_name(name, (char*)&entry, &case_flags)) {
+        entry.nt_reserved = case_flags;
+    } else {
+        if (!fat32_generate_short_name(fs, dir_cluster, name, (char*)&entry)) return false;
+        lfn_count = (name_len + FAT32_LFN_CHARS - 1) / FAT32_LFN_CHARS;
+    }
+    entry.attr = attr;
+    entry.first_cluster_hi = (uint16_t)(first_cluster >> 16);
+    entry.first_cluster_lo = (uint16_t)(first_cluster & 0xFFFF);
+    
+    // Find lfn_count + 1 consecutive free slots
+    fat32_dir_t dir;
+    fat32_dir_start(fs, dir_cluster, &dir);
+    uint32_t needed = lfn_count + 1;
+    uint32_t run_start = 0, run = 0;
+    for (uint32_t index = 0; run < needed; index++) {
+        uint32_t sector, offset;
+        if (!fat32_dir_locate(&dir, index, &sector, &offset)) {
+            uint32_t cluster;
+            if (!fat32_alloc_cluster(fs, dir.cluster, &cluster) || !fat32_zero_cluster(fs, cluster)) {
+                return false;
+            }
+            index--;
+            continue;
+        }
+        
+        bcache_buf_t* buf = bcache_get(fs->disk_id, sector, BCACHE_META);
+        if (!buf) return false;
+        uint8_t first = buf->data[offset];
+        bcache_release(buf);
+        
+        if (first == 0x00 || first == FAT32_DELETED) {
+            if (run++ == 0) run_start = index;
+        } else {
+            run = 0;
+        }
+    }
+    
+    uint8_t checksum = fat32_lfn_checksum((const char*)&entry);
+    for (uint32_t i = 0; i < lfn_count; i++) {
+        uint32_t order = lfn_count - i;
+        fat32_lfn_entry_t lfn;
+        fat32_memset(&lfn, 0, sizeof(lfn));
+        lfn.order = (uint8_t)order | (i == 0 ? FAT32_LFN_LAST : 0);
+        lfn.attr = FAT32_ATTR_LONG_NAME;
+        lfn.checksum = checksum;
+        
+        uint32_t base = (order - 1) * FAT32_LFN_CHARS;
+        for (uint32_t c = 0; c < FAT32_LFN_CHARS; c++) {
+            uint16_t value = 0xFFFF;
+            if (base + c < name_len) value = (uint8_t)name[base + c];
+            else if (base + c == name_len) value = 0x0000;
+            fat32_lfn_set(&lfn, (int)c, value);
+        }
+        if (!fat32_dir_write_entry(&dir, run_start + i, &lfn)) return false;
+    }
+    if (!fat32_dir_write_entry(&dir, run_start + lfn_count, &entry)) return false;
+    fat32_vfs_dir_changed(fs, dir.first_cluster);
+    
+    if (result) {
+        fat32_memset(result, 0, sizeof(*result));
+        uint32_t copy = name_len < FAT32_MAX_NAME ? (uint32_t)name_len : FAT32_MAX_NAME;
+        fat32_memcpy(result->name, name, copy);
+        fat32_memcpy(result->short_name, &entry, 11);
+        result->attr = attr;
+        result->first_cluster = first_cluster;
+        result->dir_cluster = dir.first_cluster;
+        result->entry_index = run_start + lfn_count;
+        result->lfn_index = run_start;
+    }
+    return true;
+}
+
+static bool fat32_dir_remove(fat32_fs_t* fs, fat32_dirent_t* entry) {
+    fat32_dir_t dir;
+    fat32_dir_start(fs, entry->dir_cluster, &dir);
+    
+    for (uint32_t index = entry->lfn_index; index <= entry->entry_index; index++) {
+        uint32_t sector, offset;
+        if (!fat32_dir_locate(&dir, index, &sector, &offset)) return false;
+        
+        bcache_buf_t* buf = bcache_get(fs->disk_id, sector, BCACHE_META);
+        if (!buf) return false;
+        buf->data[offset] = FAT32_DELETED;
+        bcache_mark_dirty(buf);
+        bcache_release(buf);
+    }
+    fat32_vfs_dir_changed(fs, entry->dir_cluster);
+    return true;
+}
+
+bool fat32_opendir(fat32_fs_t* fs, const char* path, fat32_dir_t* dir) {
+    fat32_dirent_t entry;
+    if (!dir || !fat32_stat(fs, path, &entry) || !(entry.attr & FAT32_ATTR_DIRECTORY)) {
+        return false;
+    }
+    fat32_dir_start(fs, entry.first_cluster, dir);
+    return true;
+}
+
+bool fat32_mkdir(fat32_fs_t* fs, const char* path) {
+    fat32_dirent_t parent, existing;
+    char name[FAT32_MAX_NAME + 1];
+    if (!fat32_lookup_parent(fs, path, &parent, name) ||
+        fat32_find(fs, parent.first_cluster, name, &existing)) {
+        return false;
+    }
+    
+    uint32_t cluster;
+    if (!fat32_alloc_cluster(fs, 0, &cluster)) return false;
+    if (!fat32_zero_cluster(fs, cluster)) {
+        fat32_free_chain(fs, cluster);
+        return false;
+    }
+    
+    // "." and ".."; the root is referred to as cluster 0
+    fat32_dir_entry_t dots[2];
+    fat32_memset(dots, 0, sizeof(dots));
+    uint32_t parent_cluster = parent.first_cluster == fs->root_dir_cluster ? 0 : parent.first_cluster;
+    for (int i = 0; i < 2; i++) {
+        fat32_memset(&dots[i], ' ', 11);
+        dots[i].name[0] = '.';
+        dots[i].attr = FAT32_ATTR_DIRECTORY;
+    }
+    dots[1].name[1] = '.';
+    dots[0].first_cluster_hi = (uint16_t)(cluster >> 16);
+    dots[0].first_cluster_lo = (uint16_t)(cluster & 0xFFFF);
+    dots[1].first_cluster_hi = (uint16_t)(parent_cluster >> 16);
+    dots[1].first_cluster_lo = (uint16_t)(parent_cluster & 0xFFFF);
+    
+    fat32_dir_t dir;
+    fat32_dir_start(fs, cluster, &dir);
+    if (!fat32_dir_write_entry(&dir, 0, &dots[0]) || !fat32_dir_write_entry(&dir, 1, &dots[1]) ||
+        !fat32_dir_add(fs, parent.first_cluster, name, FAT32_ATTR_DIRECTORY, cluster, NULL)) {
+        fat32_free_chain(fs, cluster);
+        return false;
+    }
+    return true;
+}
+
+static bool fat32_vfs_forget(fat32_fs_t* fs, fat32_dirent_t* entry);
+
+bool fat32_unlink(fat32_fs_t* fs, const char* path) {
+    fat32_dirent_t parent, entry;
+    char name[FAT32_MAX_NAME + 1];
+    if (!fat32_lookup_parent(fs, path, &parent, name) ||
+        !fat32_find(fs, parent.first_cluster, name, &entry)) {
+        return false;
+    }
+    
+    // Directories must be empty apart from "." and ".."
+    if (entry.attr & FAT32_ATTR_DIRECTORY) {
+        fat32_dir_t dir;
+        fat32_dirent_t child;
+        fat32_dir_start(fs, entry.first_cluster, &dir);
+        while (fat32_readdir(&dir, &child)) {
+            if (!fat32_name_equal(child.name, ".") && !fat32_name_equal(child.name, "..")) {
+                return false;
+            }
+        }
+    }
+    
+    if (!fat32_vfs_forget(fs, &entry) || !fat32_dir_remove(fs, &entry)) return false;
+    return entry.first_cluster == 0 || fat32_free_chain(fs, entry.first_cluster);
+}
+
+// ---------------------------------------------------------------------------
+// Files
+// ---------------------------------------------------------------------------
+
+static bool fat32_chain_append(fat32_file_t* file, uint32_t cluster) {
+    if (file->extent_count > 0) {
+        fat32_extent_t* last = &file->extents[file->extent_count - 1];
+        if (last->cluster + last->count == cluster) {
+            last->count++;
+            file->chain_clusters++;
+            return true;
+        }
+    }
+    
+    if (file->extent_count == file->extent_capacity) {
+        uint32_t capacity = file->extent_capacity ? file->extent_capacity * 2 : 8;
+        fat32_extent_t* extents = (fat32_extent_t*)kmalloc(capacity * sizeof(fat32_extent_t));
+        if (!extents) return false;
+        if (file->extents) {
+            fat32_memcpy(extents, file->extents, file->extent_count * sizeof(fat32_extent_t));
+            kfree(file->extents);
+        }
+        file->extents = extents;
+        file->extent_capacity = capacity;
+    }
+    
+    fat32_extent_t* extent = &file->extents[file->extent_count++];
+    extent->file_cluster = file->chain_clusters;
+    extent->cluster = cluster;
+    extent->count = 1;
+    file->chain_clusters++;
+    return true;
+}
+
+// Walk the FAT until `clusters` clusters of the chain are cached or the
+// chain ends. Only the part not seen before is read.
+static bool fat32_chain_load(fat32_file_t* file, uint32_t clusters) {
+    fat32_fs_t* fs = file->fs;
+    while (file->chain_clusters < clusters && !file->chain_complete) {
+        uint32_t next;
+        if (file->extent_count == 0) {
+            next = file->first_cluster;
+        } else {
+            fat32_extent_t* last = &file->extents[file->extent_count - 1];
+            if (!fat32_get_fat(fs, last->cluster + last->count - 1, &next)) return false;
+        }
+        
+        if (!fat32_valid_cluster(fs, next)) {
+            file->chain_complete = true;
+        } else if (!fat32_chain_append(file, next)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Disk cluster holding cluster `index` of the file, and how many clusters
+// follow it contiguously in the cached chain
+static bool fat32_chain_map(fat32_file_t* file, uint32_t index, uint32_t* cluster, uint32_t* run) {
+    if (!fat32_chain_load(file, index + 1) || index >= file->chain_clusters) return false;
+    
+    uint32_t i = file->extent_hint < file->extent_count ? file->extent_hint : 0;
+    if (file->extents[i].file_cluster > index) i = 0;
+    while (file->extents[i].file_cluster + file->extents[i].count <= index) i++;
+    file->extent_hint = i;
+    
+    fat32_extent_t* extent = &file->extents[i];
+    *cluster = extent->cluster + (index - extent->file_cluster);
+    *run = extent->count - (index - extent->file_cluster);
+    return true;
+}
+
+// Make the chain at least `clusters` long, allocating at its end
+static bool fat32_chain_grow(fat32_file_t* file, uint32_t clusters) {
+    if (!fat32_chain_load(file, clusters)) return false;
+    
+    while (file->chain_clusters < clusters) {
+        uint32_t prev = 0;
+        if (file->extent_count > 0) {
+            fat32_extent_t* last = &file->extents[file->extent_count - 1];
+            prev = last->cluster + last->count - 1;
+        }
+        
+        uint32_t cluster;
+        if (!fat32_alloc_cluster(file->fs, prev, &cluster)) return false;
+        if (prev == 0) {
+            file->first_cluster = cluster;
+            file->dirty = true;
+        }
+        if (!fat32_chain_append(file, cluster)) return false;
+    }
+    return true;
+}
+
+static bool fat32_file_init(fat32_fs_t* fs, fat32_dirent_t* entry, fat32_file_t* file) {
+    fat32_memset(file, 0, sizeof(*file));
+    file->fs = fs;
+    file->first_cluster = entry->first_cluster;
+    file->size = entry->size;
+    
+    fat32_dir_t dir;
+    fat32_dir_start(fs, entry->dir_cluster, &dir);
+    return fat32_dir_locate(&dir, entry->entry_index, &file->entry_sector, &file->entry_offset);
+}
+
+bool fat32_open(fat32_fs_t* fs, const char* path, fat32_file_t* file) {
+    fat32_dirent_t entry;
+    if (!file || !fat32_stat(fs, path, &entry) || (entry.attr & (FAT32_ATTR_DIRECTORY | FAT32_ATTR_VOLUME_ID))) {
+        return false;
+    }
+    return fat32_file_init(fs, &entry, file);
+}
+
+// Open for writing, creating the file or truncating an existing one
+bool fat32_create(fat32_fs_t* fs, const char* path, fat32_file_t* file) {
+    fat32_dirent_t parent, entry;
+    char name[FAT32_MAX_NAME + 1];
+    if (!file || !fat32_lookup_parent(fs, path, &parent, name)) return false;
+    
+    if (fat32_find(fs, parent.first_cluster, name, &entry)) {
+        if (entry.attr & (FAT32_ATTR_DIRECTORY | FAT32_ATTR_VOLUME_ID)) return false;
+        if (!fat32_vfs_forget(fs, &entry)) return false;
+        if (!fat32_file_init(fs, &entry, file)) return false;
+        if (entry.first_cluster && !fat32_free_chain(fs, entry.first_cluster)) return false;
+        file->first_cluster = 0;
+        file->size = 0;
+        file->dirty = true;
+        return true;
+    }
+    
+    if (!fat32_dir_add(fs, parent.first_cluster, name, FAT32_ATTR_ARCHIVE, 0, &entry)) return false;
+    return fat32_file_init(fs, &entry, file);
+}
+
+// Read from the current position. Each contiguous run of clusters becomes
+// one cache request, which fetches its misses with one block request.
+int32_t fat32_read(fat32_file_t* file, void* buffer, uint32_t size) {
+    if (!file || !file->fs || !buffer) return -1;
+    
+    fat32_fs_t* fs = file->fs;
+    if (file->position >= file->size) return 0;
+    if (size > file->size - file->position) size = file->size - file->position;
+    if (size == 0) return 0;
+    
+    // Cache the chain for the whole request up front so runs are complete
+    uint32_t last = (file->position + size - 1) / fs->cluster_size;
+    if (!fat32_chain_load(file, last + 1)) return -1;
+    
+    uint8_t* out = (uint8_t*)buffer;
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t offset = file->position % fs->cluster_size;
+        uint32_t cluster, run;
+        if (!fat32_chain_map(file, file->position / fs->cluster_size, &cluster, &run)) break;
+        
+        // Clamp the run before multiplying so long runs cannot overflow
+        uint32_t max_run = (size - done + offset) / fs->cluster_size + 1;
+        if (run > max_run) run = max_run;
+        
+        uint32_t lba = fat32_cluster_lba(fs, cluster) + offset / 512;
+        uint32_t sector_offset = offset % 512;
+        uint32_t n = run * fs->cluster_size - offset;
+        if (n > size - done) n = size - done;
+        
+        if (sector_offset == 0 && n >= 512) {
+            n &= ~511u;
+            if (!bcache_read(fs->disk_id, lba, n / 512, out + done, 0)) break;
+        } else {
+            bcache_buf_t* buf = bcache_get(fs->disk_id, lba, 0);
+            if (!buf) break;
+            if (n > 512 - sector_offset) n = 512 - sector_offset;
+            fat32_memcpy(out + done, buf->data + sector_offset, n);
+            bcache_release(buf);
+        }
+        
+        done += n;
+        file->position += n;
+    }
+    return done > 0 ? (int32_t)done : -1;
+}
+
+int32_t fat32_write(fat32_file_t* file, const void* buffer, uint32_t size) {
+    if (!file || !file->fs || !buffer) return -1;
+    if (size == 0) return 0;
+    
+    fat32_fs_t* fs = file->fs;
+    if (file->position + size < file->position || size > 0x7FFFFFFF) return -1;
+    
+    uint32_t clusters = (file->position + size + fs->cluster_size - 1) / fs->cluster_size;
+    if (!fat32_chain_grow(file, clusters)) return -1;
+    
+    const uint8_t* in = (const uint8_t*)buffer;
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t offset = file->position % fs->cluster_size;
+        uint32_t cluster, run;
+        if (!fat32_chain_map(file, file->position / fs->cluster_size, &cluster, &run)) break;
+        
+        // Clamp the run before multiplying so long runs cannot overflow
+        uint32_t max_run = (size - done + offset) / fs->cluster_size + 1;
+        if (run > max_run) run = max_run;
+        
+        uint32_t lba = fat32_cluster_lba(fs, cluster) + offset / 512;
+        uint32_t sector_offset = offset % 512;
+        uint32_t n = run * fs->cluster_size - offset;
+        if (n > size - done) n = size - done;
+        
+        if (sector_offset == 0 && n >= 512) {
+            n &= ~511u;
+            if (!bcache_write(fs->disk_id, lba, n / 512, in + done, 0)) break;
+        } else {
+            // Partial sector: read, modify, write back later
+            bcache_buf_t* buf = bcache_get(fs->disk_id, lba, 0);
+            if (!buf) break;
+            if (n > 512 - sector_offset) n = 512 - sector_offset;
+            fat32_memcpy(buf->data + sector_offset, in + done, n);
+            bcache_mark_dirty(buf);
+            bcache_release(buf);
+        }
+        
+        done += n;
+        file->position += n;
+        if (file->position > file->size) {
+            file->size = file->position;
+            file->dirty = true;
+        }
+    }
+    return done > 0 ? (int32_t)done : -1;
+}
+
+bool fat32_seek(fat32_file_t* file, uint32_t position) {
+    if (!file || !file->fs || position > file->size) return false;
+    file->position = position;
+    return true;
+}
+
+// Store the size and first cluster in the directory entry
+static bool fat32_store_entry(fat32_file_t* file) {
+    bool ok = true;
+    if (file->dirty) {
+        bcache_buf_t* buf = bcache_get(file->fs->disk_id, file->entry_sector, BCACHE_META);
+        if (buf) {
+            fat32_dir_entry_t* entry = (fat32_dir_entry_t*)(buf->data + file->entry_offset);
+            entry->file_size = file->size;
+            entry->first_cluster_hi = (uint16_t)(file->first_cluster >> 16);
+            entry->first_cluster_lo = (uint16_t)(file->first_cluster & 0xFFFF);
+            entry->attr |= FAT32_ATTR_ARCHIVE;
+            bcache_mark_dirty(buf);
+            bcache_release(buf);
+            file->dirty = false;
+        } else {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Store the directory entry and drop the cached chain. Data reaches the
+// disk with the next cache sync.
+bool fat32_close(fat32_file_t* file) {
+    if (!file || !file->fs) return false;
+    
+    bool ok = fat32_store_entry(file);
+    if (file->extents) {
+        kfree(file->extents);
+    }
+    fat32_memset(file, 0, sizeof(*file));
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// VFS binding. Nodes are created as paths are looked up; reads and writes
+// go through the file engine and so through the buffer cache.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    fat32_fs_t* fs;
+    bool root;                  // Owns fs
+    uint32_t first_cluster;     // Directories
+    fat32_file_t file;          // Files: open for the node's lifetime
+    fat32_dir_t cursor;         // Directories: readdir position
+    size_t cursor_index;        // VFS index of the next entry at cursor
+} fat32_vnode_t;
+
+static vfs_node_t* fat32_vfs_lookup(vfs_node_t* dir, const char* name);
+static int fat32_vfs_read(vfs_node_t* node, size_t offset, void* buffer, size_t size);
+static int fat32_vfs_write(vfs_node_t* node, size_t offset, const void* buffer, size_t size);
+static int fat32_vfs_readdir(vfs_node_t* dir, size_t index, vfs_dirent_t* entry);
+static vfs_node_t* fat32_vfs_create(vfs_node_t* dir, const char* name);
+static void fat32_vfs_release(vfs_node_t* node);
+
+static const vfs_ops_t fat32_vfs_ops = {
+    .fs_name = "fat32",
+    .lookup = fat32_vfs_lookup,
+    .read = fat32_vfs_read,
+    .write = fat32_vfs_write,
+    .readdir = fat32_vfs_readdir,
+    .create = fat32_vfs_create,
+    .release = fat32_vfs_release,
+};
+
+static bool fat32_is_dot(const char* name) {
+    return fat32_name_equal(name, ".") || fat32_name_equal(name, "..");
+}
+
+// Long names that do not fit a VFS node cannot be looked up again, so
+// they are left out of the VFS view rather than shown truncated
+static bool fat32_vfs_hidden(const char* name) {
+    return fat32_is_dot(name) || fat32_strlen(name) >= VFS_MAX_NAME_LEN;
+}
+
+static vfs_node_t* fat32_vfs_node(fat32_fs_t* fs, fat32_dirent_t* entry) {
+    bool dir = (entry->attr & FAT32_ATTR_DIRECTORY) != 0;
+    vfs_node_t* node = vfs_alloc_node(entry->name, dir ? VFS_DIRECTORY : VFS_FILE, &fat32_vfs_ops);
+    if (!node) return NULL;
+    
+    fat32_vnode_t* vnode = (fat32_vnode_t*)kmalloc(sizeof(fat32_vnode_t));
+    if (!vnode) {
+        vfs_free_node(node);
+        return NULL;
+    }
+    fat32_memset(vnode, 0, sizeof(*vnode));
+    vnode->fs = fs;
+    vnode->first_cluster = entry->first_cluster ? entry->first_cluster : fs->root_dir_cluster;
+    
+    if (!dir) {
+        if (!fat32_file_init(fs, entry, &vnode->file)) {
+            kfree(vnode);
+            vfs_free_node(node);
+            return NULL;
+        }
+        node->size = entry->size;
+    }
+    node->fs_private = vnode;
+    return node;
+}
+
+static vfs_node_t* fat32_vfs_lookup(vfs_node_t* dir, const char* name) {
+    fat32_vnode_t* vnode = (fat32_vnode_t*)dir->fs_private;
+    fat32_dirent_t entry;
+    if (fat32_is_dot(name) || !fat32_find(vnode->fs, vnode->first_cluster, name, &entry) ||
+        fat32_vfs_hidden(entry.name)) {
+        return NULL;
+    }
+    return fat32_vfs_node(vnode->fs, &entry);
+}
+
+static int fat32_vfs_read(vfs_node_t* node, size_t offset, void* buffer, size_t size) {
+    fat32_vnode_t* vnode = (fat32_vnode_t*)node->fs_private;
+    if (offset >= vnode->file.size) return 0;
+    if (!fat32_seek(&vnode->file, offset)) return -1;
+    return fat32_read(&vnode->file, buffer, size);
+}
+
+static int fat32_vfs_write(vfs_node_t* node, size_t offset, const void* buffer, size_t size) {
+    fat32_vnode_t* vnode = (fat32_vnode_t*)node->fs_private;
+    if (!fat32_seek(&vnode->file, offset)) return -1;
+    
+    int written = fat32_write(&vnode->file, buffer, size);
+    if (!fat32_store_entry(&vnode->file)) return -1;
+    node->size = vnode->file.size;
+    return written;
+}
+
+// Sequential calls continue from a cursor instead of rescanning
+static int fat32_vfs_readdir(vfs_node_t* dir, size_t index, vfs_dirent_t* entry) {
+    fat32_vnode_t* vnode = (fat32_vnode_t*)dir->fs_private;
+    if (index < vnode->cursor_index || !vnode->cursor.fs) {
+        fat32_dir_start(vnode->fs, vnode->first_cluster, &vnode->cursor);
+        vnode->cursor_index = 0;
+    }
+    
+    fat32_dirent_t fat_entry;
+    while (fat32_readdir(&vnode->cursor, &fat_entry)) {
+        if (fat32_vfs_hidden(fat_entry.name)) continue;
+        if (vnode->cursor_index++ < index) continue;
+        
+        size_t i = 0;
+        for (; fat_entry.name[i]; i++) {
+            entry->name[i] = fat_entry.name[i];
+        }
+        entry->name[i] = '\0';
+        entry->type = (fat_entry.attr & FAT32_ATTR_DIRECTORY) ? VFS_DIRECTORY : VFS_FILE;
+        entry->size = fat_entry.size;
+        return 1;
+    }
+    return 0;
+}
+
+// The VFS has already checked that the name is free
+static vfs_node_t* fat32_vfs_create(vfs_node_t* dir, const char* name) {
+    fat32_vnode_t* vnode = (fat32_vnode_t*)dir->fs_private;
+    fat32_dirent_t entry;
+    if (fat32_vfs_hidden(name) ||
+        !fat32_dir_add(vnode->fs, vnode->first_cluster, name, FAT32_ATTR_ARCHIVE, 0, &entry)) {
+        return NULL;
+    }
+    return fat32_vfs_node(vnode->fs, &entry);
+}
+
+static void fat32_vfs_release(vfs_node_t* node) {
+    fat32_vnode_t* vnode = (fat32_vnode_t*)node->fs_private;
+    if (!vnode) return;
+    
+    if (node->type == VFS_FILE) {
+        fat32_close(&vnode->file);
+    }
+    if (vnode->root) {
+        fat32_unmount(vnode->fs);
+        kfree(vnode->fs);
+    }
+    kfree(vnode);
+    node->fs_private = NULL;
+}
+
+// Find the node a mounted tree has cached for a directory entry
+static vfs_node_t* fat32_vfs_find(vfs_node_t* dir, fat32_dirent_t* entry, uint32_t sector, uint32_t offset) {
+    for (size_t i = 0; i < dir->dir->count; i++) {
+        vfs_node_t* node = dir->dir->entries[i];
+        fat32_vnode_t* vnode = (fat32_vnode_t*)node->fs_private;
+        if (node->type == VFS_FILE) {
+            if (vnode->file.entry_sector == sector && vnode->file.entry_offset == offset) {
+                return node;
+            }
+            continue;
+        }
+        if ((entry->attr & FAT32_ATTR_DIRECTORY) && vnode->first_cluster == entry->first_cluster) {
+            return node;
+        }
+        vfs_node_t* found = fat32_vfs_find(node, entry, sector, offset);
+        if (found) return found;
+    }
+    return NULL;
+}
+
+// Find the node a mounted tree has cached for a directory cluster
+static vfs_node_t* fat32_vfs_find_dir(vfs_node_t* dir, uint32_t cluster) {
+    if (((fat32_vnode_t*)dir->fs_private)->first_cluster == cluster) {
+        return dir;
+    }
+    for (size_t i = 0; i < dir->dir->count; i++) {
+        vfs_node_t* node = dir->dir->entries[i];
+        if (node->type != VFS_DIRECTORY) continue;
+        vfs_node_t* found = fat32_vfs_find_dir(node, cluster);
+        if (found) return found;
+    }
+    return NULL;
+}
+
+// Is a mounted root on the same volume as fs?
+static bool fat32_vfs_same_volume(vfs_node_t* root, fat32_fs_t* fs) {
+    fat32_vnode_t* vnode = (fat32_vnode_t*)root->fs_private;
+    return root->ops == &fat32_vfs_ops && vnode->fs->disk_id == fs->disk_id &&
+           vnode->fs->start_sector == fs->start_sector;
+}
+
+// An entry is about to be removed or truncated: drop any mounted node for
+// it, whose open file would otherwise keep using the freed clusters.
+// Fails if such a node is in use.
+static bool fat32_vfs_forget(fat32_fs_t* fs, fat32_dirent_t* entry) {
+    uint32_t sector, offset;
+    fat32_dir_t dir;
+    fat32_dir_start(fs, entry->dir_cluster, &dir);
+    if (!fat32_dir_locate(&dir, entry->entry_index, &sector, &offset)) return false;
+    
+    vfs_node_t* root;
+    for (size_t i = 0; (root = vfs_get_mount(i)) != NULL; i++) {
+        if (!fat32_vfs_same_volume(root, fs)) continue;
+        vfs_node_t* node = fat32_vfs_find(root, entry, sector, offset);
+        if (node && vfs_forget(node) < 0) return false;
+    }
+    return true;
+}
+
+// A name was added to or removed from a directory: a mounted copy of it
+// may have cached the old answer, the name being missing in particular
+static void fat32_vfs_dir_changed(fat32_fs_t* fs, uint32_t dir_cluster) {
+    vfs_node_t* root;
+    for (size_t i = 0; (root = vfs_get_mount(i)) != NULL; i++) {
+        if (!fat32_vfs_same_volume(root, fs)) continue;
+        vfs_dcache_invalidate_dir(fat32_vfs_find_dir(root, dir_cluster));
+    }
+}
+
+// Mount the volume at the start of a disk and return its root directory
+// node, ready for vfs_mount()
+vfs_node_t* fat32_vfs_mount(uint32_t disk_id) {
+    fat32_fs_t* fs = (fat32_fs_t*)kmalloc(sizeof(fat32_fs_t));
+    if (!fs) return NULL;
+    if (!fat32_mount(disk_id, 0, fs)) {
+        kfree(fs);
+        return NULL;
+    }
+    
+    fat32_dirent_t root;
+    fat32_root_entry(fs, &root);
+    vfs_node_t* node = fat32_vfs_node(fs, &root);
+    if (!node) {
+        fat32_unmount(fs);
+        kfree(fs);
+        return NULL;
+    }
+    ((fat32_vnode_t*)node->fs_private)->root = true;
+    return node;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "../include/memory.h"
+#include "../include/interrupts.h"
 
 typedef struct heap_block {
     size_t size;
@@ -77,9 +78,9 @@ static void merge_free_blocks(void) {
     }
 }
 
-void* kmalloc(size_t size) {
-    if (size == 0) return NULL;
-    
+// Timer callbacks allocate from interrupt context, so the block list is
+// only ever walked with interrupts disabled
+static void* kmalloc_locked(size_t size) {
     size = (size + 7) & ~7;
     
     heap_block_t* block = find_free_block(size);
@@ -117,6 +118,16 @@ void* kmalloc(size_t size) {
     return NULL;
 }
 
+void* kmalloc(size_t size) {
+    if (size == 0) return NULL;
+    
+    uint32_t flags = irq_save();
+    void* ptr = kmalloc_locked(size);
+    irq_restore(flags);
+    
+    return ptr;
+}
+
 void kfree(void* ptr) {
     if (!ptr) return;
     
@@ -126,6 +137,8 @@ void kfree(void* ptr) {
         return;
     }
     
+    uint32_t flags = irq_save();
     block->free = 1;
     merge_free_blocks();
+    irq_restore(flags);
 }
\ No newline at end of file
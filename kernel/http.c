@@ -2,6 +2,8 @@
 #include "../include/tcp.h"
 #include "../include/net.h"
 #include "../include/memory.h"
+#include "../include/dns.h"
+#include "../include/epoll.h"
 
 extern void terminal_writestring(const char* data);
 extern size_t strlen(const char* str);
@@ -40,6 +42,18 @@ static char* http_strstr(const char* haystack, const char* needle) {
     return NULL;
 }
 
+static char http_tolower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static int http_strcasecmp(const char* s1, const char* s2) {
+    while (*s1 && http_tolower(*s1) == http_tolower(*s2)) {
+        s1++;
+        s2++;
+    }
+    return (unsigned char)http_tolower(*s1) - (unsigned char)http_tolower(*s2);
+}
+
 static int http_atoi(const char* str) {
     int result = 0;
     int sign = 1;
@@ -57,30 +71,6 @@ static int http_atoi(const char* str) {
     return result * sign;
 }
 
-// Convert IP string to uint32_t
-static uint32_t http_parse_ip(const char* ip_str) {
-    uint32_t ip = 0;
-    int octet = 0;
-    int value = 0;
-    
-    while (*ip_str) {
-        if (*ip_str >= '0' && *ip_str <= '9') {
-            value = value * 10 + (*ip_str - '0');
-        } else if (*ip_str == '.') {
-            ip = (ip << 8) | (value & 0xFF);
-            value = 0;
-            octet++;
-            if (octet >= 3) break;
-        }
-        ip_str++;
-    }
-    
-    // Last octet
-    ip = (ip << 8) | (value & 0xFF);
-    
-    return ip;
-}
-
 int http_parse_url(const char* url, char* host, uint16_t* port, char* path) {
     // Default values
     *port = 80;
@@ -116,116 +106,503 @@ int http_parse_url(const char* url, char* host, uint16_t* port, char* path) {
     return 0;
 }
 
-int http_get(const char* host, uint16_t port, const char* path, http_response_t* response) {
-    terminal_writestring("HTTP GET ");
-    terminal_writestring(host);
-    terminal_writestring(path);
-    terminal_writestring("\n");
+// Idle keep-alive connection
+typedef struct {
+    char host[HTTP_MAX_HOST];
+    uint16_t port;
+    int socket;                 // -1 when the slot is empty
+    uint32_t idle_since;
+} http_pooled_t;
+
+// Buffered reader over one connection
+typedef struct {
+    int socket;
+    uint8_t* buffer;
+    size_t start;
+    size_t end;
+    size_t received;            // Bytes read from the socket so far
+} http_reader_t;
+
+// Returned when a reused connection turned out to be closed by the server
+// before it sent anything; the request is retried on a fresh connection
+#define HTTP_STALE (-2)
+
+static http_pooled_t http_pool[HTTP_POOL_SIZE];
+static int http_pool_ready = 0;
+static http_stats_t http_stats;
+
+static void http_pool_init(void) {
+    if (http_pool_ready) return;
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_pool[i].socket = -1;
+    }
+    http_pool_ready = 1;
+}
+
+// Take an idle connection to host:port from the pool, or open a new one
+static int http_pool_acquire(const char* host, uint16_t port, int* reused) {
+    http_pool_init();
+    uint32_t now = timer_get_ticks();
+    
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_pooled_t* slot = &http_pool[i];
+        if (slot->socket < 0 || slot->port != port || http_strcasecmp(slot->host, host) != 0) {
+            continue;
+        }
+        
+        int sock = slot->socket;
+        slot->socket = -1;
+        
+        // Anything readable on an idle connection means the server closed
+        // it (or sent junk); either way it cannot carry another request
+        if (now - slot->idle_since > HTTP_IDLE_TIMEOUT || tcp_poll(sock) != EPOLLOUT) {
+            tcp_close(sock);
+            continue;
+        }
+        
+        *reused = 1;
+        http_stats.connections_reused++;
+        return sock;
+    }
     
-    // For now, use hardcoded IP (would need DNS resolver)
-    uint32_t server_ip = http_parse_ip("93.184.216.34"); // example.com
+    uint32_t server_ip;
+    if (dns_resolve(host, &server_ip) < 0) {
+        terminal_writestring("Failed to resolve host\n");
+        return -1;
+    }
     
-    // Create TCP socket
     int sock = tcp_socket();
     if (sock < 0) {
         terminal_writestring("Failed to create socket\n");
         return -1;
     }
     
-    // Connect to server
-    terminal_writestring("Connecting to server...\n");
     if (tcp_connect(sock, server_ip, port) < 0) {
         terminal_writestring("Failed to connect\n");
         tcp_close(sock);
         return -1;
     }
     
-    terminal_writestring("Connected!\n");
+    *reused = 0;
+    http_stats.connections_opened++;
+    return sock;
+}
+
+// Park a connection for reuse, displacing the longest idle one if full
+static void http_pool_release(const char* host, uint16_t port, int sock) {
+    http_pooled_t* slot = NULL;
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (http_pool[i].socket < 0) {
+            slot = &http_pool[i];
+            break;
+        }
+        if (!slot || (int32_t)(http_pool[i].idle_since - slot->idle_since) < 0) {
+            slot = &http_pool[i];
+        }
+    }
+    
+    if (slot->socket >= 0) {
+        tcp_close(slot->socket);
+    }
+    
+    size_t i = 0;
+    for (; host[i] && i < HTTP_MAX_HOST - 1; i++) {
+        slot->host[i] = host[i];
+    }
+    slot->host[i] = '\0';
+    slot->port = port;
+    slot->socket = sock;
+    slot->idle_since = timer_get_ticks();
+}
+
+void http_pool_flush(void) {
+    http_pool_init();
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (http_pool[i].socket >= 0) {
+            tcp_close(http_pool[i].socket);
+            http_pool[i].socket = -1;
+        }
+    }
+}
+
+http_stats_t* http_get_stats(void) {
+    return &http_stats;
+}
+
+static int http_fill(http_reader_t* reader) {
+    if (reader->start == reader->end) {
+        reader->start = 0;
+        reader->end = 0;
+    } else if (reader->end == HTTP_BUFFER_SIZE) {
+        // Slide the unread tail to the front
+        size_t unread = reader->end - reader->start;
+        for (size_t i = 0; i < unread; i++) {
+            reader->buffer[i] = reader->buffer[reader->start + i];
+        }
+        reader->start = 0;
+        reader->end = unread;
+    }
+    if (reader->end == HTTP_BUFFER_SIZE) {
+        return -1; // Line longer than the buffer
+    }
+    
+    int received = tcp_recv(reader->socket, reader->buffer + reader->end, HTTP_BUFFER_SIZE - reader->end);
+    if (received > 0) {
+        reader->end += received;
+        reader->received += received;
+    }
+    return received;
+}
+
+// Read one line without its CRLF. Returns the length, or -1 on EOF/error.
+static int http_read_line(http_reader_t* reader, char* line, size_t max) {
+    size_t length = 0;
+    
+    while (1) {
+        while (reader->start < reader->end) {
+            char c = (char)reader->buffer[reader->start++];
+            if (c == '\n') {
+                if (length > 0 && line[length - 1] == '\r') length--;
+                line[length] = '\0';
+                return (int)length;
+            }
+            if (length + 1 >= max) return -1;
+            line[length++] = c;
+        }
+        if (http_fill(reader) <= 0) return -1;
+    }
+}
+
+// Hand length body bytes (or everything up to EOF for HTTP_LENGTH_UNKNOWN)
+// to the callback, straight out of the receive buffer
+static int http_read_body(http_reader_t* reader, uint32_t length, http_body_callback_t on_body,
+                          void* context, size_t* total) {
+    while (length > 0) {
+        if (reader->start == reader->end) {
+            int received = http_fill(reader);
+            if (received < 0) return -1;
+            if (received == 0) return length == HTTP_LENGTH_UNKNOWN ? 0 : -1;
+        }
+        
+        size_t chunk = reader->end - reader->start;
+        if (length != HTTP_LENGTH_UNKNOWN && chunk > length) chunk = length;
+        
+        if (on_body && on_body(context, reader->buffer + reader->start, chunk) < 0) {
+            return -1;
+        }
+        reader->start += chunk;
+        *total += chunk;
+        if (length != HTTP_LENGTH_UNKNOWN) length -= chunk;
+    }
+    return 0;
+}
+
+// Value of a "Name: value" header line if its name matches, else NULL
+static const char* http_header_value(const char* line, const char* name) {
+    while (*name) {
+        if (http_tolower(*line) != *name) return NULL;
+        line++;
+        name++;
+    }
+    if (*line != ':') return NULL;
+    line++;
+    while (*line == ' ' || *line == '\t') line++;
+    return line;
+}
+
+static int http_parse_hex(const char* str, uint32_t* value) {
+    uint32_t result = 0;
+    int digits = 0;
+    for (; *str; str++, digits++) {
+        char c = http_tolower(*str);
+        uint32_t digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else break;
+        if (result > 0x0FFFFFFF) return 0;
+        result = (result << 4) | digit;
+    }
+    *value = result;
+    return digits > 0;
+}
+
+// Chunked transfer coding: hex size lines, each chunk followed by CRLF,
+// a zero-size chunk and optional trailers ending in a blank line
+static int http_read_chunked(http_reader_t* reader, http_body_callback_t on_body,
+                             void* context, size_t* total) {
+    char line[128];
+    
+    while (1) {
+        if (http_read_line(reader, line, sizeof(line)) < 0) return -1;
+        uint32_t size;
+        if (!http_parse_hex(line, &size)) return -1; // Extensions after ';' are ignored
+        
+        if (size == 0) {
+            // Trailer section
+            int length;
+            do {
+                length = http_read_line(reader, line, sizeof(line));
+            } while (length > 0);
+            return length == 0 ? 0 : -1;
+        }
+        
+        if (http_read_body(reader, size, on_body, context, total) < 0) return -1;
+        if (http_read_line(reader, line, sizeof(line)) != 0) return -1;
+    }
+}
+
+// One request/response exchange on an open connection. Returns the body
+// length, HTTP_STALE or -1. raw_headers, if given, receives a copy of the
+// header block.
+static int http_exchange(http_reader_t* reader, const char* request, size_t request_length,
+                         int head_only, http_head_t* head, http_body_callback_t on_body,
+                         void* context, char** raw_headers) {
+    if (tcp_send(reader->socket, request, request_length) != (int)request_length) {
+        return HTTP_STALE;
+    }
+    
+    char line[512];
+    char* headers = NULL;
+    size_t headers_length = 0;
+    
+    // Skip interim 1xx responses
+    do {
+        if (http_read_line(reader, line, sizeof(line)) < 0) {
+            return reader->received == 0 ? HTTP_STALE : -1;
+        }
+        if (http_strstr(line, "HTTP/1.") != line || !http_strstr(line, " ")) {
+            return -1;
+        }
+        
+        head->status_code = http_atoi(http_strstr(line, " ") + 1);
+        head->content_length = HTTP_LENGTH_UNKNOWN;
+        head->chunked = 0;
+        head->keep_alive = line[7] != '0'; // HTTP/1.0 closes by default
+        
+        if (raw_headers) {
+            if (!headers) headers = (char*)kmalloc(HTTP_MAX_HEADERS);
+            headers_length = 0;
+        }
+        
+        int length;
+        while ((length = http_read_line(reader, line, sizeof(line))) > 0) {
+            const char* value;
+            if ((value = http_header_value(line, "content-length"))) {
+                head->content_length = (uint32_t)http_atoi(value);
+            } else if ((value = http_header_value(line, "transfer-encoding"))) {
+                head->chunked = http_strstr(value, "chunked") != NULL;
+            } else if ((value = http_header_value(line, "connection"))) {
+                if (http_strcasecmp(value, "close") == 0) head->keep_alive = 0;
+                if (http_strcasecmp(value, "keep-alive") == 0) head->keep_alive = 1;
+            }
+            
+            if (headers && headers_length + length + 3 < HTTP_MAX_HEADERS) {
+                for (int i = 0; i < length; i++) headers[headers_length++] = line[i];
+                headers[headers_length++] = '\r';
+                headers[headers_length++] = '\n';
+            }
+        }
+        if (length < 0) {
+            if (headers) kfree(headers);
+            return -1;
+        }
+    } while (head->status_code >= 100 && head->status_code < 200);
+    
+    if (headers) {
+        headers[headers_length] = '\0';
+        *raw_headers = headers;
+    }
+    
+    // Body framing (RFC 7230 section 3.3.3)
+    size_t total = 0;
+    int result = 0;
+    if (head_only || head->status_code == 204 || head->status_code == 304) {
+        // No body
+    } else if (head->chunked) {
+        result = http_read_chunked(reader, on_body, context, &total);
+    } else if (head->content_length != HTTP_LENGTH_UNKNOWN) {
+        result = http_read_body(reader, head->content_length, on_body, context, &total);
+    } else {
+        head->keep_alive = 0;
+        result = http_read_body(reader, HTTP_LENGTH_UNKNOWN, on_body, context, &total);
+    }
+    
+    // Leftover bytes would be misread as the next response
+    if (result < 0 || reader->start != reader->end) {
+        head->keep_alive = 0;
+    }
+    return result < 0 ? -1 : (int)total;
+}
+
+static int http_perform(const char* method, const char* host, uint16_t port, const char* path,
+                        http_head_t* head, http_body_callback_t on_body, void* context,
+                        char** raw_headers) {
+    http_stats.requests++;
     
     // Build HTTP request
-    char request[512];
-    char* p = request;
+    size_t request_size = strlen(method) + strlen(path) + strlen(host) + 128;
+    char* request = (char*)kmalloc(request_size);
+    if (!request) return -1;
     
-    // Request line
-    http_strcpy(p, "GET ");
+    char* p = request;
+    http_strcpy(p, method);
     p += strlen(p);
-    http_strcpy(p, path);
+    http_strcpy(p, " ");
     p += strlen(p);
-    http_strcpy(p, " HTTP/1.0\r\n");
+    http_strcpy(p, path);
     p += strlen(p);
-    
-    // Host header
-    http_strcpy(p, "Host: ");
+    http_strcpy(p, " HTTP/1.1\r\nHost: ");
     p += strlen(p);
     http_strcpy(p, host);
     p += strlen(p);
-    http_strcpy(p, "\r\n");
-    p += strlen(p);
+    http_strcpy(p, "\r\nUser-Agent: MyKernel/1.0\r\nConnection: keep-alive\r\n\r\n");
+    size_t request_length = strlen(request);
     
-    // User-Agent
-    http_strcpy(p, "User-Agent: MyKernel/1.0\r\n");
-    p += strlen(p);
-    
-    // Connection close
-    http_strcpy(p, "Connection: close\r\n");
-    p += strlen(p);
-    
-    // End of headers
-    http_strcpy(p, "\r\n");
-    
-    // Send request
-    terminal_writestring("Sending HTTP request...\n");
-    int sent = tcp_send(sock, request, strlen(request));
-    if (sent < 0) {
-        terminal_writestring("Failed to send request\n");
-        tcp_close(sock);
+    http_reader_t reader;
+    reader.buffer = (uint8_t*)kmalloc(HTTP_BUFFER_SIZE);
+    if (!reader.buffer) {
+        kfree(request);
         return -1;
     }
     
-    // Receive response
-    terminal_writestring("Waiting for response...\n");
-    char* buffer = (char*)kmalloc(8192);
-    if (!buffer) {
-        tcp_close(sock);
-        return -1;
-    }
-    
-    int total_received = 0;
-    int received;
+    int head_only = http_strcmp(method, "HEAD") == 0;
+    int result = -1;
     
-    while ((received = tcp_recv(sock, buffer + total_received, 8192 - total_received - 1)) > 0) {
-        total_received += received;
-        if (total_received >= 8191) break;
+    // A pooled connection may have been closed under us; retry once fresh
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int reused = 0;
+        int sock = http_pool_acquire(host, port, &reused);
+        if (sock < 0) break;
+        
+        reader.socket = sock;
+        reader.start = 0;
+        reader.end = 0;
+        reader.received = 0;
+        
+        result = http_exchange(&reader, request, request_length, head_only, head,
+                               on_body, context, raw_headers);
+        if (result == HTTP_STALE) {
+            tcp_close(sock);
+            result = -1;
+            if (reused) continue;
+            break;
+        }
+        
+        if (result >= 0 && head->keep_alive) {
+            http_pool_release(host, port, sock);
+        } else {
+            tcp_close(sock);
+        }
+        break;
     }
     
-    buffer[total_received] = '\0';
-    
-    // Parse response
-    response->headers = buffer;
-    response->body = http_strstr(buffer, "\r\n\r\n");
+    kfree(reader.buffer);
+    kfree(request);
+    return result;
+}
+
+// Issue a request and stream the response body to on_body. Returns the
+// body length or -1.
+int http_request(const char* method, const char* host, uint16_t port, const char* path,
+                 http_head_t* head, http_body_callback_t on_body, void* context) {
+    http_head_t local_head;
+    return http_perform(method, host, port, path, head ? head : &local_head,
+                        on_body, context, NULL);
+}
+
+// Growable buffer for http_get
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} http_buffer_t;
+
+static int http_buffer_append(void* context, const uint8_t* data, size_t length) {
+    http_buffer_t* buffer = (http_buffer_t*)context;
     
-    if (response->body) {
-        response->body += 4; // Skip \r\n\r\n
-        response->body_length = total_received - (response->body - buffer);
+    if (buffer->length + length + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : HTTP_BUFFER_SIZE;
+        while (buffer->length + length + 1 > capacity) capacity *= 2;
         
-        // Parse status code
-        char* status_line = buffer;
-        char* space = http_strstr(status_line, " ");
-        if (space) {
-            response->status_code = http_atoi(space + 1);
+        char* grown = (char*)kmalloc(capacity);
+        if (!grown) return -1;
+        for (size_t i = 0; i < buffer->length; i++) {
+            grown[i] = buffer->data[i];
         }
+        if (buffer->data) kfree(buffer->data);
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    
+    for (size_t i = 0; i < length; i++) {
+        buffer->data[buffer->length++] = (char)data[i];
+    }
+    buffer->data[buffer->length] = '\0';
+    return 0;
+}
+
+// Fetch a whole response into memory
+int http_get(const char* host, uint16_t port, const char* path, http_response_t* response) {
+    http_buffer_t buffer = {NULL, 0, 0};
+    http_head_t head;
+    
+    response->headers = NULL;
+    response->body = NULL;
+    response->body_length = 0;
+    response->status_code = 0;
+    
+    int result = http_perform("GET", host, port, path, &head, http_buffer_append, &buffer,
+                              &response->headers);
+    if (result < 0) {
+        if (buffer.data) kfree(buffer.data);
+        http_free_response(response);
+        return -1;
     }
     
-    terminal_writestring("Response received!\n");
+    // Empty bodies still get a terminated buffer
+    if (!buffer.data && http_buffer_append(&buffer, NULL, 0) < 0) {
+        http_free_response(response);
+        return -1;
+    }
+    
+    response->status_code = head.status_code;
+    response->body = buffer.data;
+    response->body_length = buffer.length;
+    return 0;
+}
+
+int http_file_sink(void* context, const uint8_t* data, size_t length) {
+    http_file_sink_t* sink = (http_file_sink_t*)context;
+    if (length == 0) return 0;
     
-    tcp_close(sock);
+    int written = vfs_write(sink->file, sink->offset, data, length);
+    if (written != (int)length) return -1;
+    sink->offset += length;
     return 0;
 }
 
+// Stream a response body into a file, creating it. Files are written in
+// place with no truncation, so an existing non-empty file is refused
+// rather than left with stale bytes past the new end. Returns the body
+// length or -1.
+int http_download(const char* host, uint16_t port, const char* path, const char* file_path,
+                  http_head_t* head) {
+    vfs_node_t* file = vfs_create(file_path);
+    if (!file || file->size != 0) {
+        return -1;
+    }
+    
+    http_file_sink_t sink = {file, 0};
+    return http_request("GET", host, port, path, head, http_file_sink, &sink);
+}
+
 void http_free_response(http_response_t* response) {
     if (response->headers) {
         kfree(response->headers);
         response->headers = NULL;
+    }
+    if (response->body) {
+        kfree(response->body);
         response->body = NULL;
     }
 }
\ No newline at end of file
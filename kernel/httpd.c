@@ -0,0 +1,628 @@
+#include "../include/httpd.h"
+#include "../include/socket.h"
+#include "../include/tcp.h"
+#include "../include/epoll.h"
+#include "../include/slab.h"
+#include "../include/errno.h"
+
+extern void terminal_writestring(const char* data);
+extern size_t strlen(const char* str);
+
+#define HTTPD_PAGE(text) "<html><body><h1>" text "</h1></body></html>\n"
+
+// Status lines and their canned bodies, sent without copying
+static const struct {
+    int status;
+    const char* reason;
+    const char* page;
+} httpd_statuses[] = {
+    {200, "OK", NULL},
+    {400, "Bad Request", HTTPD_PAGE("400 Bad Request")},
+    {404, "Not Found", HTTPD_PAGE("404 Not Found")},
+    {405, "Method Not Allowed", HTTPD_PAGE("405 Method Not Allowed")},
+    {431, "Request Header Fields Too Large", HTTPD_PAGE("431 Request Header Fields Too Large")},
+    {505, "HTTP Version Not Supported", HTTPD_PAGE("505 HTTP Version Not Supported")},
+};
+
+static struct {
+    int listen_fd;              // -1 while stopped
+    int epfd;
+    uint16_t port;
+    uint32_t last_sweep;
+    httpd_conn_t* connections;
+} httpd = { -1, -1, 0, 0, NULL };
+
+static slab_cache_t httpd_conn_cache;
+static httpd_stats_t httpd_stats;
+static int httpd_initialized = 0;
+
+static void httpd_itoa(uint32_t value, char* buffer) {
+    char temp[12];
+    int pos = 0;
+    do {
+        temp[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    int i = 0;
+    while (pos > 0) {
+        buffer[i++] = temp[--pos];
+    }
+    buffer[i] = '\0';
+}
+
+static void httpd_write_uint(uint32_t value) {
+    char buffer[12];
+    httpd_itoa(value, buffer);
+    terminal_writestring(buffer);
+}
+
+static char httpd_tolower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// Does the header line start with name (which includes the colon)?
+static int httpd_header_is(const char* line, const char* name) {
+    while (*name) {
+        if (httpd_tolower(*line++) != *name++) return 0;
+    }
+    return 1;
+}
+
+// Case-insensitive search for a token within one header value
+static int httpd_value_has(const char* value, const char* token) {
+    for (; *value && *value != '\r' && *value != '\n'; value++) {
+        const char* v = value;
+        const char* t = token;
+        while (*t && httpd_tolower(*v) == *t) {
+            v++;
+            t++;
+        }
+        if (!*t) return 1;
+    }
+    return 0;
+}
+
+static int httpd_hex(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = httpd_tolower(c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Append to the response head; fails rather than truncate
+static int httpd_append(httpd_conn_t* conn, const char* text) {
+    while (*text) {
+        if (conn->header_length >= HTTPD_HEADER_SIZE) return -1;
+        conn->header[conn->header_length++] = *text++;
+    }
+    return 0;
+}
+
+static const char* httpd_content_type(const char* name) {
+    const char* dot = NULL;
+    for (const char* p = name; *p; p++) {
+        if (*p == '.') dot = p;
+    }
+    if (!dot) return "application/octet-stream";
+    
+    static const struct {
+        const char* extension;
+        const char* type;
+    } types[] = {
+        {".html", "text/html"},
+        {".htm", "text/html"},
+        {".txt", "text/plain"},
+        {".css", "text/css"},
+        {".js", "application/javascript"},
+        {".json", "application/json"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".gif", "image/gif"},
+    };
+    
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        const char* a = dot;
+        const char* b = types[i].extension;
+        while (*b && httpd_tolower(*a) == *b) {
+            a++;
+            b++;
+        }
+        if (!*a && !*b) return types[i].type;
+    }
+    return "application/octet-stream";
+}
+
+// Resolve an absolute, percent-decoded request path; ".." stops at the
+// root. Files on mounted volumes are read through the buffer cache, which
+// deferred work may use.
+static vfs_node_t* httpd_lookup(const char* path) {
+    vfs_node_t* node = vfs_lookup(path);
+    if (node && node->type == VFS_DIRECTORY) {
+        node = vfs_find_child(node, "index.html");
+    }
+    return (node && node->type == VFS_FILE) ? node : NULL;
+}
+
+static void httpd_release_file(httpd_conn_t* conn) {
+    if (conn->file) {
+        vfs_node_put(conn->file);
+        conn->file = NULL;
+    }
+}
+
+static void httpd_close(httpd_conn_t* conn) {
+    httpd_release_file(conn);
+    socket_close(conn->fd);
+    
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        httpd.connections = conn->next;
+    }
+    if (conn->next) conn->next->prev = conn->prev;
+    
+    httpd_stats.active--;
+    slab_free(&httpd_conn_cache, conn);
+}
+
+// Build the response head and point the body at its source: the file,
+// or a canned page for errors
+static void httpd_respond(httpd_conn_t* conn, int status, vfs_node_t* file, int head_only) {
+    size_t index = 0;
+    while (index < sizeof(httpd_statuses) / sizeof(httpd_statuses[0]) - 1 &&
+           httpd_statuses[index].status != status) {
+        index++;
+    }
+    
+    if (status >= 500) httpd_stats.status_5xx++;
+    else if (status >= 400) httpd_stats.status_4xx++;
+    else httpd_stats.status_2xx++;
+    
+    // After a malformed request the stream position is in doubt
+    if (status >= 400 && status != 404 && status != 405) conn->keep_alive = 0;
+    if (conn->requests + 1 >= HTTPD_MAX_REQUESTS) conn->keep_alive = 0;
+    
+    const char* type = "text/html";
+    if (file) {
+        vfs_node_get(file);
+        conn->file = file;
+        conn->body = NULL;
+        conn->body_length = file->size;
+        type = httpd_content_type(file->name);
+    } else {
+        conn->body = (const uint8_t*)httpd_statuses[index].page;
+        conn->body_length = strlen(httpd_statuses[index].page);
+    }
+    
+    char number[12];
+    conn->header_length = 0;
+    httpd_itoa(status, number);
+    httpd_append(conn, "HTTP/1.1 ");
+    httpd_append(conn, number);
+    httpd_append(conn, " ");
+    httpd_append(conn, httpd_statuses[index].reason);
+    httpd_append(conn, "\r\nServer: ByteOS\r\nContent-Type: ");
+    httpd_append(conn, type);
+    if (status == 405) {
+        httpd_append(conn, "\r\nAllow: GET, HEAD");
+    }
+    httpd_itoa(conn->body_length, number);
+    httpd_append(conn, "\r\nContent-Length: ");
+    httpd_append(conn, number);
+    httpd_append(conn, conn->keep_alive ? "\r\nConnection: keep-alive\r\n\r\n" :
+                                          "\r\nConnection: close\r\n\r\n");
+    
+    if (head_only) conn->body_length = 0;
+    conn->header_sent = 0;
+    conn->body_sent = 0;
+    conn->state = HTTPD_CONN_SENDING;
+    
+    // Head and body leave as full segments rather than a runt head first;
+    // the cork comes off once the last byte is queued
+    socket_setsockopt(conn->fd, IPPROTO_TCP, TCP_CORK, 1);
+}
+
+// Parse one complete request head at the start of conn->request. Returns 1
+// with a response prepared, 0 if the head is still incomplete.
+static int httpd_parse(httpd_conn_t* conn) {
+    char* request = conn->request;
+    size_t length = conn->request_length;
+    
+    size_t end = 0;
+    while (end + 3 < length && !(request[end] == '\r' && request[end + 1] == '\n' &&
+                                 request[end + 2] == '\r' && request[end + 3] == '\n')) {
+        end++;
+    }
+    if (end + 3 >= length) {
+        if (length >= HTTPD_REQUEST_SIZE) {
+            conn->keep_alive = 0;
+            httpd_respond(conn, 431, NULL, 0);
+            conn->request_length = 0;
+            return 1;
+        }
+        return 0;
+    }
+    
+    // Terminate the head; pipelined bytes after it are moved down once
+    // the response is on its way
+    request[end + 2] = '\0';
+    size_t consumed = end + 4;
+    httpd_stats.requests++;
+    if (conn->requests > 0) httpd_stats.reused++;
+    
+    // Request line: METHOD SP target SP HTTP/1.x
+    char* method = request;
+    char* target = method;
+    while (*target && *target != ' ' && *target != '\r') target++;
+    if (*target) *target++ = '\0';
+    char* version = target;
+    while (*version && *version != ' ' && *version != '\r') version++;
+    if (*version) *version++ = '\0';
+    char* line = version;
+    while (*line && *line != '\r') line++;
+    if (*line) *line++ = '\0';
+    
+    int head_only = 0;
+    int status = 200;
+    if (version[0] != 'H' || version[1] != 'T' || version[2] != 'T' || version[3] != 'P' ||
+        version[4] != '/' || version[5] != '1' || version[6] != '.' ||
+        (version[7] != '0' && version[7] != '1') || version[8]) {
+        status = version[0] == 'H' ? 505 : 400;
+    } else if (target[0] != '/') {
+        status = 400;
+    }
+    
+    // HTTP/1.1 defaults to keep-alive, 1.0 to close
+    conn->keep_alive = status == 200 && version[7] == '1';
+    
+    // Headers
+    while (*line) {
+        if (*line == '\n') line++;
+        if (httpd_header_is(line, "connection:")) {
+            if (httpd_value_has(line + 11, "close")) conn->keep_alive = 0;
+            else if (httpd_value_has(line + 11, "keep-alive")) conn->keep_alive = 1;
+        } else if (httpd_header_is(line, "content-length:") ||
+                   httpd_header_is(line, "transfer-encoding:")) {
+            // Request bodies are not read, so the stream cannot continue
+            conn->keep_alive = 0;
+        }
+        while (*line && *line != '\n') line++;
+    }
+    
+    if (status == 200) {
+        if (method[0] == 'H' && method[1] == 'E' && method[2] == 'A' && method[3] == 'D' && !method[4]) {
+            head_only = 1;
+        } else if (!(method[0] == 'G' && method[1] == 'E' && method[2] == 'T' && !method[3])) {
+            status = 405;
+        }
+    }
+    
+    vfs_node_t* file = NULL;
+    if (status == 200) {
+        // Decode in place; the query string is ignored
+        char* in = target;
+        char* out = target;
+        while (*in && *in != '?' && *in != '#') {
+            if (*in == '%' && httpd_hex(in[1]) >= 0 && httpd_hex(in[2]) >= 0) {
+                *out = (char)(httpd_hex(in[1]) * 16 + httpd_hex(in[2]));
+                in += 3;
+            } else {
+                *out = *in++;
+            }
+            // A decoded NUL would end the path early
+            if (*out == '\0') {
+                status = 400;
+                break;
+            }
+            out++;
+        }
+        *out = '\0';
+        
+        if (status == 200) {
+            file = httpd_lookup(target);
+            if (!file) status = 404;
+        }
+    }
+    
+    httpd_respond(conn, status, file, head_only);
+    
+    for (size_t i = consumed; i < length; i++) {
+        request[i - consumed] = request[i];
+    }
+    conn->request_length = length - consumed;
+    return 1;
+}
+
+typedef struct {
+    vfs_node_t* file;
+    size_t offset;
+} httpd_source_t;
+
+// Read the next piece of the body into the socket's send ring
+static int httpd_fill(void* context, void* dest, size_t length) {
+    httpd_source_t* source = (httpd_source_t*)context;
+    int read = vfs_read(source->file, source->offset, dest, length);
+    if (read > 0) source->offset += read;
+    return read;
+}
+
+// Queue as much of the response as the send ring takes. Returns 1 when all
+// of it is queued, 0 if the socket is full, < 0 on error.
+static int httpd_send(httpd_conn_t* conn) {
+    while (conn->header_sent < conn->header_length) {
+        int sent = socket_send(conn->fd, conn->header + conn->header_sent,
+                               conn->header_length - conn->header_sent);
+        if (sent == -EAGAIN) return 0;
+        if (sent <= 0) return -1;
+        conn->header_sent += sent;
+    }
+    
+    // sendfile: the file is read straight into the send ring. A file that
+    // shrank underneath comes up short and ends the connection.
+    while (conn->body_sent < conn->body_length) {
+        size_t remaining = conn->body_length - conn->body_sent;
+        int sent;
+        if (conn->file) {
+            httpd_source_t source = { conn->file, conn->body_sent };
+            sent = socket_send_fill(conn->fd, httpd_fill, &source, remaining);
+        } else {
+            sent = socket_send(conn->fd, conn->body + conn->body_sent, remaining);
+        }
+        if (sent == -EAGAIN) return 0;
+        if (sent <= 0) return -1;
+        conn->body_sent += sent;
+        httpd_stats.bytes_sent += sent;
+    }
+    
+    socket_setsockopt(conn->fd, IPPROTO_TCP, TCP_CORK, 0);
+    return 1;
+}
+
+// Advance one connection as far as its socket allows. Returns < 0 once the
+// connection has been closed.
+static int httpd_process(httpd_conn_t* conn) {
+    int reads = 0;
+    
+    for (;;) {
+        if (conn->state == HTTPD_CONN_SENDING) {
+            int result = httpd_send(conn);
+            if (result < 0) {
+                httpd_close(conn);
+                return -1;
+            }
+            if (result == 0) break;
+            
+            httpd_release_file(conn);
+            conn->requests++;
+            if (!conn->keep_alive) {
+                httpd_close(conn);
+                return -1;
+            }
+            conn->state = HTTPD_CONN_READING;
+        }
+        
+        // A pipelined request may already be buffered
+        if (httpd_parse(conn)) continue;
+        
+        if (reads++ >= HTTPD_READS_PER_EVENT) break;
+        int received = socket_recv(conn->fd, conn->request + conn->request_length,
+                                   HTTPD_REQUEST_SIZE - conn->request_length);
+        if (received == -EAGAIN) break;
+        if (received <= 0) {
+            // Peer closed (or reset) between requests
+            httpd_close(conn);
+            return -1;
+        }
+        conn->request_length += received;
+    }
+    
+    // Wait for whichever direction is blocking progress
+    uint32_t interest = conn->state == HTTPD_CONN_SENDING ? EPOLLOUT : EPOLLIN;
+    if (interest != conn->interest) {
+        epoll_event_t event;
+        event.events = interest;
+        event.data = (uint32_t)conn;
+        epoll_ctl(httpd.epfd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->interest = interest;
+    }
+    return 0;
+}
+
+static void httpd_accept(void) {
+    for (;;) {
+        int fd = socket_accept(httpd.listen_fd, NULL);
+        if (fd < 0) return;
+        
+        // Before any close: a blocking one would linger for the FIN
+        socket_setsockopt(fd, SOL_SOCKET, SO_NONBLOCK, 1);
+        
+        if (httpd_stats.active >= HTTPD_MAX_CONNECTIONS) {
+            httpd_stats.rejected++;
+            socket_close(fd);
+            continue;
+        }
+        
+        httpd_conn_t* conn = (httpd_conn_t*)slab_alloc(&httpd_conn_cache);
+        if (!conn) {
+            httpd_stats.rejected++;
+            socket_close(fd);
+            continue;
+        }
+        
+        conn->fd = fd;
+        conn->state = HTTPD_CONN_READING;
+        conn->interest = EPOLLIN;
+        conn->last_active = timer_get_ticks();
+        conn->requests = 0;
+        conn->keep_alive = 0;
+        conn->request_length = 0;
+        conn->header_length = 0;
+        conn->body_length = 0;
+        conn->file = NULL;
+        
+        epoll_event_t event;
+        event.events = EPOLLIN;
+        event.data = (uint32_t)conn;
+        if (epoll_ctl(httpd.epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            httpd_stats.rejected++;
+            socket_close(fd);
+            slab_free(&httpd_conn_cache, conn);
+            continue;
+        }
+        
+        conn->prev = NULL;
+        conn->next = httpd.connections;
+        if (httpd.connections) httpd.connections->prev = conn;
+        httpd.connections = conn;
+        httpd_stats.accepted++;
+        httpd_stats.active++;
+    }
+}
+
+// Close connections that have made no progress for HTTPD_IDLE_TIMEOUT,
+// whether idle between requests or stalled behind a closed window
+static void httpd_sweep(uint32_t now) {
+    httpd_conn_t* conn = httpd.connections;
+    while (conn) {
+        httpd_conn_t* next = conn->next;
+        if ((int32_t)(now - conn->last_active) >= (int32_t)HTTPD_IDLE_TIMEOUT) {
+            httpd_stats.idle_closed++;
+            httpd_close(conn);
+        }
+        conn = next;
+    }
+}
+
+// Deferred work, every tick
+static void httpd_work(void) {
+    if (httpd.listen_fd < 0) return;
+    
+    uint32_t now = timer_get_ticks();
+    epoll_event_t events[HTTPD_MAX_EVENTS];
+    int count = epoll_wait(httpd.epfd, events, HTTPD_MAX_EVENTS, 0);
+    
+    for (int i = 0; i < count; i++) {
+        if (events[i].data == 0) {
+            httpd_accept();
+            continue;
+        }
+        
+        httpd_conn_t* conn = (httpd_conn_t*)events[i].data;
+        if (events[i].events & EPOLLERR) {
+            httpd_close(conn);
+            continue;
+        }
+        conn->last_active = now;
+        httpd_process(conn);
+    }
+    
+    if ((int32_t)(now - httpd.last_sweep) >= (int32_t)HTTPD_SWEEP_INTERVAL) {
+        httpd.last_sweep = now;
+        httpd_sweep(now);
+    }
+}
+
+void httpd_init(void) {
+    if (httpd_initialized) return;
+    slab_cache_init(&httpd_conn_cache, "httpd_conn", sizeof(httpd_conn_t));
+    work_register(httpd_work, HTTPD_WORK_INTERVAL);
+    httpd_initialized = 1;
+}
+
+int httpd_start(uint16_t port) {
+    if (!httpd_initialized) return -EINVAL;
+    if (httpd.listen_fd >= 0) return -EADDRINUSE;
+    
+    int fd = socket_create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) return fd;
+    
+    sockaddr_in_t addr;
+    addr.family = AF_INET;
+    addr.port = port;
+    addr.addr = 0;
+    
+    int result = socket_bind(fd, &addr);
+    if (result >= 0) result = socket_listen(fd, TCP_DEFAULT_BACKLOG);
+    if (result >= 0) result = socket_setsockopt(fd, SOL_SOCKET, SO_NONBLOCK, 1);
+    
+    int epfd = result >= 0 ? epoll_create() : -1;
+    if (result >= 0 && epfd < 0) result = epfd;
+    
+    if (result >= 0) {
+        // Listener events carry cookie 0, connections their state pointer
+        epoll_event_t event;
+        event.events = EPOLLIN;
+        event.data = 0;
+        result = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+    }
+    
+    if (result < 0) {
+        if (epfd >= 0) epoll_close(epfd);
+        socket_close(fd);
+        return result;
+    }
+    
+    // The work item starts serving once listen_fd is set
+    work_disable();
+    httpd.epfd = epfd;
+    httpd.port = port;
+    httpd.last_sweep = timer_get_ticks();
+    httpd.listen_fd = fd;
+    work_enable();
+    return 0;
+}
+
+void httpd_stop(void) {
+    work_disable();
+    if (httpd.listen_fd >= 0) {
+        while (httpd.connections) {
+            httpd_close(httpd.connections);
+        }
+        socket_close(httpd.listen_fd);
+        epoll_close(httpd.epfd);
+        httpd.listen_fd = -1;
+        httpd.epfd = -1;
+    }
+    work_enable();
+}
+
+int httpd_is_running(void) {
+    return httpd.listen_fd >= 0;
+}
+
+httpd_stats_t* httpd_get_stats(void) {
+    return &httpd_stats;
+}
+
+void httpd_dump(void) {
+    if (httpd.listen_fd >= 0) {
+        terminal_writestring("httpd: listening on port ");
+        httpd_write_uint(httpd.port);
+        terminal_writestring("\n");
+    } else {
+        terminal_writestring("httpd: stopped\n");
+    }
+    
+    terminal_writestring("Connections: ");
+    httpd_write_uint(httpd_stats.active);
+    terminal_writestring(" active, ");
+    httpd_write_uint(httpd_stats.accepted);
+    terminal_writestring(" accepted, ");
+    httpd_write_uint(httpd_stats.rejected);
+    terminal_writestring(" rejected, ");
+    httpd_write_uint(httpd_stats.idle_closed);
+    terminal_writestring(" idle closed\nRequests: ");
+    httpd_write_uint(httpd_stats.requests);
+    terminal_writestring(" (");
+    httpd_write_uint(httpd_stats.reused);
+    terminal_writestring(" on kept-alive connections)\nResponses: ");
+    httpd_write_uint(httpd_stats.status_2xx);
+    terminal_writestring(" 2xx, ");
+    httpd_write_uint(httpd_stats.status_4xx);
+    terminal_writestring(" 4xx, ");
+    httpd_write_uint(httpd_stats.status_5xx);
+    terminal_writestring(" 5xx, ");
+    httpd_write_uint(httpd_stats.bytes_sent);
+    terminal_writestring(" body bytes\n");
+    slab_cache_dump(&httpd_conn_cache);
+}
\ No newline at end of file
@@ -242,13 +242,17 @@ int hypr_load_file(hypr_editor_t* editor, const char* filename) {
     editor->scroll_offset = 0;
     editor->modified = 0;
     
-    // Parse file content into lines
-    if (file->data && file->size > 0) {
+    // Parse file content into lines, read through the file's filesystem
+    if (file->size > 0) {
         size_t current_line = 0;
         size_t char_pos = 0;
+        char chunk[256];
         
         for (size_t i = 0; i < file->size && current_line < HYPR_MAX_LINES; i++) {
-            char c = file->data[i];
+            if (i % sizeof(chunk) == 0 && vfs_read(file, i, chunk, sizeof(chunk)) <= 0) {
+                break;
+            }
+            char c = chunk[i % sizeof(chunk)];
             
             if (c == '\n') {
                 editor->lines[current_line].content[char_pos] = '\0';
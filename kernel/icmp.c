@@ -7,25 +7,22 @@ void icmp_init(void) {
     terminal_writestring("ICMP protocol initialized\n");
 }
 
-void icmp_handle_packet(net_buffer_t* buffer, size_t offset, ip_header_t* ip_hdr) {
-    if (buffer->length < offset + sizeof(icmp_header_t)) {
+void icmp_handle_packet(ip_header_t* ip_hdr, uint8_t* data, size_t length) {
+    if (length < sizeof(icmp_header_t)) {
         return; // Packet too small
     }
     
-    icmp_header_t* icmp_hdr = (icmp_header_t*)(buffer->data + offset);
+    icmp_header_t* icmp_hdr = (icmp_header_t*)data;
     
     // Calculate payload size
-    uint16_t ip_total_length = ntohs(ip_hdr->total_length);
-    uint8_t ip_header_length = (ip_hdr->version_ihl & 0xF) * 4;
-    size_t icmp_length = ip_total_length - ip_header_length;
-    size_t payload_length = icmp_length - sizeof(icmp_header_t);
+    size_t payload_length = length - sizeof(icmp_header_t);
     
     switch (icmp_hdr->type) {
         case ICMP_TYPE_ECHO_REQUEST:
             // Respond to ping
             terminal_writestring("Received ICMP ping request\n");
             icmp_send_echo_reply(ip_hdr->src_ip, icmp_hdr->id, icmp_hdr->sequence,
-                               buffer->data + offset + sizeof(icmp_header_t), payload_length);
+                               data + sizeof(icmp_header_t), payload_length);
             break;
         case ICMP_TYPE_ECHO_REPLY:
             terminal_writestring("Received ICMP ping reply\n");
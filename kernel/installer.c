@@ -1,6 +1,7 @@
 #include "../include/installer.h"
 #include "../include/disk.h"
 #include "../include/fat32.h"
+#include "../include/scheduler.h"
 
 static install_config_t* current_install = NULL;
 static bool installer_initialized = false;
@@ -19,6 +20,26 @@ static void inst_strcpy(char* dest, const char* src) {
     *dest = '\0';
 }
 
+static void inst_strcat(char* dest, const char* src) {
+    inst_strcpy(dest + inst_strlen(dest), src);
+}
+
+static void inst_itoa(uint32_t value, char* str) {
+    char temp[12];
+    int pos = 0;
+    
+    do {
+        temp[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    
+    int i = 0;
+    while (pos > 0) {
+        str[i++] = temp[--pos];
+    }
+    str[i] = '\0';
+}
+
 static void inst_memcpy(void* dest, const void* src, size_t size) {
     unsigned char* d = (unsigned char*)dest;
     const unsigned char* s = (const unsigned char*)src;
@@ -60,20 +81,16 @@ bool installer_copy_file_to_fat32(fat32_fs_t* fs, const char* filename, const ui
         return false;
     }
     
-    // For now, this is a simplified implementation
-    // In a real system, we would:
-    // 1. Find free directory entry in root directory
-    // 2. Allocate clusters for the file
-    // 3. Write file data to allocated clusters
-    // 4. Update FAT table
-    // 5. Create directory entry
-    
-    // Since implementing full FAT32 file operations is complex,
-    // we'll simulate successful file copying for now
-    (void)filename;
-    (void)size;
+    fat32_file_t file;
+    if (!fat32_create(fs, filename, &file)) {
+        return false;
+    }
     
-    return true;  // Simulate success
+    bool ok = fat32_write(&file, data, size) == (int32_t)size;
+    if (!fat32_close(&file)) {
+        ok = false;
+    }
+    return ok;
 }
 
 bool installer_create_directory(fat32_fs_t* fs, const char* dirname) {
@@ -81,11 +98,12 @@ bool installer_create_directory(fat32_fs_t* fs, const char* dirname) {
         return false;
     }
     
-    // Simplified directory creation
-    // In real implementation, would create directory entry and allocate cluster
-    (void)dirname;
-    
-    return true;  // Simulate success
+    // Already there is fine; a file in the way is not
+    fat32_dirent_t entry;
+    if (fat32_stat(fs, dirname, &entry)) {
+        return (entry.attr & FAT32_ATTR_DIRECTORY) != 0;
+    }
+    return fat32_mkdir(fs, dirname);
 }
 
 bool installer_step_format_disk(install_config_t* config) {
@@ -105,14 +123,33 @@ bool installer_step_format_disk(install_config_t* config) {
     
     // Format disk with FAT32
     uint32_t total_sectors = (uint32_t)disk->sectors;
+    uint32_t start_ticks = timer_get_ticks();
     if (!fat32_format_disk(config->target_disk, 0, total_sectors, config->volume_label)) {
         config->status = INSTALL_STATUS_ERROR;
         inst_strcpy(config->status_message, "Disk formatting failed");
         return false;
     }
     
+    // Normalise to a gigabyte so runs on different disks compare
+    uint32_t size_mb = total_sectors / 2048;
+    config->format_ms = (timer_get_ticks() - start_ticks) * TIMER_MS_PER_TICK;
+    if (size_mb == 0) {
+        config->format_ms_per_gb = config->format_ms;
+    } else if (config->format_ms < 0x400000) {
+        config->format_ms_per_gb = config->format_ms * 1024 / size_mb;
+    } else {
+        config->format_ms_per_gb = config->format_ms / (size_mb / 1024 ? size_mb / 1024 : 1);
+    }
+    
+    char num[12];
     config->progress_percent = 20;
-    inst_strcpy(config->status_message, "Disk formatted successfully");
+    inst_strcpy(config->status_message, "Disk formatted in ");
+    inst_itoa(config->format_ms, num);
+    inst_strcat(config->status_message, num);
+    inst_strcat(config->status_message, " ms (");
+    inst_itoa(config->format_ms_per_gb, num);
+    inst_strcat(config->status_message, num);
+    inst_strcat(config->status_message, " ms/GB)");
     return true;
 }
 
@@ -132,14 +169,20 @@ bool installer_step_copy_kernel(install_config_t* config) {
     }
     
     // Copy kernel to /boot/kernel.bin
-    if (!installer_copy_file_to_fat32(&fs, "kernel.bin", kernel_bin_data, kernel_bin_size)) {
+    if (!installer_create_directory(&fs, "boot") ||
+        !installer_copy_file_to_fat32(&fs, "boot/kernel.bin", kernel_bin_data, kernel_bin_size)) {
         fat32_unmount(&fs);
         config->status = INSTALL_STATUS_ERROR;
         inst_strcpy(config->status_message, "Failed to copy kernel");
         return false;
     }
     
-    fat32_unmount(&fs);
+    // Unmounting writes the cached metadata and file data out
+    if (!fat32_unmount(&fs)) {
+        config->status = INSTALL_STATUS_ERROR;
+        inst_strcpy(config->status_message, "Failed to write filesystem");
+        return false;
+    }
     config->progress_percent = 50;
     inst_strcpy(config->status_message, "Kernel copied successfully");
     return true;
@@ -185,7 +228,12 @@ bool installer_step_copy_system_files(install_config_t* config) {
         }
     }
     
-    fat32_unmount(&fs);
+    // Unmounting writes the cached metadata and file data out
+    if (!fat32_unmount(&fs)) {
+        config->status = INSTALL_STATUS_ERROR;
+        inst_strcpy(config->status_message, "Failed to write filesystem");
+        return false;
+    }
     config->progress_percent = 80;
     inst_strcpy(config->status_message, "System files copied successfully");
     return true;
@@ -3,36 +3,306 @@
 #include "../include/arp.h"
 #include "../include/udp.h"
 #include "../include/tcp.h"
+#include "../include/checksum.h"
+#include "../include/route.h"
+#include "../include/loopback.h"
+#include "../include/memory.h"
+#include "../include/interrupts.h"
 
 extern void terminal_writestring(const char* data);
 
 static uint16_t ip_id_counter = 1;
 
+// Hole descriptor (RFC 815): a byte range of the payload still missing
+typedef struct ip_hole {
+    uint32_t first;
+    uint32_t last;
+    struct ip_hole* next;
+} ip_hole_t;
+
+// Datagram being reassembled, keyed by (src, dst, id, protocol)
+typedef struct ip_reasm {
+    ip_header_t header;         // From the first fragment, rewritten on delivery
+    ip_hole_t* holes;
+    ip_fragment_t* fragments;   // Sorted by offset, non-overlapping
+    size_t memory;
+    uint32_t deadline;
+    struct ip_reasm* next;
+} ip_reasm_t;
+
+static ip_reasm_t* ip_reasm_list = NULL;   // Oldest first
+static size_t ip_reasm_memory = 0;
+
+// Datagram too large for one frame whose next hop is not resolved yet. It
+// is fragmented only once ARP answers: the neighbour's pending queue is
+// far smaller than the fragments of a large datagram.
+typedef struct ip_deferred {
+    net_interface_t* iface;
+    ip_addr_t next_hop;
+    ip_addr_t dest;
+    uint8_t protocol;
+    uint16_t id;
+    size_t length;
+    struct ip_deferred* next;
+    uint8_t data[];
+} ip_deferred_t;
+
+static ip_deferred_t* ip_deferred_list = NULL;
+static uint32_t ip_deferred_count = 0;
+
+static uint32_t ip_addr_to_u32(ip_addr_t* addr) {
+    return ((uint32_t)addr->addr[0] << 24) | ((uint32_t)addr->addr[1] << 16) |
+           ((uint32_t)addr->addr[2] << 8) | (uint32_t)addr->addr[3];
+}
+
 void ip_init(void) {
+    timer_register_callback(ip_reasm_timer_tick, IP_REASM_TIMER_INTERVAL);
     terminal_writestring("IP protocol initialized\n");
 }
 
 uint16_t ip_checksum(void* data, size_t length) {
-    uint16_t* ptr = (uint16_t*)data;
-    uint32_t sum = 0;
+    return csum_fold(csum_partial(data, length, 0));
+}
+
+static void ip_reasm_free(ip_reasm_t* reasm) {
+    ip_hole_t* hole = reasm->holes;
+    while (hole) {
+        ip_hole_t* next = hole->next;
+        kfree(hole);
+        hole = next;
+    }
+    ip_fragment_t* frag = reasm->fragments;
+    while (frag) {
+        ip_fragment_t* next = frag->next;
+        kfree(frag);
+        frag = next;
+    }
+    ip_reasm_memory -= reasm->memory;
+    kfree(reasm);
+}
+
+static void ip_reasm_unlink(ip_reasm_t* reasm) {
+    ip_reasm_t** link = &ip_reasm_list;
+    while (*link) {
+        if (*link == reasm) {
+            *link = reasm->next;
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+static ip_reasm_t* ip_reasm_find(ip_header_t* ip_hdr) {
+    for (ip_reasm_t* reasm = ip_reasm_list; reasm; reasm = reasm->next) {
+        if (reasm->header.identification == ip_hdr->identification &&
+            reasm->header.protocol == ip_hdr->protocol &&
+            ip_compare(&reasm->header.src_ip, &ip_hdr->src_ip) &&
+            ip_compare(&reasm->header.dest_ip, &ip_hdr->dest_ip)) {
+            return reasm;
+        }
+    }
+    return NULL;
+}
+
+// Evict the oldest datagrams until needed more bytes fit under the cap
+static int ip_reasm_reserve(ip_reasm_t* current, size_t needed) {
+    while (ip_reasm_memory + needed > IP_REASM_MAX_MEMORY) {
+        ip_reasm_t* victim = ip_reasm_list;
+        if (!victim || victim == current) {
+            return 0;
+        }
+        ip_reasm_list = victim->next;
+        ip_reasm_free(victim);
+    }
+    return 1;
+}
+
+static int ip_reasm_add_hole(ip_hole_t** link, uint32_t first, uint32_t last) {
+    ip_hole_t* hole = (ip_hole_t*)kmalloc(sizeof(ip_hole_t));
+    if (!hole) return 0;
+    hole->first = first;
+    hole->last = last;
+    hole->next = *link;
+    *link = hole;
+    return 1;
+}
+
+// Copy the part of a fragment that fills [first, last] into its own piece
+static int ip_reasm_store(ip_reasm_t* reasm, uint8_t* payload, uint32_t frag_first,
+                          uint32_t first, uint32_t last) {
+    size_t length = last - first + 1;
+    if (!ip_reasm_reserve(reasm, sizeof(ip_fragment_t) + length)) {
+        return 0;
+    }
+    
+    ip_fragment_t* piece = (ip_fragment_t*)kmalloc(sizeof(ip_fragment_t) + length);
+    if (!piece) return 0;
+    
+    piece->offset = first;
+    piece->length = length;
+    uint8_t* src = payload + (first - frag_first);
+    for (size_t i = 0; i < length; i++) {
+        piece->data[i] = src[i];
+    }
+    
+    ip_fragment_t** link = &reasm->fragments;
+    while (*link && (*link)->offset < first) {
+        link = &(*link)->next;
+    }
+    piece->next = *link;
+    *link = piece;
+    
+    reasm->memory += sizeof(ip_fragment_t) + length;
+    ip_reasm_memory += sizeof(ip_fragment_t) + length;
+    return 1;
+}
+
+static void ip_deliver(ip_header_t* ip_hdr, uint8_t* data, size_t length) {
+    switch (ip_hdr->protocol) {
+        case IP_PROTOCOL_ICMP:
+            icmp_handle_packet(ip_hdr, data, length);
+            break;
+        case IP_PROTOCOL_TCP:
+            tcp_handle_packet(data, length, ip_addr_to_u32(&ip_hdr->src_ip),
+                              ip_addr_to_u32(&ip_hdr->dest_ip));
+            break;
+        case IP_PROTOCOL_UDP:
+            udp_handle_packet(ip_hdr, data, length);
+            break;
+        default:
+            // Unknown protocol
+            break;
+    }
+}
+
+// All holes filled: pass the datagram up. UDP consumes the pieces
+// directly; other protocols get one linear copy.
+static void ip_reasm_complete(ip_reasm_t* reasm, size_t length) {
+    ip_header_t* ip_hdr = &reasm->header;
+    ip_hdr->version_ihl = 0x45;
+    ip_hdr->total_length = htons(sizeof(ip_header_t) + length);
+    ip_hdr->flags_fragment = 0;
     
-    // Sum all 16-bit words
-    while (length > 1) {
-        sum += *ptr++;
-        length -= 2;
+    if (ip_hdr->protocol == IP_PROTOCOL_UDP) {
+        udp_handle_fragments(ip_hdr, reasm->fragments, length);
+        return;
     }
     
-    // Add odd byte if present
-    if (length == 1) {
-        sum += *(uint8_t*)ptr << 8;
+    uint8_t* flat = (uint8_t*)kmalloc(length);
+    if (!flat) return;
+    for (ip_fragment_t* frag = reasm->fragments; frag; frag = frag->next) {
+        for (size_t i = 0; i < frag->length; i++) {
+            flat[frag->offset + i] = frag->data[i];
+        }
+    }
+    ip_deliver(ip_hdr, flat, length);
+    kfree(flat);
+}
+
+// Fold one fragment into its datagram using the RFC 815 hole list. Only
+// the bytes that fill holes are stored, so duplicates and overlaps cost
+// nothing. Interrupts must be disabled.
+static void ip_reassemble(ip_header_t* ip_hdr, uint8_t* payload, size_t length) {
+    uint16_t frag = ntohs(ip_hdr->flags_fragment);
+    uint32_t first = (uint32_t)(frag & IP_FRAGMENT_MASK) * 8;
+    uint32_t last = first + length - 1;
+    int more = (frag & IP_FLAG_MF) != 0;
+    
+    if (length == 0 || last + sizeof(ip_header_t) > IP_MAX_PACKET ||
+        (more && (length % 8) != 0)) {
+        return; // Malformed
     }
     
-    // Add carry bits
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    ip_reasm_t* reasm = ip_reasm_find(ip_hdr);
+    if (!reasm) {
+        if (!ip_reasm_reserve(NULL, sizeof(ip_reasm_t))) return;
+        reasm = (ip_reasm_t*)kmalloc(sizeof(ip_reasm_t));
+        if (!reasm) return;
+        
+        reasm->header = *ip_hdr;
+        reasm->holes = NULL;
+        reasm->fragments = NULL;
+        reasm->memory = sizeof(ip_reasm_t);
+        reasm->deadline = timer_get_ticks() + IP_REASM_TIMEOUT;
+        reasm->next = NULL;
+        ip_reasm_memory += reasm->memory;
+        
+        if (!ip_reasm_add_hole(&reasm->holes, 0, IP_MAX_PACKET)) {
+            ip_reasm_memory -= reasm->memory;
+            kfree(reasm);
+            return;
+        }
+        
+        // Append, keeping the list oldest first for eviction
+        ip_reasm_t** link = &ip_reasm_list;
+        while (*link) link = &(*link)->next;
+        *link = reasm;
     }
     
-    return ~sum;
+    if (first == 0) {
+        reasm->header = *ip_hdr;
+    }
+    
+    ip_hole_t** link = &reasm->holes;
+    while (*link) {
+        ip_hole_t* hole = *link;
+        if (first > hole->last || last < hole->first) {
+            link = &hole->next;
+            continue;
+        }
+        
+        // Store the overlap, then replace the hole by what remains of it
+        uint32_t fill_first = first > hole->first ? first : hole->first;
+        uint32_t fill_last = last < hole->last ? last : hole->last;
+        if (!ip_reasm_store(reasm, payload, first, fill_first, fill_last)) {
+            ip_reasm_unlink(reasm);
+            ip_reasm_free(reasm);
+            return;
+        }
+        
+        *link = hole->next;
+        int ok = 1;
+        if (first > hole->first) {
+            ok = ip_reasm_add_hole(link, hole->first, first - 1);
+            if (ok) link = &(*link)->next;
+        }
+        if (ok && last < hole->last && more) {
+            ok = ip_reasm_add_hole(link, last + 1, hole->last);
+            if (ok) link = &(*link)->next;
+        }
+        kfree(hole);
+        if (!ok) {
+            ip_reasm_unlink(reasm);
+            ip_reasm_free(reasm);
+            return;
+        }
+    }
+    
+    if (!reasm->holes) {
+        ip_reasm_unlink(reasm);
+        ip_fragment_t* tail = reasm->fragments;
+        while (tail && tail->next) tail = tail->next;
+        if (tail) {
+            ip_reasm_complete(reasm, tail->offset + tail->length);
+        }
+        ip_reasm_free(reasm);
+    }
+}
+
+// Drop datagrams whose fragments did not all arrive in time
+void ip_reasm_timer_tick(void) {
+    uint32_t now = timer_get_ticks();
+    
+    ip_reasm_t** link = &ip_reasm_list;
+    while (*link) {
+        ip_reasm_t* reasm = *link;
+        if ((int32_t)(now - reasm->deadline) >= 0) {
+            *link = reasm->next;
+            ip_reasm_free(reasm);
+        } else {
+            link = &reasm->next;
+        }
+    }
 }
 
 void ip_handle_packet(net_buffer_t* buffer, size_t offset) {
@@ -49,13 +319,14 @@ void ip_handle_packet(net_buffer_t* buffer, size_t offset) {
     }
     
     uint8_t ihl = ip_hdr->version_ihl & 0xF;
-    if (ihl < 5) {
+    if (ihl < 5 || offset + ihl * 4 > buffer->length) {
         return; // Invalid header length
     }
     
-    // Check if packet is for us
-    net_interface_t* iface = net_get_interface();
-    if (!ip_compare(&ip_hdr->dest_ip, &iface->ip)) {
+    // Check if packet is for us; limited broadcast reaches us even before
+    // the interface has an address (DHCP replies)
+    if (!net_interface_for_address(&ip_hdr->dest_ip) &&
+        ip_addr_to_u32(&ip_hdr->dest_ip) != 0xFFFFFFFF) {
         return; // Not for us
     }
     
@@ -68,70 +339,65 @@ void ip_handle_packet(net_buffer_t* buffer, size_t offset) {
     }
     ip_hdr->checksum = orig_checksum;
     
-    // Handle based on protocol
     size_t ip_header_size = ihl * 4;
-    switch (ip_hdr->protocol) {
-        case IP_PROTOCOL_ICMP:
-            icmp_handle_packet(buffer, offset + ip_header_size, ip_hdr);
-            break;
-        case IP_PROTOCOL_TCP:
-            tcp_handle_packet(buffer->data + offset + ip_header_size, 
-                             ntohs(ip_hdr->total_length) - ip_header_size,
-                             (ip_hdr->src_ip.addr[0] << 24) | (ip_hdr->src_ip.addr[1] << 16) |
-                             (ip_hdr->src_ip.addr[2] << 8) | ip_hdr->src_ip.addr[3],
-                             (ip_hdr->dest_ip.addr[0] << 24) | (ip_hdr->dest_ip.addr[1] << 16) |
-                             (ip_hdr->dest_ip.addr[2] << 8) | ip_hdr->dest_ip.addr[3]);
-            break;
-        case IP_PROTOCOL_UDP:
-            udp_handle_packet(buffer, offset + ip_header_size, ip_hdr);
-            break;
-        default:
-            // Unknown protocol
-            break;
+    size_t total_length = ntohs(ip_hdr->total_length);
+    if (total_length < ip_header_size || offset + total_length > buffer->length) {
+        return; // Truncated
     }
+    
+    ip_receive(ip_hdr, buffer->data + offset + ip_header_size, total_length - ip_header_size);
 }
 
-int ip_send_packet(ip_addr_t dest, uint8_t protocol, uint8_t* data, size_t length) {
-    net_interface_t* iface = net_get_interface();
-    if (!iface->active) {
-        return -1; // Interface not active
+// Input for a validated packet addressed to us. Loopback enters here
+// directly with the sender's payload, skipping the frame entirely.
+void ip_receive(ip_header_t* ip_hdr, uint8_t* payload, size_t length) {
+    // Fragments wait for the rest of their datagram
+    if (ntohs(ip_hdr->flags_fragment) & (IP_FLAG_MF | IP_FRAGMENT_MASK)) {
+        uint32_t irq_flags = irq_save();
+        ip_reassemble(ip_hdr, payload, length);
+        irq_restore(irq_flags);
+        return;
     }
     
+    // Handle based on protocol
+    ip_deliver(ip_hdr, payload, length);
+}
+
+static void ip_build_header(ip_header_t* ip_hdr, ip_addr_t* src, ip_addr_t* dest, uint8_t protocol,
+                            uint16_t id, uint16_t flags_fragment, size_t length) {
+    ip_hdr->version_ihl = 0x45; // IPv4, 20 byte header
+    ip_hdr->type_of_service = 0;
+    ip_hdr->total_length = htons(sizeof(ip_header_t) + length);
+    ip_hdr->identification = htons(id);
+    ip_hdr->flags_fragment = htons(flags_fragment);
+    ip_hdr->ttl = 64;
+    ip_hdr->protocol = protocol;
+    ip_hdr->checksum = 0;
+    ip_copy(&ip_hdr->src_ip, src);
+    ip_copy(&ip_hdr->dest_ip, dest);
+    
+    // Calculate checksum
+    ip_hdr->checksum = ip_checksum(ip_hdr, sizeof(ip_header_t));
+}
+
+// Build and send one IP packet carrying data as payload under a header
+// prepared by the caller
+static int ip_send_fragment(net_interface_t* iface, ip_addr_t next_hop, const ip_header_t* header,
+                            uint8_t* data, size_t length) {
     // Allocate buffer
     net_buffer_t* buffer = net_alloc_buffer();
     if (!buffer) {
         return -1; // No free buffers
     }
     
-    // Resolve destination MAC address
-    mac_addr_t dest_mac;
-    if (!arp_resolve(dest, &dest_mac)) {
-        net_free_buffer(buffer);
-        return -1; // Could not resolve MAC
-    }
-    
-    // Build Ethernet header
+    // Build Ethernet header; ARP fills in the destination MAC
     eth_header_t* eth = (eth_header_t*)buffer->data;
-    mac_copy(&eth->dest, &dest_mac);
     mac_copy(&eth->src, &iface->mac);
     eth->type = htons(ETH_TYPE_IP);
     
     // Build IP header
     ip_header_t* ip_hdr = (ip_header_t*)(buffer->data + sizeof(eth_header_t));
-    ip_hdr->version_ihl = 0x45; // IPv4, 20 byte header
-    ip_hdr->type_of_service = 0;
-    ip_hdr->total_length = htons(sizeof(ip_header_t) + length);
-    ip_hdr->identification = htons(ip_id_counter);
-    ip_id_counter++;
-    ip_hdr->flags_fragment = htons(0x4000); // Don't fragment
-    ip_hdr->ttl = 64;
-    ip_hdr->protocol = protocol;
-    ip_hdr->checksum = 0;
-    ip_copy(&ip_hdr->src_ip, &iface->ip);
-    ip_copy(&ip_hdr->dest_ip, &dest);
-    
-    // Calculate checksum
-    ip_hdr->checksum = ip_checksum(ip_hdr, sizeof(ip_header_t));
+    *ip_hdr = *header;
     
     // Copy payload
     uint8_t* payload = buffer->data + sizeof(eth_header_t) + sizeof(ip_header_t);
@@ -141,9 +407,178 @@ int ip_send_packet(ip_addr_t dest, uint8_t protocol, uint8_t* data, size_t lengt
     
     buffer->length = sizeof(eth_header_t) + sizeof(ip_header_t) + length;
     
-    // Send packet
-    net_send_packet(buffer);
-    net_free_buffer(buffer);
+    // Send packet, or hold it until the next hop is resolved
+    return arp_output(buffer, next_hop);
+}
+
+static int ip_send_fragments(net_interface_t* iface, ip_addr_t next_hop, ip_addr_t dest,
+                             uint8_t protocol, uint16_t id, uint8_t* data, size_t length);
+
+static int ip_defer(net_interface_t* iface, ip_addr_t next_hop, ip_addr_t dest,
+                    uint8_t protocol, uint16_t id, uint8_t* data, size_t length) {
+    ip_deferred_t* deferred = (ip_deferred_t*)kmalloc(sizeof(ip_deferred_t) + length);
+    if (!deferred) {
+        return -1;
+    }
+    deferred->iface = iface;
+    deferred->next_hop = next_hop;
+    deferred->dest = dest;
+    deferred->protocol = protocol;
+    deferred->id = id;
+    deferred->length = length;
+    for (size_t i = 0; i < length; i++) {
+        deferred->data[i] = data[i];
+    }
+    
+    uint32_t irq_flags = irq_save();
+    if (ip_deferred_count >= IP_MAX_DEFERRED) {
+        irq_restore(irq_flags);
+        kfree(deferred);
+        return -1;
+    }
+    deferred->next = ip_deferred_list;
+    ip_deferred_list = deferred;
+    ip_deferred_count++;
+    irq_restore(irq_flags);
+    return 0;
+}
+
+// ARP resolved next_hop, or gave up on it: send or drop what waited for it
+void ip_neighbour_update(ip_addr_t next_hop, int reachable) {
+    ip_deferred_t* ready = NULL;
+    
+    uint32_t irq_flags = irq_save();
+    ip_deferred_t** link = &ip_deferred_list;
+    while (*link) {
+        ip_deferred_t* deferred = *link;
+        if (ip_compare(&deferred->next_hop, &next_hop)) {
+            *link = deferred->next;
+            ip_deferred_count--;
+            deferred->next = ready;
+            ready = deferred;
+        } else {
+            link = &deferred->next;
+        }
+    }
+    irq_restore(irq_flags);
+    
+    while (ready) {
+        ip_deferred_t* deferred = ready;
+        ready = deferred->next;
+        if (reachable) {
+            ip_send_fragments(deferred->iface, deferred->next_hop, deferred->dest,
+                              deferred->protocol, deferred->id, deferred->data, deferred->length);
+        }
+        kfree(deferred);
+    }
+}
+
+// Send data as one packet if it fits the MTU, otherwise as fragments
+// sharing one identification. TCP sizes its own segments and keeps DF.
+int ip_send_packet(ip_addr_t dest, uint8_t protocol, uint8_t* data, size_t length) {
+    if (length + sizeof(ip_header_t) > IP_MAX_PACKET) {
+        return -1;
+    }
+    
+    // Traffic to one of our own addresses never touches a NIC: the
+    // loopback device hands the caller's buffer straight to ip_receive
+    if (net_interface_for_address(&dest) || dest.addr[0] == 127) {
+        ip_header_t ip_hdr;
+        ip_build_header(&ip_hdr, &dest, &dest, protocol, ip_id_counter++, 0, length);
+        return loopback_output(&ip_hdr, data, length);
+    }
+    
+    // Pick the interface and next hop; off-subnet traffic goes via a gateway
+    net_interface_t* iface;
+    uint32_t gateway;
+    if (ip_addr_to_u32(&dest) == 0xFFFFFFFF) {
+        // Limited broadcast stays on the primary link, which may not have
+        // an address yet: DHCP sends from 0.0.0.0
+        iface = net_get_interface();
+        gateway = 0xFFFFFFFF;
+    } else if (route_lookup(ip_addr_to_u32(&dest), &iface, &gateway) < 0) {
+        return -1; // No route to host
+    } else if (!iface->active) {
+        return -1; // Interface not active
+    }
+    
+    ip_addr_t next_hop;
+    next_hop.addr[0] = (gateway >> 24) & 0xFF;
+    next_hop.addr[1] = (gateway >> 16) & 0xFF;
+    next_hop.addr[2] = (gateway >> 8) & 0xFF;
+    next_hop.addr[3] = gateway & 0xFF;
+    
+    uint16_t id = ip_id_counter++;
+    ip_header_t header;
+    
+    if (length + sizeof(ip_header_t) <= iface->mtu) {
+        uint16_t flags = (protocol == IP_PROTOCOL_TCP) ? IP_FLAG_DF : 0;
+        ip_build_header(&header, &iface->ip, &dest, protocol, id, flags, length);
+        return ip_send_fragment(iface, next_hop, &header, data, length);
+    }
+    
+    // Fragmenting for a neighbour still being resolved would overflow
+    // its ARP queue; hold the datagram whole instead
+    mac_addr_t mac;
+    if (gateway != 0xFFFFFFFF && !arp_resolve(next_hop, &mac)) {
+        if (!arp_lookup(next_hop)) {
+            return -1; // ARP table busy, nothing will ever answer
+        }
+        return ip_defer(iface, next_hop, dest, protocol, id, data, length);
+    }
+    return ip_send_fragments(iface, next_hop, dest, protocol, id, data, length);
+}
+
+// Split data into MTU-sized fragments sharing one identification
+static int ip_send_fragments(net_interface_t* iface, ip_addr_t next_hop, ip_addr_t dest,
+                             uint8_t protocol, uint16_t id, uint8_t* data, size_t length) {
+    ip_header_t header;
+    
+    // Every fragment but the last carries a multiple of 8 bytes. The
+    // header is checksummed once; each fragment only patches its length
+    // and offset fields.
+    size_t max_payload = (iface->mtu - sizeof(ip_header_t)) & ~7u;
+    ip_build_header(&header, &iface->ip, &dest, protocol, id, IP_FLAG_MF, max_payload);
+    for (size_t offset = 0; offset < length; offset += max_payload) {
+        size_t chunk = length - offset;
+        uint16_t flags = (uint16_t)(offset / 8);
+        if (chunk > max_payload) {
+            chunk = max_payload;
+            flags |= IP_FLAG_MF;
+        }
+        
+        uint16_t total_length = htons(sizeof(ip_header_t) + chunk);
+        uint16_t flags_fragment = htons(flags);
+        uint16_t checksum = header.checksum;
+        csum_replace2(&checksum, header.total_length, total_length);
+        csum_replace2(&checksum, header.flags_fragment, flags_fragment);
+        header.checksum = checksum;
+        header.total_length = total_length;
+        header.flags_fragment = flags_fragment;
+        
+        if (ip_send_fragment(iface, next_hop, &header, data + offset, chunk) < 0) {
+            return -1;
+        }
+    }
     
     return 0;
+}
+
+// Source address for packets to dest: the destination itself when it is
+// local, otherwise the address of the interface the route leaves by
+uint32_t ip_source_address(uint32_t dest) {
+    ip_addr_t addr;
+    addr.addr[0] = (dest >> 24) & 0xFF;
+    addr.addr[1] = (dest >> 16) & 0xFF;
+    addr.addr[2] = (dest >> 8) & 0xFF;
+    addr.addr[3] = dest & 0xFF;
+    if (net_interface_for_address(&addr) || addr.addr[0] == 127) {
+        return dest;
+    }
+    
+    net_interface_t* iface;
+    if (route_lookup(dest, &iface, NULL) == 0) {
+        return ip_addr_to_u32(&iface->ip);
+    }
+    return get_local_ip();
 }
\ No newline at end of file
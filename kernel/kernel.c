@@ -14,6 +14,10 @@
 #include "../include/net.h"
 #include "../include/ip.h"
 #include "../include/arp.h"
+#include "../include/route.h"
+#include "../include/loopback.h"
+#include "../include/dns.h"
+#include "../include/httpd.h"
 #include "../include/icmp.h"
 #include "../include/udp.h"
 #include "../include/dhcp.h"
@@ -22,6 +26,9 @@
 #include "../include/tcp.h"
 #include "../include/usb.h"
 #include "../include/disk.h"
+#include "../include/blk.h"
+#include "../include/bcache.h"
+#include "../include/fat32.h"
 #include "../include/installer.h"
 // GUI components disabled for rewrite
 //#include "../include/sdk.h"
@@ -227,6 +234,15 @@ void kernel_main(multiboot_info_t* mbi) {
         } else {
             serial_writestring("byteOS: Warning - No disks detected\n");
         }
+        blk_init();
+        bcache_init();
+        
+        // The boot disk's volume, if it has one, holds state kept across
+        // boots such as the DHCP lease
+        vfs_node_t* boot_volume = fat32_vfs_mount(0);
+        if (boot_volume && vfs_mount("disk0", boot_volume) == 0) {
+            terminal_writestring("Boot volume mounted at /mnt/disk0\n");
+        }
         
         terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
         terminal_writestring("Keyboard, interrupts and syscalls enabled!\n");
@@ -307,12 +323,17 @@ void kernel_main(multiboot_info_t* mbi) {
         
         terminal_writestring("\nInitializing Network stack...\n");
         net_init();
+        route_init();
+        loopback_init();
         arp_init();
         ip_init();
         icmp_init();
         udp_init();
         tcp_init();
+        dns_init();
+        httpd_init();
         dhcp_init();
+        dhcp_start();
         
         // show_boot_screen("Initializing video drivers...");
         video_init();
@@ -1,10 +1,15 @@
 #include "../include/net.h"
 #include "../include/memory.h"
+#include "../include/interrupts.h"
+#include "../include/checksum.h"
+#include "../include/route.h"
 
 extern void terminal_writestring(const char* data);
 
 static net_buffer_t net_buffers[NET_MAX_BUFFERS];
 static net_interface_t interface;
+static net_interface_t* net_interfaces[NET_MAX_INTERFACES];
+static int net_interface_count = 0;
 
 static void net_strcpy(char* dest, const char* src) {
     while (*src) {
@@ -13,7 +18,25 @@ static void net_strcpy(char* dest, const char* src) {
     *dest = '\0';
 }
 
+static int net_strcmp(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static void net_eth_transmit(net_interface_t* iface, net_buffer_t* buffer) {
+    // TODO: This would send to actual network hardware
+    // For now, just simulate sending
+    (void)iface;
+    (void)buffer;
+}
+
 void net_init(void) {
+    // Pick the fastest checksum routine for this CPU
+    checksum_init();
+    
     // Initialize buffer pool
     for (int i = 0; i < NET_MAX_BUFFERS; i++) {
         net_buffers[i].in_use = 0;
@@ -23,6 +46,9 @@ void net_init(void) {
     // Initialize interface
     interface.active = 0;
     net_strcpy(interface.name, "eth0");
+    interface.flags = 0;
+    interface.mtu = 1500;
+    interface.transmit = net_eth_transmit;
     
     // Set default MAC (would normally be read from hardware)
     interface.mac.addr[0] = 0x52;
@@ -32,17 +58,23 @@ void net_init(void) {
     interface.mac.addr[4] = 0x34;
     interface.mac.addr[5] = 0x56;
     
+    net_interface_count = 0;
+    net_register_interface(&interface);
+    
     terminal_writestring("Network stack initialized\n");
 }
 
 net_buffer_t* net_alloc_buffer(void) {
+    uint32_t flags = irq_save();
     for (int i = 0; i < NET_MAX_BUFFERS; i++) {
         if (!net_buffers[i].in_use) {
             net_buffers[i].in_use = 1;
             net_buffers[i].length = 0;
+            irq_restore(flags);
             return &net_buffers[i];
         }
     }
+    irq_restore(flags);
     return NULL; // No free buffers
 }
 
@@ -54,9 +86,10 @@ void net_free_buffer(net_buffer_t* buffer) {
 }
 
 void net_send_packet(net_buffer_t* buffer) {
-    // TODO: This would send to actual network hardware
-    // For now, just simulate sending
-    (void)buffer;
+    // Ethernet frames always leave through the primary interface
+    interface.stats.tx_packets++;
+    interface.stats.tx_bytes += buffer->length;
+    interface.transmit(&interface, buffer);
 }
 
 void net_receive_packet(uint8_t* data, size_t length) {
@@ -66,9 +99,13 @@ void net_receive_packet(uint8_t* data, size_t length) {
     
     net_buffer_t* buffer = net_alloc_buffer();
     if (!buffer) {
+        interface.stats.rx_dropped++;
         return; // No free buffers
     }
     
+    interface.stats.rx_packets++;
+    interface.stats.rx_bytes += length;
+    
     // Copy packet data
     for (size_t i = 0; i < length && i < NET_BUFFER_SIZE; i++) {
         buffer->data[i] = data[i];
@@ -95,12 +132,74 @@ void net_receive_packet(uint8_t* data, size_t length) {
     net_free_buffer(buffer);
 }
 
+// Add an interface to the registry; returns its index
+int net_register_interface(net_interface_t* iface) {
+    if (net_interface_count >= NET_MAX_INTERFACES) {
+        return -1;
+    }
+    
+    iface->stats.rx_packets = 0;
+    iface->stats.rx_bytes = 0;
+    iface->stats.rx_dropped = 0;
+    iface->stats.tx_packets = 0;
+    iface->stats.tx_bytes = 0;
+    iface->stats.tx_dropped = 0;
+    
+    net_interfaces[net_interface_count] = iface;
+    return net_interface_count++;
+}
+
+net_interface_t* net_find_interface(const char* name) {
+    for (int i = 0; i < net_interface_count; i++) {
+        if (net_strcmp(net_interfaces[i]->name, name) == 0) {
+            return net_interfaces[i];
+        }
+    }
+    return NULL;
+}
+
+net_interface_t* net_get_interface_at(int index) {
+    if (index < 0 || index >= net_interface_count) {
+        return NULL;
+    }
+    return net_interfaces[index];
+}
+
+// The active interface that owns ip, if the address is one of ours
+net_interface_t* net_interface_for_address(ip_addr_t* ip) {
+    for (int i = 0; i < net_interface_count; i++) {
+        net_interface_t* iface = net_interfaces[i];
+        if (iface->active && ip_compare(&iface->ip, ip)) {
+            return iface;
+        }
+    }
+    return NULL;
+}
+
+void net_interface_configure(net_interface_t* iface, ip_addr_t ip, ip_addr_t netmask, ip_addr_t gateway) {
+    ip_copy(&iface->ip, &ip);
+    ip_copy(&iface->netmask, &netmask);
+    ip_copy(&iface->gateway, &gateway);
+    iface->active = 1;
+    
+    // Connected subnet plus default route through the gateway
+    route_interface_up(iface);
+}
+
+// Drop the address (lease expired or released); the link stays registered
+void net_interface_unconfigure(net_interface_t* iface) {
+    route_flush_interface(iface);
+    iface->active = 0;
+    for (int i = 0; i < 4; i++) {
+        iface->ip.addr[i] = 0;
+        iface->netmask.addr[i] = 0;
+        iface->gateway.addr[i] = 0;
+    }
+}
+
 void net_set_interface(mac_addr_t mac, ip_addr_t ip, ip_addr_t netmask, ip_addr_t gateway) {
     mac_copy(&interface.mac, &mac);
-    ip_copy(&interface.ip, &ip);
-    ip_copy(&interface.netmask, &netmask);
-    ip_copy(&interface.gateway, &gateway);
-    interface.active = 1;
+    net_interface_configure(&interface, ip, netmask, gateway);
 }
 
 net_interface_t* net_get_interface(void) {
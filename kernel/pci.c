@@ -89,6 +89,23 @@ int pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t* dev) {
     return 0;
 }
 
+// Fill in a device record from configuration space
+static void pci_read_function(uint8_t bus, uint8_t device, uint8_t function, pci_device_t* dev) {
+    dev->vendor_id = pci_read_config_word(bus, device, function, PCI_VENDOR_ID);
+    dev->device_id = pci_read_config_word(bus, device, function, PCI_DEVICE_ID);
+    dev->bus = bus;
+    dev->device = device;
+    dev->function = function;
+    dev->class_code = pci_read_config_byte(bus, device, function, PCI_CLASS_CODE);
+    dev->subclass = pci_read_config_byte(bus, device, function, PCI_SUBCLASS);
+    dev->prog_if = pci_read_config_byte(bus, device, function, PCI_PROG_IF);
+    
+    // Read base addresses
+    for (int i = 0; i < 6; i++) {
+        dev->base_addresses[i] = pci_read_config_dword(bus, device, function, PCI_BASE_ADDRESS_0 + (i * 4));
+    }
+}
+
 static void pci_check_device(uint8_t bus, uint8_t device) {
     uint16_t vendor_id = pci_read_config_word(bus, device, 0, PCI_VENDOR_ID);
     
@@ -100,20 +117,7 @@ static void pci_check_device(uint8_t bus, uint8_t device) {
         return; // Too many devices
     }
     
-    pci_device_t* dev = &detected_devices[device_count];
-    dev->vendor_id = vendor_id;
-    dev->device_id = pci_read_config_word(bus, device, 0, PCI_DEVICE_ID);
-    dev->bus = bus;
-    dev->device = device;
-    dev->function = 0;
-    dev->class_code = pci_read_config_byte(bus, device, 0, PCI_CLASS_CODE);
-    dev->subclass = pci_read_config_byte(bus, device, 0, PCI_SUBCLASS);
-    
-    // Read base addresses
-    for (int i = 0; i < 6; i++) {
-        dev->base_addresses[i] = pci_read_config_dword(bus, device, 0, PCI_BASE_ADDRESS_0 + (i * 4));
-    }
-    
+    pci_read_function(bus, device, 0, &detected_devices[device_count]);
     device_count++;
     
     // Check for multifunction device
@@ -123,19 +127,7 @@ static void pci_check_device(uint8_t bus, uint8_t device) {
         for (int func = 1; func < 8; func++) {
             uint16_t func_vendor = pci_read_config_word(bus, device, func, PCI_VENDOR_ID);
             if (func_vendor != 0xFFFF && device_count < 256) {
-                pci_device_t* func_dev = &detected_devices[device_count];
-                func_dev->vendor_id = func_vendor;
-                func_dev->device_id = pci_read_config_word(bus, device, func, PCI_DEVICE_ID);
-                func_dev->bus = bus;
-                func_dev->device = device;
-                func_dev->function = func;
-                func_dev->class_code = pci_read_config_byte(bus, device, func, PCI_CLASS_CODE);
-                func_dev->subclass = pci_read_config_byte(bus, device, func, PCI_SUBCLASS);
-                
-                for (int i = 0; i < 6; i++) {
-                    func_dev->base_addresses[i] = pci_read_config_dword(bus, device, func, PCI_BASE_ADDRESS_0 + (i * 4));
-                }
-                
+                pci_read_function(bus, device, func, &detected_devices[device_count]);
                 device_count++;
             }
         }
@@ -149,4 +141,34 @@ int pci_scan_bus(void) {
     }
     
     return device_count;
+}
+
+// Walks configuration space directly rather than the table filled by
+// pci_init(), so storage drivers can probe before the bus scan has run.
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t* dev) {
+    for (uint8_t device = 0; device < 32; device++) {
+        if (pci_read_config_word(0, device, 0, PCI_VENDOR_ID) == 0xFFFF) {
+            continue;
+        }
+        
+        uint8_t functions = (pci_read_config_byte(0, device, 0, PCI_HEADER_TYPE) & 0x80) ? 8 : 1;
+        for (uint8_t func = 0; func < functions; func++) {
+            if (pci_read_config_word(0, device, func, PCI_VENDOR_ID) == 0xFFFF) {
+                continue;
+            }
+            if (pci_read_config_byte(0, device, func, PCI_CLASS_CODE) == class_code &&
+                pci_read_config_byte(0, device, func, PCI_SUBCLASS) == subclass) {
+                pci_read_function(0, device, func, dev);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void pci_enable_bus_master(pci_device_t* dev) {
+    // The status register shares the dword; its bits are write-one-to-clear
+    uint32_t command = pci_read_config_dword(dev->bus, dev->device, dev->function, PCI_COMMAND) & 0xFFFF;
+    command |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER;
+    pci_write_config_dword(dev->bus, dev->device, dev->function, PCI_COMMAND, command);
 }
\ No newline at end of file
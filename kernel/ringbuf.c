@@ -0,0 +1,88 @@
+#include "../include/ringbuf.h"
+#include "../include/memory.h"
+
+static void ring_copy(uint8_t* dest, const uint8_t* src, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        dest[i] = src[i];
+    }
+}
+
+int ring_init(ring_buffer_t* ring, size_t size) {
+    ring->data = (uint8_t*)kmalloc(size);
+    ring->size = ring->data ? size : 0;
+    ring->head = 0;
+    ring->tail = 0;
+    return ring->data != NULL;
+}
+
+void ring_free(ring_buffer_t* ring) {
+    if (ring->data) kfree(ring->data);
+    ring->data = NULL;
+    ring->size = 0;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+// Grow (or shrink) the ring, keeping its contents. Fails if the new size
+// cannot hold the bytes currently queued.
+int ring_resize(ring_buffer_t* ring, size_t new_size) {
+    size_t used = ring_used(ring);
+    if (new_size < used) return 0;
+    
+    uint8_t* new_data = (uint8_t*)kmalloc(new_size);
+    if (!new_data) return 0;
+    
+    ring_peek(ring, 0, new_data, used);
+    
+    if (ring->data) kfree(ring->data);
+    ring->data = new_data;
+    ring->size = new_size;
+    ring->head = 0;
+    ring->tail = used;
+    return 1;
+}
+
+size_t ring_write(ring_buffer_t* ring, const void* data, size_t len) {
+    size_t space = ring_space(ring);
+    if (len > space) len = space;
+    if (len == 0) return 0;
+    
+    size_t pos = ring->tail & (ring->size - 1);
+    size_t first = ring->size - pos;
+    if (first > len) first = len;
+    
+    ring_copy(ring->data + pos, (const uint8_t*)data, first);
+    ring_copy(ring->data, (const uint8_t*)data + first, len - first);
+    
+    ring->tail += len;
+    return len;
+}
+
+size_t ring_peek(ring_buffer_t* ring, size_t offset, void* buffer, size_t len) {
+    size_t used = ring_used(ring);
+    if (offset >= used) return 0;
+    if (len > used - offset) len = used - offset;
+    if (len == 0) return 0;
+    
+    size_t pos = (ring->head + offset) & (ring->size - 1);
+    size_t first = ring->size - pos;
+    if (first > len) first = len;
+    
+    ring_copy((uint8_t*)buffer, ring->data + pos, first);
+    ring_copy((uint8_t*)buffer + first, ring->data, len - first);
+    
+    return len;
+}
+
+size_t ring_read(ring_buffer_t* ring, void* buffer, size_t len) {
+    len = ring_peek(ring, 0, buffer, len);
+    ring->head += len;
+    return len;
+}
+
+size_t ring_discard(ring_buffer_t* ring, size_t len) {
+    size_t used = ring_used(ring);
+    if (len > used) len = used;
+    ring->head += len;
+    return len;
+}
\ No newline at end of file
@@ -0,0 +1,408 @@
+#include "../include/route.h"
+#include "../include/interrupts.h"
+
+extern void terminal_writestring(const char* data);
+
+// Trie node. A node covers key/length; a route ends here if route is
+// set, otherwise the node only joins two diverging subtrees. A trie
+// with n prefixes never needs more than 2n - 1 nodes.
+typedef struct route_node {
+    uint32_t key;
+    uint8_t length;
+    route_entry_t* route;
+    struct route_node* child[2];
+} route_node_t;
+
+#define ROUTE_MAX_NODES (ROUTE_MAX_ROUTES * 2)
+
+typedef struct {
+    uint32_t dest;
+    route_entry_t* route;
+    uint32_t generation;
+} route_cache_entry_t;
+
+static route_entry_t routes[ROUTE_MAX_ROUTES];
+static route_node_t route_nodes[ROUTE_MAX_NODES];
+static route_node_t* route_free_nodes = NULL;
+static route_node_t* route_root = NULL;
+
+// Bumped on every table change; cache entries from older generations
+// are ignored, so a change never has to walk the cache.
+static route_cache_entry_t route_cache[ROUTE_CACHE_SIZE];
+static uint32_t route_generation = 1;
+static route_stats_t route_stats;
+
+static uint32_t route_mask(uint8_t length) {
+    return length == 0 ? 0 : 0xFFFFFFFFu << (32 - length);
+}
+
+// Bit i of addr, counting from the most significant bit
+static int route_bit(uint32_t addr, uint8_t i) {
+    return (addr >> (31 - i)) & 1;
+}
+
+static uint8_t route_common_length(uint32_t a, uint32_t b) {
+    uint32_t diff = a ^ b;
+    return diff == 0 ? 32 : (uint8_t)__builtin_clz(diff);
+}
+
+static uint32_t route_ip_to_u32(ip_addr_t* ip) {
+    return ((uint32_t)ip->addr[0] << 24) | ((uint32_t)ip->addr[1] << 16) |
+           ((uint32_t)ip->addr[2] << 8) | (uint32_t)ip->addr[3];
+}
+
+static ip_addr_t route_u32_to_ip(uint32_t addr) {
+    ip_addr_t ip;
+    ip.addr[0] = (addr >> 24) & 0xFF;
+    ip.addr[1] = (addr >> 16) & 0xFF;
+    ip.addr[2] = (addr >> 8) & 0xFF;
+    ip.addr[3] = addr & 0xFF;
+    return ip;
+}
+
+static void route_itoa(uint32_t value, char* buffer) {
+    char temp[12];
+    int i = 0;
+    do {
+        temp[i++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    int j = 0;
+    while (i > 0) {
+        buffer[j++] = temp[--i];
+    }
+    buffer[j] = '\0';
+}
+
+static route_node_t* route_node_alloc(uint32_t key, uint8_t length) {
+    route_node_t* node = route_free_nodes;
+    if (!node) return NULL;
+    route_free_nodes = node->child[0];
+    
+    node->key = key & route_mask(length);
+    node->length = length;
+    node->route = NULL;
+    node->child[0] = NULL;
+    node->child[1] = NULL;
+    return node;
+}
+
+static void route_node_free(route_node_t* node) {
+    node->child[0] = route_free_nodes;
+    route_free_nodes = node;
+}
+
+// Find or create the node for prefix/length, splitting a compressed
+// edge where the new prefix diverges from it
+static route_node_t* route_trie_insert(uint32_t prefix, uint8_t length) {
+    route_node_t** link = &route_root;
+    
+    while (1) {
+        route_node_t* node = *link;
+        if (!node) {
+            node = route_node_alloc(prefix, length);
+            *link = node;
+            return node;
+        }
+        
+        uint8_t common = route_common_length(node->key, prefix);
+        if (common > node->length) common = node->length;
+        if (common > length) common = length;
+        
+        if (common == node->length) {
+            if (length == node->length) {
+                return node;
+            }
+            link = &node->child[route_bit(prefix, node->length)];
+            continue;
+        }
+        
+        if (common == length) {
+            // The new prefix sits above node on its edge
+            route_node_t* above = route_node_alloc(prefix, length);
+            if (!above) return NULL;
+            above->child[route_bit(node->key, length)] = node;
+            *link = above;
+            return above;
+        }
+        
+        // Diverge: a glue node at the common prefix gets both subtrees
+        if (!route_free_nodes || !route_free_nodes->child[0]) {
+            return NULL; // Need two nodes
+        }
+        route_node_t* glue = route_node_alloc(prefix, common);
+        route_node_t* leaf = route_node_alloc(prefix, length);
+        glue->child[route_bit(prefix, common)] = leaf;
+        glue->child[route_bit(node->key, common)] = node;
+        *link = glue;
+        return leaf;
+    }
+}
+
+// Remove a node left without a route if it no longer joins two subtrees
+static route_node_t* route_trie_compact(route_node_t* node) {
+    if (!node || node->route || (node->child[0] && node->child[1])) {
+        return node;
+    }
+    route_node_t* child = node->child[0] ? node->child[0] : node->child[1];
+    route_node_free(node);
+    return child;
+}
+
+static route_entry_t* route_trie_lookup(uint32_t dest) {
+    route_entry_t* best = NULL;
+    route_node_t* node = route_root;
+    
+    while (node) {
+        if ((dest ^ node->key) & route_mask(node->length)) {
+            break;
+        }
+        if (node->route) {
+            best = node->route;
+        }
+        if (node->length == 32) {
+            break;
+        }
+        node = node->child[route_bit(dest, node->length)];
+    }
+    
+    return best;
+}
+
+static uint32_t route_cache_index(uint32_t dest) {
+    uint32_t hash = dest ^ (dest >> 16);
+    hash ^= hash >> 8;
+    return hash & (ROUTE_CACHE_SIZE - 1);
+}
+
+void route_init(void) {
+    route_root = NULL;
+    route_free_nodes = NULL;
+    for (int i = ROUTE_MAX_NODES - 1; i >= 0; i--) {
+        route_node_free(&route_nodes[i]);
+    }
+    for (int i = 0; i < ROUTE_MAX_ROUTES; i++) {
+        routes[i].in_use = 0;
+    }
+    for (int i = 0; i < ROUTE_CACHE_SIZE; i++) {
+        route_cache[i].generation = 0;
+    }
+    route_generation = 1;
+    route_stats.lookups = 0;
+    route_stats.cache_hits = 0;
+    route_stats.cache_misses = 0;
+    route_stats.no_route = 0;
+    
+    terminal_writestring("Routing table initialized\n");
+}
+
+int route_add(uint32_t prefix, uint8_t prefix_length, uint32_t gateway, net_interface_t* iface) {
+    if (prefix_length > 32 || !iface) {
+        return -1;
+    }
+    prefix &= route_mask(prefix_length);
+    
+    uint32_t flags = irq_save();
+    
+    // Reserve an entry before touching the trie; replacing an existing
+    // prefix needs none
+    route_entry_t* spare = NULL;
+    int exists = 0;
+    for (int i = 0; i < ROUTE_MAX_ROUTES; i++) {
+        if (!routes[i].in_use) {
+            if (!spare) spare = &routes[i];
+        } else if (routes[i].prefix == prefix && routes[i].prefix_length == prefix_length) {
+            exists = 1;
+        }
+    }
+    if (!spare && !exists) {
+        irq_restore(flags);
+        return -1; // Table full
+    }
+    
+    route_node_t* node = route_trie_insert(prefix, prefix_length);
+    if (!node) {
+        irq_restore(flags);
+        return -1; // Out of trie nodes
+    }
+    
+    route_entry_t* route = node->route;
+    if (!route) {
+        route = spare;
+        node->route = route;
+    }
+    
+    // Adding an existing prefix replaces its next hop
+    route->prefix = prefix;
+    route->prefix_length = prefix_length;
+    route->gateway = gateway;
+    route->iface = iface;
+    route->in_use = 1;
+    route_generation++;
+    
+    irq_restore(flags);
+    return 0;
+}
+
+int route_delete(uint32_t prefix, uint8_t prefix_length) {
+    if (prefix_length > 32) {
+        return -1;
+    }
+    prefix &= route_mask(prefix_length);
+    
+    uint32_t flags = irq_save();
+    
+    // Remember the path so emptied nodes can be compacted bottom-up
+    route_node_t** path[33];
+    int depth = 0;
+    route_node_t** link = &route_root;
+    
+    while (*link) {
+        route_node_t* node = *link;
+        if (node->length > prefix_length ||
+            ((prefix ^ node->key) & route_mask(node->length))) {
+            break;
+        }
+        path[depth++] = link;
+        if (node->length == prefix_length) {
+            break;
+        }
+        link = &node->child[route_bit(prefix, node->length)];
+    }
+    
+    route_node_t* node = depth > 0 ? *path[depth - 1] : NULL;
+    if (!node || node->length != prefix_length || !node->route) {
+        irq_restore(flags);
+        return -1; // No such route
+    }
+    
+    node->route->in_use = 0;
+    node->route = NULL;
+    while (depth > 0) {
+        depth--;
+        *path[depth] = route_trie_compact(*path[depth]);
+    }
+    route_generation++;
+    
+    irq_restore(flags);
+    return 0;
+}
+
+void route_flush_interface(net_interface_t* iface) {
+    for (int i = 0; i < ROUTE_MAX_ROUTES; i++) {
+        if (routes[i].in_use && routes[i].iface == iface) {
+            route_delete(routes[i].prefix, routes[i].prefix_length);
+        }
+    }
+}
+
+// Install the connected subnet and, if one is configured, the default
+// route through the interface gateway
+void route_interface_up(net_interface_t* iface) {
+    route_flush_interface(iface);
+    
+    uint32_t ip = route_ip_to_u32(&iface->ip);
+    uint32_t netmask = route_ip_to_u32(&iface->netmask);
+    uint32_t gateway = route_ip_to_u32(&iface->gateway);
+    if (ip == 0) {
+        return;
+    }
+    
+    uint8_t length = 0;
+    while (length < 32 && (netmask & (0x80000000u >> length))) {
+        length++;
+    }
+    
+    route_add(ip, length, 0, iface);
+    if (gateway != 0) {
+        route_add(0, 0, gateway, iface);
+    }
+}
+
+int route_lookup(uint32_t dest, net_interface_t** iface, uint32_t* next_hop) {
+    uint32_t flags = irq_save();
+    route_stats.lookups++;
+    
+    route_cache_entry_t* cached = &route_cache[route_cache_index(dest)];
+    route_entry_t* route;
+    if (cached->generation == route_generation && cached->dest == dest) {
+        route_stats.cache_hits++;
+        route = cached->route;
+    } else {
+        route_stats.cache_misses++;
+        route = route_trie_lookup(dest);
+        if (route) {
+            cached->dest = dest;
+            cached->route = route;
+            cached->generation = route_generation;
+        }
+    }
+    
+    if (!route) {
+        route_stats.no_route++;
+        irq_restore(flags);
+        return -1;
+    }
+    
+    if (iface) *iface = route->iface;
+    if (next_hop) *next_hop = route->gateway ? route->gateway : dest;
+    
+    irq_restore(flags);
+    return 0;
+}
+
+route_stats_t* route_get_stats(void) {
+    return &route_stats;
+}
+
+void route_dump(void) {
+    char num[12];
+    
+    terminal_writestring("Destination         Gateway          Iface\n");
+    for (int i = 0; i < ROUTE_MAX_ROUTES; i++) {
+        route_entry_t* route = &routes[i];
+        if (!route->in_use) continue;
+        
+        ip_addr_t addr = route_u32_to_ip(route->prefix);
+        const char* text = ip_to_string(&addr);
+        terminal_writestring(text);
+        terminal_writestring("/");
+        route_itoa(route->prefix_length, num);
+        terminal_writestring(num);
+        
+        size_t width = 0;
+        while (text[width]) width++;
+        for (width += 1 + (route->prefix_length >= 10 ? 2 : 1); width < 20; width++) {
+            terminal_writestring(" ");
+        }
+        
+        if (route->gateway) {
+            addr = route_u32_to_ip(route->gateway);
+            text = ip_to_string(&addr);
+        } else {
+            text = "*";
+        }
+        terminal_writestring(text);
+        width = 0;
+        while (text[width]) width++;
+        for (; width < 17; width++) {
+            terminal_writestring(" ");
+        }
+        terminal_writestring(route->iface->name);
+        terminal_writestring("\n");
+    }
+    
+    terminal_writestring("Lookups: ");
+    route_itoa(route_stats.lookups, num);
+    terminal_writestring(num);
+    terminal_writestring("  cache hits: ");
+    route_itoa(route_stats.cache_hits, num);
+    terminal_writestring(num);
+    terminal_writestring("  misses: ");
+    route_itoa(route_stats.cache_misses, num);
+    terminal_writestring(num);
+    terminal_writestring("  no route: ");
+    route_itoa(route_stats.no_route, num);
+    terminal_writestring(num);
+    terminal_writestring("\n");
+}
\ No newline at end of file
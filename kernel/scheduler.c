@@ -8,6 +8,29 @@ static process_t* ready_queue = NULL;
 static process_t* current_process = NULL;
 static uint32_t time_slice_counter = 0;
 static uint32_t scheduler_enabled = 0;
+static volatile uint32_t timer_ticks = 0;
+
+typedef struct {
+    timer_callback_t callback;
+    uint32_t interval;
+    uint32_t countdown;
+} timer_entry_t;
+
+static timer_entry_t timer_callbacks[MAX_TIMER_CALLBACKS];
+static int timer_callback_count = 0;
+
+typedef struct {
+    work_callback_t callback;
+    uint32_t interval;
+    uint32_t countdown;
+    volatile int pending;
+} work_entry_t;
+
+static work_entry_t work_items[MAX_WORK_ITEMS];
+static int work_count = 0;
+static volatile int work_due = 0;
+static volatile int work_running = 0;
+static volatile uint32_t work_disabled = 0;
 
 static void outb(uint16_t port, uint8_t value) {
     asm volatile ("outb %1, %0" : : "dN" (port), "a" (value));
@@ -31,19 +54,59 @@ void scheduler_init(void) {
     terminal_writestring("Scheduler initialized with preemptive multitasking\n");
 }
 
+// Run the deferred work that has come due. The EOI has already been
+// sent, so interrupts can be enabled around each item; a nested timer
+// interrupt only marks more work due, which waits for the next tick.
+static void work_run(void) {
+    if (work_running || work_disabled || !work_due) {
+        return;
+    }
+    
+    work_running = 1;
+    work_due = 0;
+    for (int i = 0; i < work_count; i++) {
+        if (work_items[i].pending) {
+            work_items[i].pending = 0;
+            asm volatile("sti" : : : "memory");
+            work_items[i].callback();
+            asm volatile("cli" : : : "memory");
+        }
+    }
+    work_running = 0;
+}
+
 void timer_handler(registers_t regs) {
     (void)regs;
     
-    if (!scheduler_enabled) {
-        return;
+    timer_ticks++;
+    
+    // Run periodic kernel timers
+    for (int i = 0; i < timer_callback_count; i++) {
+        if (--timer_callbacks[i].countdown == 0) {
+            timer_callbacks[i].countdown = timer_callbacks[i].interval;
+            timer_callbacks[i].callback();
+        }
     }
     
-    time_slice_counter++;
+    // Deferred work only comes due here
+    for (int i = 0; i < work_count; i++) {
+        if (--work_items[i].countdown == 0) {
+            work_items[i].countdown = work_items[i].interval;
+            work_items[i].pending = 1;
+            work_due = 1;
+        }
+    }
     
-    if (time_slice_counter >= 10) {
-        time_slice_counter = 0;
-        schedule_next();
+    if (scheduler_enabled) {
+        time_slice_counter++;
+        
+        if (time_slice_counter >= 10) {
+            time_slice_counter = 0;
+            schedule_next();
+        }
     }
+    
+    work_run();
 }
 
 void schedule_next(void) {
@@ -123,4 +186,101 @@ void enable_scheduler(void) {
 
 void disable_scheduler(void) {
     scheduler_enabled = 0;
+}
+
+void wait_queue_init(wait_queue_t* wq) {
+    wq->generation = 0;
+}
+
+// Block the caller until wake_up() or the timeout (0 = none) expires.
+// Returns 1 when woken, 0 on timeout.
+int wait_queue_sleep_timeout(wait_queue_t* wq, uint32_t ticks) {
+    uint32_t flags = irq_save();
+    uint32_t generation = wq->generation;
+    uint32_t deadline = timer_ticks + ticks;
+    
+    process_t* sleeper = current_process;
+    if (sleeper && sleeper->state == PROCESS_RUNNING) {
+        sleeper->state = PROCESS_BLOCKED;
+    }
+    
+    int woken = 1;
+    while (wq->generation == generation) {
+        if (ticks && (int32_t)(timer_ticks - deadline) >= 0) {
+            woken = 0;
+            break;
+        }
+        // sti;hlt is atomic, so an interrupt cannot be lost in between
+        asm volatile("sti\n\thlt\n\tcli" : : : "memory");
+    }
+    
+    if (sleeper && sleeper->state == PROCESS_BLOCKED) {
+        sleeper->state = PROCESS_RUNNING;
+    }
+    
+    irq_restore(flags);
+    return woken;
+}
+
+void wait_queue_sleep(wait_queue_t* wq) {
+    wait_queue_sleep_timeout(wq, 0);
+}
+
+void wake_up(wait_queue_t* wq) {
+    wq->generation++;
+}
+
+uint32_t timer_get_ticks(void) {
+    return timer_ticks;
+}
+
+int timer_register_callback(timer_callback_t callback, uint32_t interval_ticks) {
+    if (!callback || timer_callback_count >= MAX_TIMER_CALLBACKS) {
+        return -1;
+    }
+    
+    if (interval_ticks == 0) {
+        interval_ticks = 1;
+    }
+    
+    uint32_t flags = irq_save();
+    timer_entry_t* entry = &timer_callbacks[timer_callback_count];
+    entry->callback = callback;
+    entry->interval = interval_ticks;
+    entry->countdown = interval_ticks;
+    timer_callback_count++;
+    irq_restore(flags);
+    
+    return 0;
+}
+
+int work_register(work_callback_t callback, uint32_t interval_ticks) {
+    if (!callback || work_count >= MAX_WORK_ITEMS) {
+        return -1;
+    }
+    
+    if (interval_ticks == 0) {
+        interval_ticks = 1;
+    }
+    
+    uint32_t flags = irq_save();
+    work_entry_t* entry = &work_items[work_count];
+    entry->callback = callback;
+    entry->interval = interval_ticks;
+    entry->countdown = interval_ticks;
+    entry->pending = 0;
+    work_count++;
+    irq_restore(flags);
+    
+    return 0;
+}
+
+// Hold off deferred work. Work that comes due meanwhile is kept pending
+// and runs on the first tick after the matching work_enable().
+void work_disable(void) {
+    work_disabled++;
+}
+
+void work_enable(void) {
+    work_disabled--;
 }
\ No newline at end of file
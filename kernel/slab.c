@@ -0,0 +1,189 @@
+#include "../include/slab.h"
+#include "../include/memory.h"
+#include "../include/interrupts.h"
+
+extern void terminal_writestring(const char* data);
+
+#define SLAB_ALIGN 8
+#define SLAB_ROUND(size) (((size) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+#define SLAB_FIRST_OBJECT SLAB_ROUND(sizeof(slab_t))
+
+static void slab_itoa(uint32_t value, char* buffer) {
+    char temp[12];
+    int pos = 0;
+    do {
+        temp[pos++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    int i = 0;
+    while (pos > 0) {
+        buffer[i++] = temp[--pos];
+    }
+    buffer[i] = '\0';
+}
+
+static void slab_write_uint(uint32_t value) {
+    char buffer[12];
+    slab_itoa(value, buffer);
+    terminal_writestring(buffer);
+}
+
+static void slab_list_push(slab_t** list, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) (*list)->prev = slab;
+    *list = slab;
+}
+
+static void slab_list_remove(slab_t** list, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+// Carve a fresh page into objects
+static slab_t* slab_grow(slab_cache_t* cache) {
+    slab_t* slab = (slab_t*)pmm_alloc_page();
+    if (!slab) return NULL;
+    
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+    
+    // Thread the free list back to front so allocation walks the page
+    // in address order
+    uint8_t* base = (uint8_t*)slab + SLAB_FIRST_OBJECT;
+    for (uint32_t i = cache->objects_per_slab; i > 0; i--) {
+        void** object = (void**)(base + (i - 1) * cache->object_size);
+        *object = slab->free_list;
+        slab->free_list = object;
+    }
+    
+    cache->slabs++;
+    return slab;
+}
+
+int slab_cache_init(slab_cache_t* cache, const char* name, size_t object_size) {
+    if (!cache || object_size == 0) return -1;
+    
+    size_t size = SLAB_ROUND(object_size < sizeof(void*) ? sizeof(void*) : object_size);
+    if (size > PAGE_SIZE - SLAB_FIRST_OBJECT) return -1;
+    
+    int i = 0;
+    while (name && name[i] && i < SLAB_NAME_LEN - 1) {
+        cache->name[i] = name[i];
+        i++;
+    }
+    cache->name[i] = '\0';
+    
+    cache->object_size = size;
+    cache->objects_per_slab = (PAGE_SIZE - SLAB_FIRST_OBJECT) / size;
+    cache->partial = NULL;
+    cache->full = NULL;
+    cache->empty = NULL;
+    cache->slabs = 0;
+    cache->objects_in_use = 0;
+    cache->peak_in_use = 0;
+    cache->allocations = 0;
+    cache->failures = 0;
+    return 0;
+}
+
+void* slab_alloc(slab_cache_t* cache) {
+    uint32_t irq_flags = irq_save();
+    
+    slab_t* slab = cache->partial;
+    if (!slab) {
+        // Reuse the spare before asking for a new page
+        slab = cache->empty ? cache->empty : slab_grow(cache);
+        cache->empty = NULL;
+        if (!slab) {
+            cache->failures++;
+            irq_restore(irq_flags);
+            return NULL;
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+    
+    void** object = (void**)slab->free_list;
+    slab->free_list = *object;
+    slab->in_use++;
+    
+    if (!slab->free_list) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+    
+    cache->allocations++;
+    cache->objects_in_use++;
+    if (cache->objects_in_use > cache->peak_in_use) {
+        cache->peak_in_use = cache->objects_in_use;
+    }
+    
+    irq_restore(irq_flags);
+    return object;
+}
+
+void slab_free(slab_cache_t* cache, void* object) {
+    if (!object) return;
+    
+    // Slabs are page aligned, so the header is found from any object
+    slab_t* slab = (slab_t*)PAGE_ALIGN_DOWN((uintptr_t)object);
+    if (slab->cache != cache) return;
+    
+    uint32_t irq_flags = irq_save();
+    
+    if (!slab->free_list) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+    
+    *(void**)object = slab->free_list;
+    slab->free_list = object;
+    slab->in_use--;
+    cache->objects_in_use--;
+    
+    // Keep one empty slab around; give any further ones back
+    void* release = NULL;
+    if (slab->in_use == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty) {
+            release = slab;
+            cache->slabs--;
+        } else {
+            cache->empty = slab;
+        }
+    }
+    
+    irq_restore(irq_flags);
+    
+    if (release) {
+        pmm_free_page(release);
+    }
+}
+
+void slab_cache_dump(slab_cache_t* cache) {
+    terminal_writestring(cache->name);
+    terminal_writestring(": ");
+    slab_write_uint(cache->objects_in_use);
+    terminal_writestring(" objects in use (peak ");
+    slab_write_uint(cache->peak_in_use);
+    terminal_writestring("), ");
+    slab_write_uint(cache->slabs);
+    terminal_writestring(" slabs of ");
+    slab_write_uint(cache->objects_per_slab);
+    terminal_writestring(" x ");
+    slab_write_uint(cache->object_size);
+    terminal_writestring(" bytes, ");
+    slab_write_uint(cache->allocations);
+    terminal_writestring(" allocations, ");
+    slab_write_uint(cache->failures);
+    terminal_writestring(" failures\n");
+}
\ No newline at end of file
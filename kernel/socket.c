@@ -0,0 +1,236 @@
+#include "../include/socket.h"
+#include "../include/tcp.h"
+#include "../include/udp.h"
+#include "../include/interrupts.h"
+#include "../include/errno.h"
+
+typedef struct {
+    int in_use;
+    int type;               // SOCK_STREAM or SOCK_DGRAM
+    int tcp;                // TCP socket id for SOCK_STREAM
+    udp_socket_t* udp;      // Protocol state for SOCK_DGRAM
+    
+    // Default destination set by connect() on a datagram socket
+    int connected;
+    uint32_t remote_ip;
+    uint16_t remote_port;
+} socket_t;
+
+static socket_t sockets[SOCKET_MAX];
+
+static socket_t* socket_get(int fd) {
+    if (fd < 0 || fd >= SOCKET_MAX || !sockets[fd].in_use) {
+        return NULL;
+    }
+    return &sockets[fd];
+}
+
+static int socket_alloc(int type) {
+    uint32_t irq_flags = irq_save();
+    for (int fd = 0; fd < SOCKET_MAX; fd++) {
+        if (!sockets[fd].in_use) {
+            sockets[fd].in_use = 1;
+            sockets[fd].type = type;
+            sockets[fd].tcp = -1;
+            sockets[fd].udp = NULL;
+            sockets[fd].connected = 0;
+            sockets[fd].remote_ip = 0;
+            sockets[fd].remote_port = 0;
+            irq_restore(irq_flags);
+            return fd;
+        }
+    }
+    irq_restore(irq_flags);
+    return -EMFILE;
+}
+
+int socket_create(int domain, int type, int protocol) {
+    if (domain != AF_INET) return -EAFNOSUPPORT;
+    
+    if (type == SOCK_STREAM && (protocol == 0 || protocol == IPPROTO_TCP)) {
+        int fd = socket_alloc(type);
+        if (fd < 0) return fd;
+        sockets[fd].tcp = tcp_socket();
+        if (sockets[fd].tcp < 0) {
+            sockets[fd].in_use = 0;
+            return -EMFILE;
+        }
+        return fd;
+    }
+    
+    if (type == SOCK_DGRAM && (protocol == 0 || protocol == IPPROTO_UDP)) {
+        int fd = socket_alloc(type);
+        if (fd < 0) return fd;
+        sockets[fd].udp = udp_socket_create();
+        if (!sockets[fd].udp) {
+            sockets[fd].in_use = 0;
+            return -ENOMEM;
+        }
+        return fd;
+    }
+    
+    return -EPROTONOSUPPORT;
+}
+
+int socket_bind(int fd, const sockaddr_in_t* addr) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return -EBADF;
+    if (!addr || addr->family != AF_INET) return -EINVAL;
+    
+    if (sock->type == SOCK_STREAM) {
+        return tcp_bind(sock->tcp, addr->port) < 0 ? -EADDRINUSE : 0;
+    }
+    return udp_socket_bind(sock->udp, addr->addr, addr->port);
+}
+
+int socket_listen(int fd, int backlog) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return -EBADF;
+    if (sock->type != SOCK_STREAM) return -EOPNOTSUPP;
+    
+    return tcp_listen(sock->tcp, backlog) < 0 ? -EINVAL : 0;
+}
+
+int socket_accept(int fd, sockaddr_in_t* addr) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return -EBADF;
+    if (sock->type != SOCK_STREAM) return -EOPNOTSUPP;
+    
+    uint32_t remote_ip;
+    uint16_t remote_port;
+    int tcp = tcp_accept(sock->tcp, &remote_ip, &remote_port);
+    if (tcp < 0) return tcp == -1 ? -EINVAL : tcp;
+    
+    int child = socket_alloc(SOCK_STREAM);
+    if (child < 0) {
+        tcp_close(tcp);
+        return child;
+    }
+    sockets[child].tcp = tcp;
+    
+    if (addr) {
+        addr->family = AF_INET;
+        addr->addr = remote_ip;
+        addr->port = remote_port;
+    }
+    return child;
+}
+
+int socket_connect(int fd, const sockaddr_in_t* addr) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return -EBADF;
+    if (!addr || addr->family != AF_INET) return -EINVAL;
+    
+    if (sock->type == SOCK_STREAM) {
+        return tcp_connect(sock->tcp, addr->addr, addr->port) < 0 ? -ETIMEDOUT : 0;
+    }
+    
+    // Datagram sockets just remember the default destination
+    sock->connected = 1;
+    sock->remote_ip = addr->addr;
+    sock->remote_port = addr->port;
+    return 0;
+}
+
+int socket_sendto(int fd, const void* data, size_t length, const sockaddr_in_t* addr) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return -EBADF;
+    
+    if (sock->type == SOCK_STREAM) {
+        return tcp_send(sock->tcp, data, length);
+    }
+    
+    if (addr) {
+        return udp_socket_sendto(sock->udp, data, length, addr->addr, addr->port);
+    }
+    if (!sock->connected) return -EDESTADDRREQ;
+    return udp_socket_sendto(sock->udp, data, length, sock->remote_ip, sock->remote_port);
+}
+
+int socket_recvfrom(int fd, void* buffer, size_t length, sockaddr_in_t* addr) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return -EBADF;
+    
+    if (sock->type == SOCK_STREAM) {
+        return tcp_recv(sock->tcp, buffer, length);
+    }
+    
+    uint32_t src_ip;
+    uint16_t src_port;
+    int result = udp_socket_recvfrom(sock->udp, buffer, length, &src_ip, &src_port);
+    if (result >= 0 && addr) {
+        addr->family = AF_INET;
+        addr->addr = src_ip;
+        addr->port = src_port;
+    }
+    return result;
+}
+
+int socket_send(int fd, const void* data, size_t length) {
+    return socket_sendto(fd, data, length, NULL);
+}
+
+// Stream sockets only: queue data produced in place by fill()
+int socket_send_fill(int fd, socket_fill_t fill, void* context, size_t length) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return -EBADF;
+    if (sock->type != SOCK_STREAM) return -EOPNOTSUPP;
+    return tcp_send_fill(sock->tcp, fill, context, length);
+}
+
+int socket_recv(int fd, void* buffer, size_t length) {
+    return socket_recvfrom(fd, buffer, length, NULL);
+}
+
+int socket_setsockopt(int fd, int level, int option, int value) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return -EBADF;
+    
+    if (level == SOL_SOCKET && option == SO_NONBLOCK) {
+        if (sock->type == SOCK_STREAM) {
+            return tcp_set_nonblocking(sock->tcp, value);
+        }
+        sock->udp->nonblocking = value ? 1 : 0;
+        return 0;
+    }
+    
+    if (level == IPPROTO_TCP && sock->type == SOCK_STREAM) {
+        return tcp_setsockopt(sock->tcp, option, value);
+    }
+    
+    return -EINVAL;
+}
+
+int socket_close(int fd) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return -EBADF;
+    
+    if (sock->type == SOCK_STREAM) {
+        tcp_close(sock->tcp);
+    } else {
+        udp_socket_close(sock->udp);
+    }
+    
+    sock->in_use = 0;
+    return 0;
+}
+
+uint32_t socket_poll(int fd) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return EPOLLERR;
+    
+    if (sock->type == SOCK_STREAM) {
+        return tcp_poll(sock->tcp);
+    }
+    return udp_socket_poll(sock->udp);
+}
+
+poll_head_t* socket_poll_head(int fd) {
+    socket_t* sock = socket_get(fd);
+    if (!sock) return NULL;
+    
+    if (sock->type == SOCK_STREAM) {
+        return tcp_poll_head(sock->tcp);
+    }
+    return &sock->udp->poll;
+}
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include "../include/process.h"
 #include "../include/keyboard.h"
 #include "../include/scheduler.h"
+#include "../include/epoll.h"
+#include "../include/socket.h"
+#include "../include/dns.h"
 
 extern void terminal_writestring(const char* data);
 extern void terminal_putchar(char c);
@@ -18,8 +21,9 @@ void syscall_init(void) {
 void syscall_handler(registers_t regs) {
     uint32_t syscall_num = regs.eax;
     uint32_t arg1 = regs.ebx;
-    // uint32_t arg2 = regs.ecx;
-    // uint32_t arg3 = regs.edx;
+    uint32_t arg2 = regs.ecx;
+    uint32_t arg3 = regs.edx;
+    uint32_t arg4 = regs.esi;
     uint32_t result = 0;
     
     switch (syscall_num) {
@@ -54,6 +58,60 @@ void syscall_handler(registers_t regs) {
             result = 0;
             break;
             
+        case SYSCALL_EPOLL_CREATE:
+            result = (uint32_t)epoll_create();
+            break;
+            
+        case SYSCALL_EPOLL_CTL:
+            result = (uint32_t)epoll_ctl((int)arg1, (int)arg2, (int)arg3, (epoll_event_t*)arg4);
+            break;
+            
+        case SYSCALL_EPOLL_WAIT:
+            result = (uint32_t)epoll_wait((int)arg1, (epoll_event_t*)arg2, (int)arg3, (int)arg4);
+            break;
+            
+        case SYSCALL_EPOLL_CLOSE:
+            result = (uint32_t)epoll_close((int)arg1);
+            break;
+            
+        case SYSCALL_SOCKET:
+            result = (uint32_t)socket_create((int)arg1, (int)arg2, (int)arg3);
+            break;
+            
+        case SYSCALL_BIND:
+            result = (uint32_t)socket_bind((int)arg1, (const sockaddr_in_t*)arg2);
+            break;
+            
+        case SYSCALL_LISTEN:
+            result = (uint32_t)socket_listen((int)arg1, (int)arg2);
+            break;
+            
+        case SYSCALL_ACCEPT:
+            result = (uint32_t)socket_accept((int)arg1, (sockaddr_in_t*)arg2);
+            break;
+            
+        case SYSCALL_CONNECT:
+            result = (uint32_t)socket_connect((int)arg1, (const sockaddr_in_t*)arg2);
+            break;
+            
+        case SYSCALL_SENDTO:
+            result = (uint32_t)socket_sendto((int)arg1, (const void*)arg2, arg3,
+                                             (const sockaddr_in_t*)arg4);
+            break;
+            
+        case SYSCALL_RECVFROM:
+            result = (uint32_t)socket_recvfrom((int)arg1, (void*)arg2, arg3,
+                                               (sockaddr_in_t*)arg4);
+            break;
+            
+        case SYSCALL_CLOSE:
+            result = (uint32_t)socket_close((int)arg1);
+            break;
+            
+        case SYSCALL_RESOLVE:
+            result = (uint32_t)dns_resolve((const char*)arg1, (uint32_t*)arg2);
+            break;
+            
         default:
             result = -1;
             break;
@@ -2,13 +2,17 @@
 #include "../include/net.h"
 #include "../include/ip.h"
 #include "../include/memory.h"
+#include "../include/interrupts.h"
+#include "../include/scheduler.h"
+#include "../include/errno.h"
+#include "../include/checksum.h"
 
 extern void terminal_writestring(const char* data);
 extern size_t strlen(const char* str);
 
 // Global variables
 static tcp_connection_t* tcp_connections = NULL;
-static tcp_socket_t tcp_sockets[64];
+static tcp_socket_t tcp_sockets[TCP_MAX_SOCKETS];
 static uint16_t next_port = 49152; // Start of dynamic port range
 static int tcp_initialized = 0;
 
@@ -39,63 +43,33 @@ void tcp_init(void) {
     terminal_writestring("Initializing TCP protocol...\n");
     
     // Initialize socket table
-    for (int i = 0; i < 64; i++) {
+    for (int i = 0; i < TCP_MAX_SOCKETS; i++) {
         tcp_sockets[i].connection = NULL;
         tcp_sockets[i].socket_id = -1;
         tcp_sockets[i].is_listening = 0;
+        poll_head_init(&tcp_sockets[i].poll);
     }
     
     tcp_connections = NULL;
     tcp_initialized = 1;
     
+    // Retransmission and TIME_WAIT timers
+    timer_register_callback(tcp_timer_tick, TCP_TIMER_INTERVAL);
+    
     terminal_writestring("TCP protocol initialized\n");
 }
 
 uint16_t tcp_checksum(tcp_header_t* tcp_hdr, uint8_t* data, size_t data_len, uint32_t src_ip, uint32_t dst_ip) {
-    uint32_t sum = 0;
-    
-    // Create pseudo header
-    tcp_pseudo_header_t pseudo;
-    pseudo.src_ip = src_ip;
-    pseudo.dst_ip = dst_ip;
-    pseudo.zero = 0;
-    pseudo.protocol = 6; // TCP protocol number
-    pseudo.tcp_length = htons(sizeof(tcp_header_t) + data_len);
-    
-    // Sum pseudo header
-    uint16_t* ptr = (uint16_t*)&pseudo;
-    for (size_t i = 0; i < sizeof(tcp_pseudo_header_t) / 2; i++) {
-        sum += ntohs(ptr[i]);
-    }
+    uint32_t sum = csum_pseudo_header(src_ip, dst_ip, IP_PROTOCOL_TCP,
+                                      sizeof(tcp_header_t) + data_len, 0);
     
-    // Sum TCP header
+    // Header with the checksum field zeroed, then options and payload
     uint16_t old_checksum = tcp_hdr->checksum;
     tcp_hdr->checksum = 0;
-    
-    ptr = (uint16_t*)tcp_hdr;
-    for (size_t i = 0; i < sizeof(tcp_header_t) / 2; i++) {
-        sum += ntohs(ptr[i]);
-    }
-    
+    sum = csum_partial(tcp_hdr, sizeof(tcp_header_t), sum);
     tcp_hdr->checksum = old_checksum;
     
-    // Sum data
-    ptr = (uint16_t*)data;
-    for (size_t i = 0; i < data_len / 2; i++) {
-        sum += ntohs(ptr[i]);
-    }
-    
-    // Add left-over byte if any
-    if (data_len % 2) {
-        sum += ((uint16_t)data[data_len - 1]) << 8;
-    }
-    
-    // Fold 32-bit sum to 16 bits
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-    
-    return htons(~sum);
+    return csum_fold(csum_partial(data, data_len, sum));
 }
 
 tcp_connection_t* tcp_create_connection(void) {
@@ -108,27 +82,90 @@ tcp_connection_t* tcp_create_connection(void) {
     conn->send_ack = 0;
     conn->recv_seq = 0;
     conn->recv_ack = 0;
-    conn->send_window = 8192;
-    conn->recv_window = 8192;
-    
-    // Allocate buffers
-    conn->send_buffer_size = 4096;
-    conn->recv_buffer_size = 4096;
-    conn->send_buffer = (uint8_t*)kmalloc(conn->send_buffer_size);
-    conn->recv_buffer = (uint8_t*)kmalloc(conn->recv_buffer_size);
-    conn->send_buffer_used = 0;
-    conn->recv_buffer_used = 0;
+    conn->send_window = 0;   // Learned from the peer's SYN
+    conn->recv_window = TCP_INITIAL_BUFFER_SIZE;
+    
+    // Options are negotiated on the SYN exchange
+    conn->send_mss = TCP_DEFAULT_MSS;
+    conn->send_wscale = 0;
+    conn->recv_wscale = 0;
+    conn->sack_permitted = 0;
+    
+    // Congestion control starts in slow start with an unbounded threshold
+    conn->cwnd = TCP_DEFAULT_MSS;
+    conn->ssthresh = 0xFFFFFFFF;
+    conn->dup_acks = 0;
+    conn->recover = conn->send_seq;
+    conn->in_recovery = 0;
+    
+    // Allocate buffers, grown on demand up to TCP_MAX_BUFFER_SIZE
+    if (!ring_init(&conn->send_ring, TCP_INITIAL_BUFFER_SIZE) ||
+        !ring_init(&conn->recv_ring, TCP_INITIAL_BUFFER_SIZE)) {
+        ring_free(&conn->send_ring);
+        kfree(conn);
+        return NULL;
+    }
+    wait_queue_init(&conn->send_wait);
+    wait_queue_init(&conn->recv_wait);
+    conn->recv_rtt_start = 0;
+    conn->recv_rtt_bytes = 0;
+    conn->persist_pending = 0;
+    conn->ack_pending = 0;
+    conn->delack_deadline = 0;
+    conn->nodelay = 0;
+    conn->cork = 0;
+    conn->close_pending = 0;
+    conn->poll = NULL;
+    conn->listener = NULL;
+    conn->accept_next = NULL;
+    conn->accept_head = NULL;
+    conn->accept_tail = NULL;
+    conn->accept_count = 0;
+    conn->accept_backlog = 0;
+    
+    // Retransmission state
+    conn->send_una = conn->send_seq;
+    conn->retransmit_head = NULL;
+    conn->retransmit_tail = NULL;
+    conn->srtt = 0;
+    conn->rttvar = 0;
+    conn->rto = TCP_RTO_INITIAL;
+    conn->rto_deadline = 0;
+    conn->retries = 0;
+    conn->time_wait_deadline = 0;
+    conn->orphaned = 0;
     
     // Add to connection list
+    uint32_t irq_flags = irq_save();
     conn->next = tcp_connections;
     tcp_connections = conn;
+    irq_restore(irq_flags);
     
     return conn;
 }
 
+static void tcp_free_segment(tcp_segment_t* seg) {
+    if (seg->data) kfree(seg->data);
+    kfree(seg);
+}
+
+static void tcp_flush_retransmit_queue(tcp_connection_t* conn) {
+    tcp_segment_t* seg = conn->retransmit_head;
+    while (seg) {
+        tcp_segment_t* next = seg->next;
+        tcp_free_segment(seg);
+        seg = next;
+    }
+    conn->retransmit_head = NULL;
+    conn->retransmit_tail = NULL;
+    conn->retries = 0;
+}
+
 void tcp_destroy_connection(tcp_connection_t* conn) {
     if (!conn) return;
     
+    uint32_t irq_flags = irq_save();
+    
     // Remove from connection list
     if (tcp_connections == conn) {
         tcp_connections = conn->next;
@@ -142,9 +179,13 @@ void tcp_destroy_connection(tcp_connection_t* conn) {
         }
     }
     
+    irq_restore(irq_flags);
+    
+    tcp_flush_retransmit_queue(conn);
+    
     // Free buffers
-    if (conn->send_buffer) kfree(conn->send_buffer);
-    if (conn->recv_buffer) kfree(conn->recv_buffer);
+    ring_free(&conn->send_ring);
+    ring_free(&conn->recv_ring);
     
     kfree(conn);
 }
@@ -186,36 +227,93 @@ int tcp_is_port_available(uint16_t port) {
     return 1;
 }
 
-void tcp_send_packet(tcp_connection_t* conn, uint8_t flags, uint8_t* data, size_t data_len) {
+// Window we can advertise right now, in unscaled bytes
+static uint32_t tcp_receive_space(tcp_connection_t* conn) {
+    return ring_space(&conn->recv_ring);
+}
+
+// SYN options: MSS, window scale and SACK-permitted. On a SYN-ACK only the
+// options the peer offered are echoed back (RFC 7323, RFC 2018).
+static size_t tcp_build_syn_options(tcp_connection_t* conn, uint8_t flags, uint8_t* opts) {
+    size_t len = 0;
+    int is_syn_ack = (flags & TCP_FLAG_ACK) != 0;
+    
+    opts[len++] = TCP_OPT_MSS;
+    opts[len++] = 4;
+    opts[len++] = (TCP_LOCAL_MSS >> 8) & 0xFF;
+    opts[len++] = TCP_LOCAL_MSS & 0xFF;
+    
+    if (!is_syn_ack || conn->recv_wscale) {
+        opts[len++] = TCP_OPT_NOP;
+        opts[len++] = TCP_OPT_WSCALE;
+        opts[len++] = 3;
+        opts[len++] = is_syn_ack ? conn->recv_wscale : TCP_LOCAL_WSCALE;
+    }
+    
+    if (!is_syn_ack || conn->sack_permitted) {
+        opts[len++] = TCP_OPT_NOP;
+        opts[len++] = TCP_OPT_NOP;
+        opts[len++] = TCP_OPT_SACK_PERMITTED;
+        opts[len++] = 2;
+    }
+    
+    return len;
+}
+
+// Build and send one segment starting at seq without touching send_seq
+static void tcp_transmit(tcp_connection_t* conn, uint32_t seq, uint8_t flags, uint8_t* data, size_t data_len) {
+    uint8_t options[TCP_MAX_OPTIONS_LEN];
+    size_t options_len = 0;
+    if (flags & TCP_FLAG_SYN) {
+        options_len = tcp_build_syn_options(conn, flags, options);
+    }
+    
     // Calculate total packet size
-    size_t total_size = sizeof(ip_header_t) + sizeof(tcp_header_t) + data_len;
+    size_t header_len = sizeof(tcp_header_t) + options_len;
+    size_t total_size = sizeof(ip_header_t) + header_len + data_len;
     uint8_t* packet = (uint8_t*)kmalloc(total_size);
     if (!packet) return;
     
+    // Window field is never scaled on SYN segments
+    uint32_t window = tcp_receive_space(conn);
+    if (!(flags & TCP_FLAG_SYN)) {
+        window >>= conn->recv_wscale;
+    }
+    if (window > 0xFFFF) window = 0xFFFF;
+    conn->recv_window = window << ((flags & TCP_FLAG_SYN) ? 0 : conn->recv_wscale);
+    
     // Prepare TCP header
     tcp_header_t* tcp_hdr = (tcp_header_t*)(packet + sizeof(ip_header_t));
     tcp_hdr->src_port = htons(conn->local_port);
     tcp_hdr->dst_port = htons(conn->remote_port);
-    tcp_hdr->seq_num = htonl(conn->send_seq);
+    tcp_hdr->seq_num = htonl(seq);
     tcp_hdr->ack_num = htonl(conn->send_ack);
-    tcp_hdr->data_offset = (sizeof(tcp_header_t) / 4) << 4; // No options
+    
+    // Any ACK-bearing segment, data included, satisfies a delayed ACK
+    if (flags & TCP_FLAG_ACK) {
+        conn->ack_pending = 0;
+    }
+    tcp_hdr->data_offset = (header_len / 4) << 4;
     tcp_hdr->flags = flags;
-    tcp_hdr->window = htons(conn->recv_window);
+    tcp_hdr->window = htons(window);
     tcp_hdr->checksum = 0;
     tcp_hdr->urgent_ptr = 0;
     
-    // Copy data if any
-    if (data && data_len > 0) {
-        uint8_t* tcp_data = packet + sizeof(ip_header_t) + sizeof(tcp_header_t);
-        for (size_t i = 0; i < data_len; i++) {
-            tcp_data[i] = data[i];
-        }
+    // Copy options
+    uint8_t* tcp_opts = packet + sizeof(ip_header_t) + sizeof(tcp_header_t);
+    for (size_t i = 0; i < options_len; i++) {
+        tcp_opts[i] = options[i];
     }
     
-    // Calculate checksum
-    tcp_hdr->checksum = tcp_checksum(tcp_hdr, 
-                                     packet + sizeof(ip_header_t) + sizeof(tcp_header_t),
-                                     data_len, conn->local_ip, conn->remote_ip);
+    // Checksum header and options, then copy and checksum the payload in
+    // one pass
+    uint32_t sum = csum_pseudo_header(conn->local_ip, conn->remote_ip, IP_PROTOCOL_TCP,
+                                      header_len + data_len, 0);
+    sum = csum_partial(tcp_hdr, header_len, sum);
+    if (data && data_len > 0) {
+        sum = csum_partial_copy(tcp_opts + options_len, data, data_len, sum);
+    }
+    tcp_hdr->checksum = csum_fold(sum);
     
     // Send via IP layer
     ip_addr_t dest_ip;
@@ -225,17 +323,469 @@ void tcp_send_packet(tcp_connection_t* conn, uint8_t flags, uint8_t* data, size_
     dest_ip.addr[3] = conn->remote_ip & 0xFF;
     
     ip_send_packet(dest_ip, 6, packet + sizeof(ip_header_t), 
-                   sizeof(tcp_header_t) + data_len);
+                   header_len + data_len);
+    
+    kfree(packet);
+}
+
+// Sequence space consumed by a segment (SYN and FIN count as one byte)
+static uint32_t tcp_segment_length(uint8_t flags, size_t data_len) {
+    uint32_t len = data_len;
+    if (flags & TCP_FLAG_SYN) len++;
+    if (flags & TCP_FLAG_FIN) len++;
+    return len;
+}
+
+// Keep a sent segment until the peer acknowledges it. The segment takes
+// ownership of data, which must come from kmalloc.
+static int tcp_queue_segment(tcp_connection_t* conn, uint32_t seq, uint8_t flags, uint8_t* data, size_t data_len) {
+    tcp_segment_t* seg = (tcp_segment_t*)kmalloc(sizeof(tcp_segment_t));
+    if (!seg) {
+        return 0;
+    }
     
-    // Update sequence number for data and SYN/FIN
-    if (data_len > 0 || (flags & (TCP_FLAG_SYN | TCP_FLAG_FIN))) {
-        conn->send_seq += data_len;
-        if (flags & (TCP_FLAG_SYN | TCP_FLAG_FIN)) {
-            conn->send_seq++;
+    seg->seq = seq;
+    seg->flags = flags;
+    seg->data = data;
+    seg->data_len = data ? data_len : 0;
+    seg->sent_tick = timer_get_ticks();
+    seg->retransmitted = 0;
+    seg->sacked = 0;
+    seg->next = NULL;
+    
+    uint32_t irq_flags = irq_save();
+    if (conn->retransmit_tail) {
+        conn->retransmit_tail->next = seg;
+    } else {
+        conn->retransmit_head = seg;
+        conn->rto_deadline = seg->sent_tick + conn->rto;
+    }
+    conn->retransmit_tail = seg;
+    irq_restore(irq_flags);
+    return 1;
+}
+
+// Send a segment whose kmalloc'd payload is handed over to the
+// retransmission queue, avoiding a second copy of the data. The segment
+// is queued first: over loopback its ACK can be processed before
+// tcp_transmit returns.
+static void tcp_send_owned(tcp_connection_t* conn, uint8_t flags, uint8_t* data, size_t data_len) {
+    uint32_t seq = conn->send_seq;
+    
+    conn->send_seq += tcp_segment_length(flags, data_len);
+    int queued = tcp_queue_segment(conn, seq, flags, data, data_len);
+    tcp_transmit(conn, seq, flags, data, data_len);
+    if (!queued && data) {
+        kfree(data);
+    }
+}
+
+void tcp_send_packet(tcp_connection_t* conn, uint8_t flags, uint8_t* data, size_t data_len) {
+    uint32_t seq = conn->send_seq;
+    uint32_t seg_len = tcp_segment_length(flags, data_len);
+    
+    // Only segments that consume sequence space are ever acknowledged
+    if (seg_len > 0 && !(flags & TCP_FLAG_RST)) {
+        uint8_t* copy = NULL;
+        if (data && data_len > 0) {
+            copy = (uint8_t*)kmalloc(data_len);
+            if (!copy) return;
+            for (size_t i = 0; i < data_len; i++) {
+                copy[i] = data[i];
+            }
         }
+        tcp_send_owned(conn, flags, copy, data_len);
+        return;
     }
     
-    kfree(packet);
+    tcp_transmit(conn, seq, flags, data, data_len);
+}
+
+// Feed one RTT measurement into the Jacobson/Karels estimator (RFC 6298)
+static void tcp_update_rtt(tcp_connection_t* conn, uint32_t rtt) {
+    if (rtt == 0) rtt = 1;
+    
+    if (conn->srtt == 0) {
+        // First measurement
+        conn->srtt = rtt << 3;
+        conn->rttvar = rtt << 1;
+    } else {
+        int32_t delta = (int32_t)rtt - (int32_t)(conn->srtt >> 3);
+        conn->srtt += delta;                // srtt = 7/8 srtt + 1/8 rtt
+        if (delta < 0) delta = -delta;
+        delta -= (int32_t)(conn->rttvar >> 2);
+        conn->rttvar += delta;              // rttvar = 3/4 rttvar + 1/4 |err|
+    }
+    
+    uint32_t rto = (conn->srtt >> 3) + conn->rttvar;
+    if (rto < TCP_RTO_MIN) rto = TCP_RTO_MIN;
+    if (rto > TCP_RTO_MAX) rto = TCP_RTO_MAX;
+    conn->rto = rto;
+}
+
+// Parsed TCP options of an incoming segment
+typedef struct {
+    uint16_t mss;
+    int wscale;              // -1 when absent
+    int sack_permitted;
+    int sack_count;
+    uint32_t sack_left[TCP_MAX_SACK_BLOCKS];
+    uint32_t sack_right[TCP_MAX_SACK_BLOCKS];
+} tcp_options_t;
+
+static void tcp_parse_options(tcp_header_t* tcp_hdr, tcp_options_t* opts) {
+    opts->mss = 0;
+    opts->wscale = -1;
+    opts->sack_permitted = 0;
+    opts->sack_count = 0;
+    
+    uint8_t* p = (uint8_t*)tcp_hdr + sizeof(tcp_header_t);
+    size_t len = ((tcp_hdr->data_offset >> 4) * 4) - sizeof(tcp_header_t);
+    size_t i = 0;
+    
+    while (i < len) {
+        uint8_t kind = p[i];
+        if (kind == TCP_OPT_END) break;
+        if (kind == TCP_OPT_NOP) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= len) break;
+        uint8_t opt_len = p[i + 1];
+        if (opt_len < 2 || i + opt_len > len) break;
+        
+        switch (kind) {
+            case TCP_OPT_MSS:
+                if (opt_len == 4) {
+                    opts->mss = (p[i + 2] << 8) | p[i + 3];
+                }
+                break;
+            case TCP_OPT_WSCALE:
+                if (opt_len == 3) {
+                    opts->wscale = p[i + 2] > TCP_MAX_WSCALE ? TCP_MAX_WSCALE : p[i + 2];
+                }
+                break;
+            case TCP_OPT_SACK_PERMITTED:
+                opts->sack_permitted = 1;
+                break;
+            case TCP_OPT_SACK:
+                for (size_t b = i + 2; b + 8 <= (size_t)(i + opt_len) &&
+                     opts->sack_count < TCP_MAX_SACK_BLOCKS; b += 8) {
+                    opts->sack_left[opts->sack_count] =
+                        ((uint32_t)p[b] << 24) | (p[b + 1] << 16) | (p[b + 2] << 8) | p[b + 3];
+                    opts->sack_right[opts->sack_count] =
+                        ((uint32_t)p[b + 4] << 24) | (p[b + 5] << 16) | (p[b + 6] << 8) | p[b + 7];
+                    opts->sack_count++;
+                }
+                break;
+        }
+        i += opt_len;
+    }
+}
+
+// Apply the options of a SYN or SYN-ACK to the connection
+static void tcp_negotiate_options(tcp_connection_t* conn, tcp_header_t* tcp_hdr, tcp_options_t* opts) {
+    uint16_t mss = opts->mss ? opts->mss : TCP_DEFAULT_MSS;
+    conn->send_mss = mss < TCP_LOCAL_MSS ? mss : TCP_LOCAL_MSS;
+    
+    // Window scaling is only in effect if both sides sent the option
+    if (opts->wscale >= 0) {
+        conn->send_wscale = opts->wscale;
+        conn->recv_wscale = TCP_LOCAL_WSCALE;
+    } else {
+        conn->send_wscale = 0;
+        conn->recv_wscale = 0;
+    }
+    
+    // On a passive open the SYN-ACK echoes whatever the peer offered
+    conn->sack_permitted = opts->sack_permitted;
+    conn->send_window = ntohs(tcp_hdr->window);
+    
+    // Initial window (RFC 3390)
+    uint32_t iw = 4 * conn->send_mss;
+    if (iw > 4380) iw = 4380;
+    if (iw < 2 * (uint32_t)conn->send_mss) iw = 2 * conn->send_mss;
+    conn->cwnd = iw;
+}
+
+static uint32_t tcp_flight_size(tcp_connection_t* conn) {
+    return conn->send_seq - conn->send_una;
+}
+
+// Halve the window on loss, but never below two segments
+static void tcp_reduce_ssthresh(tcp_connection_t* conn) {
+    uint32_t half = tcp_flight_size(conn) / 2;
+    uint32_t floor = 2 * conn->send_mss;
+    conn->ssthresh = half > floor ? half : floor;
+}
+
+// First segment the peer has not selectively acknowledged
+static tcp_segment_t* tcp_first_unsacked(tcp_connection_t* conn) {
+    tcp_segment_t* seg = conn->retransmit_head;
+    while (seg && seg->sacked) {
+        seg = seg->next;
+    }
+    return seg ? seg : conn->retransmit_head;
+}
+
+static void tcp_retransmit_segment(tcp_connection_t* conn, tcp_segment_t* seg) {
+    seg->retransmitted = 1;
+    tcp_transmit(conn, seg->seq, seg->flags, seg->data, seg->data_len);
+}
+
+static void tcp_mark_sacked(tcp_connection_t* conn, tcp_options_t* opts) {
+    for (int i = 0; i < opts->sack_count; i++) {
+        for (tcp_segment_t* seg = conn->retransmit_head; seg; seg = seg->next) {
+            uint32_t end = seg->seq + tcp_segment_length(seg->flags, seg->data_len);
+            if (TCP_SEQ_GEQ(seg->seq, opts->sack_left[i]) &&
+                TCP_SEQ_LEQ(end, opts->sack_right[i])) {
+                seg->sacked = 1;
+            }
+        }
+    }
+}
+
+// Drop acknowledged segments from the retransmission queue and run
+// NewReno congestion control on the result
+static void tcp_process_ack(tcp_connection_t* conn, uint32_t ack, int may_be_duplicate, tcp_options_t* opts) {
+    if (TCP_SEQ_GT(ack, conn->send_seq)) {
+        return; // Acknowledges data we never sent
+    }
+    
+    uint32_t irq_flags = irq_save();
+    
+    if (conn->sack_permitted && opts->sack_count > 0) {
+        tcp_mark_sacked(conn, opts);
+    }
+    
+    if (!TCP_SEQ_GT(ack, conn->send_una)) {
+        // Duplicate ACK: three in a row trigger fast retransmit
+        if (may_be_duplicate && ack == conn->send_una && conn->retransmit_head) {
+            conn->dup_acks++;
+            if (conn->dup_acks == 3 && !conn->in_recovery) {
+                tcp_reduce_ssthresh(conn);
+                conn->recover = conn->send_seq;
+                conn->in_recovery = 1;
+                tcp_retransmit_segment(conn, tcp_first_unsacked(conn));
+                conn->cwnd = conn->ssthresh + 3 * conn->send_mss;
+            } else if (conn->in_recovery) {
+                // Each further duplicate means a segment left the network
+                conn->cwnd += conn->send_mss;
+            }
+        }
+        irq_restore(irq_flags);
+        return;
+    }
+    
+    uint32_t now = timer_get_ticks();
+    uint32_t acked = ack - conn->send_una;
+    
+    tcp_segment_t* seg = conn->retransmit_head;
+    while (seg && TCP_SEQ_LEQ(seg->seq + tcp_segment_length(seg->flags, seg->data_len), ack)) {
+        if (!seg->retransmitted) {
+            tcp_update_rtt(conn, now - seg->sent_tick);
+        }
+        tcp_segment_t* next = seg->next;
+        tcp_free_segment(seg);
+        seg = next;
+    }
+    
+    conn->retransmit_head = seg;
+    if (!seg) {
+        conn->retransmit_tail = NULL;
+    }
+    
+    conn->send_una = ack;
+    conn->retries = 0;
+    conn->dup_acks = 0;
+    
+    if (conn->in_recovery) {
+        if (TCP_SEQ_GEQ(ack, conn->recover)) {
+            // Full ACK: leave fast recovery with a deflated window
+            conn->in_recovery = 0;
+            conn->cwnd = conn->ssthresh;
+        } else {
+            // Partial ACK: the next hole is lost too, resend it right away
+            if (seg) {
+                tcp_retransmit_segment(conn, tcp_first_unsacked(conn));
+            }
+            conn->cwnd = conn->cwnd > acked ? conn->cwnd - acked : 0;
+            conn->cwnd += conn->send_mss;
+        }
+    } else if (conn->cwnd < conn->ssthresh) {
+        // Slow start
+        conn->cwnd += acked < conn->send_mss ? acked : conn->send_mss;
+    } else {
+        // Congestion avoidance: about one segment per RTT
+        uint32_t inc = (conn->send_mss * conn->send_mss) / conn->cwnd;
+        conn->cwnd += inc ? inc : 1;
+    }
+    
+    // Forward progress: restart the timer for the next outstanding segment
+    if (seg) {
+        conn->rto_deadline = now + conn->rto;
+    }
+    
+    irq_restore(irq_flags);
+}
+
+// Grow the receive buffer when the peer fills more than half of it within
+// one round trip, so the advertised window keeps up with the link
+static void tcp_autotune_receive(tcp_connection_t* conn, size_t bytes) {
+    uint32_t now = timer_get_ticks();
+    uint32_t rtt = conn->srtt ? (conn->srtt >> 3) : TCP_RTO_MIN;
+    
+    conn->recv_rtt_bytes += bytes;
+    if ((int32_t)(now - conn->recv_rtt_start) < (int32_t)rtt) {
+        return;
+    }
+    
+    if (conn->recv_rtt_bytes * 2 >= conn->recv_ring.size &&
+        conn->recv_ring.size < TCP_MAX_BUFFER_SIZE) {
+        ring_resize(&conn->recv_ring, conn->recv_ring.size * 2);
+    }
+    
+    conn->recv_rtt_start = now;
+    conn->recv_rtt_bytes = 0;
+}
+
+// Wake everyone sleeping on the connection and notify epoll watchers.
+// Called whenever data, buffer space or the state changes.
+static void tcp_wake_all(tcp_connection_t* conn) {
+    wake_up(&conn->recv_wait);
+    wake_up(&conn->send_wait);
+    poll_notify(conn->poll);
+}
+
+// Send as much buffered data as the congestion and receive windows allow
+void tcp_output(tcp_connection_t* conn) {
+    if (conn->state != TCP_ESTABLISHED && conn->state != TCP_CLOSE_WAIT) {
+        return;
+    }
+    
+    uint32_t irq_flags = irq_save();
+    size_t drained = 0;
+    
+    while (ring_used(&conn->send_ring) > 0) {
+        uint32_t window = conn->cwnd < conn->send_window ? conn->cwnd : conn->send_window;
+        uint32_t flight = tcp_flight_size(conn);
+        if (flight >= window) {
+            break;
+        }
+        
+        size_t unsent = ring_used(&conn->send_ring);
+        size_t chunk = unsent;
+        if (chunk > conn->send_mss) chunk = conn->send_mss;
+        if (chunk > window - flight) chunk = window - flight;
+        
+        // Nagle: hold back a small segment while data is in flight so
+        // small writes coalesce. Window-limited runts are never sent early
+        // (SWS avoidance), even with TCP_NODELAY.
+        if (chunk < conn->send_mss && flight > 0 &&
+            (!conn->nodelay || chunk < unsent)) {
+            break;
+        }
+        
+        // Corked: the tail waits for the writer to finish the message
+        if (conn->cork && chunk == unsent && chunk < conn->send_mss) {
+            break;
+        }
+        
+        // Move the chunk straight from the ring into the segment
+        uint8_t* payload = (uint8_t*)kmalloc(chunk);
+        if (!payload) break;
+        ring_read(&conn->send_ring, payload, chunk);
+        tcp_send_owned(conn, TCP_FLAG_ACK | TCP_FLAG_PSH, payload, chunk);
+        drained += chunk;
+    }
+    
+    if (drained > 0) {
+        tcp_wake_all(conn);
+    }
+    
+    // Deferred close: the FIN follows the last byte of queued data
+    if (conn->close_pending && ring_used(&conn->send_ring) == 0) {
+        conn->close_pending = 0;
+        conn->state = conn->state == TCP_ESTABLISHED ? TCP_FIN_WAIT_1 : TCP_LAST_ACK;
+        tcp_send_fin(conn);
+    }
+    
+    // Peer closed its window with nothing in flight: probe it from the
+    // timer. Data held back by cork or Nagle is not probed; a window
+    // update or uncork runs this again and disarms the probe.
+    if (conn->send_window == 0 && ring_used(&conn->send_ring) > 0 && !conn->retransmit_head) {
+        if (!conn->persist_pending) {
+            conn->persist_pending = 1;
+            conn->rto_deadline = timer_get_ticks() + conn->rto;
+        }
+    } else {
+        conn->persist_pending = 0;
+    }
+    
+    irq_restore(irq_flags);
+}
+
+// Append data to the send ring, growing it towards two congestion windows
+// so a fast link is never starved. Returns bytes accepted.
+// Make room for len more bytes where the window can use it. Called with
+// interrupts disabled.
+static void tcp_grow_send_ring(tcp_connection_t* conn, size_t len) {
+    ring_buffer_t* ring = &conn->send_ring;
+    size_t wanted = ring_used(ring) + len;
+    
+    if (wanted > ring->size && ring->size < TCP_MAX_BUFFER_SIZE) {
+        size_t target = ring->size;
+        while (target < wanted && target < TCP_MAX_BUFFER_SIZE &&
+               target < 2 * conn->cwnd + conn->send_mss) {
+            target *= 2;
+        }
+        if (target > ring->size) {
+            ring_resize(ring, target);
+        }
+    }
+}
+
+static size_t tcp_buffer_send_data(tcp_connection_t* conn, const uint8_t* data, size_t len) {
+    uint32_t irq_flags = irq_save();
+    tcp_grow_send_ring(conn, len);
+    size_t accepted = ring_write(&conn->send_ring, data, len);
+    irq_restore(irq_flags);
+    return accepted;
+}
+
+// Acknowledge an in-order data segment: every second one at once, the
+// rest from the delayed ACK timer unless outgoing data carries it first
+static void tcp_schedule_ack(tcp_connection_t* conn) {
+    if (conn->ack_pending == 0) {
+        conn->delack_deadline = timer_get_ticks() + TCP_DELACK_TIMEOUT;
+    }
+    conn->ack_pending++;
+    
+    if (conn->ack_pending >= TCP_DELACK_SEGMENTS) {
+        tcp_send_ack(conn);
+    }
+}
+
+// Handshake of a passively opened connection completed: hand it to the
+// listener's accept queue
+static void tcp_enqueue_accept(tcp_connection_t* conn) {
+    tcp_connection_t* listener = conn->listener;
+    
+    conn->accept_next = NULL;
+    if (listener->accept_tail) {
+        listener->accept_tail->accept_next = conn;
+    } else {
+        listener->accept_head = conn;
+    }
+    listener->accept_tail = conn;
+    listener->accept_count++;
+    
+    tcp_wake_all(listener);
+}
+
+static void tcp_enter_time_wait(tcp_connection_t* conn) {
+    conn->state = TCP_TIME_WAIT;
+    conn->time_wait_deadline = timer_get_ticks() + 2 * TCP_MSL;
 }
 
 void tcp_send_syn(tcp_connection_t* conn) {
@@ -260,10 +810,73 @@ void tcp_send_rst(tcp_connection_t* conn) {
     tcp_send_packet(conn, TCP_FLAG_RST, NULL, 0);
 }
 
+// Take an in-order segment's payload, and its FIN, into the receive
+// ring. Returns 1 if the FIN was accepted, 0 if there was none, and -1
+// if the segment was out of order or did not fit and was re-ACKed.
+static int tcp_receive_segment(tcp_connection_t* conn, uint32_t seq, uint8_t flags,
+                               uint8_t* data, size_t data_len) {
+    if (data_len == 0 && !(flags & TCP_FLAG_FIN)) {
+        return 0;
+    }
+    
+    // Out-of-order or duplicate segment: re-ACK what we expect
+    if (seq != conn->send_ack) {
+        tcp_send_ack(conn);
+        return -1;
+    }
+    
+    if (data_len > 0 && data_len <= ring_space(&conn->recv_ring)) {
+        ring_write(&conn->recv_ring, data, data_len);
+        
+        // Update acknowledgment
+        conn->send_ack = seq + data_len;
+        tcp_autotune_receive(conn, data_len);
+        tcp_schedule_ack(conn);
+        tcp_wake_all(conn);
+    } else if (data_len > 0) {
+        // No room: tell the peer about the window we do have.
+        // A FIN on this segment comes back with the retransmit.
+        tcp_send_ack(conn);
+        return -1;
+    }
+    
+    // The FIN follows the payload
+    if (flags & TCP_FLAG_FIN) {
+        conn->send_ack = seq + data_len + 1;
+        tcp_send_ack(conn);
+        return 1;
+    }
+    return 0;
+}
+
 void tcp_state_machine(tcp_connection_t* conn, tcp_header_t* tcp_hdr, uint8_t* data, size_t data_len) {
     uint8_t flags = tcp_hdr->flags;
     uint32_t seq = ntohl(tcp_hdr->seq_num);
     uint32_t ack = ntohl(tcp_hdr->ack_num);
+    tcp_state_t old_state = conn->state;
+    int result;
+    
+    tcp_options_t opts;
+    tcp_parse_options(tcp_hdr, &opts);
+    
+    if ((flags & TCP_FLAG_SYN) && (conn->state == TCP_SYN_SENT ||
+                                   conn->state == TCP_LISTEN ||
+                                   conn->state == TCP_CLOSED)) {
+        tcp_negotiate_options(conn, tcp_hdr, &opts);
+    }
+    
+    if ((flags & TCP_FLAG_ACK) && conn->state != TCP_LISTEN && conn->state != TCP_CLOSED) {
+        // Peer's receive window; never scaled on a SYN
+        uint32_t window = ntohs(tcp_hdr->window);
+        if (!(flags & TCP_FLAG_SYN)) {
+            window <<= conn->send_wscale;
+        }
+        int may_be_duplicate = data_len == 0 && !(flags & (TCP_FLAG_SYN | TCP_FLAG_FIN)) &&
+                               window == conn->send_window;
+        conn->send_window = window;
+        
+        tcp_process_ack(conn, ack, may_be_duplicate, &opts);
+    }
     
     switch (conn->state) {
         case TCP_CLOSED:
@@ -298,69 +911,95 @@ void tcp_state_machine(tcp_connection_t* conn, tcp_header_t* tcp_hdr, uint8_t* d
         case TCP_SYN_RECEIVED:
             if (flags & TCP_FLAG_ACK) {
                 conn->state = TCP_ESTABLISHED;
-                terminal_writestring("TCP connection established!\n");
+                if (conn->listener) {
+                    tcp_enqueue_accept(conn);
+                } else {
+                    terminal_writestring("TCP connection established!\n");
+                }
             }
             break;
             
         case TCP_ESTABLISHED:
+            // Close request: our own FIN waits for tcp_close and for the
+            // send ring to drain
+            result = tcp_receive_segment(conn, seq, flags, data, data_len);
+            if (result < 0) {
+                break;
+            }
+            if (result > 0) {
+                conn->state = TCP_CLOSE_WAIT;
+            }
+            
+            // The ACK may have opened the window for more buffered data,
+            // which also piggybacks any pending ACK
+            tcp_output(conn);
+            break;
+            
+        case TCP_CLOSE_WAIT:
+            // Our ACK of the peer's FIN was lost
             if (flags & TCP_FLAG_FIN) {
-                // Close request
-                conn->send_ack = seq + 1;
                 tcp_send_ack(conn);
-                conn->state = TCP_CLOSE_WAIT;
-                
-                // Send our FIN
-                tcp_send_fin(conn);
-                conn->state = TCP_LAST_ACK;
-            } else if (data_len > 0) {
-                // Data received
-                if (conn->recv_buffer_used + data_len <= conn->recv_buffer_size) {
-                    // Copy data to receive buffer
-                    for (size_t i = 0; i < data_len; i++) {
-                        conn->recv_buffer[conn->recv_buffer_used + i] = data[i];
-                    }
-                    conn->recv_buffer_used += data_len;
-                    
-                    // Update acknowledgment
-                    conn->send_ack = seq + data_len;
-                    tcp_send_ack(conn);
-                }
             }
+            
+            // Keep draining; tcp_output sends our FIN once closed and empty
+            tcp_output(conn);
             break;
             
         case TCP_FIN_WAIT_1:
-            if ((flags & (TCP_FLAG_FIN | TCP_FLAG_ACK)) == (TCP_FLAG_FIN | TCP_FLAG_ACK)) {
-                conn->send_ack = seq + 1;
-                tcp_send_ack(conn);
-                conn->state = TCP_TIME_WAIT;
-            } else if (flags & TCP_FLAG_ACK) {
+            // The peer may keep sending until its own FIN. Ours is acked
+            // once nothing is left to retransmit; a FIN before that is a
+            // simultaneous close.
+            result = tcp_receive_segment(conn, seq, flags, data, data_len);
+            if (result > 0) {
+                if ((flags & TCP_FLAG_ACK) && !conn->retransmit_head) {
+                    tcp_enter_time_wait(conn);
+                } else {
+                    conn->state = TCP_CLOSING;
+                }
+            } else if ((flags & TCP_FLAG_ACK) && !conn->retransmit_head) {
                 conn->state = TCP_FIN_WAIT_2;
             }
             break;
             
         case TCP_FIN_WAIT_2:
+            if (tcp_receive_segment(conn, seq, flags, data, data_len) > 0) {
+                tcp_enter_time_wait(conn);
+            }
+            break;
+            
+        case TCP_CLOSING:
             if (flags & TCP_FLAG_FIN) {
-                conn->send_ack = seq + 1;
+                // Our ACK of the peer's FIN was lost
                 tcp_send_ack(conn);
-                conn->state = TCP_TIME_WAIT;
+            }
+            if ((flags & TCP_FLAG_ACK) && !conn->retransmit_head) {
+                tcp_enter_time_wait(conn);
             }
             break;
             
         case TCP_LAST_ACK:
-            if (flags & TCP_FLAG_ACK) {
+            if ((flags & TCP_FLAG_ACK) && !conn->retransmit_head) {
                 conn->state = TCP_CLOSED;
                 terminal_writestring("TCP connection closed\n");
             }
             break;
             
         case TCP_TIME_WAIT:
-            // Wait for 2MSL timeout
-            conn->state = TCP_CLOSED;
+            // Our last ACK was lost and the peer resent its FIN
+            if (flags & TCP_FLAG_FIN) {
+                tcp_send_ack(conn);
+                tcp_enter_time_wait(conn);
+            }
             break;
             
         default:
             break;
     }
+    
+    // Let sleepers in connect/send/recv see the new state (EOF, reset, ...)
+    if (conn->state != old_state) {
+        tcp_wake_all(conn);
+    }
 }
 
 void tcp_handle_packet(uint8_t* packet, size_t len, uint32_t src_ip, uint32_t dst_ip) {
@@ -377,9 +1016,10 @@ void tcp_handle_packet(uint8_t* packet, size_t len, uint32_t src_ip, uint32_t ds
     size_t data_len = len - header_len;
     uint8_t* data = packet + header_len;
     
-    // Verify checksum
+    // Verify checksum (options are summed along with the payload)
     uint16_t received_checksum = tcp_hdr->checksum;
-    uint16_t calculated_checksum = tcp_checksum(tcp_hdr, data, data_len, src_ip, dst_ip);
+    uint16_t calculated_checksum = tcp_checksum(tcp_hdr, packet + sizeof(tcp_header_t),
+                                                len - sizeof(tcp_header_t), src_ip, dst_ip);
     
     if (received_checksum != calculated_checksum) {
         terminal_writestring("TCP checksum error\n");
@@ -391,13 +1031,16 @@ void tcp_handle_packet(uint8_t* packet, size_t len, uint32_t src_ip, uint32_t ds
     
     if (!conn) {
         // Check for listening socket
-        for (int i = 0; i < 64; i++) {
+        for (int i = 0; i < TCP_MAX_SOCKETS; i++) {
             if (tcp_sockets[i].is_listening && 
                 tcp_sockets[i].connection &&
                 tcp_sockets[i].connection->local_port == dst_port) {
+                tcp_connection_t* listener = tcp_sockets[i].connection;
                 
-                // Create new connection for incoming SYN
-                if (tcp_hdr->flags & TCP_FLAG_SYN) {
+                // Create new connection for incoming SYN, unless the
+                // accept queue is already full
+                if ((tcp_hdr->flags & TCP_FLAG_SYN) &&
+                    listener->accept_count < listener->accept_backlog) {
                     conn = tcp_create_connection();
                     if (conn) {
                         conn->local_ip = dst_ip;
@@ -405,6 +1048,8 @@ void tcp_handle_packet(uint8_t* packet, size_t len, uint32_t src_ip, uint32_t ds
                         conn->remote_ip = src_ip;
                         conn->remote_port = src_port;
                         conn->state = TCP_LISTEN;
+                        conn->listener = listener;
+                        conn->nodelay = tcp_sockets[i].nodelay;
                     }
                 }
                 break;
@@ -422,11 +1067,13 @@ void tcp_handle_packet(uint8_t* packet, size_t len, uint32_t src_ip, uint32_t ds
 
 // Socket API implementation
 int tcp_socket(void) {
-    for (int i = 0; i < 64; i++) {
+    for (int i = 0; i < TCP_MAX_SOCKETS; i++) {
         if (tcp_sockets[i].socket_id == -1) {
             tcp_sockets[i].socket_id = i;
             tcp_sockets[i].connection = NULL;
             tcp_sockets[i].is_listening = 0;
+            tcp_sockets[i].nonblocking = 0;
+            tcp_sockets[i].nodelay = 0;
             return i;
         }
     }
@@ -434,7 +1081,7 @@ int tcp_socket(void) {
 }
 
 int tcp_bind(int socket, uint16_t port) {
-    if (socket < 0 || socket >= 64 || tcp_sockets[socket].socket_id == -1) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || tcp_sockets[socket].socket_id == -1) {
         return -1;
     }
     
@@ -446,27 +1093,72 @@ int tcp_bind(int socket, uint16_t port) {
     if (!conn) return -1;
     
     conn->local_port = port;
+    conn->nodelay = tcp_sockets[socket].nodelay;
     conn->local_ip = get_local_ip();
+    conn->poll = &tcp_sockets[socket].poll;
     tcp_sockets[socket].connection = conn;
     
     return 0;
 }
 
 int tcp_listen(int socket, int backlog) {
-    (void)backlog; // Not implemented yet
-    
-    if (socket < 0 || socket >= 64 || !tcp_sockets[socket].connection) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || !tcp_sockets[socket].connection) {
         return -1;
     }
     
+    tcp_connection_t* conn = tcp_sockets[socket].connection;
     tcp_sockets[socket].is_listening = 1;
-    tcp_sockets[socket].connection->state = TCP_LISTEN;
+    conn->state = TCP_LISTEN;
+    conn->accept_backlog = backlog > 0 ? backlog : TCP_DEFAULT_BACKLOG;
     
     return 0;
 }
 
+// Take the oldest established connection off a listening socket and give
+// it a socket of its own. Returns the new socket, or -EAGAIN if the
+// listener is non-blocking and nothing is pending.
+int tcp_accept(int socket, uint32_t* remote_ip, uint16_t* remote_port) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || !tcp_sockets[socket].is_listening) {
+        return -1;
+    }
+    
+    tcp_connection_t* listener = tcp_sockets[socket].connection;
+    uint32_t irq_flags = irq_save();
+    
+    while (!listener->accept_head) {
+        if (tcp_sockets[socket].nonblocking) {
+            irq_restore(irq_flags);
+            return -EAGAIN;
+        }
+        wait_queue_sleep(&listener->recv_wait);
+    }
+    
+    int child_socket = tcp_socket();
+    if (child_socket < 0) {
+        irq_restore(irq_flags);
+        return -ENOMEM;
+    }
+    
+    tcp_connection_t* conn = listener->accept_head;
+    listener->accept_head = conn->accept_next;
+    if (!listener->accept_head) listener->accept_tail = NULL;
+    listener->accept_count--;
+    conn->accept_next = NULL;
+    conn->listener = NULL;
+    
+    tcp_sockets[child_socket].connection = conn;
+    tcp_sockets[child_socket].nodelay = conn->nodelay;
+    conn->poll = &tcp_sockets[child_socket].poll;
+    
+    irq_restore(irq_flags);
+    
+    if (remote_ip) *remote_ip = conn->remote_ip;
+    if (remote_port) *remote_port = conn->remote_port;
+    return child_socket;
+}
+
 int tcp_connect(int socket, uint32_t remote_ip, uint16_t remote_port) {
-    if (socket < 0 || socket >= 64 || tcp_sockets[socket].socket_id == -1) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || tcp_sockets[socket].socket_id == -1) {
         return -1;
     }
     
@@ -476,95 +1168,391 @@ int tcp_connect(int socket, uint32_t remote_ip, uint16_t remote_port) {
         if (!conn) return -1;
         
         conn->local_port = tcp_allocate_port();
-        conn->local_ip = get_local_ip();
+        conn->nodelay = tcp_sockets[socket].nodelay;
+        conn->poll = &tcp_sockets[socket].poll;
         tcp_sockets[socket].connection = conn;
     }
     
     conn->remote_ip = remote_ip;
     conn->remote_port = remote_port;
+    conn->local_ip = ip_source_address(remote_ip);
     
     // Send SYN
     tcp_send_syn(conn);
     
-    // Wait for connection (simplified - should be async)
-    int timeout = 30; // 3 seconds
-    while (conn->state != TCP_ESTABLISHED && timeout > 0) {
-        // In real implementation, would yield to scheduler
-        for (volatile int i = 0; i < 1000000; i++);
-        timeout--;
+    // Wait for the handshake; the SYN is retransmitted by the timer
+    uint32_t deadline = timer_get_ticks() + TCP_CONNECT_TIMEOUT;
+    uint32_t irq_flags = irq_save();
+    while (conn->state == TCP_SYN_SENT) {
+        int32_t remaining = (int32_t)(deadline - timer_get_ticks());
+        if (remaining <= 0) break;
+        wait_queue_sleep_timeout(&conn->recv_wait, (uint32_t)remaining);
     }
+    irq_restore(irq_flags);
     
     return (conn->state == TCP_ESTABLISHED) ? 0 : -1;
 }
 
+int tcp_set_nonblocking(int socket, int nonblocking) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || tcp_sockets[socket].socket_id == -1) {
+        return -1;
+    }
+    
+    tcp_sockets[socket].nonblocking = nonblocking ? 1 : 0;
+    return 0;
+}
+
+int tcp_setsockopt(int socket, int option, int value) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || tcp_sockets[socket].socket_id == -1) {
+        return -1;
+    }
+    
+    switch (option) {
+        case TCP_NODELAY:
+            tcp_sockets[socket].nodelay = value ? 1 : 0;
+            if (tcp_sockets[socket].connection) {
+                tcp_sockets[socket].connection->nodelay = tcp_sockets[socket].nodelay;
+                // Flush anything Nagle was holding back
+                tcp_output(tcp_sockets[socket].connection);
+            }
+            return 0;
+        case TCP_CORK:
+            if (!tcp_sockets[socket].connection) {
+                return -ENOTCONN;
+            }
+            tcp_sockets[socket].connection->cork = value ? 1 : 0;
+            if (!value) {
+                tcp_output(tcp_sockets[socket].connection);
+            }
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
+
+// Returns bytes queued, or -EAGAIN if the socket is non-blocking and the
+// send ring is full. Blocking sockets sleep until all of data is queued.
 int tcp_send(int socket, const void* data, size_t len) {
-    if (socket < 0 || socket >= 64 || !tcp_sockets[socket].connection) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || !tcp_sockets[socket].connection) {
         return -1;
     }
     
     tcp_connection_t* conn = tcp_sockets[socket].connection;
-    if (conn->state != TCP_ESTABLISHED) {
-        return -1;
+    if (conn->state != TCP_ESTABLISHED && conn->state != TCP_CLOSE_WAIT) {
+        return -ENOTCONN;
     }
     
-    // Send data in chunks if needed
+    // Queue into the send ring; the window decides what goes out now
     size_t sent = 0;
     while (sent < len) {
-        size_t chunk = (len - sent > 1460) ? 1460 : (len - sent); // MSS
-        tcp_send_packet(conn, TCP_FLAG_ACK | TCP_FLAG_PSH, 
-                       (uint8_t*)data + sent, chunk);
-        sent += chunk;
+        size_t queued = tcp_buffer_send_data(conn, (const uint8_t*)data + sent, len - sent);
+        sent += queued;
+        tcp_output(conn);
+        
+        if (sent == len) break;
+        
+        if (tcp_sockets[socket].nonblocking) {
+            return sent > 0 ? (int)sent : -EAGAIN;
+        }
+        
+        // Ring full: sleep until ACKs let tcp_output drain it
+        uint32_t irq_flags = irq_save();
+        while (ring_space(&conn->send_ring) == 0 &&
+               (conn->state == TCP_ESTABLISHED || conn->state == TCP_CLOSE_WAIT)) {
+            wait_queue_sleep(&conn->send_wait);
+        }
+        irq_restore(irq_flags);
+        
+        if (conn->state != TCP_ESTABLISHED && conn->state != TCP_CLOSE_WAIT) {
+            return sent > 0 ? (int)sent : -ECONNRESET;
+        }
     }
     
     return sent;
 }
 
+// Queue up to len bytes that fill() writes straight into the send ring,
+// e.g. from a file, with no buffer in between. Never sleeps: returns the
+// bytes queued, -EAGAIN if the ring is full, or fill()'s error.
+int tcp_send_fill(int socket, tcp_fill_t fill, void* context, size_t len) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || !tcp_sockets[socket].connection || !fill) {
+        return -1;
+    }
+    
+    tcp_connection_t* conn = tcp_sockets[socket].connection;
+    if (conn->state != TCP_ESTABLISHED && conn->state != TCP_CLOSE_WAIT) {
+        return -ENOTCONN;
+    }
+    
+    ring_buffer_t* ring = &conn->send_ring;
+    size_t queued = 0;
+    while (queued < len) {
+        // Only the writer moves the tail or resizes the ring, so its free
+        // space can be filled with interrupts enabled
+        uint32_t irq_flags = irq_save();
+        tcp_grow_send_ring(conn, len - queued);
+        size_t pos = ring->tail & (ring->size - 1);
+        size_t chunk = ring->size - pos;
+        if (chunk > ring_space(ring)) chunk = ring_space(ring);
+        if (chunk > len - queued) chunk = len - queued;
+        uint8_t* dest = ring->data + pos;
+        irq_restore(irq_flags);
+        if (chunk == 0) break;
+        
+        int filled = fill(context, dest, chunk);
+        if (filled <= 0) {
+            if (queued == 0) return filled;
+            break;
+        }
+        
+        irq_flags = irq_save();
+        ring->tail += filled;
+        irq_restore(irq_flags);
+        queued += filled;
+        if ((size_t)filled < chunk) break;
+    }
+    
+    if (queued == 0) return -EAGAIN;
+    tcp_output(conn);
+    return (int)queued;
+}
+
+// Can more data still arrive on this connection?
+static int tcp_may_receive(tcp_connection_t* conn) {
+    return conn->state == TCP_SYN_SENT || conn->state == TCP_SYN_RECEIVED ||
+           conn->state == TCP_ESTABLISHED || conn->state == TCP_FIN_WAIT_1 ||
+           conn->state == TCP_FIN_WAIT_2;
+}
+
+// Returns bytes read, 0 at end of stream, or -EAGAIN if the socket is
+// non-blocking and nothing is buffered
 int tcp_recv(int socket, void* buffer, size_t len) {
-    if (socket < 0 || socket >= 64 || !tcp_sockets[socket].connection) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || !tcp_sockets[socket].connection) {
         return -1;
     }
     
     tcp_connection_t* conn = tcp_sockets[socket].connection;
+    if (len == 0) return 0;
     
-    // Copy data from receive buffer
-    size_t to_copy = (len < conn->recv_buffer_used) ? len : conn->recv_buffer_used;
+    uint32_t irq_flags = irq_save();
     
-    for (size_t i = 0; i < to_copy; i++) {
-        ((uint8_t*)buffer)[i] = conn->recv_buffer[i];
+    while (ring_used(&conn->recv_ring) == 0 && tcp_may_receive(conn)) {
+        if (tcp_sockets[socket].nonblocking) {
+            irq_restore(irq_flags);
+            return -EAGAIN;
+        }
+        wait_queue_sleep(&conn->recv_wait);
     }
     
-    // Shift remaining data
-    for (size_t i = 0; i < conn->recv_buffer_used - to_copy; i++) {
-        conn->recv_buffer[i] = conn->recv_buffer[i + to_copy];
+    int was_full = ring_space(&conn->recv_ring) < conn->send_mss;
+    size_t copied = ring_read(&conn->recv_ring, (uint8_t*)buffer, len);
+    
+    // Window update so a peer stalled on our full buffer resumes
+    if (was_full && copied > 0 && conn->state == TCP_ESTABLISHED) {
+        tcp_send_ack(conn);
     }
-    conn->recv_buffer_used -= to_copy;
     
-    return to_copy;
+    irq_restore(irq_flags);
+    return copied;
 }
 
+// Abort connections still owned by a listener that is going away
+static void tcp_abort_children(tcp_connection_t* listener) {
+    for (tcp_connection_t* conn = tcp_connections; conn; conn = conn->next) {
+        if (conn->listener == listener) {
+            tcp_send_rst(conn);
+            tcp_flush_retransmit_queue(conn);
+            conn->state = TCP_CLOSED;
+            conn->listener = NULL;
+            conn->accept_next = NULL;
+            conn->orphaned = 1;
+        }
+    }
+}
+
+// Start an orderly close. The FIN goes out after any queued data. Blocking
+// sockets wait up to TCP_LINGER_TIMEOUT for the FIN exchange; either way
+// the connection is left to the timer, which reaps it once fully closed.
 int tcp_close(int socket) {
-    if (socket < 0 || socket >= 64 || !tcp_sockets[socket].connection) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || !tcp_sockets[socket].connection) {
         return -1;
     }
     
     tcp_connection_t* conn = tcp_sockets[socket].connection;
+    poll_head_detach(&tcp_sockets[socket].poll);
+    
+    uint32_t irq_flags = irq_save();
+    conn->poll = NULL;
+    conn->cork = 0;
+    
+    if (tcp_sockets[socket].is_listening) {
+        tcp_abort_children(conn);
+        conn->state = TCP_CLOSED;
+    } else if (conn->state == TCP_ESTABLISHED || conn->state == TCP_CLOSE_WAIT) {
+        conn->close_pending = 1;
+        tcp_output(conn);
+    }
     
-    if (conn->state == TCP_ESTABLISHED) {
-        tcp_send_fin(conn);
-        conn->state = TCP_FIN_WAIT_1;
+    if (!tcp_sockets[socket].nonblocking) {
+        uint32_t deadline = timer_get_ticks() + TCP_LINGER_TIMEOUT;
+        while (conn->state != TCP_CLOSED && conn->state != TCP_TIME_WAIT) {
+            int32_t remaining = (int32_t)(deadline - timer_get_ticks());
+            if (remaining <= 0) break;
+            wait_queue_sleep_timeout(&conn->recv_wait, (uint32_t)remaining);
+        }
     }
     
-    // Wait for close to complete (simplified)
-    int timeout = 20;
-    while (conn->state != TCP_CLOSED && timeout > 0) {
-        for (volatile int i = 0; i < 1000000; i++);
-        timeout--;
+    // The timer destroys orphaned connections once they reach CLOSED
+    // (TIME_WAIT after 2MSL)
+    if (conn->state == TCP_CLOSED) {
+        irq_restore(irq_flags);
+        tcp_destroy_connection(conn);
+    } else {
+        conn->orphaned = 1;
+        irq_restore(irq_flags);
     }
     
-    tcp_destroy_connection(conn);
     tcp_sockets[socket].connection = NULL;
     tcp_sockets[socket].socket_id = -1;
     tcp_sockets[socket].is_listening = 0;
     
     return 0;
+}
+
+// Current readiness of a socket as EPOLL* bits
+uint32_t tcp_poll(int socket) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || tcp_sockets[socket].socket_id == -1) {
+        return EPOLLERR;
+    }
+    
+    tcp_connection_t* conn = tcp_sockets[socket].connection;
+    if (!conn) {
+        return EPOLLHUP;
+    }
+    
+    if (tcp_sockets[socket].is_listening) {
+        return conn->accept_head ? EPOLLIN : 0;
+    }
+    
+    uint32_t events = 0;
+    if (ring_used(&conn->recv_ring) > 0 || !tcp_may_receive(conn)) {
+        events |= EPOLLIN;
+    }
+    if ((conn->state == TCP_ESTABLISHED || conn->state == TCP_CLOSE_WAIT) &&
+        !conn->close_pending && ring_space(&conn->send_ring) > 0) {
+        events |= EPOLLOUT;
+    }
+    if (conn->state == TCP_CLOSED || conn->state == TCP_TIME_WAIT ||
+        conn->state == TCP_LAST_ACK || conn->state == TCP_CLOSING) {
+        events |= EPOLLHUP;
+    }
+    
+    return events;
+}
+
+poll_head_t* tcp_poll_head(int socket) {
+    if (socket < 0 || socket >= TCP_MAX_SOCKETS || tcp_sockets[socket].socket_id == -1) {
+        return NULL;
+    }
+    return &tcp_sockets[socket].poll;
+}
+
+// Resend the oldest unacknowledged segment of every connection whose
+// retransmission timer has expired, backing off exponentially
+void tcp_retransmit_check(void) {
+    uint32_t now = timer_get_ticks();
+    
+    for (tcp_connection_t* conn = tcp_connections; conn; conn = conn->next) {
+        tcp_segment_t* seg = conn->retransmit_head;
+        if ((!seg && !conn->persist_pending) || (int32_t)(now - conn->rto_deadline) < 0) {
+            continue;
+        }
+        
+        if (!seg) {
+            // Zero window probe: push one byte past the closed window
+            conn->persist_pending = 0;
+            if (conn->send_window != 0) {
+                continue;
+            }
+            uint8_t* probe = (uint8_t*)kmalloc(1);
+            if (probe && ring_read(&conn->send_ring, probe, 1) == 1) {
+                tcp_send_owned(conn, TCP_FLAG_ACK, probe, 1);
+                tcp_wake_all(conn);
+            } else if (probe) {
+                kfree(probe);
+            }
+            continue;
+        }
+        
+        if (conn->retries >= TCP_MAX_RETRIES) {
+            // Peer is unreachable, abort the connection. A half-open
+            // child was never queued for accept, so nobody else owns it.
+            if (conn->listener && conn->state == TCP_SYN_RECEIVED) {
+                conn->orphaned = 1;
+            }
+            tcp_flush_retransmit_queue(conn);
+            conn->state = TCP_CLOSED;
+            tcp_wake_all(conn);
+            continue;
+        }
+        
+        conn->retries++;
+        
+        // Timeout: collapse to one segment and forget SACK state (RFC 5681)
+        tcp_reduce_ssthresh(conn);
+        conn->cwnd = conn->send_mss;
+        conn->in_recovery = 0;
+        conn->dup_acks = 0;
+        for (tcp_segment_t* s = seg; s; s = s->next) {
+            s->sacked = 0;
+        }
+        tcp_retransmit_segment(conn, seg);
+        
+        conn->rto *= 2;
+        if (conn->rto > TCP_RTO_MAX) conn->rto = TCP_RTO_MAX;
+        conn->rto_deadline = now + conn->rto;
+    }
+}
+
+// Send ACKs that were delayed waiting for a second segment or for
+// outgoing data to ride on
+static void tcp_delack_check(void) {
+    uint32_t now = timer_get_ticks();
+    
+    for (tcp_connection_t* conn = tcp_connections; conn; conn = conn->next) {
+        if (conn->ack_pending > 0 &&
+            (int32_t)(now - conn->delack_deadline) >= 0) {
+            tcp_send_ack(conn);
+        }
+    }
+}
+
+// Called from the timer interrupt every TCP_TIMER_INTERVAL ticks
+void tcp_timer_tick(void) {
+    if (!tcp_initialized) {
+        return;
+    }
+    
+    uint32_t now = timer_get_ticks();
+    
+    tcp_connection_t* conn = tcp_connections;
+    while (conn) {
+        tcp_connection_t* next = conn->next;
+        
+        // 2MSL expiry
+        if (conn->state == TCP_TIME_WAIT &&
+            (int32_t)(now - conn->time_wait_deadline) >= 0) {
+            conn->state = TCP_CLOSED;
+            tcp_wake_all(conn);
+        }
+        
+        if (conn->orphaned && conn->state == TCP_CLOSED) {
+            tcp_destroy_connection(conn);
+        }
+        
+        conn = next;
+    }
+    
+    tcp_retransmit_check();
+    tcp_delack_check();
 }
\ No newline at end of file
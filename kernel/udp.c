@@ -1,69 +1,143 @@
 #include "../include/udp.h"
-#include "../include/dhcp.h"
 #include "../include/memory.h"
+#include "../include/interrupts.h"
+#include "../include/errno.h"
+#include "../include/checksum.h"
 
 extern void terminal_writestring(const char* data);
 
+// Bound sockets, hashed by local port
+static udp_socket_t* udp_port_hash[UDP_HASH_SIZE];
+static uint16_t udp_next_ephemeral = UDP_EPHEMERAL_FIRST;
+
+static inline uint32_t udp_hash(uint16_t port) {
+    return (port ^ (port >> 6)) & (UDP_HASH_SIZE - 1);
+}
+
+static void udp_to_ip_addr(uint32_t ip, ip_addr_t* addr) {
+    addr->addr[0] = (ip >> 24) & 0xFF;
+    addr->addr[1] = (ip >> 16) & 0xFF;
+    addr->addr[2] = (ip >> 8) & 0xFF;
+    addr->addr[3] = ip & 0xFF;
+}
+
+static uint32_t udp_from_ip_addr(ip_addr_t* addr) {
+    return ((uint32_t)addr->addr[0] << 24) | ((uint32_t)addr->addr[1] << 16) |
+           ((uint32_t)addr->addr[2] << 8) | (uint32_t)addr->addr[3];
+}
+
 void udp_init(void) {
+    for (int i = 0; i < UDP_HASH_SIZE; i++) {
+        udp_port_hash[i] = NULL;
+    }
+    
     terminal_writestring("UDP protocol initialized\n");
 }
 
-uint16_t udp_checksum(ip_header_t* ip_hdr, udp_header_t* udp_hdr, uint8_t* data, size_t length) {
-    // UDP checksum calculation with pseudo-header
-    uint32_t sum = 0;
-    
-    // Pseudo-header
-    sum += (ip_hdr->src_ip.addr[0] << 8) + ip_hdr->src_ip.addr[1];
-    sum += (ip_hdr->src_ip.addr[2] << 8) + ip_hdr->src_ip.addr[3];
-    sum += (ip_hdr->dest_ip.addr[0] << 8) + ip_hdr->dest_ip.addr[1];
-    sum += (ip_hdr->dest_ip.addr[2] << 8) + ip_hdr->dest_ip.addr[3];
-    sum += IP_PROTOCOL_UDP;
-    sum += ntohs(udp_hdr->length);
-    
-    // UDP header
-    sum += ntohs(udp_hdr->src_port);
-    sum += ntohs(udp_hdr->dest_port);
-    sum += ntohs(udp_hdr->length);
-    // Skip checksum field
+// Socket bound to port that accepts datagrams for dest_ip
+static udp_socket_t* udp_lookup(uint32_t dest_ip, uint16_t port) {
+    for (udp_socket_t* sock = udp_port_hash[udp_hash(port)]; sock; sock = sock->hash_next) {
+        if (sock->local_port == port &&
+            (sock->local_ip == 0 || sock->local_ip == dest_ip)) {
+            return sock;
+        }
+    }
+    return NULL;
+}
+
+static int udp_port_in_use(uint16_t port) {
+    for (udp_socket_t* sock = udp_port_hash[udp_hash(port)]; sock; sock = sock->hash_next) {
+        if (sock->local_port == port) return 1;
+    }
+    return 0;
+}
+
+// Allocate a datagram for a socket's queue, or NULL if the queue is full.
+// Interrupts must be disabled.
+static udp_datagram_t* udp_alloc_datagram(udp_socket_t* sock, uint32_t src_ip, uint16_t src_port,
+                                          size_t length) {
+    if (sock->queued_bytes + length > UDP_RECV_QUEUE_MAX) {
+        sock->drops++;
+        return NULL;
+    }
     
-    // Data
-    uint16_t* data_ptr = (uint16_t*)data;
-    size_t remaining = length;
+    udp_datagram_t* dgram = (udp_datagram_t*)kmalloc(sizeof(udp_datagram_t) + length);
+    if (!dgram) {
+        sock->drops++;
+        return NULL;
+    }
     
-    while (remaining > 1) {
-        sum += ntohs(*data_ptr++);
-        remaining -= 2;
+    dgram->src_ip = src_ip;
+    dgram->src_port = src_port;
+    dgram->length = length;
+    dgram->next = NULL;
+    return dgram;
+}
+
+// Append a filled datagram and wake readers. Interrupts must be disabled.
+static void udp_enqueue(udp_socket_t* sock, udp_datagram_t* dgram) {
+    if (sock->queue_tail) {
+        sock->queue_tail->next = dgram;
+    } else {
+        sock->queue_head = dgram;
     }
+    sock->queue_tail = dgram;
+    sock->queued_bytes += dgram->length;
     
-    if (remaining == 1) {
-        sum += *(uint8_t*)data_ptr << 8;
+    wake_up(&sock->recv_wait);
+    poll_notify(&sock->poll);
+}
+
+// Hand a datagram to its socket. Interrupts must be disabled.
+static void udp_deliver(udp_socket_t* sock, uint32_t src_ip, uint16_t src_port,
+                        uint8_t* data, size_t length) {
+    if (sock->handler) {
+        sock->handler(sock, src_ip, src_port, data, length);
+        return;
     }
     
-    // Add carry bits
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    udp_datagram_t* dgram = udp_alloc_datagram(sock, src_ip, src_port, length);
+    if (!dgram) return;
+    
+    for (size_t i = 0; i < length; i++) {
+        dgram->data[i] = data[i];
     }
+    udp_enqueue(sock, dgram);
+}
+
+uint16_t udp_checksum(ip_header_t* ip_hdr, udp_header_t* udp_hdr, uint8_t* data, size_t length) {
+    // Pseudo-header, then the header with its checksum field zeroed
+    uint32_t sum = csum_pseudo_header(udp_from_ip_addr(&ip_hdr->src_ip),
+                                      udp_from_ip_addr(&ip_hdr->dest_ip),
+                                      IP_PROTOCOL_UDP, ntohs(udp_hdr->length), 0);
+    uint16_t old_checksum = udp_hdr->checksum;
+    udp_hdr->checksum = 0;
+    sum = csum_partial(udp_hdr, sizeof(udp_header_t), sum);
+    udp_hdr->checksum = old_checksum;
+    sum = csum_partial(data, length, sum);
     
-    return ~sum;
+    // Zero means "no checksum" in UDP, so it is sent as all ones
+    uint16_t checksum = csum_fold(sum);
+    return checksum ? checksum : 0xFFFF;
 }
 
-void udp_handle_packet(net_buffer_t* buffer, size_t offset, ip_header_t* ip_hdr) {
-    if (buffer->length < offset + sizeof(udp_header_t)) {
+void udp_handle_packet(ip_header_t* ip_hdr, uint8_t* data, size_t length) {
+    if (length < sizeof(udp_header_t)) {
         return; // Packet too small
     }
     
-    udp_header_t* udp_hdr = (udp_header_t*)(buffer->data + offset);
+    udp_header_t* udp_hdr = (udp_header_t*)data;
     
     uint16_t dest_port = ntohs(udp_hdr->dest_port);
     uint16_t src_port = ntohs(udp_hdr->src_port);
     uint16_t udp_length = ntohs(udp_hdr->length);
     
-    if (udp_length < sizeof(udp_header_t)) {
+    if (udp_length < sizeof(udp_header_t) || udp_length > length) {
         return; // Invalid length
     }
     
     size_t data_length = udp_length - sizeof(udp_header_t);
-    uint8_t* udp_data = buffer->data + offset + sizeof(udp_header_t);
+    uint8_t* udp_data = data + sizeof(udp_header_t);
     
     // Verify checksum (optional for IPv4)
     if (udp_hdr->checksum != 0) {
@@ -76,20 +150,86 @@ void udp_handle_packet(net_buffer_t* buffer, size_t offset, ip_header_t* ip_hdr)
         udp_hdr->checksum = orig_checksum;
     }
     
-    // Handle different services
-    switch (dest_port) {
-        case UDP_PORT_DHCP_CLIENT:
-            if (src_port == UDP_PORT_DHCP_SERVER) {
-                dhcp_handle_packet(buffer, offset + sizeof(udp_header_t));
+    // Demultiplex to the socket bound to the destination port; kernel
+    // services such as DHCP own ordinary sockets with a receive handler
+    uint32_t irq_flags = irq_save();
+    udp_socket_t* sock = udp_lookup(udp_from_ip_addr(&ip_hdr->dest_ip), dest_port);
+    if (sock) {
+        udp_deliver(sock, udp_from_ip_addr(&ip_hdr->src_ip), src_port, udp_data, data_length);
+    }
+    irq_restore(irq_flags);
+}
+
+// Reassembled datagram, still in pieces. The payload is checksummed and
+// copied piece by piece straight into the socket queue; only in-kernel
+// handlers, which want flat data, get a linear copy.
+void udp_handle_fragments(ip_header_t* ip_hdr, ip_fragment_t* fragments, size_t length) {
+    if (!fragments || fragments->length < sizeof(udp_header_t)) {
+        return;
+    }
+    
+    udp_header_t* udp_hdr = (udp_header_t*)fragments->data;
+    uint16_t udp_length = ntohs(udp_hdr->length);
+    if (udp_length < sizeof(udp_header_t) || udp_length > length) {
+        return;
+    }
+    
+    // Summing everything including the checksum field must give zero
+    if (udp_hdr->checksum != 0) {
+        uint32_t sum = csum_pseudo_header(udp_from_ip_addr(&ip_hdr->src_ip),
+                                          udp_from_ip_addr(&ip_hdr->dest_ip),
+                                          IP_PROTOCOL_UDP, udp_length, 0);
+        size_t remaining = udp_length;
+        for (ip_fragment_t* frag = fragments; frag && remaining > 0; frag = frag->next) {
+            size_t part = frag->length < remaining ? frag->length : remaining;
+            sum = csum_partial(frag->data, part, sum);
+            remaining -= part;
+        }
+        if (csum_fold(sum) != 0) {
+            return; // Checksum mismatch
+        }
+    }
+    
+    uint16_t src_port = ntohs(udp_hdr->src_port);
+    uint16_t dest_port = ntohs(udp_hdr->dest_port);
+    size_t data_length = udp_length - sizeof(udp_header_t);
+    
+    uint32_t irq_flags = irq_save();
+    
+    udp_socket_t* sock = udp_lookup(udp_from_ip_addr(&ip_hdr->dest_ip), dest_port);
+    uint8_t* flat = NULL;
+    udp_datagram_t* dgram = NULL;
+    uint8_t* out = NULL;
+    
+    if (sock && sock->handler) {
+        flat = (uint8_t*)kmalloc(data_length);
+        out = flat;
+    } else if (sock) {
+        dgram = udp_alloc_datagram(sock, udp_from_ip_addr(&ip_hdr->src_ip), src_port, data_length);
+        out = dgram ? dgram->data : NULL;
+    }
+    
+    if (out) {
+        // Gather the payload, skipping the UDP header at the front
+        size_t skip = sizeof(udp_header_t);
+        size_t copied = 0;
+        for (ip_fragment_t* frag = fragments; frag && copied < data_length; frag = frag->next) {
+            size_t start = skip < frag->length ? skip : frag->length;
+            skip -= start;
+            for (size_t i = start; i < frag->length && copied < data_length; i++) {
+                out[copied++] = frag->data[i];
             }
-            break;
-        case UDP_PORT_DNS:
-            // TODO: DNS handling
-            break;
-        default:
-            // Unknown port
-            break;
+        }
+        
+        if (flat) {
+            sock->handler(sock, udp_from_ip_addr(&ip_hdr->src_ip), src_port, flat, data_length);
+            kfree(flat);
+        } else {
+            udp_enqueue(sock, dgram);
+        }
     }
+    
+    irq_restore(irq_flags);
 }
 
 int udp_send_packet(ip_addr_t dest_ip, uint16_t src_port, uint16_t dest_port, uint8_t* data, size_t length) {
@@ -107,30 +247,167 @@ int udp_send_packet(ip_addr_t dest_ip, uint16_t src_port, uint16_t dest_port, ui
     udp_hdr->length = htons(udp_packet_size);
     udp_hdr->checksum = 0; // We'll calculate this after building the IP header
     
-    // Copy data
-    uint8_t* udp_data = udp_packet + sizeof(udp_header_t);
-    for (size_t i = 0; i < length; i++) {
-        udp_data[i] = data[i];
+    // Copy the payload and checksum it in the same pass
+    uint32_t src_ip = ip_source_address(udp_from_ip_addr(&dest_ip));
+    uint32_t sum = csum_pseudo_header(src_ip, udp_from_ip_addr(&dest_ip),
+                                      IP_PROTOCOL_UDP, udp_packet_size, 0);
+    sum = csum_partial(udp_hdr, sizeof(udp_header_t), sum);
+    sum = csum_partial_copy(udp_packet + sizeof(udp_header_t), data, length, sum);
+    uint16_t checksum = csum_fold(sum);
+    udp_hdr->checksum = checksum ? checksum : 0xFFFF;
+    
+    // Send via IP
+    int result = ip_send_packet(dest_ip, IP_PROTOCOL_UDP, udp_packet, udp_packet_size);
+    
+    kfree(udp_packet);
+    return result;
+}
+
+udp_socket_t* udp_socket_create(void) {
+    udp_socket_t* sock = (udp_socket_t*)kmalloc(sizeof(udp_socket_t));
+    if (!sock) return NULL;
+    
+    sock->local_ip = 0;
+    sock->local_port = 0;
+    sock->bound = 0;
+    sock->nonblocking = 0;
+    sock->queue_head = NULL;
+    sock->queue_tail = NULL;
+    sock->queued_bytes = 0;
+    sock->drops = 0;
+    wait_queue_init(&sock->recv_wait);
+    poll_head_init(&sock->poll);
+    sock->handler = NULL;
+    sock->handler_context = NULL;
+    sock->hash_next = NULL;
+    
+    return sock;
+}
+
+// Bind to a local port; port 0 picks a free ephemeral port
+int udp_socket_bind(udp_socket_t* sock, uint32_t local_ip, uint16_t port) {
+    if (!sock || sock->bound) return -EINVAL;
+    
+    uint32_t irq_flags = irq_save();
+    
+    if (port == 0) {
+        for (uint32_t tries = 0; tries < 65536 - UDP_EPHEMERAL_FIRST; tries++) {
+            uint16_t candidate = udp_next_ephemeral;
+            udp_next_ephemeral = (udp_next_ephemeral == 65535) ? UDP_EPHEMERAL_FIRST
+                                                                : udp_next_ephemeral + 1;
+            if (!udp_port_in_use(candidate)) {
+                port = candidate;
+                break;
+            }
+        }
+        if (port == 0) {
+            irq_restore(irq_flags);
+            return -EADDRINUSE;
+        }
+    } else if (udp_port_in_use(port)) {
+        irq_restore(irq_flags);
+        return -EADDRINUSE;
+    }
+    
+    sock->local_ip = local_ip;
+    sock->local_port = port;
+    sock->bound = 1;
+    uint32_t bucket = udp_hash(port);
+    sock->hash_next = udp_port_hash[bucket];
+    udp_port_hash[bucket] = sock;
+    
+    irq_restore(irq_flags);
+    return 0;
+}
+
+void udp_socket_set_handler(udp_socket_t* sock, udp_rx_handler_t handler, void* context) {
+    sock->handler = handler;
+    sock->handler_context = context;
+}
+
+int udp_socket_sendto(udp_socket_t* sock, const void* data, size_t length,
+                      uint32_t dest_ip, uint16_t dest_port) {
+    if (!sock) return -EBADF;
+    
+    // Sending from an unbound socket binds it implicitly
+    if (!sock->bound) {
+        int err = udp_socket_bind(sock, 0, 0);
+        if (err < 0) return err;
     }
     
-    // For checksum calculation, we need to build a pseudo IP header
-    net_interface_t* iface = net_get_interface();
-    if (!iface->active) {
-        kfree(udp_packet);
+    ip_addr_t dest;
+    udp_to_ip_addr(dest_ip, &dest);
+    if (udp_send_packet(dest, sock->local_port, dest_port, (uint8_t*)data, length) < 0) {
         return -1;
     }
+    return length;
+}
+
+// Receive one datagram. Excess bytes beyond length are discarded, as with
+// BSD datagram sockets. Returns -EAGAIN for an empty non-blocking socket.
+int udp_socket_recvfrom(udp_socket_t* sock, void* buffer, size_t length,
+                        uint32_t* src_ip, uint16_t* src_port) {
+    if (!sock) return -EBADF;
     
-    // Create temporary IP header for checksum calculation
-    ip_header_t temp_ip_hdr;
-    ip_copy(&temp_ip_hdr.src_ip, &iface->ip);
-    ip_copy(&temp_ip_hdr.dest_ip, &dest_ip);
+    uint32_t irq_flags = irq_save();
     
-    // Calculate UDP checksum
-    udp_hdr->checksum = udp_checksum(&temp_ip_hdr, udp_hdr, udp_data, length);
+    while (!sock->queue_head) {
+        if (sock->nonblocking) {
+            irq_restore(irq_flags);
+            return -EAGAIN;
+        }
+        wait_queue_sleep(&sock->recv_wait);
+    }
     
-    // Send via IP
-    int result = ip_send_packet(dest_ip, IP_PROTOCOL_UDP, udp_packet, udp_packet_size);
+    udp_datagram_t* dgram = sock->queue_head;
+    sock->queue_head = dgram->next;
+    if (!sock->queue_head) sock->queue_tail = NULL;
+    sock->queued_bytes -= dgram->length;
     
-    kfree(udp_packet);
-    return result;
+    irq_restore(irq_flags);
+    
+    size_t copied = dgram->length < length ? dgram->length : length;
+    for (size_t i = 0; i < copied; i++) {
+        ((uint8_t*)buffer)[i] = dgram->data[i];
+    }
+    if (src_ip) *src_ip = dgram->src_ip;
+    if (src_port) *src_port = dgram->src_port;
+    
+    kfree(dgram);
+    return copied;
+}
+
+uint32_t udp_socket_poll(udp_socket_t* sock) {
+    uint32_t events = EPOLLOUT;
+    if (sock->queue_head) events |= EPOLLIN;
+    return events;
+}
+
+void udp_socket_close(udp_socket_t* sock) {
+    if (!sock) return;
+    
+    poll_head_detach(&sock->poll);
+    
+    uint32_t irq_flags = irq_save();
+    
+    if (sock->bound) {
+        udp_socket_t** link = &udp_port_hash[udp_hash(sock->local_port)];
+        while (*link) {
+            if (*link == sock) {
+                *link = sock->hash_next;
+                break;
+            }
+            link = &(*link)->hash_next;
+        }
+    }
+    
+    udp_datagram_t* dgram = sock->queue_head;
+    while (dgram) {
+        udp_datagram_t* next = dgram->next;
+        kfree(dgram);
+        dgram = next;
+    }
+    
+    irq_restore(irq_flags);
+    kfree(sock);
 }
\ No newline at end of file
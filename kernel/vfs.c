@@ -1,5 +1,7 @@
 #include "../include/vfs.h"
 #include "../include/memory.h"
+#include "../include/interrupts.h"
+#include "../include/scheduler.h"
 
 extern void* kmalloc(size_t size);
 extern void kfree(void* ptr);
@@ -40,26 +42,219 @@ static void vfs_strcat(char* dest, const char* src) {
     *dest = '\0';
 }
 
+static int ramfs_read(vfs_node_t* node, size_t offset, void* buffer, size_t size);
+static int ramfs_write(vfs_node_t* node, size_t offset, const void* buffer, size_t size);
+static int ramfs_readdir(vfs_node_t* dir, size_t index, vfs_dirent_t* entry);
+static vfs_node_t* ramfs_create(vfs_node_t* dir, const char* name);
+
+// In-memory nodes: contents in node->data, children all in the tree
+static const vfs_ops_t vfs_ramfs_ops = {
+    .fs_name = "ramfs",
+    .lookup = NULL,
+    .read = ramfs_read,
+    .write = ramfs_write,
+    .readdir = ramfs_readdir,
+    .create = ramfs_create,
+    .release = NULL,
+};
+
+static vfs_node_t* vfs_mounts[VFS_MAX_MOUNTS];
+static vfs_node_t* vfs_mnt_dir;
+
+static uint32_t vfs_generation;    // Source of directory generations
+static vfs_dentry_t vfs_dcache[VFS_DCACHE_SIZE];
+static vfs_dcache_stats_t vfs_dcache_stats;
+
+// FNV-1a
+static uint32_t vfs_name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static vfs_node_t** vfs_alloc_table(size_t count) {
+    vfs_node_t** table = (vfs_node_t**)kmalloc(count * sizeof(vfs_node_t*));
+    if (table) {
+        for (size_t i = 0; i < count; i++) {
+            table[i] = NULL;
+        }
+    }
+    return table;
+}
+
+vfs_node_t* vfs_alloc_node(const char* name, vfs_type_t type, const vfs_ops_t* ops) {
+    vfs_node_t* node = (vfs_node_t*)kmalloc(sizeof(vfs_node_t));
+    if (!node) {
+        return NULL;
+    }
+    
+    size_t i = 0;
+    for (; name[i] && i < VFS_MAX_NAME_LEN - 1; i++) {
+        node->name[i] = name[i];
+    }
+    node->name[i] = '\0';
+    node->type = type;
+    node->size = 0;
+    node->data = NULL;
+    node->ops = ops ? ops : &vfs_ramfs_ops;
+    node->fs_private = NULL;
+    node->parent = NULL;
+    node->dir = NULL;
+    node->hash_next = NULL;
+    node->creation_time = 0; // TODO: Add proper timestamp
+    node->refs = 0;
+    node->unlinked = 0;
+    
+    if (type == VFS_DIRECTORY) {
+        node->dir = (vfs_dir_t*)kmalloc(sizeof(vfs_dir_t));
+        if (node->dir) {
+            node->dir->buckets = vfs_alloc_table(VFS_DIR_MIN_BUCKETS);
+            node->dir->bucket_count = VFS_DIR_MIN_BUCKETS;
+            node->dir->entries = vfs_alloc_table(VFS_DIR_MIN_BUCKETS);
+            node->dir->count = 0;
+            node->dir->capacity = VFS_DIR_MIN_BUCKETS;
+            node->dir->generation = ++vfs_generation;
+        }
+        if (!node->dir || !node->dir->buckets || !node->dir->entries) {
+            if (node->dir) {
+                if (node->dir->buckets) kfree(node->dir->buckets);
+                if (node->dir->entries) kfree(node->dir->entries);
+                kfree(node->dir);
+            }
+            kfree(node);
+            return NULL;
+        }
+    }
+    return node;
+}
+
+// Drop the dentries of a directory that is about to be freed
+static void vfs_dcache_forget(vfs_node_t* dir) {
+    for (int i = 0; i < VFS_DCACHE_SIZE; i++) {
+        if (vfs_dcache[i].parent == dir) {
+            vfs_dcache[i].parent = NULL;
+        }
+    }
+}
+
+void vfs_free_node(vfs_node_t* node) {
+    if (node->ops->release) {
+        work_disable();
+        node->ops->release(node);
+        work_enable();
+    }
+    if (node->data) {
+        kfree(node->data);
+    }
+    if (node->dir) {
+        vfs_dcache_forget(node);
+        kfree(node->dir->buckets);
+        kfree(node->dir->entries);
+        kfree(node->dir);
+    }
+    kfree(node);
+}
+
+static vfs_node_t* vfs_dir_find(vfs_dir_t* dir, const char* name) {
+    vfs_node_t* node = dir->buckets[vfs_name_hash(name) & (dir->bucket_count - 1)];
+    while (node && vfs_strcmp(node->name, name) != 0) {
+        node = node->hash_next;
+    }
+    return node;
+}
+
+// Double the entry array and the hash table once the directory is full.
+// The new arrays are built first and swapped in with interrupts off, so
+// readers in deferred work (the HTTP server) always see a consistent table.
+static int vfs_dir_grow(vfs_dir_t* dir) {
+    size_t capacity = dir->capacity * 2;
+    vfs_node_t** entries = vfs_alloc_table(capacity);
+    vfs_node_t** buckets = vfs_alloc_table(capacity);
+    if (!entries || !buckets) {
+        if (entries) kfree(entries);
+        if (buckets) kfree(buckets);
+        return -1;
+    }
+    
+    uint32_t irq_flags = irq_save();
+    vfs_node_t** old_entries = dir->entries;
+    vfs_node_t** old_buckets = dir->buckets;
+    for (size_t i = 0; i < dir->count; i++) {
+        vfs_node_t* node = old_entries[i];
+        size_t bucket = vfs_name_hash(node->name) & (capacity - 1);
+        entries[i] = node;
+        node->hash_next = buckets[bucket];
+        buckets[bucket] = node;
+    }
+    dir->entries = entries;
+    dir->buckets = buckets;
+    dir->capacity = capacity;
+    dir->bucket_count = capacity;
+    irq_restore(irq_flags);
+    
+    kfree(old_entries);
+    kfree(old_buckets);
+    return 0;
+}
+
+// Link a node into a directory; readers in deferred work (the HTTP server)
+// must never see a half-updated directory
+static int vfs_attach(vfs_node_t* parent, vfs_node_t* node) {
+    vfs_dir_t* dir = parent->dir;
+    if (dir->count == dir->capacity && vfs_dir_grow(dir) < 0) {
+        return -1;
+    }
+    
+    size_t bucket = vfs_name_hash(node->name) & (dir->bucket_count - 1);
+    uint32_t irq_flags = irq_save();
+    node->parent = parent;
+    node->hash_next = dir->buckets[bucket];
+    dir->buckets[bucket] = node;
+    dir->entries[dir->count++] = node;
+    dir->generation = ++vfs_generation;
+    irq_restore(irq_flags);
+    return 0;
+}
+
+static void vfs_detach(vfs_node_t* parent, vfs_node_t* node) {
+    vfs_dir_t* dir = parent->dir;
+    size_t bucket = vfs_name_hash(node->name) & (dir->bucket_count - 1);
+    
+    uint32_t irq_flags = irq_save();
+    vfs_node_t** link = &dir->buckets[bucket];
+    while (*link && *link != node) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = node->hash_next;
+    }
+    node->hash_next = NULL;
+    
+    for (size_t i = 0; i < dir->count; i++) {
+        if (dir->entries[i] == node) {
+            // Shift remaining children to keep creation order
+            for (size_t j = i; j < dir->count - 1; j++) {
+                dir->entries[j] = dir->entries[j + 1];
+            }
+            dir->entries[--dir->count] = NULL;
+            break;
+        }
+    }
+    dir->generation = ++vfs_generation;
+    irq_restore(irq_flags);
+}
+
 void vfs_init(void) {
     // Create root directory
-    vfs_ctx.root_dir = (vfs_node_t*)kmalloc(sizeof(vfs_node_t));
+    vfs_ctx.root_dir = vfs_alloc_node("/", VFS_DIRECTORY, NULL);
     if (!vfs_ctx.root_dir) {
         terminal_writestring("VFS: Failed to allocate root directory\n");
         return;
     }
     
-    vfs_strcpy(vfs_ctx.root_dir->name, "/");
-    vfs_ctx.root_dir->type = VFS_DIRECTORY;
-    vfs_ctx.root_dir->size = 0;
-    vfs_ctx.root_dir->data = NULL;
-    vfs_ctx.root_dir->parent = NULL;
-    vfs_ctx.root_dir->child_count = 0;
-    vfs_ctx.root_dir->creation_time = 0;
-    
-    for (int i = 0; i < VFS_MAX_FILES; i++) {
-        vfs_ctx.root_dir->children[i] = NULL;
-    }
-    
     vfs_ctx.current_dir = vfs_ctx.root_dir;
     vfs_strcpy(vfs_ctx.current_path, "/");
     
@@ -68,22 +263,51 @@ void vfs_init(void) {
     vfs_mkdir("bin");
     vfs_mkdir("etc");
     vfs_mkdir("tmp");
+    vfs_mnt_dir = vfs_mkdir("mnt");
     
     terminal_writestring("VFS: Virtual File System initialized\n");
 }
 
-vfs_node_t* vfs_find_child(vfs_node_t* parent, const char* name) {
-    if (!parent || parent->type != VFS_DIRECTORY) {
+static vfs_node_t* vfs_find_child_locked(vfs_node_t* parent, const char* name) {
+    vfs_node_t* cached = vfs_dir_find(parent->dir, name);
+    if (cached) {
+        return cached;
+    }
+    
+    if (!parent->ops->lookup) {
+        return NULL;
+    }
+    vfs_node_t* child = parent->ops->lookup(parent, name);
+    if (!child) {
         return NULL;
     }
     
-    for (size_t i = 0; i < parent->child_count; i++) {
-        if (parent->children[i] && vfs_strcmp(parent->children[i]->name, name) == 0) {
-            return parent->children[i];
-        }
+    // Found under another spelling on a case-insensitive volume
+    cached = vfs_dir_find(parent->dir, child->name);
+    if (cached) {
+        vfs_free_node(child);
+        return cached;
     }
     
-    return NULL;
+    if (vfs_attach(parent, child) < 0) {
+        vfs_free_node(child);
+        return NULL;
+    }
+    return child;
+}
+
+// Cached children first; a mounted filesystem is asked for the rest and
+// the node it returns is kept in the tree for next time. Deferred work
+// is held off throughout, since it may attach nodes to the same directory.
+vfs_node_t* vfs_find_child(vfs_node_t* parent, const char* name) {
+    if (!parent || parent->type != VFS_DIRECTORY) {
+        return NULL;
+    }
+    
+    work_disable();
+    vfs_node_t* child = vfs_find_child_locked(parent, name);
+    work_enable();
+    return child;
 }
 
 vfs_node_t* vfs_mkdir(const char* name) {
@@ -91,36 +315,27 @@ vfs_node_t* vfs_mkdir(const char* name) {
         return NULL;
     }
     
+    // Only in-memory directories can be extended here
+    if (vfs_ctx.current_dir->ops != &vfs_ramfs_ops) {
+        return NULL;
+    }
+    
     // Check if directory already exists
     if (vfs_find_child(vfs_ctx.current_dir, name)) {
         return NULL; // Already exists
     }
     
-    // Check if we have space for more children
-    if (vfs_ctx.current_dir->child_count >= VFS_MAX_FILES) {
-        return NULL; // Directory full
-    }
-    
     // Create new directory
-    vfs_node_t* new_dir = (vfs_node_t*)kmalloc(sizeof(vfs_node_t));
+    vfs_node_t* new_dir = vfs_alloc_node(name, VFS_DIRECTORY, NULL);
     if (!new_dir) {
         return NULL;
     }
     
-    vfs_strcpy(new_dir->name, name);
-    new_dir->type = VFS_DIRECTORY;
-    new_dir->size = 0;
-    new_dir->data = NULL;
-    new_dir->parent = vfs_ctx.current_dir;
-    new_dir->child_count = 0;
-    new_dir->creation_time = 0; // TODO: Add proper timestamp
-    
-    for (int i = 0; i < VFS_MAX_FILES; i++) {
-        new_dir->children[i] = NULL;
-    }
-    
     // Add to parent directory
-    vfs_ctx.current_dir->children[vfs_ctx.current_dir->child_count++] = new_dir;
+    if (vfs_attach(vfs_ctx.current_dir, new_dir) < 0) {
+        vfs_free_node(new_dir);
+        return NULL; // Out of memory growing the directory
+    }
     
     return new_dir;
 }
@@ -146,8 +361,8 @@ vfs_node_t* vfs_chdir(const char* path) {
         // Stay in current directory
         target_dir = vfs_ctx.current_dir;
     } else {
-        // Find child directory
-        target_dir = vfs_find_child(vfs_ctx.current_dir, path);
+        // Find child directory, or walk a longer path
+        target_dir = vfs_lookup(path);
         if (!target_dir || target_dir->type != VFS_DIRECTORY) {
             return NULL; // Directory not found
         }
@@ -191,30 +406,20 @@ int vfs_rmdir(const char* name) {
     }
     
     vfs_node_t* target = vfs_find_child(vfs_ctx.current_dir, name);
-    if (!target || target->type != VFS_DIRECTORY) {
+    if (!target || target->type != VFS_DIRECTORY || target->ops != &vfs_ramfs_ops) {
         return -1; // Not found or not a directory
     }
     
-    // Check if directory is empty
-    if (target->child_count > 0) {
+    // Check if directory is empty and not a mount point
+    if (target->dir->count > 0 || target == vfs_mnt_dir) {
         return -2; // Directory not empty
     }
     
     // Remove from parent's children list
-    for (size_t i = 0; i < vfs_ctx.current_dir->child_count; i++) {
-        if (vfs_ctx.current_dir->children[i] == target) {
-            // Shift remaining children
-            for (size_t j = i; j < vfs_ctx.current_dir->child_count - 1; j++) {
-                vfs_ctx.current_dir->children[j] = vfs_ctx.current_dir->children[j + 1];
-            }
-            vfs_ctx.current_dir->children[vfs_ctx.current_dir->child_count - 1] = NULL;
-            vfs_ctx.current_dir->child_count--;
-            break;
-        }
-    }
+    vfs_detach(vfs_ctx.current_dir, target);
     
     // Free the directory
-    kfree(target);
+    vfs_free_node(target);
     return 0;
 }
 
@@ -223,32 +428,21 @@ vfs_node_t* vfs_create_file(const char* name, const uint8_t* data, size_t size)
         return NULL;
     }
     
+    if (vfs_ctx.current_dir->ops != &vfs_ramfs_ops) {
+        return NULL;
+    }
+    
     // Check if file already exists
     if (vfs_find_child(vfs_ctx.current_dir, name)) {
         return NULL; // Already exists
     }
     
-    // Check if we have space
-    if (vfs_ctx.current_dir->child_count >= VFS_MAX_FILES) {
-        return NULL; // Directory full
-    }
-    
     // Create new file
-    vfs_node_t* new_file = (vfs_node_t*)kmalloc(sizeof(vfs_node_t));
+    vfs_node_t* new_file = vfs_alloc_node(name, VFS_FILE, NULL);
     if (!new_file) {
         return NULL;
     }
-    
-    vfs_strcpy(new_file->name, name);
-    new_file->type = VFS_FILE;
     new_file->size = size;
-    new_file->parent = vfs_ctx.current_dir;
-    new_file->child_count = 0;
-    new_file->creation_time = 0;
-    
-    for (int i = 0; i < VFS_MAX_FILES; i++) {
-        new_file->children[i] = NULL;
-    }
     
     // Allocate and copy data if provided
     if (data && size > 0) {
@@ -261,12 +455,13 @@ vfs_node_t* vfs_create_file(const char* name, const uint8_t* data, size_t size)
         for (size_t i = 0; i < size; i++) {
             new_file->data[i] = data[i];
         }
-    } else {
-        new_file->data = NULL;
     }
     
     // Add to parent directory
-    vfs_ctx.current_dir->children[vfs_ctx.current_dir->child_count++] = new_file;
+    if (vfs_attach(vfs_ctx.current_dir, new_file) < 0) {
+        vfs_free_node(new_file);
+        return NULL; // Out of memory growing the directory
+    }
     
     return new_file;
 }
@@ -277,33 +472,414 @@ int vfs_delete_file(const char* name) {
     }
     
     vfs_node_t* target = vfs_find_child(vfs_ctx.current_dir, name);
-    if (!target || target->type != VFS_FILE) {
+    if (!target || target->type != VFS_FILE || target->ops != &vfs_ramfs_ops) {
         return -1; // Not found or not a file
     }
     
-    // Remove from parent's children list
-    for (size_t i = 0; i < vfs_ctx.current_dir->child_count; i++) {
-        if (vfs_ctx.current_dir->children[i] == target) {
-            // Shift remaining children
-            for (size_t j = i; j < vfs_ctx.current_dir->child_count - 1; j++) {
-                vfs_ctx.current_dir->children[j] = vfs_ctx.current_dir->children[j + 1];
-            }
-            vfs_ctx.current_dir->children[vfs_ctx.current_dir->child_count - 1] = NULL;
-            vfs_ctx.current_dir->child_count--;
-            break;
-        }
+    // Remove from parent's children list. Interrupt-time readers (the
+    // HTTP server) walk the tree, so the shift must not be seen half done.
+    uint32_t irq_flags = irq_save();
+    vfs_detach(vfs_ctx.current_dir, target);
+    
+    // Still referenced: the last vfs_node_put frees it
+    if (target->refs > 0) {
+        target->unlinked = 1;
+        irq_restore(irq_flags);
+        return 0;
     }
+    irq_restore(irq_flags);
     
     // Free file data and node
-    if (target->data) {
-        kfree(target->data);
-    }
-    kfree(target);
+    vfs_free_node(target);
     return 0;
 }
 
 vfs_node_t* vfs_open_file(const char* name) {
-    return vfs_find_child(vfs_ctx.current_dir, name);
+    return vfs_lookup(name);
+}
+
+void vfs_node_get(vfs_node_t* node) {
+    uint32_t irq_flags = irq_save();
+    node->refs++;
+    irq_restore(irq_flags);
+}
+
+void vfs_node_put(vfs_node_t* node) {
+    uint32_t irq_flags = irq_save();
+    int release = --node->refs == 0 && node->unlinked;
+    irq_restore(irq_flags);
+    
+    if (release) {
+        vfs_free_node(node);
+    }
+}
+
+static int ramfs_read(vfs_node_t* node, size_t offset, void* buffer, size_t size) {
+    if (offset >= node->size || !node->data) {
+        return 0;
+    }
+    if (size > node->size - offset) {
+        size = node->size - offset;
+    }
+    
+    uint8_t* out = (uint8_t*)buffer;
+    for (size_t i = 0; i < size; i++) {
+        out[i] = node->data[offset + i];
+    }
+    return (int)size;
+}
+
+static int ramfs_write(vfs_node_t* node, size_t offset, const void* buffer, size_t size) {
+    if (offset > node->size || offset + size > VFS_MAX_FILE_SIZE) {
+        return -1;
+    }
+    
+    // Growing replaces the buffer, which a pinned reader may still be using
+    if (offset + size > node->size) {
+        if (node->refs > 0) {
+            return -1;
+        }
+        uint8_t* data = (uint8_t*)kmalloc(offset + size);
+        if (!data) {
+            return -1;
+        }
+        for (size_t i = 0; i < node->size; i++) {
+            data[i] = node->data[i];
+        }
+        if (node->data) {
+            kfree(node->data);
+        }
+        node->data = data;
+        node->size = offset + size;
+    }
+    
+    const uint8_t* in = (const uint8_t*)buffer;
+    for (size_t i = 0; i < size; i++) {
+        node->data[offset + i] = in[i];
+    }
+    return (int)size;
+}
+
+static int ramfs_readdir(vfs_node_t* dir, size_t index, vfs_dirent_t* entry) {
+    if (index >= dir->dir->count) {
+        return 0;
+    }
+    
+    vfs_node_t* child = dir->dir->entries[index];
+    vfs_strcpy(entry->name, child->name);
+    entry->type = child->type;
+    entry->size = child->size;
+    return 1;
+}
+
+static vfs_node_t* ramfs_create(vfs_node_t* dir, const char* name) {
+    (void)dir;
+    return vfs_alloc_node(name, VFS_FILE, NULL);
+}
+
+int vfs_read(vfs_node_t* node, size_t offset, void* buffer, size_t size) {
+    if (!node || node->type != VFS_FILE || !buffer || !node->ops->read) {
+        return -1;
+    }
+    work_disable();
+    int result = node->ops->read(node, offset, buffer, size);
+    work_enable();
+    return result;
+}
+
+int vfs_write(vfs_node_t* node, size_t offset, const void* buffer, size_t size) {
+    if (!node || node->type != VFS_FILE || !buffer || !node->ops->write) {
+        return -1;
+    }
+    work_disable();
+    int result = node->ops->write(node, offset, buffer, size);
+    work_enable();
+    return result;
+}
+
+// Fill entry number `index` of a directory. Returns 1, or 0 past the end.
+int vfs_readdir(vfs_node_t* dir, size_t index, vfs_dirent_t* entry) {
+    if (!dir || dir->type != VFS_DIRECTORY || !entry || !dir->ops->readdir) {
+        return 0;
+    }
+    work_disable();
+    int result = dir->ops->readdir(dir, index, entry);
+    work_enable();
+    return result;
+}
+
+// Attach a filesystem's root directory as /mnt/<name>. Takes ownership
+// of the root: it is released on failure or at vfs_umount.
+int vfs_mount(const char* name, vfs_node_t* root) {
+    if (!root) {
+        return -1;
+    }
+    if (!vfs_mnt_dir || !vfs_is_valid_name(name) || root->type != VFS_DIRECTORY ||
+        vfs_find_child(vfs_mnt_dir, name)) {
+        vfs_free_node(root);
+        return -1;
+    }
+    
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (!vfs_mounts[i]) {
+            vfs_strcpy(root->name, name);
+            if (vfs_attach(vfs_mnt_dir, root) < 0) {
+                break;
+            }
+            vfs_mounts[i] = root;
+            return 0;
+        }
+    }
+    vfs_free_node(root);
+    return -1;
+}
+
+static int vfs_tree_busy(vfs_node_t* node) {
+    if (node->refs > 0 || node == vfs_ctx.current_dir) {
+        return 1;
+    }
+    for (size_t i = 0; node->dir && i < node->dir->count; i++) {
+        if (vfs_tree_busy(node->dir->entries[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Children are released before their directory, the root last
+static void vfs_tree_free(vfs_node_t* node) {
+    for (size_t i = 0; node->dir && i < node->dir->count; i++) {
+        vfs_tree_free(node->dir->entries[i]);
+    }
+    vfs_free_node(node);
+}
+
+int vfs_umount(const char* name) {
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        vfs_node_t* root = vfs_mounts[i];
+        if (root && vfs_strcmp(root->name, name) == 0) {
+            if (vfs_tree_busy(root)) {
+                return -2; // In use
+            }
+            vfs_detach(vfs_mnt_dir, root);
+            vfs_mounts[i] = NULL;
+            vfs_tree_free(root);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Drop a node and everything cached below it, for filesystems whose
+// entry was removed or rewritten behind the VFS. Fails while in use.
+int vfs_forget(vfs_node_t* node) {
+    if (!node->parent || vfs_tree_busy(node)) {
+        return -1;
+    }
+    vfs_detach(node->parent, node);
+    vfs_tree_free(node);
+    return 0;
+}
+
+vfs_node_t* vfs_get_mount(size_t index) {
+    size_t seen = 0;
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (vfs_mounts[i] && seen++ == index) {
+            return vfs_mounts[i];
+        }
+    }
+    return NULL;
+}
+
+static vfs_dentry_t* vfs_dcache_slot(vfs_node_t* parent, const char* name) {
+    uint32_t hash = (vfs_name_hash(name) ^ (uint32_t)(uintptr_t)parent) * 16777619u;
+    return &vfs_dcache[(hash >> 8) & (VFS_DCACHE_SIZE - 1)];
+}
+
+// One path component. Names are cached as spelled, so a case variant on
+// a FAT volume or a name that does not exist costs no directory read the
+// second time round.
+static vfs_node_t* vfs_walk_component(vfs_node_t* parent, const char* name) {
+    if (!parent->dir) {
+        return NULL;
+    }
+    
+    vfs_dentry_t* dentry = vfs_dcache_slot(parent, name);
+    if (dentry->parent == parent && dentry->generation == parent->dir->generation &&
+        vfs_strcmp(dentry->name, name) == 0) {
+        vfs_dcache_stats.hits++;
+        if (!dentry->node) {
+            vfs_dcache_stats.negative_hits++;
+        }
+        return dentry->node;
+    }
+    
+    vfs_dcache_stats.misses++;
+    vfs_node_t* node = vfs_find_child(parent, name);
+    
+    // The lookup may have attached a node and moved the generation on
+    dentry->parent = parent;
+    dentry->generation = parent->dir->generation;
+    dentry->node = node;
+    vfs_strcpy(dentry->name, name);
+    return node;
+}
+
+// Names in a directory changed behind the VFS: a new generation makes
+// its dentries stale, and its negative ones are dropped outright
+void vfs_dcache_invalidate_dir(vfs_node_t* dir) {
+    if (!dir || !dir->dir) {
+        return;
+    }
+    
+    uint32_t irq_flags = irq_save();
+    dir->dir->generation = ++vfs_generation;
+    irq_restore(irq_flags);
+    
+    for (int i = 0; i < VFS_DCACHE_SIZE; i++) {
+        if (vfs_dcache[i].parent == dir && !vfs_dcache[i].node) {
+            vfs_dcache[i].parent = NULL;
+        }
+    }
+}
+
+vfs_dcache_stats_t* vfs_dcache_get_stats(void) {
+    return &vfs_dcache_stats;
+}
+
+static void vfs_write_uint(uint32_t value) {
+    char num[12];
+    int pos = 11;
+    num[pos] = '\0';
+    do {
+        num[--pos] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    terminal_writestring(&num[pos]);
+}
+
+void vfs_dcache_dump(void) {
+    uint32_t used = 0;
+    uint32_t negative = 0;
+    for (int i = 0; i < VFS_DCACHE_SIZE; i++) {
+        vfs_dentry_t* dentry = &vfs_dcache[i];
+        if (dentry->parent && dentry->parent->dir &&
+            dentry->generation == dentry->parent->dir->generation) {
+            used++;
+            if (!dentry->node) negative++;
+        }
+    }
+    
+    terminal_writestring("Dentry cache: ");
+    vfs_write_uint(used);
+    terminal_writestring("/");
+    vfs_write_uint(VFS_DCACHE_SIZE);
+    terminal_writestring(" entries (");
+    vfs_write_uint(negative);
+    terminal_writestring(" negative)\n  hits ");
+    vfs_write_uint(vfs_dcache_stats.hits);
+    terminal_writestring(" (");
+    vfs_write_uint(vfs_dcache_stats.negative_hits);
+    terminal_writestring(" negative), misses ");
+    vfs_write_uint(vfs_dcache_stats.misses);
+    terminal_writestring("\n");
+}
+
+static vfs_node_t* vfs_lookup_locked(const char* path) {
+    vfs_node_t* node = path[0] == '/' ? vfs_ctx.root_dir : vfs_ctx.current_dir;
+    char component[VFS_MAX_NAME_LEN];
+    
+    while (node && *path) {
+        while (*path == '/') path++;
+        if (!*path) break;
+        
+        size_t length = 0;
+        while (*path && *path != '/') {
+            if (length >= VFS_MAX_NAME_LEN - 1) return NULL;
+            component[length++] = *path++;
+        }
+        component[length] = '\0';
+        
+        if (vfs_strcmp(component, ".") == 0) continue;
+        if (vfs_strcmp(component, "..") == 0) {
+            if (node->parent) node = node->parent;
+            continue;
+        }
+        node = vfs_walk_component(node, component);
+    }
+    return node;
+}
+
+// Resolve an absolute path, or one relative to the current directory.
+// The walk and its dentry updates are kept clear of deferred work, which
+// looks up files too.
+vfs_node_t* vfs_lookup(const char* path) {
+    if (!path) {
+        return NULL;
+    }
+    
+    work_disable();
+    vfs_node_t* node = vfs_lookup_locked(path);
+    work_enable();
+    return node;
+}
+
+static vfs_node_t* vfs_create_locked(const char* path) {
+    const char* name = path;
+    for (const char* p = path; *p; p++) {
+        if (*p == '/') name = p + 1;
+    }
+    if (!vfs_is_valid_name(name)) {
+        return NULL;
+    }
+    
+    vfs_node_t* parent = vfs_ctx.current_dir;
+    if (name != path) {
+        char dir_path[VFS_MAX_PATH_LEN];
+        size_t length = name - path;
+        if (length >= VFS_MAX_PATH_LEN) {
+            return NULL;
+        }
+        for (size_t i = 0; i < length; i++) {
+            dir_path[i] = path[i];
+        }
+        dir_path[length] = '\0';
+        parent = vfs_lookup_locked(dir_path);
+    }
+    if (!parent || parent->type != VFS_DIRECTORY) {
+        return NULL;
+    }
+    
+    vfs_node_t* node = vfs_find_child_locked(parent, name);
+    if (node) {
+        return node->type == VFS_FILE ? node : NULL;
+    }
+    
+    if (!parent->ops->create) {
+        return NULL;
+    }
+    node = parent->ops->create(parent, name);
+    if (!node) {
+        return NULL;
+    }
+    if (vfs_attach(parent, node) < 0) {
+        vfs_free_node(node);
+        return NULL;
+    }
+    return node;
+}
+
+// Open a file by path, creating it empty in its directory if it does not
+// exist yet. Existing contents are kept; writes overwrite in place.
+vfs_node_t* vfs_create(const char* path) {
+    if (!path) {
+        return NULL;
+    }
+    
+    work_disable();
+    vfs_node_t* node = vfs_create_locked(path);
+    work_enable();
+    return node;
 }
 
 void vfs_get_current_path(char* buffer, size_t buffer_size) {
@@ -331,52 +907,43 @@ void vfs_list_directory(vfs_node_t* dir) {
         return;
     }
     
-    if (dir->child_count == 0) {
-        terminal_writestring("(empty)\n");
-        return;
-    }
-    
-    for (size_t i = 0; i < dir->child_count; i++) {
-        vfs_node_t* child = dir->children[i];
-        if (child) {
-            if (child->type == VFS_DIRECTORY) {
-                terminal_writestring("[DIR]  ");
-            } else {
-                terminal_writestring("[FILE] ");
-            }
-            terminal_writestring(child->name);
+    vfs_dirent_t entry;
+    size_t index = 0;
+    while (vfs_readdir(dir, index, &entry)) {
+        index++;
+        if (entry.type == VFS_DIRECTORY) {
+            terminal_writestring("[DIR]  ");
+        } else {
+            terminal_writestring("[FILE] ");
+        }
+        terminal_writestring(entry.name);
+        
+        if (entry.type == VFS_FILE) {
+            // Simple size display
+            char size_str[16];
+            size_t size = entry.size;
+            int pos = 0;
+            do {
+                size_str[pos++] = '0' + (size % 10);
+                size /= 10;
+            } while (size > 0);
             
-            if (child->type == VFS_FILE) {
-                terminal_writestring(" (");
-                // Simple size display
-                if (child->size < 1024) {
-                    char size_str[16];
-                    int size = child->size;
-                    int pos = 0;
-                    if (size == 0) {
-                        size_str[pos++] = '0';
-                    } else {
-                        while (size > 0) {
-                            size_str[pos++] = '0' + (size % 10);
-                            size /= 10;
-                        }
-                    }
-                    // Reverse
-                    for (int j = 0; j < pos / 2; j++) {
-                        char temp = size_str[j];
-                        size_str[j] = size_str[pos - 1 - j];
-                        size_str[pos - 1 - j] = temp;
-                    }
-                    size_str[pos] = '\0';
-                    terminal_writestring(size_str);
-                    terminal_writestring(" bytes");
-                } else {
-                    terminal_writestring("large");
-                }
-                terminal_writestring(")");
+            // Reverse
+            for (int j = 0; j < pos / 2; j++) {
+                char temp = size_str[j];
+                size_str[j] = size_str[pos - 1 - j];
+                size_str[pos - 1 - j] = temp;
             }
-            terminal_writestring("\n");
+            size_str[pos] = '\0';
+            terminal_writestring(" (");
+            terminal_writestring(size_str);
+            terminal_writestring(" bytes)");
         }
+        terminal_writestring("\n");
+    }
+    
+    if (index == 0) {
+        terminal_writestring("(empty)\n");
     }
 }
 